@@ -0,0 +1,196 @@
+/*
+ * Compare the fixed point coordinate parser with the sscanf based
+ * conversion it replaced, using the coordinates found in a recorded
+ * NMEA log such as examples/sample.txt.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include <buzz_gps.h>
+#include <buzz_nmea.h>
+
+#define BENCH_MAX_COORDS 65536
+#define BENCH_ROUNDS 200
+#define BENCH_METRES_PER_DEGREE 111320.0
+
+typedef struct bench_coord_s
+{
+    char text[16];
+    char hem;
+} bench_coord_t;
+
+
+/* The conversion used before the fixed point parser, kept as the baseline */
+static int bench_sscanf_daysmins_to_float(const char * daysmin, char hem, float * out_v)
+{
+    static const char * neg_hem = "sSwW";
+
+    float sign = 1.0f;
+    int rc;
+    float raw;
+    int day;
+    float min;
+    float v;
+
+    if (hem != '\0' && NULL != strchr(neg_hem, hem))
+    {
+        sign = -1.0f;
+    }
+    rc = sscanf(daysmin, "%f", &raw);
+    if (rc <= 0)
+    {
+        return BUZZ_GPS_ERROR;
+    }
+    day = raw / 100;
+    min = (raw - (day * 100.0)) / 60.0;
+    v = min + day;
+
+    *out_v = v * sign;
+
+    return BUZZ_GPS_SUCCESS;
+}
+
+
+static double bench_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+static void bench_add(bench_coord_t * coords, int * count, const char * sentence,
+                      const buzz_gps_field_t * fields, int value_ndx)
+{
+    const buzz_gps_field_t * value = &fields[value_ndx];
+    const buzz_gps_field_t * hem = &fields[value_ndx + 1];
+
+    if (*count >= BENCH_MAX_COORDS || value->length == 0 || value->length >= sizeof(coords->text))
+    {
+        return;
+    }
+    memcpy(coords[*count].text, &sentence[value->offset], value->length);
+    coords[*count].text[value->length] = '\0';
+    coords[*count].hem = hem->length > 0 ? sentence[hem->offset] : '\0';
+    (*count)++;
+}
+
+
+static int bench_load(const char * path, bench_coord_t * coords)
+{
+    FILE * fp;
+    char line[BUZZ_GPS_MAX_LINE];
+    buzz_gps_field_t fields[BUZZ_GPS_MAX_PARSE_WORDS];
+    buzz_talker_t talker;
+    int field_count;
+    int count = 0;
+    int first = 0;
+
+    fp = fopen(path, "r");
+    if (fp == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), fp) != NULL)
+    {
+        field_count = buzz_nmea_tokenize(line, fields, BUZZ_GPS_MAX_PARSE_WORDS);
+        switch (buzz_nmea_classify(&line[fields[0].offset], fields[0].length, &talker))
+        {
+            case BUZZ_GPRMC:
+                first = 3;
+                break;
+            case BUZZ_GPGGA:
+                first = 2;
+                break;
+            case BUZZ_GPGLL:
+                first = 1;
+                break;
+            default:
+                continue;
+        }
+        if (field_count > first + 3)
+        {
+            bench_add(coords, &count, line, fields, first);
+            bench_add(coords, &count, line, fields, first + 2);
+        }
+    }
+    fclose(fp);
+    return count;
+}
+
+
+int main(int argc, char ** argv)
+{
+    bench_coord_t * coords;
+    int count;
+    int round;
+    int i;
+    double start;
+    double sscanf_ns;
+    double fixed_ns;
+    double max_diff = 0.0;
+    double sink = 0.0;
+    float f;
+    double d;
+
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s <nmea log>\n", argv[0]);
+        return 1;
+    }
+    coords = calloc(BENCH_MAX_COORDS, sizeof(bench_coord_t));
+    count = bench_load(argv[1], coords);
+    if (count <= 0)
+    {
+        fprintf(stderr, "no coordinates found in %s\n", argv[1]);
+        return 1;
+    }
+
+    start = bench_now_ns();
+    for (round = 0; round < BENCH_ROUNDS; round++)
+    {
+        for (i = 0; i < count; i++)
+        {
+            bench_sscanf_daysmins_to_float(coords[i].text, coords[i].hem, &f);
+            sink += f;
+        }
+    }
+    sscanf_ns = (bench_now_ns() - start) / ((double) count * BENCH_ROUNDS);
+
+    start = bench_now_ns();
+    for (round = 0; round < BENCH_ROUNDS; round++)
+    {
+        for (i = 0; i < count; i++)
+        {
+            buzz_nmea_parse_coordinate(coords[i].text, strlen(coords[i].text), coords[i].hem, &d);
+            sink += d;
+        }
+    }
+    fixed_ns = (bench_now_ns() - start) / ((double) count * BENCH_ROUNDS);
+
+    for (i = 0; i < count; i++)
+    {
+        bench_sscanf_daysmins_to_float(coords[i].text, coords[i].hem, &f);
+        buzz_nmea_parse_coordinate(coords[i].text, strlen(coords[i].text), coords[i].hem, &d);
+        if (fabs(f - d) > max_diff)
+        {
+            max_diff = fabs(f - d);
+        }
+    }
+
+    printf("coordinates: %d\n", count);
+    printf("sscanf float: %.1f ns/coordinate\n", sscanf_ns);
+    printf("fixed point double: %.1f ns/coordinate\n", fixed_ns);
+    printf("speedup: %.1fx\n", sscanf_ns / fixed_ns);
+    printf("max float error: %.3f m\n", max_diff * BENCH_METRES_PER_DEGREE);
+    /* keep the loops from being optimized away */
+    fprintf(stderr, "%s", sink == 0.5 ? " " : "");
+
+    free(coords);
+    return 0;
+}
@@ -0,0 +1,113 @@
+/*
+ * Time the batch geodesy functions with every kernel the CPU supports and
+ * report how far each strays from the scalar one.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include <buzz_gps.h>
+
+#define BENCH_POINTS (1 << 20)
+#define BENCH_ROUNDS 20
+
+static const char * bench_kernel_names[] = { "auto", "scalar", "sse2", "avx2" };
+
+
+static double bench_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+int main(void)
+{
+    double * lat1 = malloc(BENCH_POINTS * sizeof(double));
+    double * lon1 = malloc(BENCH_POINTS * sizeof(double));
+    double * lat2 = malloc(BENCH_POINTS * sizeof(double));
+    double * lon2 = malloc(BENCH_POINTS * sizeof(double));
+    double * out = malloc(BENCH_POINTS * sizeof(double));
+    double * out_lon = malloc(BENCH_POINTS * sizeof(double));
+    double * reference = malloc(BENCH_POINTS * sizeof(double));
+    double haversine_ns;
+    double equirectangular_ns;
+    double bearing_ns;
+    double destination_ns;
+    double start;
+    double max_diff;
+    int kernel;
+    int round;
+    int i;
+
+    srand(1);
+    for (i = 0; i < BENCH_POINTS; i++)
+    {
+        lat1[i] = 47.0 + 2.0 * rand() / RAND_MAX;
+        lon1[i] = 10.0 + 2.0 * rand() / RAND_MAX;
+        lat2[i] = lat1[i] + 0.001 * rand() / RAND_MAX;
+        lon2[i] = lon1[i] + 0.001 * rand() / RAND_MAX;
+    }
+    buzz_gps_geodesy_set_kernel(BUZZ_GPS_GEODESY_SCALAR);
+    buzz_gps_haversine_batch(lat1, lon1, lat2, lon2, reference, BENCH_POINTS);
+
+    printf("points: %d\n", BENCH_POINTS);
+    for (kernel = BUZZ_GPS_GEODESY_SCALAR; kernel <= BUZZ_GPS_GEODESY_AVX2; kernel++)
+    {
+        if (buzz_gps_geodesy_set_kernel((buzz_gps_geodesy_kernel_t) kernel) != BUZZ_GPS_SUCCESS)
+        {
+            printf("%s: not supported\n", bench_kernel_names[kernel]);
+            continue;
+        }
+
+        start = bench_now_ns();
+        for (round = 0; round < BENCH_ROUNDS; round++)
+        {
+            buzz_gps_haversine_batch(lat1, lon1, lat2, lon2, out, BENCH_POINTS);
+        }
+        haversine_ns = (bench_now_ns() - start) / ((double) BENCH_POINTS * BENCH_ROUNDS);
+        max_diff = 0.0;
+        for (i = 0; i < BENCH_POINTS; i++)
+        {
+            max_diff = fmax(max_diff, fabs(out[i] - reference[i]));
+        }
+
+        start = bench_now_ns();
+        for (round = 0; round < BENCH_ROUNDS; round++)
+        {
+            buzz_gps_equirectangular_batch(lat1, lon1, lat2, lon2, out, BENCH_POINTS);
+        }
+        equirectangular_ns = (bench_now_ns() - start) / ((double) BENCH_POINTS * BENCH_ROUNDS);
+
+        start = bench_now_ns();
+        for (round = 0; round < BENCH_ROUNDS; round++)
+        {
+            buzz_gps_bearing_batch(lat1, lon1, lat2, lon2, out, BENCH_POINTS);
+        }
+        bearing_ns = (bench_now_ns() - start) / ((double) BENCH_POINTS * BENCH_ROUNDS);
+
+        start = bench_now_ns();
+        for (round = 0; round < BENCH_ROUNDS; round++)
+        {
+            buzz_gps_destination_batch(lat1, lon1, lon2, reference, out, out_lon, BENCH_POINTS);
+        }
+        destination_ns = (bench_now_ns() - start) / ((double) BENCH_POINTS * BENCH_ROUNDS);
+
+        printf("%s: haversine %.2f ns, equirectangular %.2f ns, bearing %.2f ns, destination %.2f ns"
+            " per point, max haversine difference %.3g m\n",
+            bench_kernel_names[kernel], haversine_ns, equirectangular_ns, bearing_ns, destination_ns, max_diff);
+    }
+
+    free(lat1);
+    free(lon1);
+    free(lat2);
+    free(lon2);
+    free(out);
+    free(out_lon);
+    free(reference);
+    return 0;
+}
@@ -0,0 +1,569 @@
+/*
+ * Throughput of each parsing stage and of the whole pipeline, measured on
+ * the sentences of a recorded NMEA log such as examples/sample.txt.
+ *
+ * Every result is printed as one JSON object per line so runs can be
+ * compared between releases:
+ *
+ *   {"bench":"tokenize","sentences":...,"ns_per_sentence":...,
+ *    "sentences_per_s":...,"mb_per_s":...,"allocs_per_sentence":...}
+ *
+ * allocs_per_sentence counts malloc, calloc and realloc calls made inside
+ * the timed loop. It is null when the C library cannot be interposed.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <buzz_gps.h>
+#include <buzz_framer.h>
+#include <buzz_handle.h>
+#include <buzz_logging.h>
+#include <buzz_nmea.h>
+
+/* each stage runs over at least this many sentences */
+#define BENCH_MIN_SENTENCES 2000000
+/* the log is repeated up to this size for the in memory end to end runs */
+#define BENCH_REPLAY_BYTES (16 * 1024 * 1024)
+#define BENCH_BATCH_SIZE 64
+#define BENCH_LARGE_PATH "bench_large.nmea"
+
+typedef struct bench_line_s
+{
+    char text[BUZZ_GPS_MAX_LINE];
+    size_t len;
+    buzz_gps_field_t fields[BUZZ_GPS_MAX_PARSE_WORDS];
+    buzz_sentence_type_t type;
+} bench_line_t;
+
+typedef struct bench_log_s
+{
+    char * data;
+    size_t len;
+    bench_line_t * lines;
+    int line_count;
+} bench_log_t;
+
+static const char * g_type_names[BUZZ_GPS_TYPE_COUNT] =
+{
+    "gga", "gll", "vtg", "rmc", "gsa", "gsv", "mss", "trf", "stn", "xte", "zda"
+};
+
+
+#ifdef __GLIBC__
+#define BENCH_COUNTS_ALLOCS 1
+
+extern void * __libc_malloc(size_t size);
+extern void * __libc_calloc(size_t count, size_t size);
+extern void * __libc_realloc(void * ptr, size_t size);
+
+static uint64_t g_allocs = 0;
+
+void * malloc(size_t size)
+{
+    g_allocs++;
+    return __libc_malloc(size);
+}
+
+void * calloc(size_t count, size_t size)
+{
+    g_allocs++;
+    return __libc_calloc(count, size);
+}
+
+void * realloc(void * ptr, size_t size)
+{
+    g_allocs++;
+    return __libc_realloc(ptr, size);
+}
+#else
+#define BENCH_COUNTS_ALLOCS 0
+
+static uint64_t g_allocs = 0;
+#endif
+
+/* keeps the timed loops from being optimized away */
+static volatile double g_sink;
+
+
+static double bench_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+static void bench_report(const char * name, uint64_t sentences, uint64_t bytes, double ns, uint64_t allocs)
+{
+    printf("{\"bench\":\"%s\",\"sentences\":%llu,\"ns_per_sentence\":%.2f,\"sentences_per_s\":%.0f,\"mb_per_s\":%.1f,",
+        name,
+        (unsigned long long) sentences,
+        ns / sentences,
+        sentences / (ns / 1e9),
+        bytes / (ns / 1e9) / (1024.0 * 1024.0));
+    if (BENCH_COUNTS_ALLOCS)
+    {
+        printf("\"allocs_per_sentence\":%.3f}\n", (double) allocs / sentences);
+    }
+    else
+    {
+        printf("\"allocs_per_sentence\":null}\n");
+    }
+    fflush(stdout);
+}
+
+
+static int bench_load(const char * path, bench_log_t * log)
+{
+    FILE * fp;
+    long size;
+    char * line;
+    char * end;
+    bench_line_t * l;
+    buzz_talker_t talker;
+
+    fp = fopen(path, "rb");
+    if (fp == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    log->data = malloc(size + 1);
+    log->len = fread(log->data, 1, size, fp);
+    log->data[log->len] = '\0';
+    fclose(fp);
+
+    log->lines = calloc(log->len / 8 + 1, sizeof(bench_line_t));
+    log->line_count = 0;
+    for (line = log->data; line < log->data + log->len; line = end + 1)
+    {
+        end = strchr(line, '\n');
+        if (end == NULL)
+        {
+            break;
+        }
+        if (*line != '$' || (size_t) (end - line + 1) >= BUZZ_GPS_MAX_LINE)
+        {
+            continue;
+        }
+        l = &log->lines[log->line_count++];
+        l->len = end - line + 1;
+        memcpy(l->text, line, l->len);
+        l->text[l->len] = '\0';
+        buzz_nmea_tokenize(l->text, l->fields, BUZZ_GPS_MAX_PARSE_WORDS);
+        l->type = buzz_nmea_classify(&l->text[l->fields[0].offset], l->fields[0].length, &talker);
+    }
+    return log->line_count > 0 ? 0 : -1;
+}
+
+
+static int bench_rounds(int per_round)
+{
+    return BENCH_MIN_SENTENCES / per_round + 1;
+}
+
+
+static void bench_framing(const bench_log_t * log)
+{
+    static buzz_i_framer_t framer;
+    char out[BUZZ_GPS_MAX_LINE];
+    int rounds = bench_rounds(log->line_count);
+    uint64_t count = 0;
+    uint64_t allocs;
+    size_t pos;
+    double start;
+    int r;
+
+    allocs = g_allocs;
+    start = bench_now_ns();
+    for (r = 0; r < rounds; r++)
+    {
+        buzz_framer_init(&framer);
+        for (pos = 0; pos < log->len; )
+        {
+            pos += buzz_framer_fill_from_memory(&framer, &log->data[pos], log->len - pos);
+            while (buzz_framer_next(&framer, out, sizeof(out)) > 0)
+            {
+                count++;
+            }
+        }
+    }
+    bench_report("framing", count, (uint64_t) log->len * rounds, bench_now_ns() - start, g_allocs - allocs);
+}
+
+
+static void bench_checksum(const bench_log_t * log)
+{
+    int rounds = bench_rounds(log->line_count);
+    uint64_t bytes = 0;
+    uint64_t allocs;
+    double start;
+    int good = 0;
+    int r;
+    int i;
+
+    allocs = g_allocs;
+    start = bench_now_ns();
+    for (r = 0; r < rounds; r++)
+    {
+        for (i = 0; i < log->line_count; i++)
+        {
+            good += buzz_nmea_verify_checksum(log->lines[i].text, log->lines[i].len) == BUZZ_GPS_SUCCESS;
+            bytes += log->lines[i].len;
+        }
+    }
+    bench_report("checksum", (uint64_t) rounds * log->line_count, bytes, bench_now_ns() - start, g_allocs - allocs);
+    g_sink += good;
+}
+
+
+static void bench_tokenize(const bench_log_t * log)
+{
+    buzz_gps_field_t fields[BUZZ_GPS_MAX_PARSE_WORDS];
+    int rounds = bench_rounds(log->line_count);
+    uint64_t bytes = 0;
+    uint64_t allocs;
+    double start;
+    int total = 0;
+    int r;
+    int i;
+
+    allocs = g_allocs;
+    start = bench_now_ns();
+    for (r = 0; r < rounds; r++)
+    {
+        for (i = 0; i < log->line_count; i++)
+        {
+            total += buzz_nmea_tokenize(log->lines[i].text, fields, BUZZ_GPS_MAX_PARSE_WORDS);
+            bytes += log->lines[i].len;
+        }
+    }
+    bench_report("tokenize", (uint64_t) rounds * log->line_count, bytes, bench_now_ns() - start, g_allocs - allocs);
+    g_sink += total;
+}
+
+
+static void bench_classify(const bench_log_t * log)
+{
+    const bench_line_t * l;
+    buzz_talker_t talker;
+    int rounds = bench_rounds(log->line_count);
+    uint64_t allocs;
+    double start;
+    int total = 0;
+    int r;
+    int i;
+
+    allocs = g_allocs;
+    start = bench_now_ns();
+    for (r = 0; r < rounds; r++)
+    {
+        for (i = 0; i < log->line_count; i++)
+        {
+            l = &log->lines[i];
+            total += buzz_nmea_classify(&l->text[l->fields[0].offset], l->fields[0].length, &talker);
+        }
+    }
+    bench_report("classify", (uint64_t) rounds * log->line_count, (uint64_t) rounds * log->line_count * 6,
+        bench_now_ns() - start, g_allocs - allocs);
+    g_sink += total;
+}
+
+
+/*
+ * The latitude and longitude of every RMC, GGA and GLL sentence, the job
+ * buzz_l_daysmins_to_float used to do
+ */
+static void bench_coordinates(const bench_log_t * log)
+{
+    const bench_line_t * l;
+    const buzz_gps_field_t * f;
+    double v;
+    double total = 0.0;
+    uint64_t count = 0;
+    uint64_t bytes = 0;
+    uint64_t allocs;
+    double start;
+    int rounds = bench_rounds(log->line_count);
+    int first;
+    int r;
+    int i;
+    int j;
+
+    allocs = g_allocs;
+    start = bench_now_ns();
+    for (r = 0; r < rounds; r++)
+    {
+        for (i = 0; i < log->line_count; i++)
+        {
+            l = &log->lines[i];
+            switch (l->type)
+            {
+                case BUZZ_GPRMC:
+                    first = 3;
+                    break;
+                case BUZZ_GPGGA:
+                    first = 2;
+                    break;
+                case BUZZ_GPGLL:
+                    first = 1;
+                    break;
+                default:
+                    continue;
+            }
+            for (j = first; j <= first + 2; j += 2)
+            {
+                f = &l->fields[j];
+                if (buzz_nmea_parse_coordinate(&l->text[f->offset], f->length,
+                        l->text[l->fields[j + 1].offset], &v) == BUZZ_GPS_SUCCESS)
+                {
+                    total += v;
+                }
+                bytes += f->length;
+                count++;
+            }
+        }
+    }
+    bench_report("coordinates", count, bytes, bench_now_ns() - start, g_allocs - allocs);
+    g_sink += total;
+}
+
+
+/*
+ * Split and parse each sentence type found in the log on its own
+ */
+static void bench_parsers(const bench_log_t * log)
+{
+    buzz_gps_handle_t gps_handle;
+    buzz_gps_raw_event_t * raws;
+    buzz_gps_fix_t fix;
+    char name[32];
+    uint64_t bytes;
+    uint64_t allocs;
+    double start;
+    int type;
+    int count;
+    int rounds;
+    int ok;
+    int r;
+    int i;
+
+    if (buzz_gps_init_from_memory(&gps_handle, "", 0, BUZZ_GPS_REPLAY_FAST, 0.0, BUZZ_GPS_OPTIONS_NONE) != BUZZ_GPS_SUCCESS)
+    {
+        return;
+    }
+    raws = calloc(log->line_count, sizeof(buzz_gps_raw_event_t));
+    for (type = 0; type < BUZZ_GPS_TYPE_COUNT; type++)
+    {
+        count = 0;
+        bytes = 0;
+        for (i = 0; i < log->line_count; i++)
+        {
+            if (log->lines[i].type == type)
+            {
+                memcpy(raws[count].sentence, log->lines[i].text, log->lines[i].len + 1);
+                raws[count].length = log->lines[i].len;
+                bytes += log->lines[i].len;
+                count++;
+            }
+        }
+        if (count == 0)
+        {
+            continue;
+        }
+
+        rounds = bench_rounds(count);
+        ok = 0;
+        allocs = g_allocs;
+        start = bench_now_ns();
+        for (r = 0; r < rounds; r++)
+        {
+            for (i = 0; i < count; i++)
+            {
+                ok += buzz_handle_parse(gps_handle, &raws[i], &fix) == BUZZ_GPS_SUCCESS;
+            }
+        }
+        snprintf(name, sizeof(name), "parse_%s", g_type_names[type]);
+        bench_report(name, (uint64_t) rounds * count, bytes * rounds, bench_now_ns() - start, g_allocs - allocs);
+        g_sink += ok;
+    }
+    free(raws);
+    buzz_gps_destroy(gps_handle);
+}
+
+
+typedef enum bench_api_e
+{
+    BENCH_EVENT_BLOCKING,
+    BENCH_FIX_BLOCKING,
+    BENCH_BATCH
+} bench_api_t;
+
+
+/*
+ * Replay a whole log through one of the public APIs
+ */
+static void bench_replay(const char * name, buzz_gps_handle_t gps_handle, bench_api_t api, uint64_t bytes)
+{
+    static buzz_gps_batch_entry_t entries[BENCH_BATCH_SIZE];
+    buzz_gps_raw_event_t raw;
+    buzz_gps_event_t event;
+    buzz_gps_fix_t fix;
+    uint64_t count = 0;
+    uint64_t allocs;
+    size_t n;
+    double start;
+    int rc;
+
+    allocs = g_allocs;
+    start = bench_now_ns();
+    for (;;)
+    {
+        switch (api)
+        {
+            case BENCH_EVENT_BLOCKING:
+                rc = buzz_gps_get_event_blocking(gps_handle, &raw, &event);
+                if (rc == BUZZ_GPS_SUCCESS)
+                {
+                    buzz_gps_free_blocking_event(&event);
+                }
+                n = 1;
+                break;
+            case BENCH_FIX_BLOCKING:
+                rc = buzz_gps_get_fix_blocking(gps_handle, &raw, &fix);
+                n = 1;
+                break;
+            case BENCH_BATCH:
+            default:
+                rc = buzz_gps_get_events_batch(gps_handle, entries, BENCH_BATCH_SIZE, -1, &n);
+                break;
+        }
+        if (rc == BUZZ_GPS_END_OF_DATA)
+        {
+            break;
+        }
+        count += n;
+    }
+    bench_report(name, count, bytes, bench_now_ns() - start, g_allocs - allocs);
+}
+
+
+static void bench_replay_memory(const bench_log_t * log)
+{
+    static const char * names[] = { "replay_event_blocking", "replay_fix_blocking", "replay_batch" };
+    buzz_gps_handle_t gps_handle;
+    char * data;
+    size_t len = 0;
+    int api;
+
+    /* repeat the log so the run is long enough to time */
+    data = malloc(BENCH_REPLAY_BYTES + log->len);
+    while (len < BENCH_REPLAY_BYTES)
+    {
+        memcpy(&data[len], log->data, log->len);
+        len += log->len;
+    }
+
+    for (api = BENCH_EVENT_BLOCKING; api <= BENCH_BATCH; api++)
+    {
+        if (buzz_gps_init_from_memory(&gps_handle, data, len, BUZZ_GPS_REPLAY_FAST, 0.0, BUZZ_GPS_OPTIONS_NONE) != BUZZ_GPS_SUCCESS)
+        {
+            break;
+        }
+        bench_replay(names[api], gps_handle, (bench_api_t) api, len);
+        buzz_gps_destroy(gps_handle);
+    }
+    free(data);
+}
+
+
+/*
+ * Write the log over and over to a file of about size_mb and replay it
+ * from disk through the memory mapped file source
+ */
+static void bench_replay_large(const bench_log_t * log, long size_mb)
+{
+    static const char * names[] = { "large_event_blocking", "large_fix_blocking", "large_batch" };
+    buzz_gps_handle_t gps_handle;
+    FILE * fp;
+    uint64_t len = 0;
+    uint64_t target = (uint64_t) size_mb * 1024 * 1024;
+    int api;
+
+    fp = fopen(BENCH_LARGE_PATH, "wb");
+    if (fp == NULL)
+    {
+        perror(BENCH_LARGE_PATH);
+        return;
+    }
+    while (len < target)
+    {
+        if (fwrite(log->data, 1, log->len, fp) != log->len)
+        {
+            perror(BENCH_LARGE_PATH);
+            break;
+        }
+        len += log->len;
+    }
+    fclose(fp);
+
+    for (api = BENCH_EVENT_BLOCKING; api <= BENCH_BATCH; api++)
+    {
+        if (buzz_gps_init_from_file(&gps_handle, BENCH_LARGE_PATH, BUZZ_GPS_REPLAY_FAST, 0.0, BUZZ_GPS_OPTIONS_NONE) != BUZZ_GPS_SUCCESS)
+        {
+            break;
+        }
+        bench_replay(names[api], gps_handle, (bench_api_t) api, len);
+        buzz_gps_destroy(gps_handle);
+    }
+    unlink(BENCH_LARGE_PATH);
+}
+
+
+int main(int argc, char ** argv)
+{
+    bench_log_t log;
+    long large_mb = 0;
+
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s <nmea log> [size of the generated log in MB, 0 to skip]\n", argv[0]);
+        return 1;
+    }
+    if (argc > 2)
+    {
+        large_mb = atol(argv[2]);
+    }
+    if (bench_load(argv[1], &log) != 0)
+    {
+        fprintf(stderr, "no sentences found in %s\n", argv[1]);
+        return 1;
+    }
+
+    /* the timings are of the parser, not of writing log lines */
+    buzz_set_log_level("ERROR");
+
+    bench_framing(&log);
+    bench_checksum(&log);
+    bench_tokenize(&log);
+    bench_classify(&log);
+    bench_coordinates(&log);
+    bench_parsers(&log);
+    bench_replay_memory(&log);
+    if (large_mb > 0)
+    {
+        bench_replay_large(&log, large_mb);
+    }
+
+    free(log.lines);
+    free(log.data);
+    return 0;
+}
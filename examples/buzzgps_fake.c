@@ -1,6 +1,7 @@
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/stat.h>
 
 #include <buzz_gps.h>
 #include <buzz_logging.h>
@@ -38,6 +39,10 @@ static void run_blocking(buzz_gps_handle_t gps_handle)
         {
             printf("Unparsed event %s\n", raw.sentence);
         }
+        else if (rc == BUZZ_GPS_END_OF_DATA)
+        {
+            break;
+        }
         else
         {
             fprintf(stderr, "Failed to get a location\n");
@@ -92,6 +97,7 @@ int main(int argc, char ** argv)
     int rc;
     char * gps_device_path;
     int async = 0;
+    struct stat st;
 
     gps_device_path = argv[1];
     if (argc > 2)
@@ -101,7 +107,15 @@ int main(int argc, char ** argv)
 
     buzz_set_log_level("ERROR");
 
-    rc = buzz_gps_init(&gps_handle, gps_device_path, 0, BUZZ_GPS_OPTIONS_DEBUG);
+    /* a regular file is a recorded log, replay it at the speed it was recorded */
+    if (stat(gps_device_path, &st) == 0 && S_ISREG(st.st_mode))
+    {
+        rc = buzz_gps_init_from_file(&gps_handle, gps_device_path, BUZZ_GPS_REPLAY_REALTIME, 0.0, BUZZ_GPS_OPTIONS_NONE);
+    }
+    else
+    {
+        rc = buzz_gps_init(&gps_handle, gps_device_path, 0, BUZZ_GPS_OPTIONS_DEBUG);
+    }
     if (rc != BUZZ_GPS_SUCCESS)
     {
         fprintf(stderr, "Failed to open device\n");
@@ -0,0 +1,178 @@
+/*
+ * Delta encoding of fix sequences
+ *
+ * Each record is a flags byte followed by the change from the previous
+ * record of every value it carries, zig-zag mapped so small negative
+ * changes stay small and written as base 128 varints. Consecutive fixes
+ * differ by little, so most changes fit in a byte or two.
+ */
+#include <string.h>
+#include <math.h>
+
+#include "buzz_gps.h"
+
+#define BUZZ_DELTA_HAS_ALTITUDE 0x1
+#define BUZZ_DELTA_HAS_SPEED    0x2
+
+/* the units values are rounded to */
+#define BUZZ_DELTA_DEGREE_SCALE 1e7     // 1e-7 degrees, about 1cm
+#define BUZZ_DELTA_ALTITUDE_SCALE 10.0  // decimeters
+#define BUZZ_DELTA_SPEED_SCALE 100.0    // hundredths of a knot
+
+
+static uint64_t buzz_l_zigzag(int64_t value)
+{
+    return ((uint64_t) value << 1) ^ (uint64_t) (value >> 63);
+}
+
+
+static int64_t buzz_l_unzigzag(uint64_t value)
+{
+    return (int64_t) (value >> 1) ^ -(int64_t) (value & 1);
+}
+
+
+static size_t buzz_l_put_varint(unsigned char * out, int64_t delta)
+{
+    uint64_t value = buzz_l_zigzag(delta);
+    size_t n = 0;
+
+    while (value >= 0x80)
+    {
+        out[n++] = (unsigned char) (value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (unsigned char) value;
+    return n;
+}
+
+
+/* returns the bytes used, 0 if the varint runs past the end */
+static size_t buzz_l_get_varint(const unsigned char * in, size_t in_len, int64_t * out_delta)
+{
+    uint64_t value = 0;
+    size_t n = 0;
+    int shift = 0;
+
+    while (n < in_len && shift < 64)
+    {
+        value |= (uint64_t) (in[n] & 0x7F) << shift;
+        if (!(in[n++] & 0x80))
+        {
+            *out_delta = buzz_l_unzigzag(value);
+            return n;
+        }
+        shift += 7;
+    }
+    return 0;
+}
+
+
+void buzz_gps_delta_reset(buzz_gps_delta_state_t * state)
+{
+    memset(state, '\0', sizeof(buzz_gps_delta_state_t));
+}
+
+
+size_t buzz_gps_delta_encode(
+    buzz_gps_delta_state_t * state,
+    const buzz_gps_fix_t * fix,
+    unsigned char * out,
+    size_t out_size)
+{
+    unsigned char flags = 0;
+    int64_t time_ms;
+    int64_t latitude;
+    int64_t longitude;
+    int64_t altitude = 0;
+    int64_t speed = 0;
+    size_t n = 1;
+
+    if ((fix->flags & (BUZZ_GPS_FIX_TIMESTAMP | BUZZ_GPS_FIX_LOCATION))
+            != (BUZZ_GPS_FIX_TIMESTAMP | BUZZ_GPS_FIX_LOCATION)
+        || out_size < BUZZ_GPS_DELTA_MAX_RECORD)
+    {
+        return 0;
+    }
+    time_ms = fix->utc_ns / 1000000;
+    latitude = llround(fix->latitude * BUZZ_DELTA_DEGREE_SCALE);
+    longitude = llround(fix->longitude * BUZZ_DELTA_DEGREE_SCALE);
+
+    n += buzz_l_put_varint(&out[n], time_ms - state->time_ms);
+    n += buzz_l_put_varint(&out[n], latitude - state->latitude);
+    n += buzz_l_put_varint(&out[n], longitude - state->longitude);
+    if (fix->flags & BUZZ_GPS_FIX_ALTITUDE)
+    {
+        flags |= BUZZ_DELTA_HAS_ALTITUDE;
+        altitude = llround(fix->altitude_meters * BUZZ_DELTA_ALTITUDE_SCALE);
+        n += buzz_l_put_varint(&out[n], altitude - state->altitude);
+        state->altitude = altitude;
+    }
+    if (fix->flags & BUZZ_GPS_FIX_SPEED)
+    {
+        flags |= BUZZ_DELTA_HAS_SPEED;
+        speed = llround(fix->speed_knots * BUZZ_DELTA_SPEED_SCALE);
+        n += buzz_l_put_varint(&out[n], speed - state->speed);
+        state->speed = speed;
+    }
+    out[0] = flags;
+
+    state->time_ms = time_ms;
+    state->latitude = latitude;
+    state->longitude = longitude;
+    return n;
+}
+
+
+size_t buzz_gps_delta_decode(
+    buzz_gps_delta_state_t * state,
+    const unsigned char * in,
+    size_t in_len,
+    buzz_gps_fix_t * out_fix)
+{
+    int64_t deltas[5];
+    int count = 3;
+    size_t n = 1;
+    size_t used;
+    int i;
+
+    if (in_len < 1 || (in[0] & ~(BUZZ_DELTA_HAS_ALTITUDE | BUZZ_DELTA_HAS_SPEED)))
+    {
+        return 0;
+    }
+    count += (in[0] & BUZZ_DELTA_HAS_ALTITUDE) != 0;
+    count += (in[0] & BUZZ_DELTA_HAS_SPEED) != 0;
+    for (i = 0; i < count; i++)
+    {
+        used = buzz_l_get_varint(&in[n], in_len - n, &deltas[i]);
+        if (used == 0)
+        {
+            return 0;
+        }
+        n += used;
+    }
+
+    memset(out_fix, '\0', sizeof(buzz_gps_fix_t));
+    state->time_ms += deltas[0];
+    state->latitude += deltas[1];
+    state->longitude += deltas[2];
+    out_fix->flags = BUZZ_GPS_FIX_TIMESTAMP | BUZZ_GPS_FIX_LOCATION;
+    out_fix->utc_ns = state->time_ms * 1000000;
+    out_fix->time = (time_t) (state->time_ms / 1000);
+    out_fix->latitude = state->latitude / BUZZ_DELTA_DEGREE_SCALE;
+    out_fix->longitude = state->longitude / BUZZ_DELTA_DEGREE_SCALE;
+    i = 3;
+    if (in[0] & BUZZ_DELTA_HAS_ALTITUDE)
+    {
+        state->altitude += deltas[i++];
+        out_fix->flags |= BUZZ_GPS_FIX_ALTITUDE;
+        out_fix->altitude_meters = state->altitude / BUZZ_DELTA_ALTITUDE_SCALE;
+    }
+    if (in[0] & BUZZ_DELTA_HAS_SPEED)
+    {
+        state->speed += deltas[i++];
+        out_fix->flags |= BUZZ_GPS_FIX_SPEED;
+        out_fix->speed_knots = state->speed / BUZZ_DELTA_SPEED_SCALE;
+    }
+    return n;
+}
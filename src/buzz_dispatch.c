@@ -0,0 +1,255 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "buzz_dispatch.h"
+#include "buzz_logging.h"
+
+/* sleeps are re-checked this often in case a wakeup was missed */
+#define BUZZ_DISPATCH_WAIT_NS 100000000L
+
+
+static void buzz_l_dispatch_wait(buzz_i_dispatcher_t * dispatcher, pthread_cond_t * cond)
+{
+    struct timespec waittime;
+
+    clock_gettime(CLOCK_MONOTONIC, &waittime);
+    waittime.tv_nsec += BUZZ_DISPATCH_WAIT_NS;
+    if (waittime.tv_nsec >= 1000000000L)
+    {
+        waittime.tv_sec++;
+        waittime.tv_nsec -= 1000000000L;
+    }
+    pthread_cond_timedwait(cond, &dispatcher->wait_mutex, &waittime);
+}
+
+
+static void buzz_l_dispatch_wake(buzz_i_dispatcher_t * dispatcher, atomic_int * waiting, pthread_cond_t * cond)
+{
+    /* pairs with the waiter setting its flag before re-checking the ring */
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load(waiting))
+    {
+        pthread_mutex_lock(&dispatcher->wait_mutex);
+        pthread_cond_signal(cond);
+        pthread_mutex_unlock(&dispatcher->wait_mutex);
+    }
+}
+
+
+static size_t buzz_l_dispatch_count(buzz_i_dispatcher_t * dispatcher)
+{
+    return atomic_load(&dispatcher->tail) - atomic_load(&dispatcher->head);
+}
+
+
+/*
+ * Copy out the oldest item. The head is claimed after the copy so that, if
+ * the producer dropped this slot and reused it meanwhile, the claim fails
+ * and the possibly torn copy is discarded.
+ */
+static int buzz_l_dispatch_pop(buzz_i_dispatcher_t * dispatcher, buzz_i_dispatch_item_t * out_item)
+{
+    size_t head;
+
+    head = atomic_load_explicit(&dispatcher->head, memory_order_acquire);
+    while (head != atomic_load_explicit(&dispatcher->tail, memory_order_acquire))
+    {
+        memcpy(out_item, &dispatcher->slots[head & (dispatcher->capacity - 1)], sizeof(buzz_i_dispatch_item_t));
+        if (atomic_compare_exchange_strong(&dispatcher->head, &head, head + 1))
+        {
+            buzz_l_dispatch_wake(dispatcher, &dispatcher->producer_waiting, &dispatcher->space_cond);
+            return 1;
+        }
+        /* head now holds the value the producer moved it to */
+    }
+    return 0;
+}
+
+
+static void * buzz_l_dispatch_thread(void * arg)
+{
+    buzz_i_dispatcher_t * dispatcher = (buzz_i_dispatcher_t *) arg;
+    buzz_i_dispatch_item_t item;
+
+    for (;;)
+    {
+        if (buzz_l_dispatch_pop(dispatcher, &item))
+        {
+            dispatcher->func(&item, dispatcher->func_arg);
+            atomic_fetch_add_explicit(&dispatcher->dispatched, 1, memory_order_relaxed);
+            continue;
+        }
+        if (!atomic_load(&dispatcher->running))
+        {
+            break;
+        }
+        if (dispatcher->idle_func != NULL)
+        {
+            dispatcher->idle_func(dispatcher->func_arg);
+        }
+
+        pthread_mutex_lock(&dispatcher->wait_mutex);
+        {
+            atomic_store(&dispatcher->consumer_waiting, 1);
+            if (buzz_l_dispatch_count(dispatcher) == 0 && atomic_load(&dispatcher->running))
+            {
+                buzz_l_dispatch_wait(dispatcher, &dispatcher->items_cond);
+            }
+            atomic_store(&dispatcher->consumer_waiting, 0);
+        }
+        pthread_mutex_unlock(&dispatcher->wait_mutex);
+    }
+
+    return NULL;
+}
+
+
+int buzz_dispatch_init(
+    buzz_i_dispatcher_t * dispatcher,
+    size_t capacity,
+    buzz_gps_overflow_policy_t policy,
+    buzz_i_dispatch_func_t func,
+    buzz_i_dispatch_idle_func_t idle_func,
+    void * func_arg)
+{
+    pthread_condattr_t attr;
+    size_t rounded = 1;
+
+    while (rounded < capacity)
+    {
+        rounded <<= 1;
+    }
+
+    memset(dispatcher, '\0', sizeof(buzz_i_dispatcher_t));
+    dispatcher->slots = (buzz_i_dispatch_item_t *) calloc(rounded, sizeof(buzz_i_dispatch_item_t));
+    if (dispatcher->slots == NULL)
+    {
+        BUZZ_LOG_ERROR("Failed to allocate a dispatch queue of %d events", (int) rounded);
+        return BUZZ_GPS_ERROR;
+    }
+    dispatcher->capacity = rounded;
+    dispatcher->policy = policy;
+    dispatcher->func = func;
+    dispatcher->idle_func = idle_func;
+    dispatcher->func_arg = func_arg;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&dispatcher->items_cond, &attr);
+    pthread_cond_init(&dispatcher->space_cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_mutex_init(&dispatcher->wait_mutex, NULL);
+
+    return BUZZ_GPS_SUCCESS;
+}
+
+
+void buzz_dispatch_destroy(buzz_i_dispatcher_t * dispatcher)
+{
+    pthread_cond_destroy(&dispatcher->items_cond);
+    pthread_cond_destroy(&dispatcher->space_cond);
+    pthread_mutex_destroy(&dispatcher->wait_mutex);
+    free(dispatcher->slots);
+    dispatcher->slots = NULL;
+}
+
+
+int buzz_dispatch_start(buzz_i_dispatcher_t * dispatcher)
+{
+    atomic_store(&dispatcher->running, 1);
+    if (pthread_create(&dispatcher->thread_id, NULL, buzz_l_dispatch_thread, dispatcher) != 0)
+    {
+        atomic_store(&dispatcher->running, 0);
+        BUZZ_LOG_ERROR("Failed to start the dispatch thread");
+        return BUZZ_GPS_ERROR;
+    }
+    return BUZZ_GPS_SUCCESS;
+}
+
+
+int buzz_dispatch_stop(buzz_i_dispatcher_t * dispatcher)
+{
+    atomic_store(&dispatcher->running, 0);
+    pthread_mutex_lock(&dispatcher->wait_mutex);
+    {
+        pthread_cond_broadcast(&dispatcher->items_cond);
+        pthread_cond_broadcast(&dispatcher->space_cond);
+    }
+    pthread_mutex_unlock(&dispatcher->wait_mutex);
+
+    pthread_join(dispatcher->thread_id, NULL);
+    return BUZZ_GPS_SUCCESS;
+}
+
+
+void buzz_dispatch_push(buzz_i_dispatcher_t * dispatcher, const buzz_i_dispatch_item_t * item)
+{
+    size_t tail = atomic_load_explicit(&dispatcher->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&dispatcher->head, memory_order_acquire);
+    size_t count;
+
+    if (tail - head >= dispatcher->capacity)
+    {
+        switch (dispatcher->policy)
+        {
+            case BUZZ_GPS_OVERFLOW_DROP_NEWEST:
+                atomic_fetch_add_explicit(&dispatcher->dropped_newest, 1, memory_order_relaxed);
+                return;
+
+            case BUZZ_GPS_OVERFLOW_DROP_OLDEST:
+                /* if this fails the consumer just took the oldest and there is room */
+                if (atomic_compare_exchange_strong(&dispatcher->head, &head, head + 1))
+                {
+                    atomic_fetch_add_explicit(&dispatcher->dropped_oldest, 1, memory_order_relaxed);
+                }
+                break;
+
+            case BUZZ_GPS_OVERFLOW_BLOCK:
+            default:
+                atomic_fetch_add_explicit(&dispatcher->producer_blocked, 1, memory_order_relaxed);
+                pthread_mutex_lock(&dispatcher->wait_mutex);
+                {
+                    atomic_store(&dispatcher->producer_waiting, 1);
+                    while (buzz_l_dispatch_count(dispatcher) >= dispatcher->capacity
+                           && atomic_load(&dispatcher->running))
+                    {
+                        buzz_l_dispatch_wait(dispatcher, &dispatcher->space_cond);
+                    }
+                    atomic_store(&dispatcher->producer_waiting, 0);
+                }
+                pthread_mutex_unlock(&dispatcher->wait_mutex);
+                if (buzz_l_dispatch_count(dispatcher) >= dispatcher->capacity)
+                {
+                    /* stopped while waiting */
+                    atomic_fetch_add_explicit(&dispatcher->dropped_newest, 1, memory_order_relaxed);
+                    return;
+                }
+                break;
+        }
+    }
+
+    memcpy(&dispatcher->slots[tail & (dispatcher->capacity - 1)], item, sizeof(buzz_i_dispatch_item_t));
+    atomic_store_explicit(&dispatcher->tail, tail + 1, memory_order_release);
+
+    atomic_fetch_add_explicit(&dispatcher->queued, 1, memory_order_relaxed);
+    count = buzz_l_dispatch_count(dispatcher);
+    if (count > atomic_load_explicit(&dispatcher->high_water, memory_order_relaxed))
+    {
+        atomic_store_explicit(&dispatcher->high_water, count, memory_order_relaxed);
+    }
+
+    buzz_l_dispatch_wake(dispatcher, &dispatcher->consumer_waiting, &dispatcher->items_cond);
+}
+
+
+void buzz_dispatch_get_stats(buzz_i_dispatcher_t * dispatcher, buzz_gps_stats_t * stats)
+{
+    stats->events_queued = atomic_load_explicit(&dispatcher->queued, memory_order_relaxed);
+    stats->events_dispatched = atomic_load_explicit(&dispatcher->dispatched, memory_order_relaxed);
+    stats->events_dropped_oldest = atomic_load_explicit(&dispatcher->dropped_oldest, memory_order_relaxed);
+    stats->events_dropped_newest = atomic_load_explicit(&dispatcher->dropped_newest, memory_order_relaxed);
+    stats->producer_blocked = atomic_load_explicit(&dispatcher->producer_blocked, memory_order_relaxed);
+    stats->queue_high_water = atomic_load_explicit(&dispatcher->high_water, memory_order_relaxed);
+}
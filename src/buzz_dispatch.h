@@ -0,0 +1,85 @@
+/*
+ * Event dispatcher
+ *
+ * The reading thread pushes parsed sentences into a bounded single
+ * producer / single consumer ring and a dispatcher thread pops them and runs
+ * the user callbacks, so a slow callback never holds up reading the device.
+ */
+#ifndef BUZZ_DISPATCH_H
+#define BUZZ_DISPATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "buzz_gps.h"
+
+typedef struct buzz_i_dispatch_item_s
+{
+    buzz_gps_raw_event_t raw;
+    buzz_gps_fix_t fix;
+    /* fix is only valid when the sentence was parsed */
+    int parsed;
+    /* CLOCK_MONOTONIC time the parser finished with it, 0 if unknown */
+    uint64_t parsed_ns;
+} buzz_i_dispatch_item_t;
+
+typedef void (*buzz_i_dispatch_func_t)(buzz_i_dispatch_item_t * item, void * arg);
+
+/* called on the dispatcher thread whenever the ring runs empty, and at least every 100ms while it is */
+typedef void (*buzz_i_dispatch_idle_func_t)(void * arg);
+
+typedef struct buzz_i_dispatcher_s
+{
+    buzz_i_dispatch_item_t * slots;
+    size_t capacity;
+    buzz_gps_overflow_policy_t policy;
+
+    /* head is advanced by the consumer, and by the producer when dropping the oldest */
+    _Atomic size_t head;
+    _Atomic size_t tail;
+
+    /* only used to sleep when the ring is empty or, with BLOCK, full */
+    pthread_mutex_t wait_mutex;
+    pthread_cond_t items_cond;
+    pthread_cond_t space_cond;
+    atomic_int consumer_waiting;
+    atomic_int producer_waiting;
+
+    atomic_int running;
+    pthread_t thread_id;
+    buzz_i_dispatch_func_t func;
+    buzz_i_dispatch_idle_func_t idle_func;
+    void * func_arg;
+
+    _Atomic uint64_t queued;
+    _Atomic uint64_t dispatched;
+    _Atomic uint64_t dropped_oldest;
+    _Atomic uint64_t dropped_newest;
+    _Atomic uint64_t producer_blocked;
+    _Atomic uint64_t high_water;
+} buzz_i_dispatcher_t;
+
+/* capacity is rounded up to a power of two, idle_func may be NULL */
+int buzz_dispatch_init(
+    buzz_i_dispatcher_t * dispatcher,
+    size_t capacity,
+    buzz_gps_overflow_policy_t policy,
+    buzz_i_dispatch_func_t func,
+    buzz_i_dispatch_idle_func_t idle_func,
+    void * func_arg);
+
+void buzz_dispatch_destroy(buzz_i_dispatcher_t * dispatcher);
+
+int buzz_dispatch_start(buzz_i_dispatcher_t * dispatcher);
+
+/* deliver everything still queued, then join the dispatcher thread */
+int buzz_dispatch_stop(buzz_i_dispatcher_t * dispatcher);
+
+/* copy item into the ring, applying the overflow policy when it is full */
+void buzz_dispatch_push(buzz_i_dispatcher_t * dispatcher, const buzz_i_dispatch_item_t * item);
+
+void buzz_dispatch_get_stats(buzz_i_dispatcher_t * dispatcher, buzz_gps_stats_t * stats);
+
+#endif
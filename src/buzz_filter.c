@@ -0,0 +1,311 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "buzz_filter.h"
+#include "buzz_geodesy.h"
+#include "buzz_stats.h"
+
+#define BUZZ_FILTER_METERS_PER_DEGREE (BUZZ_GEODESY_EARTH_RADIUS * BUZZ_GEODESY_DEG_TO_RAD)
+
+#define BUZZ_FILTER_MPS_PER_KNOT 0.514444
+
+/* position error at an HDOP of 1, and the HDOP assumed when there is none */
+#define BUZZ_FILTER_UERE 3.0
+#define BUZZ_FILTER_DEFAULT_HDOP 1.5
+/* error of the speed and course readings */
+#define BUZZ_FILTER_VELOCITY_SIGMA 0.3
+
+/* spread of the first estimate of velocity and acceleration */
+#define BUZZ_FILTER_INITIAL_VELOCITY_SIGMA 20.0
+#define BUZZ_FILTER_INITIAL_ACCELERATION_SIGMA 3.0
+
+/* white acceleration (jerk for BUZZ_GPS_FILTER_CONSTANT_ACCELERATION) power, per second */
+#define BUZZ_FILTER_DEFAULT_VELOCITY_NOISE 1.0
+#define BUZZ_FILTER_DEFAULT_ACCELERATION_NOISE 0.5
+
+/* readings further apart than this start the filter over */
+#define BUZZ_FILTER_MAX_GAP 10.0
+/* move the origin once the receiver is this far from it, in meters */
+#define BUZZ_FILTER_REANCHOR 10000.0
+
+
+void buzz_filter_reset(buzz_i_filter_t * filter, buzz_gps_filter_model_t model, double process_noise)
+{
+    memset(&filter->state, '\0', sizeof(buzz_i_filter_state_t));
+    filter->model = model;
+    filter->state.order = model == BUZZ_GPS_FILTER_CONSTANT_ACCELERATION ? 3 : 2;
+    if (process_noise <= 0.0)
+    {
+        process_noise = model == BUZZ_GPS_FILTER_CONSTANT_ACCELERATION
+            ? BUZZ_FILTER_DEFAULT_ACCELERATION_NOISE : BUZZ_FILTER_DEFAULT_VELOCITY_NOISE;
+    }
+    filter->state.process_noise = process_noise;
+    filter->epoch_seconds = -1.0;
+    filter->state_seconds = -1.0;
+    filter->position_seconds = -1.0;
+    filter->velocity_seconds = -1.0;
+
+    BUZZ_SEQLOCK_WRITE(filter->snapshot, &filter->state);
+}
+
+
+/* x = F x and P = F P F' + Q over dt seconds, for one axis */
+static void buzz_l_filter_advance(int order, double q, double dt, double x[3], double p[3][3])
+{
+    double f[3][3] = { { 1.0, dt, dt * dt / 2.0 }, { 0.0, 1.0, dt }, { 0.0, 0.0, 1.0 } };
+    double fp[3][3];
+    double next[3] = { 0.0, 0.0, 0.0 };
+    double dt2 = dt * dt;
+    double dt3 = dt2 * dt;
+    int a;
+    int b;
+    int c;
+
+    if (order == 2)
+    {
+        f[0][2] = 0.0;
+    }
+    for (a = 0; a < order; a++)
+    {
+        for (b = 0; b < order; b++)
+        {
+            next[a] += f[a][b] * x[b];
+            fp[a][b] = 0.0;
+            for (c = 0; c < order; c++)
+            {
+                fp[a][b] += f[a][c] * p[c][b];
+            }
+        }
+    }
+    for (a = 0; a < order; a++)
+    {
+        x[a] = next[a];
+        for (b = 0; b < order; b++)
+        {
+            p[a][b] = 0.0;
+            for (c = 0; c < order; c++)
+            {
+                p[a][b] += fp[a][c] * f[b][c];
+            }
+        }
+    }
+
+    /* only forward in time adds uncertainty */
+    if (dt <= 0.0)
+    {
+        return;
+    }
+    if (order == 2)
+    {
+        p[0][0] += q * dt3 / 3.0;
+        p[0][1] += q * dt2 / 2.0;
+        p[1][0] += q * dt2 / 2.0;
+        p[1][1] += q * dt;
+    }
+    else
+    {
+        p[0][0] += q * dt3 * dt2 / 20.0;
+        p[0][1] += q * dt2 * dt2 / 8.0;
+        p[0][2] += q * dt3 / 6.0;
+        p[1][0] += q * dt2 * dt2 / 8.0;
+        p[1][1] += q * dt3 / 3.0;
+        p[1][2] += q * dt2 / 2.0;
+        p[2][0] += q * dt3 / 6.0;
+        p[2][1] += q * dt2 / 2.0;
+        p[2][2] += q * dt;
+    }
+}
+
+
+/* fold in a reading z of state i with variance r, for one axis */
+static void buzz_l_filter_measure(int order, double x[3], double p[3][3], int i, double z, double r)
+{
+    double s = p[i][i] + r;
+    double row[3];
+    double k[3];
+    double y = z - x[i];
+    int a;
+    int b;
+
+    for (a = 0; a < order; a++)
+    {
+        k[a] = p[a][i] / s;
+        row[a] = p[i][a];
+    }
+    for (a = 0; a < order; a++)
+    {
+        x[a] += k[a] * y;
+        for (b = 0; b < order; b++)
+        {
+            p[a][b] -= k[a] * row[b];
+        }
+    }
+}
+
+
+/* must be called locked */
+static void buzz_l_filter_start(buzz_i_filter_t * filter, const buzz_gps_fix_t * fix, uint64_t time_ns, double r)
+{
+    buzz_i_filter_state_t * state = &filter->state;
+    int axis;
+
+    memset(state->x, '\0', sizeof(state->x));
+    memset(state->p, '\0', sizeof(state->p));
+    state->valid = 1;
+    state->time_ns = time_ns;
+    state->origin_latitude = fix->latitude;
+    state->origin_longitude = fix->longitude;
+    state->x_scale = BUZZ_FILTER_METERS_PER_DEGREE * cos(fix->latitude * BUZZ_GEODESY_DEG_TO_RAD);
+    for (axis = 0; axis < 2; axis++)
+    {
+        state->p[axis][0][0] = r;
+        state->p[axis][1][1] = BUZZ_FILTER_INITIAL_VELOCITY_SIGMA * BUZZ_FILTER_INITIAL_VELOCITY_SIGMA;
+        state->p[axis][2][2] = BUZZ_FILTER_INITIAL_ACCELERATION_SIGMA * BUZZ_FILTER_INITIAL_ACCELERATION_SIGMA;
+    }
+}
+
+
+/* must be called locked */
+static void buzz_l_filter_reanchor(buzz_i_filter_state_t * state)
+{
+    double longitude;
+
+    if (fabs(state->x[0][0]) < BUZZ_FILTER_REANCHOR && fabs(state->x[1][0]) < BUZZ_FILTER_REANCHOR)
+    {
+        return;
+    }
+    longitude = state->origin_longitude + state->x[0][0] / state->x_scale;
+    state->origin_longitude = longitude > 180.0 ? longitude - 360.0 : (longitude < -180.0 ? longitude + 360.0 : longitude);
+    state->origin_latitude += state->x[1][0] / BUZZ_FILTER_METERS_PER_DEGREE;
+    state->x_scale = BUZZ_FILTER_METERS_PER_DEGREE * cos(state->origin_latitude * BUZZ_GEODESY_DEG_TO_RAD);
+    state->x[0][0] = 0.0;
+    state->x[1][0] = 0.0;
+}
+
+
+void buzz_filter_update(buzz_i_filter_t * filter, const buzz_gps_fix_t * fix, double hdop)
+{
+    buzz_i_filter_state_t * state = &filter->state;
+    int position = (fix->flags & BUZZ_GPS_FIX_LOCATION) != 0;
+    int velocity = (fix->flags & (BUZZ_GPS_FIX_SPEED | BUZZ_GPS_FIX_COURSE)) == (BUZZ_GPS_FIX_SPEED | BUZZ_GPS_FIX_COURSE);
+    uint64_t time_ns = fix->received_ns != 0 ? fix->received_ns : buzz_stats_now_ns();
+    double r = (hdop > 0.0 ? hdop : BUZZ_FILTER_DEFAULT_HDOP) * BUZZ_FILTER_UERE;
+    double seconds;
+    double dt;
+    double dlon;
+    double speed;
+    double course;
+    int timed;
+    int axis;
+
+    if (fix->flags & BUZZ_GPS_FIX_TIME)
+    {
+        filter->epoch_seconds = fix->utc_seconds;
+    }
+    seconds = filter->epoch_seconds;
+    timed = seconds >= 0.0;
+
+    r *= r;
+    /* the other sentences of an epoch repeat what was already applied */
+    if (timed && seconds == filter->position_seconds)
+    {
+        position = 0;
+    }
+    if (timed && seconds == filter->velocity_seconds)
+    {
+        velocity = 0;
+    }
+    if (!position && !velocity)
+    {
+        return;
+    }
+
+    if (timed && filter->state_seconds >= 0.0)
+    {
+        dt = seconds - filter->state_seconds;
+        dt += dt < -43200.0 ? 86400.0 : 0.0;
+    }
+    else
+    {
+        dt = ((double) time_ns - (double) state->time_ns) / 1e9;
+    }
+    if (!state->valid || dt < 0.0 || dt > BUZZ_FILTER_MAX_GAP)
+    {
+        if (!position)
+        {
+            return;
+        }
+        buzz_l_filter_start(filter, fix, time_ns, r);
+        dt = 0.0;
+    }
+    if (dt != 0.0)
+    {
+        for (axis = 0; axis < 2; axis++)
+        {
+            buzz_l_filter_advance(state->order, state->process_noise, dt, state->x[axis], state->p[axis]);
+        }
+        /* a later sentence of the same epoch is still about the same instant */
+        state->time_ns = time_ns;
+    }
+    if (timed)
+    {
+        filter->state_seconds = seconds;
+    }
+
+    if (position)
+    {
+        dlon = fix->longitude - state->origin_longitude;
+        dlon += dlon > 180.0 ? -360.0 : (dlon < -180.0 ? 360.0 : 0.0);
+        buzz_l_filter_measure(state->order, state->x[0], state->p[0], 0, dlon * state->x_scale, r);
+        buzz_l_filter_measure(state->order, state->x[1], state->p[1], 0,
+            (fix->latitude - state->origin_latitude) * BUZZ_FILTER_METERS_PER_DEGREE, r);
+        filter->position_seconds = seconds;
+    }
+    if (velocity)
+    {
+        speed = fix->speed_knots * BUZZ_FILTER_MPS_PER_KNOT;
+        course = fix->course * BUZZ_GEODESY_DEG_TO_RAD;
+        r = BUZZ_FILTER_VELOCITY_SIGMA * BUZZ_FILTER_VELOCITY_SIGMA;
+        buzz_l_filter_measure(state->order, state->x[0], state->p[0], 1, speed * sin(course), r);
+        buzz_l_filter_measure(state->order, state->x[1], state->p[1], 1, speed * cos(course), r);
+        filter->velocity_seconds = seconds;
+    }
+    buzz_l_filter_reanchor(state);
+
+    BUZZ_SEQLOCK_WRITE(filter->snapshot, state);
+}
+
+
+int buzz_filter_predict(buzz_i_filter_t * filter, uint64_t time_ns, buzz_gps_prediction_t * out_prediction)
+{
+    buzz_i_filter_state_t state;
+    double dt;
+    double longitude;
+    double course;
+    int axis;
+
+    BUZZ_SEQLOCK_READ(filter->snapshot, &state);
+    if (!state.valid)
+    {
+        return BUZZ_GPS_NOT_FOUND;
+    }
+    dt = ((double) time_ns - (double) state.time_ns) / 1e9;
+    for (axis = 0; axis < 2; axis++)
+    {
+        buzz_l_filter_advance(state.order, state.process_noise, dt, state.x[axis], state.p[axis]);
+    }
+
+    longitude = state.origin_longitude + state.x[0][0] / state.x_scale;
+    out_prediction->latitude = state.origin_latitude + state.x[1][0] / BUZZ_FILTER_METERS_PER_DEGREE;
+    out_prediction->longitude = longitude > 180.0 ? longitude - 360.0 : (longitude < -180.0 ? longitude + 360.0 : longitude);
+    out_prediction->east_mps = state.x[0][1];
+    out_prediction->north_mps = state.x[1][1];
+    out_prediction->speed_knots = hypot(state.x[0][1], state.x[1][1]) / BUZZ_FILTER_MPS_PER_KNOT;
+    course = atan2(state.x[0][1], state.x[1][1]) / BUZZ_GEODESY_DEG_TO_RAD;
+    out_prediction->course = course < 0.0 ? course + 360.0 : course;
+    out_prediction->sigma_meters = sqrt(state.p[0][0][0] + state.p[1][0][0]);
+    out_prediction->age_ns = (int64_t) (time_ns - state.time_ns);
+
+    return BUZZ_GPS_SUCCESS;
+}
@@ -0,0 +1,76 @@
+/*
+ * Position filter
+ *
+ * A Kalman filter over the position in meters east and north of an origin
+ * near the receiver, with a constant velocity or constant acceleration
+ * model. The two axes are filtered apart, so the matrices are at most 3x3
+ * and every position or velocity reading is a scalar update: nothing to
+ * invert, nothing to allocate and the same cost for every fix.
+ *
+ * Updates are timed by the receiver's time of day when the sentences carry
+ * one, which is steadier than when the bytes happened to arrive, and the
+ * position and velocity of an epoch are only applied once however many of
+ * its sentences repeat them. The state is published through a seqlock so
+ * buzz_gps_predict() never waits on the parser.
+ */
+#ifndef BUZZ_FILTER_H
+#define BUZZ_FILTER_H
+
+#include <stdint.h>
+
+#include "buzz_gps.h"
+#include "buzz_seqlock.h"
+
+typedef struct buzz_i_filter_state_s
+{
+    int valid;
+    /* states per axis, 2 for constant velocity and 3 for constant acceleration */
+    int order;
+    double process_noise;
+    /* CLOCK_MONOTONIC time the state is for */
+    uint64_t time_ns;
+
+    double origin_latitude;
+    double origin_longitude;
+    /* meters per degree of longitude at the origin */
+    double x_scale;
+
+    /* east then north: position, velocity and acceleration, and their covariance */
+    double x[2][3];
+    double p[2][3][3];
+} buzz_i_filter_state_t;
+
+typedef struct buzz_i_filter_s
+{
+    buzz_gps_filter_model_t model;
+    /* written with the handle mutex held */
+    buzz_i_filter_state_t state;
+
+    /*
+     * receiver time of day of the epoch in progress, of the state and of the
+     * last readings, -1 for none. Sentences without a time belong to the
+     * epoch in progress, as they do for fusion.
+     */
+    double epoch_seconds;
+    double state_seconds;
+    double position_seconds;
+    double velocity_seconds;
+
+    BUZZ_SEQLOCK_DECLARE(buzz_i_filter_state_t, snapshot);
+} buzz_i_filter_t;
+
+/* start over with a model, BUZZ_GPS_FILTER_NONE turns the filter off */
+void buzz_filter_reset(buzz_i_filter_t * filter, buzz_gps_filter_model_t model, double process_noise);
+
+/*
+ * Apply the position and velocity of a parsed sentence. hdop scales the
+ * position error, 0 when unknown.
+ *
+ * must be called locked
+ */
+void buzz_filter_update(buzz_i_filter_t * filter, const buzz_gps_fix_t * fix, double hdop);
+
+/* extrapolate the published state to time_ns, from any thread */
+int buzz_filter_predict(buzz_i_filter_t * filter, uint64_t time_ns, buzz_gps_prediction_t * out_prediction);
+
+#endif
@@ -0,0 +1,233 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "buzz_framer.h"
+#include "buzz_logging.h"
+
+#define BUZZ_FRAMER_MASK (BUZZ_FRAMER_RING_SIZE - 1)
+
+#if (BUZZ_FRAMER_RING_SIZE & BUZZ_FRAMER_MASK) != 0
+#error "BUZZ_FRAMER_RING_SIZE must be a power of two"
+#endif
+
+#define BUZZ_FRAMER_MARK_MASK (BUZZ_FRAMER_MARKS - 1)
+
+#if (BUZZ_FRAMER_MARKS & BUZZ_FRAMER_MARK_MASK) != 0
+#error "BUZZ_FRAMER_MARKS must be a power of two"
+#endif
+
+
+/*
+ * Find the first c at or after offset `from` (relative to head) and before
+ * `limit`. The search is split in two when the pending bytes wrap.
+ */
+static ssize_t buzz_l_framer_find(const buzz_i_framer_t * framer, size_t from, size_t limit, char c)
+{
+    size_t start = (framer->head + from) & BUZZ_FRAMER_MASK;
+    size_t len = limit - from;
+    size_t first = BUZZ_FRAMER_RING_SIZE - start;
+    const char * p;
+
+    if (first > len)
+    {
+        first = len;
+    }
+    p = memchr(&framer->ring[start], c, first);
+    if (p != NULL)
+    {
+        return from + (p - &framer->ring[start]);
+    }
+    p = memchr(framer->ring, c, len - first);
+    if (p != NULL)
+    {
+        return from + first + (p - framer->ring);
+    }
+    return -1;
+}
+
+
+static void buzz_l_framer_copy_out(const buzz_i_framer_t * framer, char * out, size_t len)
+{
+    size_t start = framer->head & BUZZ_FRAMER_MASK;
+    size_t first = BUZZ_FRAMER_RING_SIZE - start;
+
+    if (first > len)
+    {
+        first = len;
+    }
+    memcpy(out, &framer->ring[start], first);
+    memcpy(&out[first], framer->ring, len - first);
+}
+
+
+/*
+ * Remember when the bytes up to the current tail arrived
+ */
+static void buzz_l_framer_mark(buzz_i_framer_t * framer, size_t n)
+{
+    buzz_i_framer_mark_t * mark;
+
+    BUZZ_STAT_ADD(framer->bytes_read, n);
+    if (framer->mark_tail - framer->mark_head == BUZZ_FRAMER_MARKS)
+    {
+        framer->marks[(framer->mark_tail - 1) & BUZZ_FRAMER_MARK_MASK].end = framer->tail;
+        return;
+    }
+    mark = &framer->marks[framer->mark_tail++ & BUZZ_FRAMER_MARK_MASK];
+    mark->end = framer->tail;
+    mark->ns = buzz_stats_now_ns();
+}
+
+
+static void buzz_l_framer_consume(buzz_i_framer_t * framer, size_t len)
+{
+    framer->head += len;
+    framer->scanned = 0;
+    /* forget fills that have been consumed completely */
+    while (framer->mark_head != framer->mark_tail
+           && framer->marks[framer->mark_head & BUZZ_FRAMER_MARK_MASK].end <= framer->head)
+    {
+        framer->mark_head++;
+    }
+}
+
+
+void buzz_framer_init(buzz_i_framer_t * framer)
+{
+    framer->head = 0;
+    framer->tail = 0;
+    framer->scanned = 0;
+    framer->mark_head = 0;
+    framer->mark_tail = 0;
+    framer->sentence_ns = 0;
+}
+
+
+size_t buzz_framer_pending(const buzz_i_framer_t * framer)
+{
+    return framer->tail - framer->head;
+}
+
+
+ssize_t buzz_framer_fill(buzz_i_framer_t * framer, int fd)
+{
+    struct iovec iov[2];
+    size_t free_space = BUZZ_FRAMER_RING_SIZE - buzz_framer_pending(framer);
+    size_t start = framer->tail & BUZZ_FRAMER_MASK;
+    size_t first = BUZZ_FRAMER_RING_SIZE - start;
+    int iov_count = 1;
+    ssize_t n;
+
+    if (free_space == 0)
+    {
+        /* buzz_framer_next always drains a full ring so this cannot stick */
+        errno = ENOBUFS;
+        return -1;
+    }
+    if (first > free_space)
+    {
+        first = free_space;
+    }
+    iov[0].iov_base = &framer->ring[start];
+    iov[0].iov_len = first;
+    if (free_space > first)
+    {
+        iov[1].iov_base = framer->ring;
+        iov[1].iov_len = free_space - first;
+        iov_count = 2;
+    }
+
+    do
+    {
+        n = readv(fd, iov, iov_count);
+    } while (n < 0 && errno == EINTR);
+
+    if (n > 0)
+    {
+        framer->tail += n;
+        buzz_l_framer_mark(framer, n);
+    }
+    return n;
+}
+
+
+size_t buzz_framer_fill_from_memory(buzz_i_framer_t * framer, const char * data, size_t len)
+{
+    size_t free_space = BUZZ_FRAMER_RING_SIZE - buzz_framer_pending(framer);
+    size_t start = framer->tail & BUZZ_FRAMER_MASK;
+    size_t first = BUZZ_FRAMER_RING_SIZE - start;
+
+    if (len > free_space)
+    {
+        len = free_space;
+    }
+    if (first > len)
+    {
+        first = len;
+    }
+    memcpy(&framer->ring[start], data, first);
+    memcpy(framer->ring, &data[first], len - first);
+    framer->tail += len;
+    if (len > 0)
+    {
+        buzz_l_framer_mark(framer, len);
+    }
+
+    return len;
+}
+
+
+size_t buzz_framer_next(buzz_i_framer_t * framer, char * out, size_t out_len)
+{
+    size_t pending;
+    size_t limit;
+    ssize_t ndx;
+
+    while ((pending = buzz_framer_pending(framer)) > 0)
+    {
+        /* resync on the start of a sentence */
+        if (framer->ring[framer->head & BUZZ_FRAMER_MASK] != '$')
+        {
+            ndx = buzz_l_framer_find(framer, 0, pending, '$');
+            if (ndx < 0)
+            {
+                ndx = pending;
+            }
+            BUZZ_STAT_ADD(framer->resync_bytes, ndx);
+            buzz_l_framer_consume(framer, ndx);
+            continue;
+        }
+
+        /* the whole sentence plus the NUL must fit in out */
+        limit = pending;
+        if (limit > out_len - 1)
+        {
+            limit = out_len - 1;
+        }
+        ndx = buzz_l_framer_find(framer, framer->scanned, limit, '\n');
+        if (ndx >= 0)
+        {
+            buzz_l_framer_copy_out(framer, out, ndx + 1);
+            out[ndx + 1] = '\0';
+            /* marks ending at or before head were dropped, so the first one holds the '$' */
+            framer->sentence_ns = framer->marks[framer->mark_head & BUZZ_FRAMER_MARK_MASK].ns;
+            BUZZ_STAT_ADD(framer->sentences, 1);
+            buzz_l_framer_consume(framer, ndx + 1);
+            return ndx + 1;
+        }
+        if (limit == out_len - 1)
+        {
+            BUZZ_LOG_WARN("exceeded the max size of %d", (int) out_len);
+            BUZZ_STAT_ADD(framer->overlong_lines, 1);
+            /* drop the '$' and look for the next sentence */
+            buzz_l_framer_consume(framer, 1);
+            continue;
+        }
+        framer->scanned = limit;
+        return 0;
+    }
+    return 0;
+}
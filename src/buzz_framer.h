@@ -0,0 +1,88 @@
+/*
+ * Sentence framer
+ *
+ * Bytes from the GPS device are read in bulk into a per-handle ring buffer
+ * and complete "$...\n" sentences are carved out of it. Partial sentences
+ * stay in the ring until the rest of their bytes arrive.
+ */
+#ifndef BUZZ_FRAMER_H
+#define BUZZ_FRAMER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "buzz_stats.h"
+
+/* must be a power of two */
+#define BUZZ_FRAMER_RING_SIZE 4096
+/* must be a power of two */
+#define BUZZ_FRAMER_MARKS 16
+
+/* the ring position where one fill ended and when it happened */
+typedef struct buzz_i_framer_mark_s
+{
+    size_t end;
+    uint64_t ns;
+} buzz_i_framer_mark_t;
+
+typedef struct buzz_i_framer_s
+{
+    char ring[BUZZ_FRAMER_RING_SIZE];
+    /* free running counters, masked when indexing the ring */
+    size_t head;
+    size_t tail;
+    /* bytes after head already known not to contain a '\n' */
+    size_t scanned;
+
+    /*
+     * Fills still holding pending bytes, oldest first. When they run out
+     * the newest is stretched, so a sentence is never dated later than
+     * its first byte arrived.
+     */
+    buzz_i_framer_mark_t marks[BUZZ_FRAMER_MARKS];
+    unsigned int mark_head;
+    unsigned int mark_tail;
+    /* when the first byte of the sentence last returned was read */
+    uint64_t sentence_ns;
+
+    _Atomic uint64_t bytes_read;
+    _Atomic uint64_t sentences;
+    _Atomic uint64_t overlong_lines;
+    _Atomic uint64_t resync_bytes;
+} buzz_i_framer_t;
+
+void buzz_framer_init(buzz_i_framer_t * framer);
+
+/* number of bytes waiting in the ring */
+size_t buzz_framer_pending(const buzz_i_framer_t * framer);
+
+/*
+ * Read as much as is available from fd into the free space of the ring
+ * with a single syscall.
+ *
+ *  Returns the number of bytes read, 0 on end of file or -1 on error
+ *  (errno is left as set by the read).
+ */
+ssize_t buzz_framer_fill(buzz_i_framer_t * framer, int fd);
+
+/*
+ * Same as buzz_framer_fill() but copies from memory, for replaying a
+ * recorded log.
+ *
+ *  Returns the number of bytes copied, which is less than len when the
+ *  ring fills up.
+ */
+size_t buzz_framer_fill_from_memory(buzz_i_framer_t * framer, const char * data, size_t len);
+
+/*
+ * Copy the next complete sentence, from '$' through '\n', into out and
+ * NUL terminate it. Bytes before a '$' are skipped and sentences that
+ * would not fit in out_len are dropped.
+ *
+ *  Returns the sentence length or 0 if no complete sentence is buffered.
+ *  framer->sentence_ns is set to the time its first byte was read.
+ */
+size_t buzz_framer_next(buzz_i_framer_t * framer, char * out, size_t out_len);
+
+#endif
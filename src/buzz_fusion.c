@@ -0,0 +1,118 @@
+#include <string.h>
+#include <math.h>
+
+#include "buzz_fusion.h"
+#include "buzz_stats.h"
+
+/* times in different sentences of one epoch may differ in their decimals */
+#define BUZZ_FUSION_TIME_EPSILON 0.0005
+
+
+void buzz_fusion_merge(buzz_gps_fix_t * into, const buzz_gps_fix_t * fix)
+{
+    if (fix->flags & BUZZ_GPS_FIX_TIMESTAMP)
+    {
+        into->time = fix->time;
+        into->utc_ns = fix->utc_ns;
+    }
+    if (fix->flags & BUZZ_GPS_FIX_LOCATION)
+    {
+        into->latitude = fix->latitude;
+        into->longitude = fix->longitude;
+    }
+    if (fix->flags & BUZZ_GPS_FIX_SPEED)
+    {
+        into->speed_knots = fix->speed_knots;
+    }
+    if (fix->flags & BUZZ_GPS_FIX_COURSE)
+    {
+        into->course = fix->course;
+    }
+    if (fix->flags & BUZZ_GPS_FIX_ALTITUDE)
+    {
+        into->altitude_meters = fix->altitude_meters;
+    }
+    if (fix->flags & BUZZ_GPS_FIX_TIME)
+    {
+        into->utc_seconds = fix->utc_seconds;
+    }
+    if (fix->flags & BUZZ_GPS_FIX_DATE)
+    {
+        into->year = fix->year;
+        into->month = fix->month;
+        into->day = fix->day;
+    }
+    if (fix->flags & BUZZ_GPS_FIX_QUALITY)
+    {
+        into->quality = fix->quality;
+    }
+    if (fix->flags & BUZZ_GPS_FIX_MODE)
+    {
+        into->mode = fix->mode;
+    }
+    if (fix->flags & BUZZ_GPS_FIX_SATELLITES)
+    {
+        into->satellites_used = fix->satellites_used;
+    }
+    if (fix->flags & BUZZ_GPS_FIX_IN_VIEW)
+    {
+        into->satellites_in_view = fix->satellites_in_view;
+    }
+    if (fix->flags & BUZZ_GPS_FIX_HDOP)
+    {
+        into->hdop = fix->hdop;
+    }
+    if (fix->flags & BUZZ_GPS_FIX_PDOP)
+    {
+        into->pdop = fix->pdop;
+    }
+    if (fix->flags & BUZZ_GPS_FIX_VDOP)
+    {
+        into->vdop = fix->vdop;
+    }
+    into->flags |= fix->flags;
+}
+
+
+void buzz_fusion_flush(buzz_i_fusion_t * fusion)
+{
+    if (!fusion->open)
+    {
+        return;
+    }
+    fusion->open = 0;
+    BUZZ_STAT_ADD(fusion->epochs, 1);
+    fusion->cb(&fusion->epoch, fusion->user_arg);
+}
+
+
+void buzz_fusion_tick(buzz_i_fusion_t * fusion, uint64_t now_ns)
+{
+    if (fusion->open && now_ns - fusion->opened_ns >= fusion->timeout_ns)
+    {
+        buzz_fusion_flush(fusion);
+    }
+}
+
+
+void buzz_fusion_add(buzz_i_fusion_t * fusion, const buzz_gps_fix_t * fix, uint64_t now_ns)
+{
+    buzz_fusion_tick(fusion, now_ns);
+
+    if (fusion->open && (fix->flags & BUZZ_GPS_FIX_TIME) && (fusion->epoch.flags & BUZZ_GPS_FIX_TIME)
+        && fabs(fix->utc_seconds - fusion->epoch.utc_seconds) > BUZZ_FUSION_TIME_EPSILON)
+    {
+        buzz_fusion_flush(fusion);
+    }
+    if (!fusion->open)
+    {
+        memset(&fusion->epoch, '\0', sizeof(buzz_gps_fix_t));
+        fusion->epoch.type = fix->type;
+        fusion->epoch.talker = fix->talker;
+        fusion->epoch.received_ns = fix->received_ns;
+        fusion->opened_ns = now_ns;
+        fusion->open = 1;
+    }
+    buzz_fusion_merge(&fusion->epoch, fix);
+    fusion->epoch.sentences |= 1u << fix->type;
+}
@@ -0,0 +1,53 @@
+/*
+ * Epoch fusion
+ *
+ * A receiver sends several sentences for every fix, RMC, GGA, GSA and so
+ * on, each carrying part of the solution. Fusion merges the sentences
+ * that share a UTC time into one buzz_gps_fix_t and hands it to a single
+ * callback once the epoch is over.
+ *
+ * The state is only touched by the thread running the handle's callbacks.
+ */
+#ifndef BUZZ_FUSION_H
+#define BUZZ_FUSION_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "buzz_gps.h"
+
+typedef struct buzz_i_fusion_s
+{
+    /* NULL when fusion is off */
+    buzz_gps_fix_callback_t cb;
+    void * user_arg;
+    uint64_t timeout_ns;
+
+    /* the epoch being gathered */
+    int open;
+    uint64_t opened_ns;
+    buzz_gps_fix_t epoch;
+
+    _Atomic uint64_t epochs;
+} buzz_i_fusion_t;
+
+/*
+ * Copy the parts of fix named in its flags over into, and add them to
+ * into's flags
+ */
+void buzz_fusion_merge(buzz_gps_fix_t * into, const buzz_gps_fix_t * fix);
+
+/*
+ * Add a parsed fix received at now_ns (CLOCK_MONOTONIC). A fix with a
+ * different UTC time first closes the open epoch. Fixes without a time
+ * join the open epoch.
+ */
+void buzz_fusion_add(buzz_i_fusion_t * fusion, const buzz_gps_fix_t * fix, uint64_t now_ns);
+
+/* close the open epoch if it has been open longer than the timeout */
+void buzz_fusion_tick(buzz_i_fusion_t * fusion, uint64_t now_ns);
+
+/* close the open epoch, if any */
+void buzz_fusion_flush(buzz_i_fusion_t * fusion);
+
+#endif
@@ -0,0 +1,432 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <math.h>
+
+#include "buzz_geodesy.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BUZZ_GEODESY_X86 1
+#endif
+
+/* x + 1.5 * 2^52 - 1.5 * 2^52 rounds x to an integer */
+#define BUZZ_GEODESY_ROUND_MAGIC 6755399441055744.0
+
+/* pi / 2 in two parts, the first with enough trailing zeros to multiply exactly */
+#define BUZZ_GEODESY_PIO2_HI 1.57079632673412561417e+00
+#define BUZZ_GEODESY_PIO2_LO 6.07710050650619224932e-11
+/* what M_PI_2 is short of pi / 2 */
+#define BUZZ_GEODESY_PIO2_ERROR 6.123233995736765886130e-17
+
+/* Cephes sin and cos over [-pi / 4, pi / 4] */
+#define BUZZ_GEODESY_SIN0 1.58962301576546568060e-10
+#define BUZZ_GEODESY_SIN1 -2.50507477628578072866e-8
+#define BUZZ_GEODESY_SIN2 2.75573136213857245213e-6
+#define BUZZ_GEODESY_SIN3 -1.98412698295895385996e-4
+#define BUZZ_GEODESY_SIN4 8.33333333332211858878e-3
+#define BUZZ_GEODESY_SIN5 -1.66666666666666307295e-1
+
+#define BUZZ_GEODESY_COS0 -1.13585365213876817300e-11
+#define BUZZ_GEODESY_COS1 2.08757008419747316778e-9
+#define BUZZ_GEODESY_COS2 -2.75573141792967388112e-7
+#define BUZZ_GEODESY_COS3 2.48015872888517045348e-5
+#define BUZZ_GEODESY_COS4 -1.38888888888730564116e-3
+#define BUZZ_GEODESY_COS5 4.16666666666665929218e-2
+
+/* Cephes atan over [-0.66, 0.66], the leading 1 of Q left out */
+#define BUZZ_GEODESY_ATAN_P0 -8.750608600031904122785e-1
+#define BUZZ_GEODESY_ATAN_P1 -1.615753718733365076637e1
+#define BUZZ_GEODESY_ATAN_P2 -7.500855792314704667340e1
+#define BUZZ_GEODESY_ATAN_P3 -1.228866684490136173410e2
+#define BUZZ_GEODESY_ATAN_P4 -6.485021904942025371773e1
+#define BUZZ_GEODESY_ATAN_Q0 2.485846490142306297962e1
+#define BUZZ_GEODESY_ATAN_Q1 1.650270098316988542046e2
+#define BUZZ_GEODESY_ATAN_Q2 4.328810604912902668951e2
+#define BUZZ_GEODESY_ATAN_Q3 4.853903996359136964868e2
+#define BUZZ_GEODESY_ATAN_Q4 1.945506571482613964425e2
+
+
+/*
+ * The scalar kernels, straight from the C library. They are the reference
+ * the vector kernels are tested against.
+ */
+double buzz_geodesy_haversine(double lat1, double lon1, double lat2, double lon2)
+{
+    double sin_dlat = sin((lat2 - lat1) * BUZZ_GEODESY_DEG_TO_RAD / 2.0);
+    double sin_dlon = sin((lon2 - lon1) * BUZZ_GEODESY_DEG_TO_RAD / 2.0);
+    double a = sin_dlat * sin_dlat
+        + cos(lat1 * BUZZ_GEODESY_DEG_TO_RAD) * cos(lat2 * BUZZ_GEODESY_DEG_TO_RAD) * sin_dlon * sin_dlon;
+
+    a = a < 1.0 ? a : 1.0;
+    return 2.0 * BUZZ_GEODESY_EARTH_RADIUS * atan2(sqrt(a), sqrt(1.0 - a));
+}
+
+
+static void buzz_l_haversine_scalar(
+    const double * lat1,
+    const double * lon1,
+    const double * lat2,
+    const double * lon2,
+    double * out,
+    size_t count)
+{
+    size_t i;
+
+    for (i = 0; i < count; i++)
+    {
+        out[i] = buzz_geodesy_haversine(lat1[i], lon1[i], lat2[i], lon2[i]);
+    }
+}
+
+
+static void buzz_l_equirectangular_scalar(
+    const double * lat1,
+    const double * lon1,
+    const double * lat2,
+    const double * lon2,
+    double * out,
+    size_t count)
+{
+    double dlon;
+    double x;
+    double y;
+    size_t i;
+
+    for (i = 0; i < count; i++)
+    {
+        dlon = lon2[i] - lon1[i];
+        if (dlon > 180.0)
+        {
+            dlon -= 360.0;
+        }
+        else if (dlon < -180.0)
+        {
+            dlon += 360.0;
+        }
+        x = dlon * BUZZ_GEODESY_DEG_TO_RAD * cos((lat1[i] + lat2[i]) * BUZZ_GEODESY_DEG_TO_RAD / 2.0);
+        y = (lat2[i] - lat1[i]) * BUZZ_GEODESY_DEG_TO_RAD;
+        out[i] = BUZZ_GEODESY_EARTH_RADIUS * sqrt(x * x + y * y);
+    }
+}
+
+
+static void buzz_l_bearing_scalar(
+    const double * lat1,
+    const double * lon1,
+    const double * lat2,
+    const double * lon2,
+    double * out,
+    size_t count)
+{
+    double phi1;
+    double phi2;
+    double dlon;
+    double b;
+    size_t i;
+
+    for (i = 0; i < count; i++)
+    {
+        phi1 = lat1[i] * BUZZ_GEODESY_DEG_TO_RAD;
+        phi2 = lat2[i] * BUZZ_GEODESY_DEG_TO_RAD;
+        dlon = (lon2[i] - lon1[i]) * BUZZ_GEODESY_DEG_TO_RAD;
+        b = atan2(sin(dlon) * cos(phi2), cos(phi1) * sin(phi2) - sin(phi1) * cos(phi2) * cos(dlon))
+            / BUZZ_GEODESY_DEG_TO_RAD;
+        out[i] = b < 0.0 ? b + 360.0 : b;
+    }
+}
+
+
+static void buzz_l_destination_scalar(
+    const double * lat,
+    const double * lon,
+    const double * bearing,
+    const double * meters,
+    double * out_lat,
+    double * out_lon,
+    size_t count)
+{
+    double phi;
+    double angle;
+    double theta;
+    double s;
+    double lon2;
+    size_t i;
+
+    for (i = 0; i < count; i++)
+    {
+        phi = lat[i] * BUZZ_GEODESY_DEG_TO_RAD;
+        angle = meters[i] / BUZZ_GEODESY_EARTH_RADIUS;
+        theta = bearing[i] * BUZZ_GEODESY_DEG_TO_RAD;
+        s = sin(phi) * cos(angle) + cos(phi) * sin(angle) * cos(theta);
+        s = s > 1.0 ? 1.0 : (s < -1.0 ? -1.0 : s);
+        out_lat[i] = asin(s) / BUZZ_GEODESY_DEG_TO_RAD;
+        lon2 = lon[i] + atan2(sin(theta) * sin(angle) * cos(phi), cos(angle) - sin(phi) * s)
+            / BUZZ_GEODESY_DEG_TO_RAD;
+        if (lon2 > 180.0)
+        {
+            lon2 -= 360.0;
+        }
+        else if (lon2 < -180.0)
+        {
+            lon2 += 360.0;
+        }
+        out_lon[i] = lon2;
+    }
+}
+
+
+static const buzz_i_geodesy_kernels_t buzz_l_geodesy_kernels_scalar =
+{
+    BUZZ_GPS_GEODESY_SCALAR,
+    buzz_l_haversine_scalar,
+    buzz_l_equirectangular_scalar,
+    buzz_l_bearing_scalar,
+    buzz_l_destination_scalar
+};
+
+
+#ifdef BUZZ_GEODESY_X86
+
+#define BUZZ_GEODESY_SUFFIX _sse2
+#define BUZZ_GEODESY_TARGET __attribute__((target("sse2")))
+#define BUZZ_GEODESY_KERNEL BUZZ_GPS_GEODESY_SSE2
+#define VD __m128d
+#define VW 2
+#define V_LOAD(p) _mm_loadu_pd(p)
+#define V_STORE(p, a) _mm_storeu_pd(p, a)
+#define V_SET1(x) _mm_set1_pd(x)
+#define V_ADD(a, b) _mm_add_pd(a, b)
+#define V_SUB(a, b) _mm_sub_pd(a, b)
+#define V_MUL(a, b) _mm_mul_pd(a, b)
+#define V_DIV(a, b) _mm_div_pd(a, b)
+#define V_FMA(a, b, c) _mm_add_pd(_mm_mul_pd(a, b), c)
+#define V_SQRT(a) _mm_sqrt_pd(a)
+#define V_MIN(a, b) _mm_min_pd(a, b)
+#define V_MAX(a, b) _mm_max_pd(a, b)
+#define V_AND(a, b) _mm_and_pd(a, b)
+#define V_ANDNOT(a, b) _mm_andnot_pd(a, b)
+#define V_OR(a, b) _mm_or_pd(a, b)
+#define V_XOR(a, b) _mm_xor_pd(a, b)
+#define V_EQ(a, b) _mm_cmpeq_pd(a, b)
+#define V_LT(a, b) _mm_cmplt_pd(a, b)
+#define V_GT(a, b) _mm_cmpgt_pd(a, b)
+#define V_BLEND(mask, a, b) _mm_or_pd(_mm_and_pd(mask, b), _mm_andnot_pd(mask, a))
+#define V_BIT1_SIGN(a) _mm_and_pd(_mm_castsi128_pd(_mm_slli_epi64(_mm_castpd_si128(a), 62)), _mm_set1_pd(-0.0))
+
+#include "buzz_geodesy_simd.h"
+
+#undef BUZZ_GEODESY_SUFFIX
+#undef BUZZ_GEODESY_TARGET
+#undef BUZZ_GEODESY_KERNEL
+#undef VD
+#undef VW
+#undef V_LOAD
+#undef V_STORE
+#undef V_SET1
+#undef V_ADD
+#undef V_SUB
+#undef V_MUL
+#undef V_DIV
+#undef V_FMA
+#undef V_SQRT
+#undef V_MIN
+#undef V_MAX
+#undef V_AND
+#undef V_ANDNOT
+#undef V_OR
+#undef V_XOR
+#undef V_EQ
+#undef V_LT
+#undef V_GT
+#undef V_BLEND
+#undef V_BIT1_SIGN
+
+#define BUZZ_GEODESY_SUFFIX _avx2
+#define BUZZ_GEODESY_TARGET __attribute__((target("avx2,fma")))
+#define BUZZ_GEODESY_KERNEL BUZZ_GPS_GEODESY_AVX2
+#define VD __m256d
+#define VW 4
+#define V_LOAD(p) _mm256_loadu_pd(p)
+#define V_STORE(p, a) _mm256_storeu_pd(p, a)
+#define V_SET1(x) _mm256_set1_pd(x)
+#define V_ADD(a, b) _mm256_add_pd(a, b)
+#define V_SUB(a, b) _mm256_sub_pd(a, b)
+#define V_MUL(a, b) _mm256_mul_pd(a, b)
+#define V_DIV(a, b) _mm256_div_pd(a, b)
+#define V_FMA(a, b, c) _mm256_fmadd_pd(a, b, c)
+#define V_SQRT(a) _mm256_sqrt_pd(a)
+#define V_MIN(a, b) _mm256_min_pd(a, b)
+#define V_MAX(a, b) _mm256_max_pd(a, b)
+#define V_AND(a, b) _mm256_and_pd(a, b)
+#define V_ANDNOT(a, b) _mm256_andnot_pd(a, b)
+#define V_OR(a, b) _mm256_or_pd(a, b)
+#define V_XOR(a, b) _mm256_xor_pd(a, b)
+#define V_EQ(a, b) _mm256_cmp_pd(a, b, _CMP_EQ_OQ)
+#define V_LT(a, b) _mm256_cmp_pd(a, b, _CMP_LT_OQ)
+#define V_GT(a, b) _mm256_cmp_pd(a, b, _CMP_GT_OQ)
+#define V_BLEND(mask, a, b) _mm256_blendv_pd(a, b, mask)
+#define V_BIT1_SIGN(a) _mm256_and_pd( \
+    _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_castpd_si256(a), 62)), _mm256_set1_pd(-0.0))
+
+#include "buzz_geodesy_simd.h"
+
+#endif
+
+
+/* the kernels in use, picked on first use */
+static const buzz_i_geodesy_kernels_t * _Atomic buzz_l_geodesy_kernels = NULL;
+
+
+static const buzz_i_geodesy_kernels_t * buzz_l_geodesy_find(buzz_gps_geodesy_kernel_t kernel)
+{
+#ifdef BUZZ_GEODESY_X86
+    __builtin_cpu_init();
+    if ((kernel == BUZZ_GPS_GEODESY_AUTO || kernel == BUZZ_GPS_GEODESY_AVX2)
+        && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    {
+        return &buzz_l_geodesy_kernels_avx2;
+    }
+    if ((kernel == BUZZ_GPS_GEODESY_AUTO || kernel == BUZZ_GPS_GEODESY_SSE2) && __builtin_cpu_supports("sse2"))
+    {
+        return &buzz_l_geodesy_kernels_sse2;
+    }
+#endif
+    if (kernel == BUZZ_GPS_GEODESY_AUTO || kernel == BUZZ_GPS_GEODESY_SCALAR)
+    {
+        return &buzz_l_geodesy_kernels_scalar;
+    }
+    return NULL;
+}
+
+
+static const buzz_i_geodesy_kernels_t * buzz_l_geodesy_get(void)
+{
+    const buzz_i_geodesy_kernels_t * kernels = atomic_load_explicit(&buzz_l_geodesy_kernels, memory_order_acquire);
+
+    if (kernels == NULL)
+    {
+        kernels = buzz_l_geodesy_find(BUZZ_GPS_GEODESY_AUTO);
+        atomic_store_explicit(&buzz_l_geodesy_kernels, kernels, memory_order_release);
+    }
+    return kernels;
+}
+
+
+int buzz_gps_geodesy_set_kernel(buzz_gps_geodesy_kernel_t kernel)
+{
+    const buzz_i_geodesy_kernels_t * kernels = buzz_l_geodesy_find(kernel);
+
+    if (kernels == NULL)
+    {
+        return BUZZ_GPS_NOT_FOUND;
+    }
+    atomic_store_explicit(&buzz_l_geodesy_kernels, kernels, memory_order_release);
+    return BUZZ_GPS_SUCCESS;
+}
+
+
+buzz_gps_geodesy_kernel_t buzz_gps_geodesy_get_kernel(void)
+{
+    return buzz_l_geodesy_get()->kernel;
+}
+
+
+int buzz_gps_haversine_batch(
+    const double * lat1,
+    const double * lon1,
+    const double * lat2,
+    const double * lon2,
+    double * out_meters,
+    size_t count)
+{
+    buzz_l_geodesy_get()->haversine(lat1, lon1, lat2, lon2, out_meters, count);
+    return BUZZ_GPS_SUCCESS;
+}
+
+
+int buzz_gps_equirectangular_batch(
+    const double * lat1,
+    const double * lon1,
+    const double * lat2,
+    const double * lon2,
+    double * out_meters,
+    size_t count)
+{
+    buzz_l_geodesy_get()->equirectangular(lat1, lon1, lat2, lon2, out_meters, count);
+    return BUZZ_GPS_SUCCESS;
+}
+
+
+int buzz_gps_bearing_batch(
+    const double * lat1,
+    const double * lon1,
+    const double * lat2,
+    const double * lon2,
+    double * out_degrees,
+    size_t count)
+{
+    buzz_l_geodesy_get()->bearing(lat1, lon1, lat2, lon2, out_degrees, count);
+    return BUZZ_GPS_SUCCESS;
+}
+
+
+int buzz_gps_destination_batch(
+    const double * lat,
+    const double * lon,
+    const double * bearing_degrees,
+    const double * meters,
+    double * out_lat,
+    double * out_lon,
+    size_t count)
+{
+    buzz_l_geodesy_get()->destination(lat, lon, bearing_degrees, meters, out_lat, out_lon, count);
+    return BUZZ_GPS_SUCCESS;
+}
+
+
+int buzz_gps_cumulative_distance(
+    const double * lat,
+    const double * lon,
+    double * out_meters,
+    size_t count)
+{
+    size_t i;
+
+    if (count == 0)
+    {
+        return BUZZ_GPS_SUCCESS;
+    }
+    /* the legs between consecutive points first, then their running sum */
+    out_meters[0] = 0.0;
+    buzz_l_geodesy_get()->haversine(lat, lon, &lat[1], &lon[1], &out_meters[1], count - 1);
+    for (i = 1; i < count; i++)
+    {
+        out_meters[i] += out_meters[i - 1];
+    }
+    return BUZZ_GPS_SUCCESS;
+}
+
+
+int buzz_gps_segment_speed(
+    const double * lat,
+    const double * lon,
+    const int64_t * utc_ns,
+    double * out_mps,
+    size_t count)
+{
+    size_t i;
+
+    if (count == 0)
+    {
+        return BUZZ_GPS_SUCCESS;
+    }
+    out_mps[0] = NAN;
+    buzz_l_geodesy_get()->haversine(lat, lon, &lat[1], &lon[1], &out_mps[1], count - 1);
+    for (i = 1; i < count; i++)
+    {
+        out_mps[i] = utc_ns[i] > utc_ns[i - 1] ? out_mps[i] * 1e9 / (double) (utc_ns[i] - utc_ns[i - 1]) : NAN;
+    }
+    return BUZZ_GPS_SUCCESS;
+}
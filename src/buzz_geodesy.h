@@ -0,0 +1,53 @@
+/*
+ * Batch geodesy kernels
+ *
+ * Every batch function runs through a table of kernels picked once from
+ * what the CPU supports: a scalar one built on the C library, which the
+ * others are tested against, and on x86 SSE2 and AVX2 ones working on 2
+ * and 4 points at a time. The vector kernels come from one template,
+ * buzz_geodesy_simd.h, included once per instruction set.
+ */
+#ifndef BUZZ_GEODESY_H
+#define BUZZ_GEODESY_H
+
+#include <stddef.h>
+#include <math.h>
+
+#include "buzz_gps.h"
+
+/* mean earth radius in meters */
+#define BUZZ_GEODESY_EARTH_RADIUS 6371008.8
+
+#define BUZZ_GEODESY_DEG_TO_RAD (M_PI / 180.0)
+
+/* between two points given as separate latitude and longitude arrays */
+typedef void (*buzz_i_geodesy_pair_fn_t)(
+    const double * lat1,
+    const double * lon1,
+    const double * lat2,
+    const double * lon2,
+    double * out,
+    size_t count);
+
+typedef void (*buzz_i_geodesy_destination_fn_t)(
+    const double * lat,
+    const double * lon,
+    const double * bearing,
+    const double * meters,
+    double * out_lat,
+    double * out_lon,
+    size_t count);
+
+typedef struct buzz_i_geodesy_kernels_s
+{
+    buzz_gps_geodesy_kernel_t kernel;
+    buzz_i_geodesy_pair_fn_t haversine;
+    buzz_i_geodesy_pair_fn_t equirectangular;
+    buzz_i_geodesy_pair_fn_t bearing;
+    buzz_i_geodesy_destination_fn_t destination;
+} buzz_i_geodesy_kernels_t;
+
+/* great circle distance in meters of one pair, the scalar haversine kernel */
+double buzz_geodesy_haversine(double lat1, double lon1, double lat2, double lon2);
+
+#endif
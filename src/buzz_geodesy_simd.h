@@ -0,0 +1,285 @@
+/*
+ * Vector geodesy kernels
+ *
+ * Included by buzz_geodesy.c once per instruction set, after defining
+ * BUZZ_GEODESY_SUFFIX, BUZZ_GEODESY_TARGET, the vector type VD holding VW
+ * doubles and the V_ operations on it. There is no include guard on
+ * purpose.
+ *
+ * sin, cos and atan are the Cephes polynomials, good to about an ulp over
+ * the reduced range, so the results agree with the scalar kernels to far
+ * below a millimeter. Rounding to an integer adds and subtracts 1.5 * 2^52,
+ * which leaves the integer in the low bits of the sum where the quadrant
+ * signs can be shifted out of it without SSE4.1.
+ */
+
+#define BUZZ_GEODESY_CAT2(a, b) a##b
+#define BUZZ_GEODESY_CAT(a, b) BUZZ_GEODESY_CAT2(a, b)
+#define BUZZ_GEODESY_FN(name) BUZZ_GEODESY_CAT(name, BUZZ_GEODESY_SUFFIX)
+
+
+static inline BUZZ_GEODESY_TARGET void BUZZ_GEODESY_FN(buzz_l_sincos)(VD x, VD * out_sin, VD * out_cos)
+{
+    VD magic = V_SET1(BUZZ_GEODESY_ROUND_MAGIC);
+    VD t = V_ADD(V_MUL(x, V_SET1(M_2_PI)), magic);
+    VD k = V_SUB(t, magic);
+    VD half = V_SUB(V_ADD(V_MUL(k, V_SET1(0.5)), magic), magic);
+    VD even = V_EQ(k, V_ADD(half, half));
+    VD r = V_SUB(V_SUB(x, V_MUL(k, V_SET1(BUZZ_GEODESY_PIO2_HI))), V_MUL(k, V_SET1(BUZZ_GEODESY_PIO2_LO)));
+    VD z = V_MUL(r, r);
+    VD s;
+    VD c;
+
+    s = V_FMA(V_SET1(BUZZ_GEODESY_SIN0), z, V_SET1(BUZZ_GEODESY_SIN1));
+    s = V_FMA(s, z, V_SET1(BUZZ_GEODESY_SIN2));
+    s = V_FMA(s, z, V_SET1(BUZZ_GEODESY_SIN3));
+    s = V_FMA(s, z, V_SET1(BUZZ_GEODESY_SIN4));
+    s = V_FMA(s, z, V_SET1(BUZZ_GEODESY_SIN5));
+    s = V_FMA(V_MUL(r, z), s, r);
+
+    c = V_FMA(V_SET1(BUZZ_GEODESY_COS0), z, V_SET1(BUZZ_GEODESY_COS1));
+    c = V_FMA(c, z, V_SET1(BUZZ_GEODESY_COS2));
+    c = V_FMA(c, z, V_SET1(BUZZ_GEODESY_COS3));
+    c = V_FMA(c, z, V_SET1(BUZZ_GEODESY_COS4));
+    c = V_FMA(c, z, V_SET1(BUZZ_GEODESY_COS5));
+    c = V_FMA(V_MUL(z, z), c, V_SUB(V_SET1(1.0), V_MUL(z, V_SET1(0.5))));
+
+    /* odd quadrants swap the two, bit 1 of the quadrant flips the sign */
+    *out_sin = V_XOR(V_BLEND(even, c, s), V_BIT1_SIGN(t));
+    *out_cos = V_XOR(V_BLEND(even, s, c), V_BIT1_SIGN(V_ADD(t, V_SET1(1.0))));
+}
+
+
+static inline BUZZ_GEODESY_TARGET VD BUZZ_GEODESY_FN(buzz_l_atan2)(VD y, VD x)
+{
+    VD sign = V_SET1(-0.0);
+    VD one = V_SET1(1.0);
+    VD ay = V_ANDNOT(sign, y);
+    VD ax = V_ANDNOT(sign, x);
+    VD hi = V_MAX(ax, ay);
+    VD z = V_DIV(V_MIN(ax, ay), V_BLEND(V_EQ(hi, V_SET1(0.0)), hi, one));
+    VD big = V_GT(z, V_SET1(0.66));
+    VD w = V_BLEND(big, z, V_DIV(V_SUB(z, one), V_ADD(z, one)));
+    VD ww = V_MUL(w, w);
+    VD p;
+    VD q;
+    VD a;
+
+    p = V_FMA(V_SET1(BUZZ_GEODESY_ATAN_P0), ww, V_SET1(BUZZ_GEODESY_ATAN_P1));
+    p = V_FMA(p, ww, V_SET1(BUZZ_GEODESY_ATAN_P2));
+    p = V_FMA(p, ww, V_SET1(BUZZ_GEODESY_ATAN_P3));
+    p = V_FMA(p, ww, V_SET1(BUZZ_GEODESY_ATAN_P4));
+    q = V_ADD(ww, V_SET1(BUZZ_GEODESY_ATAN_Q0));
+    q = V_FMA(q, ww, V_SET1(BUZZ_GEODESY_ATAN_Q1));
+    q = V_FMA(q, ww, V_SET1(BUZZ_GEODESY_ATAN_Q2));
+    q = V_FMA(q, ww, V_SET1(BUZZ_GEODESY_ATAN_Q3));
+    q = V_FMA(q, ww, V_SET1(BUZZ_GEODESY_ATAN_Q4));
+
+    /* atan(z) = pi / 4 + atan((z - 1) / (z + 1)) above 0.66 */
+    a = V_FMA(V_MUL(w, ww), V_DIV(p, q), w);
+    a = V_ADD(a, V_AND(big, V_SET1(BUZZ_GEODESY_PIO2_ERROR / 2.0)));
+    a = V_ADD(a, V_AND(big, V_SET1(M_PI_4)));
+
+    /* back out to the octant and then the quadrant of the point */
+    a = V_BLEND(V_GT(ay, ax), a, V_ADD(V_SUB(V_SET1(M_PI_2), a), V_SET1(BUZZ_GEODESY_PIO2_ERROR)));
+    a = V_BLEND(V_LT(x, V_SET1(0.0)), a, V_ADD(V_SUB(V_SET1(M_PI), a), V_SET1(2.0 * BUZZ_GEODESY_PIO2_ERROR)));
+    return V_OR(a, V_AND(y, sign));
+}
+
+
+static inline BUZZ_GEODESY_TARGET VD BUZZ_GEODESY_FN(buzz_l_haversine_v)(VD lat1, VD lon1, VD lat2, VD lon2)
+{
+    VD rad = V_SET1(BUZZ_GEODESY_DEG_TO_RAD);
+    VD half_rad = V_SET1(BUZZ_GEODESY_DEG_TO_RAD / 2.0);
+    VD sin_dlat;
+    VD sin_dlon;
+    VD cos_lat1;
+    VD cos_lat2;
+    VD unused;
+    VD a;
+
+    BUZZ_GEODESY_FN(buzz_l_sincos)(V_MUL(V_SUB(lat2, lat1), half_rad), &sin_dlat, &unused);
+    BUZZ_GEODESY_FN(buzz_l_sincos)(V_MUL(V_SUB(lon2, lon1), half_rad), &sin_dlon, &unused);
+    BUZZ_GEODESY_FN(buzz_l_sincos)(V_MUL(lat1, rad), &unused, &cos_lat1);
+    BUZZ_GEODESY_FN(buzz_l_sincos)(V_MUL(lat2, rad), &unused, &cos_lat2);
+    a = V_FMA(V_MUL(cos_lat1, cos_lat2), V_MUL(sin_dlon, sin_dlon), V_MUL(sin_dlat, sin_dlat));
+    a = V_MIN(a, V_SET1(1.0));
+    return V_MUL(V_SET1(2.0 * BUZZ_GEODESY_EARTH_RADIUS),
+        BUZZ_GEODESY_FN(buzz_l_atan2)(V_SQRT(a), V_SQRT(V_SUB(V_SET1(1.0), a))));
+}
+
+
+static inline BUZZ_GEODESY_TARGET VD BUZZ_GEODESY_FN(buzz_l_equirectangular_v)(VD lat1, VD lon1, VD lat2, VD lon2)
+{
+    VD rad = V_SET1(BUZZ_GEODESY_DEG_TO_RAD);
+    VD dlon = V_SUB(lon2, lon1);
+    VD cos_mid;
+    VD unused;
+    VD x;
+    VD y;
+
+    /* the short way around */
+    dlon = V_SUB(dlon, V_AND(V_GT(dlon, V_SET1(180.0)), V_SET1(360.0)));
+    dlon = V_ADD(dlon, V_AND(V_LT(dlon, V_SET1(-180.0)), V_SET1(360.0)));
+    BUZZ_GEODESY_FN(buzz_l_sincos)(V_MUL(V_ADD(lat1, lat2), V_SET1(BUZZ_GEODESY_DEG_TO_RAD / 2.0)), &unused, &cos_mid);
+    x = V_MUL(V_MUL(dlon, rad), cos_mid);
+    y = V_MUL(V_SUB(lat2, lat1), rad);
+    return V_MUL(V_SET1(BUZZ_GEODESY_EARTH_RADIUS), V_SQRT(V_FMA(x, x, V_MUL(y, y))));
+}
+
+
+static inline BUZZ_GEODESY_TARGET VD BUZZ_GEODESY_FN(buzz_l_bearing_v)(VD lat1, VD lon1, VD lat2, VD lon2)
+{
+    VD rad = V_SET1(BUZZ_GEODESY_DEG_TO_RAD);
+    VD sin_lat1;
+    VD cos_lat1;
+    VD sin_lat2;
+    VD cos_lat2;
+    VD sin_dlon;
+    VD cos_dlon;
+    VD y;
+    VD x;
+    VD b;
+
+    BUZZ_GEODESY_FN(buzz_l_sincos)(V_MUL(lat1, rad), &sin_lat1, &cos_lat1);
+    BUZZ_GEODESY_FN(buzz_l_sincos)(V_MUL(lat2, rad), &sin_lat2, &cos_lat2);
+    BUZZ_GEODESY_FN(buzz_l_sincos)(V_MUL(V_SUB(lon2, lon1), rad), &sin_dlon, &cos_dlon);
+    y = V_MUL(sin_dlon, cos_lat2);
+    x = V_SUB(V_MUL(cos_lat1, sin_lat2), V_MUL(V_MUL(sin_lat1, cos_lat2), cos_dlon));
+    b = V_MUL(BUZZ_GEODESY_FN(buzz_l_atan2)(y, x), V_SET1(1.0 / BUZZ_GEODESY_DEG_TO_RAD));
+    return V_ADD(b, V_AND(V_LT(b, V_SET1(0.0)), V_SET1(360.0)));
+}
+
+
+static inline BUZZ_GEODESY_TARGET void BUZZ_GEODESY_FN(buzz_l_destination_v)(
+    VD lat,
+    VD lon,
+    VD bearing,
+    VD meters,
+    VD * out_lat,
+    VD * out_lon)
+{
+    VD rad = V_SET1(BUZZ_GEODESY_DEG_TO_RAD);
+    VD deg = V_SET1(1.0 / BUZZ_GEODESY_DEG_TO_RAD);
+    VD sin_lat;
+    VD cos_lat;
+    VD sin_angle;
+    VD cos_angle;
+    VD sin_bearing;
+    VD cos_bearing;
+    VD s;
+    VD lon2;
+
+    BUZZ_GEODESY_FN(buzz_l_sincos)(V_MUL(lat, rad), &sin_lat, &cos_lat);
+    BUZZ_GEODESY_FN(buzz_l_sincos)(V_DIV(meters, V_SET1(BUZZ_GEODESY_EARTH_RADIUS)), &sin_angle, &cos_angle);
+    BUZZ_GEODESY_FN(buzz_l_sincos)(V_MUL(bearing, rad), &sin_bearing, &cos_bearing);
+
+    /* asin(s) as atan2(s, sqrt(1 - s^2)) */
+    s = V_FMA(V_MUL(cos_lat, sin_angle), cos_bearing, V_MUL(sin_lat, cos_angle));
+    s = V_MAX(V_MIN(s, V_SET1(1.0)), V_SET1(-1.0));
+    *out_lat = V_MUL(BUZZ_GEODESY_FN(buzz_l_atan2)(s, V_SQRT(V_SUB(V_SET1(1.0), V_MUL(s, s)))), deg);
+
+    lon2 = V_MUL(BUZZ_GEODESY_FN(buzz_l_atan2)(
+        V_MUL(V_MUL(sin_bearing, sin_angle), cos_lat),
+        V_SUB(cos_angle, V_MUL(sin_lat, s))), deg);
+    lon2 = V_ADD(lon2, lon);
+    lon2 = V_SUB(lon2, V_AND(V_GT(lon2, V_SET1(180.0)), V_SET1(360.0)));
+    *out_lon = V_ADD(lon2, V_AND(V_LT(lon2, V_SET1(-180.0)), V_SET1(360.0)));
+}
+
+
+/*
+ * The batch loops. The last few points go through the same vector code
+ * from a padded copy, so a result never depends on where in the batch a
+ * point was.
+ */
+#define BUZZ_GEODESY_PAIR_KERNEL(name, op) \
+static BUZZ_GEODESY_TARGET void BUZZ_GEODESY_FN(name)( \
+    const double * lat1, \
+    const double * lon1, \
+    const double * lat2, \
+    const double * lon2, \
+    double * out, \
+    size_t count) \
+{ \
+    double pad[5][VW]; \
+    size_t i; \
+    size_t j; \
+ \
+    for (i = 0; i + VW <= count; i += VW) \
+    { \
+        V_STORE(&out[i], BUZZ_GEODESY_FN(op)( \
+            V_LOAD(&lat1[i]), V_LOAD(&lon1[i]), V_LOAD(&lat2[i]), V_LOAD(&lon2[i]))); \
+    } \
+    if (i == count) \
+    { \
+        return; \
+    } \
+    for (j = 0; j < VW; j++) \
+    { \
+        pad[0][j] = lat1[i + (j < count - i ? j : 0)]; \
+        pad[1][j] = lon1[i + (j < count - i ? j : 0)]; \
+        pad[2][j] = lat2[i + (j < count - i ? j : 0)]; \
+        pad[3][j] = lon2[i + (j < count - i ? j : 0)]; \
+    } \
+    V_STORE(pad[4], BUZZ_GEODESY_FN(op)(V_LOAD(pad[0]), V_LOAD(pad[1]), V_LOAD(pad[2]), V_LOAD(pad[3]))); \
+    memcpy(&out[i], pad[4], (count - i) * sizeof(double)); \
+}
+
+BUZZ_GEODESY_PAIR_KERNEL(buzz_l_haversine, buzz_l_haversine_v)
+BUZZ_GEODESY_PAIR_KERNEL(buzz_l_equirectangular, buzz_l_equirectangular_v)
+BUZZ_GEODESY_PAIR_KERNEL(buzz_l_bearing, buzz_l_bearing_v)
+
+
+static BUZZ_GEODESY_TARGET void BUZZ_GEODESY_FN(buzz_l_destination)(
+    const double * lat,
+    const double * lon,
+    const double * bearing,
+    const double * meters,
+    double * out_lat,
+    double * out_lon,
+    size_t count)
+{
+    double pad[6][VW];
+    VD lat2;
+    VD lon2;
+    size_t i;
+    size_t j;
+
+    for (i = 0; i + VW <= count; i += VW)
+    {
+        BUZZ_GEODESY_FN(buzz_l_destination_v)(
+            V_LOAD(&lat[i]), V_LOAD(&lon[i]), V_LOAD(&bearing[i]), V_LOAD(&meters[i]), &lat2, &lon2);
+        V_STORE(&out_lat[i], lat2);
+        V_STORE(&out_lon[i], lon2);
+    }
+    if (i == count)
+    {
+        return;
+    }
+    for (j = 0; j < VW; j++)
+    {
+        pad[0][j] = lat[i + (j < count - i ? j : 0)];
+        pad[1][j] = lon[i + (j < count - i ? j : 0)];
+        pad[2][j] = bearing[i + (j < count - i ? j : 0)];
+        pad[3][j] = meters[i + (j < count - i ? j : 0)];
+    }
+    BUZZ_GEODESY_FN(buzz_l_destination_v)(
+        V_LOAD(pad[0]), V_LOAD(pad[1]), V_LOAD(pad[2]), V_LOAD(pad[3]), &lat2, &lon2);
+    V_STORE(pad[4], lat2);
+    V_STORE(pad[5], lon2);
+    memcpy(&out_lat[i], pad[4], (count - i) * sizeof(double));
+    memcpy(&out_lon[i], pad[5], (count - i) * sizeof(double));
+}
+
+
+static const buzz_i_geodesy_kernels_t BUZZ_GEODESY_FN(buzz_l_geodesy_kernels) =
+{
+    BUZZ_GEODESY_KERNEL,
+    BUZZ_GEODESY_FN(buzz_l_haversine),
+    BUZZ_GEODESY_FN(buzz_l_equirectangular),
+    BUZZ_GEODESY_FN(buzz_l_bearing),
+    BUZZ_GEODESY_FN(buzz_l_destination)
+};
+
+#undef BUZZ_GEODESY_PAIR_KERNEL
@@ -0,0 +1,845 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "buzz_geofence.h"
+#include "buzz_geodesy.h"
+#include "buzz_logging.h"
+
+/* bounds on the grid cell size, in degrees */
+#define BUZZ_GEOFENCE_MIN_CELL 1e-4
+#define BUZZ_GEOFENCE_MAX_CELL 1.0
+
+#define BUZZ_GEOFENCE_EMPTY_CELL UINT64_MAX
+
+/* a fence in a grid cell, sorted to group the cells together */
+typedef struct buzz_i_geofence_pair_s
+{
+    uint64_t key;
+    uint32_t fence;
+} buzz_i_geofence_pair_t;
+
+
+static int buzz_l_pair_cmp(const void * a, const void * b)
+{
+    const buzz_i_geofence_pair_t * pa = (const buzz_i_geofence_pair_t *) a;
+    const buzz_i_geofence_pair_t * pb = (const buzz_i_geofence_pair_t *) b;
+
+    if (pa->key != pb->key)
+    {
+        return pa->key < pb->key ? -1 : 1;
+    }
+    return pa->fence < pb->fence ? -1 : pa->fence > pb->fence;
+}
+
+
+static int buzz_l_double_cmp(const void * a, const void * b)
+{
+    double da = *(const double *) a;
+    double db = *(const double *) b;
+
+    return da < db ? -1 : da > db;
+}
+
+
+int buzz_gps_geofence_create(
+    buzz_gps_geofence_t * out_engine,
+    int dwell_ms,
+    buzz_gps_geofence_callback_t transition_cb,
+    void * user_arg)
+{
+    buzz_i_geofence_engine_t * engine;
+
+    if (transition_cb == NULL)
+    {
+        return BUZZ_GPS_ERROR;
+    }
+    engine = (buzz_i_geofence_engine_t *) calloc(1, sizeof(buzz_i_geofence_engine_t));
+    if (engine == NULL)
+    {
+        return BUZZ_GPS_ERROR;
+    }
+    pthread_mutex_init(&engine->mutex, NULL);
+    engine->dwell_ns = dwell_ms > 0 ? (int64_t) dwell_ms * 1000000 : 0;
+    engine->cb = transition_cb;
+    engine->user_arg = user_arg;
+    engine->dirty = 1;
+
+    *out_engine = engine;
+    return BUZZ_GPS_SUCCESS;
+}
+
+
+static void buzz_l_geofence_free_grid(buzz_i_geofence_engine_t * engine)
+{
+    free(engine->cells);
+    free(engine->circle_x);
+    free(engine->circle_y);
+    free(engine->circle_z);
+    free(engine->circle_chord2);
+    free(engine->circle_fence);
+    free(engine->polygon_fence);
+    free(engine->hits);
+    engine->cells = NULL;
+    engine->circle_x = NULL;
+    engine->circle_y = NULL;
+    engine->circle_z = NULL;
+    engine->circle_chord2 = NULL;
+    engine->circle_fence = NULL;
+    engine->polygon_fence = NULL;
+    engine->hits = NULL;
+}
+
+
+static void buzz_l_geofence_free_polygon(buzz_i_geofence_t * fence)
+{
+    free(fence->latitudes);
+    free(fence->longitudes);
+    free(fence->slopes);
+    fence->latitudes = NULL;
+    fence->longitudes = NULL;
+    fence->slopes = NULL;
+}
+
+
+int buzz_gps_geofence_destroy(buzz_gps_geofence_t engine)
+{
+    size_t i;
+
+    for (i = 0; i < engine->fence_count; i++)
+    {
+        buzz_l_geofence_free_polygon(&engine->fences[i]);
+    }
+    buzz_l_geofence_free_grid(engine);
+    free(engine->fences);
+    free(engine->inside);
+    pthread_mutex_destroy(&engine->mutex);
+    free(engine);
+
+    return BUZZ_GPS_SUCCESS;
+}
+
+
+/*
+ * Room for one more fence, returned zeroed
+ *
+ * must be called locked
+ */
+static buzz_i_geofence_t * buzz_l_geofence_new(buzz_i_geofence_engine_t * engine, int id)
+{
+    buzz_i_geofence_t * fence;
+    buzz_i_geofence_t * fences;
+    uint32_t * inside;
+    size_t size;
+
+    if (engine->fence_count == UINT32_MAX)
+    {
+        return NULL;
+    }
+    if (engine->fence_count == engine->fence_size)
+    {
+        size = engine->fence_size == 0 ? 64 : engine->fence_size * 2;
+        fences = (buzz_i_geofence_t *) realloc(engine->fences, size * sizeof(buzz_i_geofence_t));
+        if (fences == NULL)
+        {
+            return NULL;
+        }
+        engine->fences = fences;
+        inside = (uint32_t *) realloc(engine->inside, size * sizeof(uint32_t));
+        if (inside == NULL)
+        {
+            return NULL;
+        }
+        engine->inside = inside;
+        engine->fence_size = size;
+    }
+    fence = &engine->fences[engine->fence_count];
+    memset(fence, '\0', sizeof(buzz_i_geofence_t));
+    fence->id = id;
+    return fence;
+}
+
+
+/* must be called locked */
+static void buzz_l_geofence_added(buzz_i_geofence_engine_t * engine)
+{
+    engine->fence_count++;
+    engine->live_count++;
+    engine->dirty = 1;
+}
+
+
+int buzz_gps_geofence_add_circle(
+    buzz_gps_geofence_t engine,
+    int id,
+    double latitude,
+    double longitude,
+    double radius_m)
+{
+    buzz_i_geofence_t * fence;
+    double lat = latitude * BUZZ_GEODESY_DEG_TO_RAD;
+    double lon = longitude * BUZZ_GEODESY_DEG_TO_RAD;
+    double angle;
+    double dlon;
+
+    if (!(latitude >= -90.0 && latitude <= 90.0 && longitude >= -180.0 && longitude <= 180.0 && radius_m >= 0.0))
+    {
+        return BUZZ_GPS_ERROR;
+    }
+    angle = radius_m / BUZZ_GEODESY_EARTH_RADIUS;
+    if (angle > M_PI)
+    {
+        angle = M_PI;
+    }
+
+    pthread_mutex_lock(&engine->mutex);
+    fence = buzz_l_geofence_new(engine, id);
+    if (fence == NULL)
+    {
+        pthread_mutex_unlock(&engine->mutex);
+        BUZZ_LOG_ERROR("No room for geofence %d", id);
+        return BUZZ_GPS_ERROR;
+    }
+    fence->circle = 1;
+    fence->x = cos(lat) * cos(lon);
+    fence->y = cos(lat) * sin(lon);
+    fence->z = sin(lat);
+    fence->chord2 = 4.0 * sin(angle / 2.0) * sin(angle / 2.0);
+    if (fabs(lat) + angle < M_PI / 2.0)
+    {
+        /* the widest point is where the meridians touch the circle */
+        dlon = asin(sin(angle) / cos(lat)) / BUZZ_GEODESY_DEG_TO_RAD;
+        fence->south = latitude - angle / BUZZ_GEODESY_DEG_TO_RAD;
+        fence->north = latitude + angle / BUZZ_GEODESY_DEG_TO_RAD;
+        fence->west = longitude - dlon;
+        fence->east = longitude + dlon;
+    }
+    else
+    {
+        /* around a pole, every longitude */
+        fence->south = -90.0;
+        fence->north = 90.0;
+        fence->west = -180.0;
+        fence->east = 180.0;
+    }
+    buzz_l_geofence_added(engine);
+    pthread_mutex_unlock(&engine->mutex);
+
+    return BUZZ_GPS_SUCCESS;
+}
+
+
+int buzz_gps_geofence_add_polygon(
+    buzz_gps_geofence_t engine,
+    int id,
+    const double * latitudes,
+    const double * longitudes,
+    size_t count)
+{
+    buzz_i_geofence_t * fence;
+    double * lat;
+    double * lon;
+    double * slope;
+    size_t i;
+
+    if (count < 3)
+    {
+        return BUZZ_GPS_ERROR;
+    }
+    for (i = 0; i < count; i++)
+    {
+        if (!(latitudes[i] >= -90.0 && latitudes[i] <= 90.0
+            && longitudes[i] >= -180.0 && longitudes[i] <= 180.0))
+        {
+            return BUZZ_GPS_ERROR;
+        }
+    }
+    lat = (double *) malloc((count + 1) * sizeof(double));
+    lon = (double *) malloc((count + 1) * sizeof(double));
+    slope = (double *) malloc(count * sizeof(double));
+    if (lat == NULL || lon == NULL || slope == NULL)
+    {
+        free(lat);
+        free(lon);
+        free(slope);
+        return BUZZ_GPS_ERROR;
+    }
+
+    /* each vertex within 180 degrees of the last, so edges can cross the antimeridian */
+    for (i = 0; i < count; i++)
+    {
+        lat[i] = latitudes[i];
+        lon[i] = longitudes[i];
+        while (i > 0 && lon[i] - lon[i - 1] > 180.0)
+        {
+            lon[i] -= 360.0;
+        }
+        while (i > 0 && lon[i] - lon[i - 1] < -180.0)
+        {
+            lon[i] += 360.0;
+        }
+    }
+    lat[count] = lat[0];
+    lon[count] = lon[0];
+    if (fabs(lon[count - 1] - lon[0]) > 180.0)
+    {
+        free(lat);
+        free(lon);
+        free(slope);
+        BUZZ_LOG_WARN("Geofence %d goes around a pole", id);
+        return BUZZ_GPS_ERROR;
+    }
+    for (i = 0; i < count; i++)
+    {
+        slope[i] = lat[i + 1] != lat[i] ? (lon[i + 1] - lon[i]) / (lat[i + 1] - lat[i]) : 0.0;
+    }
+
+    pthread_mutex_lock(&engine->mutex);
+    fence = buzz_l_geofence_new(engine, id);
+    if (fence == NULL)
+    {
+        pthread_mutex_unlock(&engine->mutex);
+        free(lat);
+        free(lon);
+        free(slope);
+        BUZZ_LOG_ERROR("No room for geofence %d", id);
+        return BUZZ_GPS_ERROR;
+    }
+    fence->latitudes = lat;
+    fence->longitudes = lon;
+    fence->slopes = slope;
+    fence->edges = count;
+    fence->south = fence->north = lat[0];
+    fence->west = fence->east = lon[0];
+    for (i = 1; i < count; i++)
+    {
+        fence->south = lat[i] < fence->south ? lat[i] : fence->south;
+        fence->north = lat[i] > fence->north ? lat[i] : fence->north;
+        fence->west = lon[i] < fence->west ? lon[i] : fence->west;
+        fence->east = lon[i] > fence->east ? lon[i] : fence->east;
+    }
+    buzz_l_geofence_added(engine);
+    pthread_mutex_unlock(&engine->mutex);
+
+    return BUZZ_GPS_SUCCESS;
+}
+
+
+int buzz_gps_geofence_remove(buzz_gps_geofence_t engine, int id)
+{
+    buzz_i_geofence_t * fence;
+    size_t i;
+    size_t j;
+    int rc = BUZZ_GPS_NOT_FOUND;
+
+    pthread_mutex_lock(&engine->mutex);
+    for (i = 0; i < engine->fence_count; i++)
+    {
+        fence = &engine->fences[i];
+        if (fence->removed || fence->id != id)
+        {
+            continue;
+        }
+        fence->removed = 1;
+        buzz_l_geofence_free_polygon(fence);
+        for (j = 0; fence->inside && j < engine->inside_count; j++)
+        {
+            if (engine->inside[j] == i)
+            {
+                engine->inside[j] = engine->inside[--engine->inside_count];
+                break;
+            }
+        }
+        fence->inside = 0;
+        engine->live_count--;
+        engine->dirty = 1;
+        rc = BUZZ_GPS_SUCCESS;
+    }
+    pthread_mutex_unlock(&engine->mutex);
+
+    return rc;
+}
+
+
+/*
+ * The cells a fence covers, 0 when there are too many for the grid
+ *
+ * must be called locked
+ */
+static int64_t buzz_l_geofence_span(
+    buzz_i_geofence_engine_t * engine,
+    const buzz_i_geofence_t * fence,
+    int64_t * out_lat0,
+    int64_t * out_lon0,
+    int64_t * out_rows,
+    int64_t * out_columns)
+{
+    *out_lat0 = (int64_t) floor((fence->south + 90.0) / engine->cell_deg);
+    *out_rows = (int64_t) floor((fence->north + 90.0) / engine->cell_deg) - *out_lat0 + 1;
+    *out_lon0 = (int64_t) floor((fence->west + 180.0) / engine->cell_deg);
+    *out_columns = (int64_t) floor((fence->east + 180.0) / engine->cell_deg) - *out_lon0 + 1;
+    if (*out_columns >= engine->cells_around || *out_rows * *out_columns > BUZZ_GEOFENCE_MAX_CELLS)
+    {
+        return 0;
+    }
+    return *out_rows * *out_columns;
+}
+
+
+static uint64_t buzz_l_geofence_key(buzz_i_geofence_engine_t * engine, int64_t row, int64_t column)
+{
+    column %= engine->cells_around;
+    if (column < 0)
+    {
+        column += engine->cells_around;
+    }
+    return ((uint64_t) row << 32) | (uint64_t) column;
+}
+
+
+static size_t buzz_l_geofence_slot(buzz_i_geofence_engine_t * engine, uint64_t key)
+{
+    return (size_t) ((key * 0x9E3779B97F4A7C15ull) >> (64 - engine->cell_bits));
+}
+
+
+/*
+ * Append the circles, then the polygons, of a run of pairs to the engine's
+ * arrays as one cell
+ *
+ * must be called locked
+ */
+static void buzz_l_geofence_fill_cell(
+    buzz_i_geofence_engine_t * engine,
+    buzz_i_geofence_cell_t * cell,
+    const buzz_i_geofence_pair_t * pairs,
+    size_t count,
+    uint32_t * circle_next,
+    uint32_t * polygon_next)
+{
+    const buzz_i_geofence_t * fence;
+    size_t i;
+
+    cell->circle_begin = *circle_next;
+    cell->polygon_begin = *polygon_next;
+    for (i = 0; i < count; i++)
+    {
+        fence = &engine->fences[pairs[i].fence];
+        if (fence->circle)
+        {
+            engine->circle_x[*circle_next] = fence->x;
+            engine->circle_y[*circle_next] = fence->y;
+            engine->circle_z[*circle_next] = fence->z;
+            engine->circle_chord2[*circle_next] = fence->chord2;
+            engine->circle_fence[(*circle_next)++] = pairs[i].fence;
+        }
+        else
+        {
+            engine->polygon_fence[(*polygon_next)++] = pairs[i].fence;
+        }
+    }
+    cell->circle_end = *circle_next;
+    cell->polygon_end = *polygon_next;
+}
+
+
+/*
+ * Drop the removed fences from the array, so add and remove churn does not
+ * grow it, and point the list of fences the receiver is inside at the new
+ * places. Only the grid refers to fences by place, and it is rebuilt next.
+ *
+ * must be called locked
+ */
+static void buzz_l_geofence_compact(buzz_i_geofence_engine_t * engine)
+{
+    size_t i;
+    size_t n = 0;
+
+    if (engine->live_count == engine->fence_count)
+    {
+        return;
+    }
+    engine->inside_count = 0;
+    for (i = 0; i < engine->fence_count; i++)
+    {
+        if (engine->fences[i].removed)
+        {
+            continue;
+        }
+        if (n != i)
+        {
+            engine->fences[n] = engine->fences[i];
+        }
+        if (engine->fences[n].inside)
+        {
+            engine->inside[engine->inside_count++] = (uint32_t) n;
+        }
+        n++;
+    }
+    engine->fence_count = n;
+}
+
+
+/*
+ * Size the cells after the median fence and bin every fence
+ *
+ * must be called locked
+ */
+static int buzz_l_geofence_rebuild(buzz_i_geofence_engine_t * engine)
+{
+    buzz_i_geofence_pair_t * pairs;
+    buzz_i_geofence_pair_t * global;
+    buzz_i_geofence_t * fence;
+    buzz_i_geofence_cell_t * cell;
+    double * extents;
+    double median = BUZZ_GEOFENCE_MAX_CELL;
+    size_t pair_count = 0;
+    size_t global_count = 0;
+    size_t circles = 0;
+    size_t distinct = 0;
+    size_t widest = 1;
+    size_t n = 0;
+    size_t i;
+    size_t j;
+    size_t slot;
+    int64_t lat0, lon0, rows, columns, r, c;
+    uint32_t circle_next = 0;
+    uint32_t polygon_next = 0;
+
+    buzz_l_geofence_free_grid(engine);
+    buzz_l_geofence_compact(engine);
+    extents = (double *) malloc((engine->live_count + 1) * sizeof(double));
+    if (extents == NULL)
+    {
+        return 0;
+    }
+    for (i = 0; i < engine->fence_count; i++)
+    {
+        fence = &engine->fences[i];
+        if (!fence->removed)
+        {
+            extents[n++] = fmax(fence->north - fence->south, fence->east - fence->west);
+        }
+    }
+    if (n > 0)
+    {
+        qsort(extents, n, sizeof(double), buzz_l_double_cmp);
+        median = extents[n / 2];
+    }
+    free(extents);
+    median = fmin(fmax(median, BUZZ_GEOFENCE_MIN_CELL), BUZZ_GEOFENCE_MAX_CELL);
+    engine->cells_around = (int64_t) ceil(360.0 / median);
+    engine->cell_deg = 360.0 / (double) engine->cells_around;
+
+    for (i = 0; i < engine->fence_count; i++)
+    {
+        fence = &engine->fences[i];
+        if (!fence->removed)
+        {
+            pair_count += buzz_l_geofence_span(engine, fence, &lat0, &lon0, &rows, &columns);
+        }
+    }
+    pairs = (buzz_i_geofence_pair_t *) malloc((pair_count + engine->live_count + 1) * sizeof(buzz_i_geofence_pair_t));
+    if (pairs == NULL)
+    {
+        return 0;
+    }
+    global = &pairs[pair_count];
+    pair_count = 0;
+    for (i = 0; i < engine->fence_count; i++)
+    {
+        fence = &engine->fences[i];
+        if (fence->removed)
+        {
+            continue;
+        }
+        if (buzz_l_geofence_span(engine, fence, &lat0, &lon0, &rows, &columns) == 0)
+        {
+            global[global_count].key = BUZZ_GEOFENCE_EMPTY_CELL;
+            global[global_count++].fence = (uint32_t) i;
+            continue;
+        }
+        for (r = lat0; r < lat0 + rows; r++)
+        {
+            for (c = lon0; c < lon0 + columns; c++)
+            {
+                pairs[pair_count].key = buzz_l_geofence_key(engine, r, c);
+                pairs[pair_count++].fence = (uint32_t) i;
+            }
+        }
+    }
+    qsort(pairs, pair_count, sizeof(buzz_i_geofence_pair_t), buzz_l_pair_cmp);
+    for (i = 0; i < pair_count; i++)
+    {
+        distinct += i == 0 || pairs[i].key != pairs[i - 1].key;
+    }
+
+    for (engine->cell_bits = 4; ((size_t) 1 << engine->cell_bits) < distinct * 2; engine->cell_bits++)
+    {
+    }
+    /* a circle is copied to every cell it is in */
+    for (i = 0; i < pair_count + global_count; i++)
+    {
+        circles += engine->fences[pairs[i].fence].circle;
+    }
+    engine->cells = (buzz_i_geofence_cell_t *) malloc(((size_t) 1 << engine->cell_bits) * sizeof(buzz_i_geofence_cell_t));
+    engine->circle_x = (double *) malloc((circles + 1) * sizeof(double));
+    engine->circle_y = (double *) malloc((circles + 1) * sizeof(double));
+    engine->circle_z = (double *) malloc((circles + 1) * sizeof(double));
+    engine->circle_chord2 = (double *) malloc((circles + 1) * sizeof(double));
+    engine->circle_fence = (uint32_t *) malloc((circles + 1) * sizeof(uint32_t));
+    engine->polygon_fence = (uint32_t *) malloc((pair_count + global_count - circles + 1) * sizeof(uint32_t));
+    if (engine->cells == NULL || engine->circle_x == NULL || engine->circle_y == NULL || engine->circle_z == NULL
+        || engine->circle_chord2 == NULL || engine->circle_fence == NULL || engine->polygon_fence == NULL)
+    {
+        free(pairs);
+        buzz_l_geofence_free_grid(engine);
+        return 0;
+    }
+    for (slot = 0; slot < ((size_t) 1 << engine->cell_bits); slot++)
+    {
+        engine->cells[slot].key = BUZZ_GEOFENCE_EMPTY_CELL;
+    }
+
+    for (i = 0; i < pair_count; i = j)
+    {
+        for (j = i + 1; j < pair_count && pairs[j].key == pairs[i].key; j++)
+        {
+        }
+        slot = buzz_l_geofence_slot(engine, pairs[i].key);
+        while (engine->cells[slot].key != BUZZ_GEOFENCE_EMPTY_CELL)
+        {
+            slot = (slot + 1) & (((size_t) 1 << engine->cell_bits) - 1);
+        }
+        cell = &engine->cells[slot];
+        cell->key = pairs[i].key;
+        buzz_l_geofence_fill_cell(engine, cell, &pairs[i], j - i, &circle_next, &polygon_next);
+        widest = cell->circle_end - cell->circle_begin > widest ? cell->circle_end - cell->circle_begin : widest;
+    }
+    buzz_l_geofence_fill_cell(engine, &engine->global, global, global_count, &circle_next, &polygon_next);
+    widest = engine->global.circle_end - engine->global.circle_begin > widest
+        ? engine->global.circle_end - engine->global.circle_begin : widest;
+    free(pairs);
+
+    engine->hits = (unsigned char *) malloc(widest);
+    if (engine->hits == NULL)
+    {
+        buzz_l_geofence_free_grid(engine);
+        return 0;
+    }
+    engine->dirty = 0;
+    return 1;
+}
+
+
+/* must be called locked */
+static void buzz_l_geofence_found(buzz_i_geofence_engine_t * engine, uint32_t index, int64_t now_ns)
+{
+    buzz_i_geofence_t * fence = &engine->fences[index];
+
+    fence->seen = engine->generation;
+    if (!fence->inside)
+    {
+        fence->inside = 1;
+        fence->dwelled = 0;
+        fence->entered_ns = now_ns;
+        fence->entered = engine->generation;
+        engine->inside[engine->inside_count++] = index;
+    }
+}
+
+
+/* crossing number of a ray going east from the point, odd when inside */
+static int buzz_l_geofence_in_polygon(const buzz_i_geofence_t * fence, double latitude, double longitude)
+{
+    const double * lat = fence->latitudes;
+    const double * lon = fence->longitudes;
+    const double * slope = fence->slopes;
+    size_t i;
+    int crossings = 0;
+
+    for (i = 0; i < fence->edges; i++)
+    {
+        int straddles = (lat[i] > latitude) != (lat[i + 1] > latitude);
+        double cross = lon[i] + (latitude - lat[i]) * slope[i];
+
+        crossings += straddles & (longitude < cross);
+    }
+    return crossings & 1;
+}
+
+
+/* must be called locked */
+static void buzz_l_geofence_test_cell(
+    buzz_i_geofence_engine_t * engine,
+    const buzz_i_geofence_cell_t * cell,
+    double latitude,
+    double longitude,
+    const double * point,
+    int64_t now_ns)
+{
+    const double * cx = &engine->circle_x[cell->circle_begin];
+    const double * cy = &engine->circle_y[cell->circle_begin];
+    const double * cz = &engine->circle_z[cell->circle_begin];
+    const double * chord2 = &engine->circle_chord2[cell->circle_begin];
+    unsigned char * hits = engine->hits;
+    const buzz_i_geofence_t * fence;
+    size_t n = cell->circle_end - cell->circle_begin;
+    size_t i;
+    double x;
+
+    for (i = 0; i < n; i++)
+    {
+        double dx = point[0] - cx[i];
+        double dy = point[1] - cy[i];
+        double dz = point[2] - cz[i];
+
+        hits[i] = dx * dx + dy * dy + dz * dz <= chord2[i];
+    }
+    for (i = 0; i < n; i++)
+    {
+        if (hits[i])
+        {
+            buzz_l_geofence_found(engine, engine->circle_fence[cell->circle_begin + i], now_ns);
+        }
+    }
+    engine->tests += n;
+
+    for (i = cell->polygon_begin; i < cell->polygon_end; i++)
+    {
+        fence = &engine->fences[engine->polygon_fence[i]];
+        x = longitude;
+        if (x < fence->west)
+        {
+            x += 360.0;
+        }
+        else if (x > fence->east)
+        {
+            x -= 360.0;
+        }
+        if (latitude < fence->south || latitude > fence->north || x < fence->west || x > fence->east)
+        {
+            continue;
+        }
+        engine->tests++;
+        if (buzz_l_geofence_in_polygon(fence, latitude, x))
+        {
+            buzz_l_geofence_found(engine, engine->polygon_fence[i], now_ns);
+        }
+    }
+}
+
+
+/* must be called locked */
+static void buzz_l_geofence_emit(
+    buzz_i_geofence_engine_t * engine,
+    const buzz_i_geofence_t * fence,
+    buzz_gps_geofence_transition_t transition,
+    const buzz_gps_fix_t * fix,
+    int64_t now_ns)
+{
+    buzz_gps_geofence_event_t event;
+
+    event.fence_id = fence->id;
+    event.transition = transition;
+    event.fix = fix;
+    event.inside_ns = now_ns - fence->entered_ns;
+    engine->events++;
+    engine->cb(&event, engine->user_arg);
+}
+
+
+int buzz_gps_geofence_update(buzz_gps_geofence_t engine, const buzz_gps_fix_t * fix)
+{
+    const buzz_i_geofence_cell_t * cell;
+    buzz_i_geofence_t * fence;
+    double lat;
+    double lon;
+    double point[3];
+    int64_t now_ns;
+    size_t slot;
+    size_t i;
+    size_t kept = 0;
+    uint64_t key;
+
+    if (!(fix->flags & BUZZ_GPS_FIX_LOCATION))
+    {
+        return BUZZ_GPS_NOT_FOUND;
+    }
+    now_ns = (fix->flags & BUZZ_GPS_FIX_TIMESTAMP) ? fix->utc_ns : (int64_t) fix->received_ns;
+    lat = fix->latitude * BUZZ_GEODESY_DEG_TO_RAD;
+    lon = fix->longitude * BUZZ_GEODESY_DEG_TO_RAD;
+    point[0] = cos(lat) * cos(lon);
+    point[1] = cos(lat) * sin(lon);
+    point[2] = sin(lat);
+
+    pthread_mutex_lock(&engine->mutex);
+    if (engine->dirty && !buzz_l_geofence_rebuild(engine))
+    {
+        pthread_mutex_unlock(&engine->mutex);
+        BUZZ_LOG_ERROR("Failed to build the geofence grid");
+        return BUZZ_GPS_ERROR;
+    }
+    engine->generation++;
+    engine->fixes++;
+
+    key = buzz_l_geofence_key(engine,
+        (int64_t) floor((fix->latitude + 90.0) / engine->cell_deg),
+        (int64_t) floor((fix->longitude + 180.0) / engine->cell_deg));
+    for (slot = buzz_l_geofence_slot(engine, key);
+         engine->cells[slot].key != BUZZ_GEOFENCE_EMPTY_CELL;
+         slot = (slot + 1) & (((size_t) 1 << engine->cell_bits) - 1))
+    {
+        cell = &engine->cells[slot];
+        if (cell->key == key)
+        {
+            buzz_l_geofence_test_cell(engine, cell, fix->latitude, fix->longitude, point, now_ns);
+            break;
+        }
+    }
+    buzz_l_geofence_test_cell(engine, &engine->global, fix->latitude, fix->longitude, point, now_ns);
+
+    /* exits first, so moving from one fence to the next reads in order */
+    for (i = 0; i < engine->inside_count; i++)
+    {
+        fence = &engine->fences[engine->inside[i]];
+        if (fence->seen != engine->generation)
+        {
+            fence->inside = 0;
+            buzz_l_geofence_emit(engine, fence, BUZZ_GPS_GEOFENCE_EXIT, fix, now_ns);
+            continue;
+        }
+        engine->inside[kept++] = engine->inside[i];
+    }
+    engine->inside_count = kept;
+    for (i = 0; i < engine->inside_count; i++)
+    {
+        fence = &engine->fences[engine->inside[i]];
+        if (fence->entered == engine->generation)
+        {
+            buzz_l_geofence_emit(engine, fence, BUZZ_GPS_GEOFENCE_ENTER, fix, now_ns);
+        }
+        else if (engine->dwell_ns > 0 && !fence->dwelled && now_ns - fence->entered_ns >= engine->dwell_ns)
+        {
+            fence->dwelled = 1;
+            buzz_l_geofence_emit(engine, fence, BUZZ_GPS_GEOFENCE_DWELL, fix, now_ns);
+        }
+    }
+    pthread_mutex_unlock(&engine->mutex);
+
+    return BUZZ_GPS_SUCCESS;
+}
+
+
+int buzz_gps_geofence_get_stats(buzz_gps_geofence_t engine, buzz_gps_geofence_stats_t * out_stats)
+{
+    pthread_mutex_lock(&engine->mutex);
+    out_stats->fences = engine->live_count;
+    out_stats->fixes = engine->fixes;
+    out_stats->tests = engine->tests;
+    out_stats->events = engine->events;
+    pthread_mutex_unlock(&engine->mutex);
+
+    return BUZZ_GPS_SUCCESS;
+}
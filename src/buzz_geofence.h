@@ -0,0 +1,115 @@
+/*
+ * Geofence engine
+ *
+ * Fences are circles, tested by great circle distance, and polygons with
+ * straight edges in latitude and longitude. They are binned into a uniform
+ * grid of cells about the size of a typical fence, so a fix is only tested
+ * against the few fences of its own cell. Fences covering too many cells
+ * are kept aside and tested on every fix.
+ *
+ * The tests run over arrays rather than lists of structures: the circles
+ * of a cell are stored side by side as unit vectors and the edges of a
+ * polygon as vertex and slope arrays, so both are a branch free loop the
+ * compiler can vectorize.
+ *
+ * The grid is rebuilt on the first fix after fences are added or removed,
+ * and removed fences are dropped from the engine then.
+ */
+#ifndef BUZZ_GEOFENCE_H
+#define BUZZ_GEOFENCE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "buzz_gps.h"
+
+/* fences spanning more cells than this are tested on every fix */
+#define BUZZ_GEOFENCE_MAX_CELLS 64
+
+typedef struct buzz_i_geofence_s
+{
+    int id;
+    int removed;
+    int circle;
+
+    /* bounding box in degrees, longitudes unwrapped so west <= east */
+    double south;
+    double north;
+    double west;
+    double east;
+
+    /* circles: unit vector of the center and the squared chord of the radius */
+    double x;
+    double y;
+    double z;
+    double chord2;
+
+    /* polygons: vertices with the first repeated at the end, and the change
+       of longitude per degree of latitude along each edge */
+    double * latitudes;
+    double * longitudes;
+    double * slopes;
+    size_t edges;
+
+    /* where the tracked receiver is */
+    int inside;
+    int dwelled;
+    int64_t entered_ns;
+    /* the last fix found inside, and the one that entered */
+    uint64_t seen;
+    uint64_t entered;
+} buzz_i_geofence_t;
+
+/* the fences of one grid cell, ranges of the engine's arrays */
+typedef struct buzz_i_geofence_cell_s
+{
+    uint64_t key;
+    uint32_t circle_begin;
+    uint32_t circle_end;
+    uint32_t polygon_begin;
+    uint32_t polygon_end;
+} buzz_i_geofence_cell_t;
+
+typedef struct buzz_i_geofence_engine_s
+{
+    /* held while fences change and while a fix is evaluated */
+    pthread_mutex_t mutex;
+    int64_t dwell_ns;
+    buzz_gps_geofence_callback_t cb;
+    void * user_arg;
+
+    buzz_i_geofence_t * fences;
+    size_t fence_count;
+    size_t fence_size;
+    size_t live_count;
+
+    /* the grid, an open addressing table of the cells with fences in them */
+    int dirty;
+    double cell_deg;
+    int64_t cells_around;
+    buzz_i_geofence_cell_t * cells;
+    int cell_bits;
+    buzz_i_geofence_cell_t global;
+
+    /* the circles of every cell, cell after cell */
+    double * circle_x;
+    double * circle_y;
+    double * circle_z;
+    double * circle_chord2;
+    uint32_t * circle_fence;
+    uint32_t * polygon_fence;
+    /* results of the circle test of one cell */
+    unsigned char * hits;
+
+    /* fences the receiver is inside */
+    uint32_t * inside;
+    size_t inside_count;
+    uint64_t generation;
+
+    uint64_t fixes;
+    uint64_t tests;
+    uint64_t events;
+} buzz_i_geofence_engine_t;
+
+#endif
@@ -2,7 +2,6 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
-#include <sqlite3.h>
 #include <unistd.h>
 #include <ctype.h>
 #include <fcntl.h>
@@ -10,40 +9,24 @@
 #include <termios.h>
 #include <unistd.h>
 #include <time.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "buzz_gps.h"
+#include "buzz_dispatch.h"
+#include "buzz_framer.h"
+#include "buzz_handle.h"
 #include "buzz_logging.h"
+#include "buzz_nmea.h"
+#include "buzz_schema.h"
+#include "buzz_seqlock.h"
 
-#define BUZZ_GPS_MAX_LINE 128
-#define BUZZ_GPS_MAX_PARSE_WORDS 32
-
-typedef int (*buzz_gps_parse_raw_func_t)(buzz_gps_raw_event_t * raw_event, buzz_gps_event_t * out_event);
-
-
-typedef struct buzz_i_gps_handle_s {
-    int serial_port;
-    pthread_cond_t cond;
-    pthread_mutex_t mutex;
-    pthread_t thread_id;
-
-    buzz_gps_location_t * last_location;
-    buzz_gps_speed_t * last_speed;
-    buzz_gps_altitude_t * last_altitude;
-
-    int running;
-
-    int error_interval;
-    int interval_time;
-
-    buzz_gps_raw_event_callback_t raw_cb;
-    buzz_gps_event_callback_t event_cb;
-    void * user_arg;
-} buzz_i_gps_handle_t;
 
 
 typedef struct nmea_i_parser_s {
     buzz_sentence_type_t type;
-    buzz_gps_parse_raw_func_t parser_func;
+    const buzz_i_sentence_schema_t * schema;
     int valid;
  } nmea_i_parser_t;
 
@@ -51,32 +34,32 @@ typedef struct nmea_i_parser_s {
 nmea_i_parser_t g_nmea_sentence_map[BUZZ_GPS_TYPE_COUNT];
 int g_nmea_sentence_map_initialized = 0;
 
-static int buzz_l_parse_gprmc(buzz_gps_raw_event_t * raw_event, buzz_gps_event_t * out_event);
-
-static int buzz_l_parse_gpgll(buzz_gps_raw_event_t * raw_event, buzz_gps_event_t * out_event);
+static int buzz_l_get_raw_event(buzz_gps_handle_t gps_handle, buzz_gps_raw_event_t * raw_event, int wake_fd);
 
-static int buzz_l_get_raw_event(buzz_gps_handle_t gps_handle, buzz_gps_raw_event_t * raw_event);
+static void buzz_l_split_sentence(buzz_gps_handle_t gps_handle, buzz_gps_raw_event_t * raw_event);
 
 static int buzz_l_get_full_event(
     buzz_gps_handle_t gps_handle,
     buzz_gps_raw_event_t * raw_event,
-    buzz_gps_event_t * out_event);
+    buzz_gps_fix_t * out_fix,
+    uint64_t * out_parsed_ns);
 
 /*
- * Each entry is a description of where the lattitude/longitude information is in the word list
- * The array is null terminated
+ * Each entry points at the schema describing where the values are in the
+ * fields of that sentence type, see buzz_schema.c
  */
  static int buzz_l_initialize_map()
  {
-    memset(&g_nmea_sentence_map, '\0', sizeof(nmea_i_parser_t)*BUZZ_GPS_TYPE_COUNT);
+    int type;
 
-    g_nmea_sentence_map[BUZZ_GPRMC].type = BUZZ_GPRMC;
-    g_nmea_sentence_map[BUZZ_GPRMC].valid = 1;
-    g_nmea_sentence_map[BUZZ_GPRMC].parser_func = buzz_l_parse_gprmc;
+    memset(&g_nmea_sentence_map, '\0', sizeof(nmea_i_parser_t)*BUZZ_GPS_TYPE_COUNT);
 
-    g_nmea_sentence_map[BUZZ_GPGLL].type = BUZZ_GPGLL;
-    g_nmea_sentence_map[BUZZ_GPGLL].valid = 1;
-    g_nmea_sentence_map[BUZZ_GPGLL].parser_func = buzz_l_parse_gpgll;
+    for (type = 0; type < BUZZ_GPS_TYPE_COUNT; type++)
+    {
+        g_nmea_sentence_map[type].type = type;
+        g_nmea_sentence_map[type].schema = buzz_schema_for(type);
+        g_nmea_sentence_map[type].valid = g_nmea_sentence_map[type].schema != NULL;
+    }
 
     g_nmea_sentence_map_initialized = 1;
 
@@ -84,483 +67,1496 @@ static int buzz_l_get_full_event(
  }
 
 
-static int buzz_l_nmea_get_string_type(char * strtype)
+/*
+ * Block until fd is readable. Returns BUZZ_GPS_NOT_FOUND if wake_fd became
+ * readable first, meaning the handle is being stopped.
+ */
+static int buzz_l_wait_readable(int fd, int wake_fd)
+{
+    struct pollfd fds[2];
+    int n;
+
+    fds[0].fd = fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = wake_fd;
+    fds[1].events = POLLIN;
+    do
+    {
+        n = poll(fds, 2, -1);
+    } while (n < 0 && errno == EINTR);
+
+    if (n < 0 || (fds[1].revents & POLLIN))
+    {
+        return BUZZ_GPS_NOT_FOUND;
+    }
+    return BUZZ_GPS_SUCCESS;
+}
+
+
+/*
+ * Field holding the hhmmss.ss UTC time of each sentence type, 0 if it has none
+ */
+static const int g_sentence_time_field[BUZZ_GPS_TYPE_COUNT] =
+{
+    [BUZZ_GPGGA] = 1,
+    [BUZZ_GPRMC] = 1,
+    [BUZZ_GPGLL] = 5,
+    [BUZZ_GPZDA] = 1,
+};
+
+
+/*
+ * Copy the next part of a replayed log into the read buffer. A last line
+ * without a line ending is given one so that it is not lost.
+ *
+ *  Returns the number of bytes added, 0 at the end of the log.
+ */
+static size_t buzz_l_replay_fill(buzz_gps_handle_t gps_handle)
+{
+    buzz_i_replay_t * replay = &gps_handle->replay;
+    size_t n = 0;
+
+    if (replay->pos < replay->len)
+    {
+        n = buzz_framer_fill_from_memory(&gps_handle->framer, &replay->data[replay->pos], replay->len - replay->pos);
+    }
+    else if (replay->pos == replay->len && replay->len > 0 && replay->data[replay->len - 1] != '\n')
+    {
+        n = buzz_framer_fill_from_memory(&gps_handle->framer, "\n", 1);
+    }
+    replay->pos += n;
+
+    return n;
+}
+
+
+static int buzz_l_sentence_time(const buzz_gps_raw_event_t * raw_event, double * out_seconds)
 {
-    static char * type_names[] = 
+    int ndx;
+
+    if ((unsigned) raw_event->type >= BUZZ_GPS_TYPE_COUNT)
     {
-        "$GPGGA",
-        "$GPGLL",
-        "$GPVTG",
-        "$GPRMC",
-        "$GPGSA",
-        "$GPGSV",
-        "$GPMSS",
-        "$GPTRF",
-        "$GPSTN",
-        "$GPXTE",
-        "$GPZDA",
-        NULL
-    };
+        return BUZZ_GPS_NOT_FOUND;
+    }
+    ndx = g_sentence_time_field[raw_event->type];
+    if (ndx == 0 || ndx >= raw_event->field_count || raw_event->fields[ndx].length < 6)
+    {
+        return BUZZ_GPS_NOT_FOUND;
+    }
+    return buzz_nmea_parse_time(
+        &raw_event->sentence[raw_event->fields[ndx].offset], raw_event->fields[ndx].length, out_seconds);
+}
 
-    for (int i = 0; type_names[i] != NULL; i++)
+
+/*
+ * Sleep until the monotonic clock reaches target, or until wake_fd is
+ * written to when it is not -1. Returns 0 if woken early.
+ */
+static int buzz_l_sleep_until(const struct timespec * target, int wake_fd)
+{
+    struct timespec now;
+    struct pollfd fd;
+    long ms;
+
+    if (wake_fd < 0)
+    {
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, target, NULL) == EINTR)
+        {
+        }
+        return 1;
+    }
+    for (;;)
     {
-        if(strcmp(strtype, type_names[i]) == 0)
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        ms = (target->tv_sec - now.tv_sec) * 1000 + (target->tv_nsec - now.tv_nsec) / 1000000;
+        if (ms <= 0)
+        {
+            return 1;
+        }
+        fd.fd = wake_fd;
+        fd.events = POLLIN;
+        if (poll(&fd, 1, ms) > 0)
         {
-            return i;
+            return 0;
         }
     }
-    return -1;
 }
 
 
-static int buzz_l_read_until_char(int fd, char * buf, size_t max_size, char term_char)
+static int buzz_l_timespec_before(const struct timespec * a, const struct timespec * b)
 {
-    int done = 0;
-    int n;
-    size_t ndx = 0;
+    return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+
+/*
+ * When a replayed sentence is due: its UTC time, measured from the first
+ * timed sentence and divided by the replay speed, after the replay began.
+ * Returns 1 and sets out_due if that is still to come.
+ */
+static int buzz_l_replay_due(buzz_gps_handle_t gps_handle, const buzz_gps_raw_event_t * raw_event, struct timespec * out_due)
+{
+    buzz_i_replay_t * replay = &gps_handle->replay;
+    struct timespec now;
+    double t;
+    double delay;
+
+    if (!replay->active || replay->mode == BUZZ_GPS_REPLAY_FAST)
+    {
+        return 0;
+    }
+    if (buzz_l_sentence_time(raw_event, &t) != BUZZ_GPS_SUCCESS)
+    {
+        return 0;
+    }
+    t += replay->day_offset;
+    if (replay->anchored && t < replay->last_time - 43200.0)
+    {
+        /* the log crossed midnight */
+        replay->day_offset += 86400.0;
+        t += 86400.0;
+    }
+    if (!replay->anchored || t < replay->last_time)
+    {
+        /* the first time seen, or the log jumped back: pace from here */
+        replay->anchored = 1;
+        replay->anchor_time = t;
+        replay->last_time = t;
+        clock_gettime(CLOCK_MONOTONIC, &replay->anchor_clock);
+        return 0;
+    }
+    replay->last_time = t;
+
+    delay = (t - replay->anchor_time) / replay->speed;
+    *out_due = replay->anchor_clock;
+    out_due->tv_sec += (time_t) delay;
+    out_due->tv_nsec += (long) ((delay - (time_t) delay) * 1e9);
+    if (out_due->tv_nsec >= 1000000000L)
+    {
+        out_due->tv_sec++;
+        out_due->tv_nsec -= 1000000000L;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return buzz_l_timespec_before(&now, out_due);
+}
+
+
+/*
+ * A paced replay hands sentences out well after the log was read into the
+ * framer, so stamp them when they are handed out rather than when framed
+ */
+static void buzz_l_replay_stamp(buzz_gps_handle_t gps_handle, buzz_gps_raw_event_t * raw_event)
+{
+    if (gps_handle->replay.active && gps_handle->replay.mode != BUZZ_GPS_REPLAY_FAST)
+    {
+        raw_event->received_ns = buzz_stats_now_ns();
+    }
+}
+
+
+/*
+ * Keep a framed sentence that is not due yet for the next read
+ *
+ * must be called locked
+ */
+static void buzz_l_replay_hold(buzz_gps_handle_t gps_handle, const buzz_gps_raw_event_t * raw_event)
+{
+    buzz_i_replay_t * replay = &gps_handle->replay;
+
+    memcpy(replay->held_sentence, raw_event->sentence, raw_event->length + 1);
+    replay->held_length = raw_event->length;
+    replay->held = 1;
+}
+
+
+/*
+ * Move the held sentence into raw_event, setting its length and stamping
+ * it as received now that it is due
+ *
+ * must be called locked
+ */
+static void buzz_l_replay_release(buzz_gps_handle_t gps_handle, buzz_gps_raw_event_t * raw_event)
+{
+    buzz_i_replay_t * replay = &gps_handle->replay;
+
+    memcpy(raw_event->sentence, replay->held_sentence, replay->held_length + 1);
+    raw_event->length = replay->held_length;
+    raw_event->received_ns = buzz_stats_now_ns();
+    replay->held = 0;
+}
+
+
+/*
+ * Wait for the sentence a paced replay is holding back, with the lock
+ * released so the handle can be used and stopped meanwhile. Returns 0 if
+ * deadline, NULL for none, passed first or wake_fd, -1 for none, was
+ * written to.
+ *
+ * must be called locked
+ */
+static int buzz_l_replay_wait_held(buzz_gps_handle_t gps_handle, const struct timespec * deadline, int wake_fd)
+{
+    struct timespec now;
+    struct timespec until = gps_handle->replay.held_due;
+    int reached;
+
+    if (deadline != NULL)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (!buzz_l_timespec_before(&now, deadline))
+        {
+            return 0;
+        }
+        if (buzz_l_timespec_before(deadline, &until))
+        {
+            until = *deadline;
+        }
+    }
+
+    pthread_mutex_unlock(&gps_handle->mutex);
+    reached = buzz_l_sleep_until(&until, wake_fd);
+    pthread_mutex_lock(&gps_handle->mutex);
+
+    return reached;
+}
+
+
+/*
+ * Take the next buffered sentence with a good checksum, dropping and
+ * counting the corrupt ones on the way so they never reach the tokenizer.
+ * Sentences without a checksum are passed through.
+ *
+ *  Returns the sentence length or 0 if no complete sentence is buffered.
+ */
+static size_t buzz_l_frame_sentence(buzz_gps_handle_t gps_handle, char * buffer, size_t buf_len)
+{
+    size_t len;
+
+    while ((len = buzz_framer_next(&gps_handle->framer, buffer, buf_len)) > 0)
+    {
+        if ((gps_handle->options & BUZZ_GPS_OPTIONS_SKIP_CHECKSUM)
+            || buzz_nmea_verify_checksum(buffer, len) != BUZZ_GPS_ERROR)
+        {
+            return len;
+        }
+        BUZZ_STAT_ADD(gps_handle->stats.checksum_errors, 1);
+        BUZZ_LOG_DEBUG("Dropping a sentence with a bad checksum: %s", buffer);
+    }
+    return 0;
+}
+
+
+/*
+ * Frame the next sentence out of the handle's read buffer, refilling it from
+ * the serial port, or the replayed log, only when no complete sentence is
+ * already buffered.
+ * If wake_fd is not -1 waiting on the port is abandoned when it is written to.
+ */
+static int buzz_l_read_sentence(
+    buzz_gps_handle_t gps_handle,
+    char * buffer,
+    size_t buf_len,
+    int * out_len,
+    int wake_fd)
+{
+    ssize_t n;
 
-    while(!done)
+    while ((*out_len = buzz_l_frame_sentence(gps_handle, buffer, buf_len)) == 0)
     {
-        n = read(fd, &buf[ndx], 1);
-        if (n < 0) {
-            buzz_logger(BUZZ_ERROR, "GPS error returned when reading the serial port: %s", strerror(errno));
+        if (gps_handle->replay.active)
+        {
+            if (buzz_l_replay_fill(gps_handle) == 0)
+            {
+                return BUZZ_GPS_END_OF_DATA;
+            }
+            continue;
+        }
+        if (wake_fd >= 0 && buzz_l_wait_readable(gps_handle->serial_port, wake_fd) != BUZZ_GPS_SUCCESS)
+        {
             return BUZZ_GPS_NOT_FOUND;
         }
-        if (buf[ndx] == term_char) {
-            done = 1;
+        n = buzz_framer_fill(&gps_handle->framer, gps_handle->serial_port);
+        if (n < 0)
+        {
+            BUZZ_LOG_ERROR("GPS error returned when reading the serial port: %s", strerror(errno));
+            return BUZZ_GPS_NOT_FOUND;
         }
-        ndx = ndx + n;
-        if (ndx >= max_size) {
-            buzz_logger(BUZZ_WARN, "exceeded the max size of %d", max_size);
+        if (n == 0)
+        {
+            BUZZ_LOG_ERROR("End of file on the serial port");
             return BUZZ_GPS_NOT_FOUND;
         }
     }
-    return ndx;
+
+    return BUZZ_GPS_SUCCESS;
 }
 
 
-static int buzz_l_daysmins_to_float(const char * daysmin, char hem, float * out_v)
+/*
+ * Build the words[] compatibility view. We avoid the need for heap memory by
+ * copying the sentence once and overwriting the ',' before each field with '\0'.
+ */
+static void buzz_l_build_words(buzz_gps_raw_event_t * raw_event)
 {
-    static const char * neg_hem = "sSwW";
+    int i;
 
-    float sign = 1.0f;
-    int rc;
-    float raw;
-    int day;
-    float min;
-    float v;
+    memcpy(raw_event->buffer, raw_event->sentence, raw_event->length + 1);
+    for (i = 0; i < raw_event->field_count; i++)
+    {
+        if (i > 0)
+        {
+            raw_event->buffer[raw_event->fields[i].offset - 1] = '\0';
+        }
+        raw_event->words[i] = &raw_event->buffer[raw_event->fields[i].offset];
+    }
+    raw_event->word_count = raw_event->field_count;
+}
 
-    buzz_logger(BUZZ_DEBUG, "converting %s %c", daysmin, hem);
-    if (NULL != strchr(neg_hem, hem))
+
+/*
+ * Point the compatibility event at storage filled from the fix
+ */
+static void buzz_l_fix_to_event(
+    const buzz_gps_fix_t * fix,
+    buzz_gps_event_t * out_event,
+    buzz_i_event_storage_t * storage)
+{
+    memset(out_event, '\0', sizeof(buzz_gps_event_t));
+    out_event->type = fix->type;
+    out_event->time = fix->time;
+    out_event->received_ns = fix->received_ns;
+    if (fix->flags & BUZZ_GPS_FIX_LOCATION)
     {
-        sign = -1.0f;
+        storage->location.lattitude = fix->latitude;
+        storage->location.longitude = fix->longitude;
+        out_event->location = &storage->location;
     }
-    rc = sscanf(daysmin, "%f", &raw);
-    if (rc <= 0)
+    if (fix->flags & BUZZ_GPS_FIX_SPEED)
     {
-        return BUZZ_GPS_ERROR;
+        storage->speed.knots_per_hour = fix->speed_knots;
+        storage->speed.direction = fix->course;
+        out_event->speed = &storage->speed;
+    }
+    if (fix->flags & BUZZ_GPS_FIX_ALTITUDE)
+    {
+        storage->altitude.altitude_meters = fix->altitude_meters;
+        out_event->altitude = &storage->altitude;
     }
-    day = raw / 100;
-    min = (raw - (day * 100.0)) / 60.0;
-    v = min + day;
+}
 
-    *out_v = v * sign;;
 
-    return BUZZ_GPS_SUCCESS;
+/*
+ * Fold a parsed fix into the last known values and publish them
+ *
+ * must be called locked
+ */
+static void buzz_l_update_last_fix(buzz_gps_handle_t gps_handle, const buzz_gps_fix_t * fix)
+{
+    buzz_gps_fix_t * last = &gps_handle->last_fix;
+
+    last->type = fix->type;
+    last->talker = fix->talker;
+    last->received_ns = fix->received_ns;
+    buzz_fusion_merge(last, fix);
+
+    BUZZ_SEQLOCK_WRITE(gps_handle->last_fix_snapshot, last);
+
+    if (gps_handle->filter.model != BUZZ_GPS_FILTER_NONE)
+    {
+        buzz_filter_update(&gps_handle->filter, fix, (last->flags & BUZZ_GPS_FIX_HDOP) ? last->hdop : 0.0);
+    }
 }
 
 
-static int buzz_l_read_sentence(
+/*
+ * read until we get a location or an error 
+ *
+ * must be called locked
+ */
+static int buzz_l_get_events(
     buzz_gps_handle_t gps_handle,
-    char * buffer,
-    size_t buf_len)
+    buzz_gps_raw_event_t * out_raw,
+    buzz_gps_fix_t * out_fix)
 {
     int rc;
-    int char_count = 0;
-    int n;
+    
+    rc = buzz_l_get_raw_event(gps_handle, out_raw, -1);
+    if (rc == BUZZ_GPS_END_OF_DATA)
+    {
+        return rc;
+    }
+    if (rc != BUZZ_GPS_SUCCESS)
+    {
+        BUZZ_LOG_INFO("Error getting raw sentence");
+        return BUZZ_GPS_RAW_SENTENCE;
+    }
+    BUZZ_LOG_DEBUG("Found event type %d", out_raw->type);
+    rc = buzz_l_get_full_event(gps_handle, out_raw, out_fix, NULL);
+
+    return rc;
+}
+
 
-    memset(buffer, '\0', buf_len);
+/*
+ * Read the next sentence. A paced replay holds one that is not due yet and
+ * waits for it with the lock released; whoever reads next once it is due
+ * takes it, which need not be this caller.
+ * Returns BUZZ_GPS_NOT_FOUND if wake_fd, -1 for none, is written to.
+ *
+ * must be called locked
+ */
+static int buzz_l_get_raw_event(buzz_gps_handle_t gps_handle, buzz_gps_raw_event_t * raw_event, int wake_fd)
+{
+    buzz_i_replay_t * replay = &gps_handle->replay;
+    struct timespec now;
+    int rc;
 
-    /* read until we find the first character of a sentence */
-    while (buffer[0] != '$')
+    for (;;)
     {
-        n = read(gps_handle->serial_port, buffer, 1);
-        if (n < 0)
+        if (replay->held)
         {
-            buzz_logger(BUZZ_ERROR, "GPS error returned when reading the serial port: %s", strerror(errno));
-            return BUZZ_GPS_NOT_FOUND;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            if (!buzz_l_timespec_before(&now, &replay->held_due))
+            {
+                buzz_l_replay_release(gps_handle, raw_event);
+                buzz_l_split_sentence(gps_handle, raw_event);
+                return BUZZ_GPS_SUCCESS;
+            }
+            if (!buzz_l_replay_wait_held(gps_handle, NULL, wake_fd))
+            {
+                return BUZZ_GPS_NOT_FOUND;
+            }
+            continue;
         }
-        char_count++;
-        if (char_count > BUZZ_GPS_MAX_LINE)
+
+        BUZZ_LOG_DEBUG("Reading a sentence from the GPS device...");
+        rc = buzz_l_read_sentence(gps_handle, raw_event->sentence, BUZZ_GPS_MAX_LINE, &raw_event->length, wake_fd);
+        if (rc != BUZZ_GPS_SUCCESS)
         {
-            buzz_logger(BUZZ_ERROR, "Read %d bytes before finding a $", char_count);
-            return BUZZ_GPS_NOT_FOUND;
+            return rc == BUZZ_GPS_END_OF_DATA ? rc : BUZZ_GPS_ERROR;
+        }
+        raw_event->received_ns = gps_handle->framer.sentence_ns;
+        BUZZ_LOG_DEBUG("Read the sentence: %s", raw_event->sentence);
+
+        buzz_l_split_sentence(gps_handle, raw_event);
+        if (buzz_l_replay_due(gps_handle, raw_event, &replay->held_due))
+        {
+            buzz_l_replay_hold(gps_handle, raw_event);
+            continue;
+        }
+        buzz_l_replay_stamp(gps_handle, raw_event);
+
+        return BUZZ_GPS_SUCCESS;
+    }
+}
+
+
+/*
+ * Fill in the fields, type and talker of a raw event whose sentence and
+ * length are set
+ */
+static void buzz_l_split_sentence(buzz_gps_handle_t gps_handle, buzz_gps_raw_event_t * raw_event)
+{
+    const buzz_gps_field_t * type_field;
+
+    raw_event->field_count = buzz_nmea_tokenize(raw_event->sentence, raw_event->fields, BUZZ_GPS_MAX_PARSE_WORDS);
+    type_field = &raw_event->fields[0];
+
+    BUZZ_LOG_DEBUG("Parsing sentence type %.*s of %d words",
+        type_field->length, &raw_event->sentence[type_field->offset], raw_event->field_count);
+    raw_event->type = buzz_nmea_classify(&raw_event->sentence[type_field->offset], type_field->length, &raw_event->talker);
+
+    if (gps_handle->options & BUZZ_GPS_OPTIONS_NO_WORDS)
+    {
+        raw_event->word_count = 0;
+    }
+    else
+    {
+        buzz_l_build_words(raw_event);
+    }
+}
+
+
+/*
+ * Give a fix with a time of day the full UTC timestamp, from the date it
+ * carries or the last one seen. A time well before the last one means the
+ * day has rolled over since that date was sent.
+ *
+ * must be called locked
+ */
+static void buzz_l_stamp_utc(buzz_gps_handle_t gps_handle, buzz_gps_fix_t * fix)
+{
+    buzz_i_utc_date_t * date = &gps_handle->utc_date;
+    int64_t whole;
+    int64_t seconds;
+
+    if (fix->flags & BUZZ_GPS_FIX_DATE)
+    {
+        date->day_start = buzz_nmea_days_from_civil(fix->year, fix->month, fix->day) * 86400;
+        date->last_seconds = 0.0;
+        date->valid = 1;
+    }
+    if (!(fix->flags & BUZZ_GPS_FIX_TIME) || !date->valid)
+    {
+        return;
+    }
+    if (!(fix->flags & BUZZ_GPS_FIX_DATE) && date->last_seconds - fix->utc_seconds > 43200.0)
+    {
+        date->day_start += 86400;
+    }
+    date->last_seconds = fix->utc_seconds;
+
+    /* times of day are never negative, so truncating is the floor */
+    whole = (int64_t) fix->utc_seconds;
+    seconds = date->day_start + whole;
+    fix->time = (time_t) seconds;
+    fix->utc_ns = seconds * 1000000000 + (int64_t) ((fix->utc_seconds - whole) * 1e9 + 0.5);
+    fix->flags |= BUZZ_GPS_FIX_TIMESTAMP;
+}
+
+
+/*
+ * Parse the fix out of a split sentence and count the outcome. out_parsed_ns,
+ * if not NULL, is set to when parsing finished.
+ *
+ * must be called locked
+ */
+static int buzz_l_get_full_event(
+    buzz_gps_handle_t gps_handle,
+    buzz_gps_raw_event_t * raw_event,
+    buzz_gps_fix_t * out_fix,
+    uint64_t * out_parsed_ns)
+{
+    buzz_i_handle_stats_t * stats = &gps_handle->stats;
+    nmea_i_parser_t * parser_ent;
+    uint64_t parsed_ns;
+    int rc;
+
+    memset(out_fix, '\0', sizeof(buzz_gps_fix_t));
+    out_fix->type = raw_event->type;
+    out_fix->talker = raw_event->talker;
+    out_fix->received_ns = raw_event->received_ns;
+
+    if (out_parsed_ns != NULL)
+    {
+        *out_parsed_ns = 0;
+    }
+    if ((unsigned) raw_event->type >= BUZZ_GPS_TYPE_COUNT)
+    {
+        BUZZ_STAT_ADD(stats->unknown_sentences, 1);
+        BUZZ_LOG_DEBUG("unknown sentence type");
+        return BUZZ_GPS_EVENT_NOT_FOUND;
+    }
+    parser_ent = &g_nmea_sentence_map[raw_event->type];
+    if (parser_ent->schema == NULL)
+    {
+        BUZZ_STAT_ADD(stats->parse_ignored[raw_event->type], 1);
+        BUZZ_LOG_DEBUG("no schema for sentence type %d", raw_event->type);
+        return BUZZ_GPS_EVENT_NOT_FOUND; 
+    }
+
+    rc = buzz_schema_parse(parser_ent->schema, raw_event, out_fix);
+    BUZZ_LOG_DEBUG("parser func rc is %d", rc);
+    if (rc == BUZZ_GPS_SUCCESS)
+    {
+        BUZZ_STAT_ADD(stats->parse_ok[raw_event->type], 1);
+        buzz_l_stamp_utc(gps_handle, out_fix);
+    }
+    else
+    {
+        BUZZ_STAT_ADD(stats->parse_failed[raw_event->type], 1);
+    }
+
+    if (raw_event->received_ns != 0 || out_parsed_ns != NULL)
+    {
+        parsed_ns = buzz_stats_now_ns();
+        if (raw_event->received_ns != 0)
+        {
+            buzz_histogram_record(&stats->read_to_parse, parsed_ns - raw_event->received_ns);
+        }
+        if (out_parsed_ns != NULL)
+        {
+            *out_parsed_ns = parsed_ns;
+        }
+    }
+
+    return rc;
+}
+
+
+/*
+ * Parse the next sentence already buffered, setting out_parse_rc to the
+ * result of parsing the fix and out_parsed_ns, if not NULL, to when the
+ * parse finished. Returns BUZZ_GPS_NOT_FOUND when no complete
+ * sentence is buffered, or when a paced replay has not reached it yet;
+ * the sentence is then held in replay.held until replay.held_due.
+ *
+ * must be called locked
+ */
+static int buzz_l_next_buffered(
+    buzz_gps_handle_t gps_handle,
+    buzz_gps_raw_event_t * raw_event,
+    buzz_gps_fix_t * out_fix,
+    int * out_parse_rc,
+    uint64_t * out_parsed_ns)
+{
+    buzz_i_replay_t * replay = &gps_handle->replay;
+    struct timespec now;
+
+    if (replay->held)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (buzz_l_timespec_before(&now, &replay->held_due))
+        {
+            return BUZZ_GPS_NOT_FOUND;
+        }
+        buzz_l_replay_release(gps_handle, raw_event);
+        buzz_l_split_sentence(gps_handle, raw_event);
+    }
+    else
+    {
+        raw_event->length = buzz_l_frame_sentence(gps_handle, raw_event->sentence, BUZZ_GPS_MAX_LINE);
+        if (raw_event->length == 0)
+        {
+            return BUZZ_GPS_NOT_FOUND;
+        }
+        raw_event->received_ns = gps_handle->framer.sentence_ns;
+        BUZZ_LOG_DEBUG("Read the sentence: %s", raw_event->sentence);
+
+        buzz_l_split_sentence(gps_handle, raw_event);
+        if (buzz_l_replay_due(gps_handle, raw_event, &replay->held_due))
+        {
+            buzz_l_replay_hold(gps_handle, raw_event);
+            return BUZZ_GPS_NOT_FOUND;
+        }
+        buzz_l_replay_stamp(gps_handle, raw_event);
+    }
+    *out_parse_rc = buzz_l_get_full_event(gps_handle, raw_event, out_fix, out_parsed_ns);
+    if (*out_parse_rc == BUZZ_GPS_SUCCESS)
+    {
+        buzz_l_update_last_fix(gps_handle, out_fix);
+    }
+
+    return BUZZ_GPS_SUCCESS;
+}
+
+
+int buzz_handle_parse(buzz_gps_handle_t gps_handle, buzz_gps_raw_event_t * raw_event, buzz_gps_fix_t * out_fix)
+{
+    buzz_l_split_sentence(gps_handle, raw_event);
+    return buzz_l_get_full_event(gps_handle, raw_event, out_fix, NULL);
+}
+
+
+int buzz_handle_next_buffered(buzz_gps_handle_t gps_handle, buzz_i_dispatch_item_t * out_item)
+{
+    int rc;
+    int parse_rc = BUZZ_GPS_EVENT_NOT_FOUND;
+
+    rc = buzz_l_next_buffered(gps_handle, &out_item->raw, &out_item->fix, &parse_rc, &out_item->parsed_ns);
+    out_item->parsed = parse_rc == BUZZ_GPS_SUCCESS;
+
+    return rc;
+}
+
+
+/*
+ * Fill entries from the sentences already buffered
+ *
+ * must be called locked
+ */
+static size_t buzz_l_drain_batch(
+    buzz_gps_handle_t gps_handle,
+    buzz_gps_batch_entry_t * entries,
+    size_t count,
+    size_t max)
+{
+    while (count < max)
+    {
+        if (buzz_l_next_buffered(gps_handle, &entries[count].raw, &entries[count].fix, &entries[count].rc, NULL)
+            != BUZZ_GPS_SUCCESS)
+        {
+            break;
+        }
+        count++;
+    }
+    return count;
+}
+
+
+/*
+ * Runs on the dispatcher thread, or the reactor thread, so callbacks never
+ * hold up the gather thread
+ */
+void buzz_handle_deliver(buzz_i_dispatch_item_t * item, void * arg)
+{
+    buzz_gps_handle_t gps_handle = (buzz_gps_handle_t) arg;
+    buzz_i_handle_stats_t * stats = &gps_handle->stats;
+    buzz_gps_event_t event;
+    uint64_t start_ns;
+    uint64_t end_ns;
+
+    start_ns = buzz_stats_now_ns();
+    if (gps_handle->raw_cb != NULL)
+    {
+        gps_handle->raw_cb(&item->raw, gps_handle->user_arg);
+    }
+    if (item->parsed)
+    {
+        if (gps_handle->fix_cb != NULL)
+        {
+            gps_handle->fix_cb(&item->fix, gps_handle->fix_user_arg);
+        }
+        if (gps_handle->event_cb != NULL)
+        {
+            /* the event storage is reused for the next event, callbacks must copy what they keep */
+            buzz_l_fix_to_event(&item->fix, &event, &gps_handle->event_storage);
+            gps_handle->event_cb(&event, gps_handle->user_arg);
+        }
+    }
+    if (gps_handle->store != NULL && (gps_handle->store->options & BUZZ_GPS_STORE_SENTENCES))
+    {
+        buzz_store_add_sentence(gps_handle->store, gps_handle->store_receiver, &item->raw);
+    }
+    if (item->parsed && gps_handle->fusion.cb != NULL)
+    {
+        buzz_fusion_add(&gps_handle->fusion, &item->fix, start_ns);
+    }
+    end_ns = buzz_stats_now_ns();
+
+    BUZZ_STAT_ADD(stats->callbacks, 1);
+    BUZZ_STAT_ADD(stats->callback_ns, end_ns - start_ns);
+    buzz_histogram_record(&stats->callback, end_ns - start_ns);
+    if (item->parsed_ns != 0)
+    {
+        buzz_histogram_record(&stats->parse_to_callback, start_ns - item->parsed_ns);
+    }
+    if (item->raw.received_ns != 0)
+    {
+        buzz_histogram_record(&stats->total, end_ns - item->raw.received_ns);
+    }
+}
+
+
+/*
+ * Close an epoch whose remaining sentences never came, runs on the same
+ * thread as buzz_handle_deliver()
+ */
+void buzz_handle_idle(void * arg)
+{
+    buzz_gps_handle_t gps_handle = (buzz_gps_handle_t) arg;
+
+    if (gps_handle->fusion.cb != NULL)
+    {
+        buzz_fusion_tick(&gps_handle->fusion, buzz_stats_now_ns());
+    }
+}
+
+
+void buzz_handle_flush(buzz_gps_handle_t gps_handle)
+{
+    if (gps_handle->fusion.cb != NULL)
+    {
+        buzz_fusion_flush(&gps_handle->fusion);
+    }
+}
+
+
+/*
+ * Sleep for the given number of seconds or until buzz_gps_stop() is called
+ */
+static void buzz_l_wait_interval(buzz_gps_handle_t gps_handle, int seconds)
+{
+    struct pollfd fd;
+
+    if (seconds <= 0)
+    {
+        return;
+    }
+    fd.fd = gps_handle->wake_pipe[0];
+    fd.events = POLLIN;
+    poll(&fd, 1, seconds * 1000);
+}
+
+
+static void * buzz_l_gather_thread(void * arg)
+{
+    buzz_gps_handle_t gps_handle = (buzz_gps_handle_t) arg;
+    int rc;
+    buzz_i_dispatch_item_t item;
+
+    while(atomic_load(&gps_handle->running))
+    {
+        /*
+         * the lock keeps blocking API callers out of the framer, it is not
+         * held for callbacks nor while a paced replay waits
+         */
+        pthread_mutex_lock(&gps_handle->mutex);
+        {
+            rc = buzz_l_get_raw_event(gps_handle, &item.raw, gps_handle->wake_pipe[0]);
+            if (rc == BUZZ_GPS_SUCCESS)
+            {
+                item.parsed = buzz_l_get_full_event(gps_handle, &item.raw, &item.fix, &item.parsed_ns) == BUZZ_GPS_SUCCESS;
+                if (item.parsed)
+                {
+                    buzz_l_update_last_fix(gps_handle, &item.fix);
+                }
+            }
+        }
+        pthread_mutex_unlock(&gps_handle->mutex);
+
+        if (!atomic_load(&gps_handle->running))
+        {
+            break;
+        }
+        if (rc == BUZZ_GPS_END_OF_DATA)
+        {
+            BUZZ_LOG_INFO("Reached the end of the replayed log");
+            pthread_mutex_lock(&gps_handle->mutex);
+            {
+                gps_handle->replay.finished = 1;
+                pthread_cond_broadcast(&gps_handle->replay.finished_cond);
+            }
+            pthread_mutex_unlock(&gps_handle->mutex);
+            break;
+        }
+        if (rc != BUZZ_GPS_SUCCESS)
+        {
+            BUZZ_LOG_ERROR("failed to get a sentence");
+            buzz_l_wait_interval(gps_handle, gps_handle->error_interval);
+        }
+        else
+        {
+            buzz_dispatch_push(&gps_handle->dispatcher, &item);
+            buzz_l_wait_interval(gps_handle, gps_handle->interval_time);
+        }
+    }
+
+    return NULL;
+}
+
+
+/*
+ * Allocate a handle with everything but its source set up
+ */
+static buzz_i_gps_handle_t * buzz_l_new_handle(int options)
+{
+    buzz_i_gps_handle_t * new_handle;
+    pthread_condattr_t attr;
+
+    if (!g_nmea_sentence_map_initialized)
+    {
+        BUZZ_LOG_DEBUG("Setting up the sentence parse in global memory");
+        buzz_l_initialize_map();
+    }
+
+    new_handle = (buzz_i_gps_handle_t *) calloc(1, sizeof(buzz_i_gps_handle_t));
+    if (new_handle == NULL)
+    {
+        return NULL;
+    }
+    new_handle->options = options;
+    new_handle->serial_port = -1;
+    new_handle->dispatch_queue_size = BUZZ_GPS_DEFAULT_QUEUE_SIZE;
+    new_handle->dispatch_policy = BUZZ_GPS_OVERFLOW_BLOCK;
+    buzz_framer_init(&new_handle->framer);
+    pthread_mutex_init(&new_handle->mutex, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&new_handle->replay.finished_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    return new_handle;
+}
+
+
+static void buzz_l_free_handle(buzz_i_gps_handle_t * handle)
+{
+    if (handle->serial_port >= 0)
+    {
+        close(handle->serial_port);
+    }
+    if (handle->replay.mapped)
+    {
+        munmap((void *) handle->replay.data, handle->replay.len);
+    }
+    pthread_cond_destroy(&handle->replay.finished_cond);
+    pthread_mutex_destroy(&handle->mutex);
+    free(handle);
+}
+
+
+int buzz_gps_init(
+    buzz_gps_handle_t * out_handle,
+    const char * serial_path,
+    speed_t baud,
+    int options)
+{
+
+    buzz_i_gps_handle_t * new_handle;
+    struct termios tty;
+
+    BUZZ_LOG_DEBUG("Opening the serial port for bluetooth");
+    new_handle = buzz_l_new_handle(options);
+    if (new_handle == NULL)
+    {
+        return BUZZ_GPS_ERROR;
+    }
+    new_handle->serial_port = open(serial_path, O_RDWR);
+    if (new_handle->serial_port < 0)
+    {
+        BUZZ_LOG_ERROR("Failed to open %s: %s", serial_path, strerror(errno));
+        goto error;
+    }
+
+    /* Only set options in not in debug mode */
+    if ((options | BUZZ_GPS_OPTIONS_DEBUG) == 0)
+    {
+        BUZZ_LOG_DEBUG("Setting tty options");
+        memset(&tty, 0, sizeof(tty));
+        if(tcgetattr(new_handle->serial_port, &tty) != 0) {
+            BUZZ_LOG_ERROR("Error %i from tcgetattr: %s\n", errno, strerror(errno));
+            goto error;
+        }
+        cfsetospeed (&tty, baud);
+    }
+
+    *out_handle = new_handle;
+
+    return BUZZ_GPS_SUCCESS;
+error:
+    buzz_l_free_handle(new_handle);
+    return BUZZ_GPS_ERROR;
+}
+
+
+int buzz_gps_init_from_memory(
+    buzz_gps_handle_t * out_handle,
+    const char * data,
+    size_t len,
+    buzz_gps_replay_mode_t mode,
+    double speed,
+    int options)
+{
+    buzz_i_gps_handle_t * new_handle;
+
+    if (mode == BUZZ_GPS_REPLAY_SCALED && !(speed > 0.0))
+    {
+        BUZZ_LOG_ERROR("The replay speed must be positive");
+        return BUZZ_GPS_ERROR;
+    }
+
+    new_handle = buzz_l_new_handle(options);
+    if (new_handle == NULL)
+    {
+        return BUZZ_GPS_ERROR;
+    }
+    new_handle->replay.active = 1;
+    new_handle->replay.data = data;
+    new_handle->replay.len = len;
+    new_handle->replay.mode = mode;
+    new_handle->replay.speed = mode == BUZZ_GPS_REPLAY_SCALED ? speed : 1.0;
+
+    *out_handle = new_handle;
+
+    return BUZZ_GPS_SUCCESS;
+}
+
+
+int buzz_gps_init_from_file(
+    buzz_gps_handle_t * out_handle,
+    const char * path,
+    buzz_gps_replay_mode_t mode,
+    double speed,
+    int options)
+{
+    int fd;
+    int rc;
+    struct stat st;
+    void * data = NULL;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        BUZZ_LOG_ERROR("Failed to open %s: %s", path, strerror(errno));
+        return BUZZ_GPS_ERROR;
+    }
+    if (fstat(fd, &st) != 0)
+    {
+        BUZZ_LOG_ERROR("Failed to stat %s: %s", path, strerror(errno));
+        close(fd);
+        return BUZZ_GPS_ERROR;
+    }
+    /* an empty log cannot be mapped, it replays as nothing */
+    if (st.st_size > 0)
+    {
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED)
+        {
+            BUZZ_LOG_ERROR("Failed to map %s: %s", path, strerror(errno));
+            close(fd);
+            return BUZZ_GPS_ERROR;
+        }
+        madvise(data, st.st_size, MADV_SEQUENTIAL);
+    }
+    /* the mapping stays valid after the close */
+    close(fd);
+
+    rc = buzz_gps_init_from_memory(out_handle, (const char *) data, st.st_size, mode, speed, options);
+    if (rc != BUZZ_GPS_SUCCESS)
+    {
+        if (data != NULL)
+        {
+            munmap(data, st.st_size);
+        }
+        return rc;
+    }
+    (*out_handle)->replay.mapped = data != NULL;
+
+    return BUZZ_GPS_SUCCESS;
+}
+
+
+int buzz_gps_destroy(buzz_gps_handle_t handle)
+{
+    if (atomic_load(&handle->running))
+    {
+        BUZZ_LOG_WARN("Trying to destroy a running handle. Call stop first");
+        return BUZZ_GPS_ERROR;
+    }
+    if (handle->reactor != NULL)
+    {
+        BUZZ_LOG_WARN("Trying to destroy a handle owned by a reactor. Remove it first");
+        return BUZZ_GPS_ERROR;
+    }
+    buzz_l_free_handle(handle);
+    return BUZZ_GPS_SUCCESS;
+}
+
+
+int buzz_gps_get_event_blocking(
+    buzz_gps_handle_t gps_handle,
+    buzz_gps_raw_event_t * out_raw,
+    buzz_gps_event_t * out_event)
+{
+    int rc;
+    buzz_gps_fix_t fix;
+    buzz_i_event_storage_t storage;
+
+    memset(out_event, '\0', sizeof(buzz_gps_event_t));
+    rc = buzz_gps_get_fix_blocking(gps_handle, out_raw, &fix);
+    if (rc != BUZZ_GPS_SUCCESS)
+    {
+        return rc;
+    }
+
+    /* the caller releases these with buzz_gps_free_blocking_event() */
+    buzz_l_fix_to_event(&fix, out_event, &storage);
+    if (out_event->location != NULL)
+    {
+        out_event->location = (buzz_gps_location_t *) malloc(sizeof(buzz_gps_location_t));
+        *out_event->location = storage.location;
+    }
+    if (out_event->speed != NULL)
+    {
+        out_event->speed = (buzz_gps_speed_t *) malloc(sizeof(buzz_gps_speed_t));
+        *out_event->speed = storage.speed;
+    }
+    if (out_event->altitude != NULL)
+    {
+        out_event->altitude = (buzz_gps_altitude_t *) malloc(sizeof(buzz_gps_altitude_t));
+        *out_event->altitude = storage.altitude;
+    }
+
+    return rc;
+}
+
+
+int buzz_gps_get_fix_blocking(
+    buzz_gps_handle_t gps_handle,
+    buzz_gps_raw_event_t * out_raw,
+    buzz_gps_fix_t * out_fix)
+{
+    int rc;
+
+    pthread_mutex_lock(&gps_handle->mutex);
+    {
+        rc = buzz_l_get_events(gps_handle, out_raw, out_fix);
+        if (rc == BUZZ_GPS_SUCCESS)
+        {
+            buzz_l_update_last_fix(gps_handle, out_fix);
+        }
+    }
+    pthread_mutex_unlock(&gps_handle->mutex);
+
+    return rc;
+}
+
+
+int buzz_gps_get_events_batch(
+    buzz_gps_handle_t gps_handle,
+    buzz_gps_batch_entry_t * entries,
+    size_t max,
+    int timeout_ms,
+    size_t * out_count)
+{
+    struct timespec deadline;
+    struct pollfd fd;
+    size_t count;
+    ssize_t n;
+    int rc = BUZZ_GPS_SUCCESS;
+
+    *out_count = 0;
+    if (max == 0)
+    {
+        return BUZZ_GPS_SUCCESS;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    if (timeout_ms > 0)
+    {
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += (long) (timeout_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+
+    pthread_mutex_lock(&gps_handle->mutex);
+    {
+        count = buzz_l_drain_batch(gps_handle, entries, 0, max);
+        if (gps_handle->replay.active)
+        {
+            /* no syscalls to save here, so fill the batch with what is due */
+            while (count < max)
+            {
+                if (gps_handle->replay.held)
+                {
+                    if (count > 0 || !buzz_l_replay_wait_held(gps_handle, timeout_ms < 0 ? NULL : &deadline, -1))
+                    {
+                        break;
+                    }
+                }
+                else if (buzz_l_replay_fill(gps_handle) == 0)
+                {
+                    rc = BUZZ_GPS_END_OF_DATA;
+                    break;
+                }
+                count = buzz_l_drain_batch(gps_handle, entries, count, max);
+            }
+        }
+        else if (count < max)
+        {
+            /* only wait when there is nothing to hand back yet */
+            fd.fd = gps_handle->serial_port;
+            fd.events = POLLIN;
+            do
+            {
+                n = poll(&fd, 1, count == 0 ? timeout_ms : 0);
+            } while (n < 0 && errno == EINTR);
+
+            if (n > 0)
+            {
+                n = buzz_framer_fill(&gps_handle->framer, gps_handle->serial_port);
+                if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+                {
+                    BUZZ_LOG_ERROR("GPS error returned when reading the serial port: %s", strerror(errno));
+                    rc = BUZZ_GPS_ERROR;
+                }
+                else if (n == 0)
+                {
+                    BUZZ_LOG_ERROR("End of file on the serial port");
+                    rc = BUZZ_GPS_ERROR;
+                }
+                count = buzz_l_drain_batch(gps_handle, entries, count, max);
+            }
+            else if (n < 0)
+            {
+                BUZZ_LOG_ERROR("Failed to wait for the serial port: %s", strerror(errno));
+                rc = BUZZ_GPS_ERROR;
+            }
         }
     }
+    pthread_mutex_unlock(&gps_handle->mutex);
 
-    rc = buzz_l_read_until_char(gps_handle->serial_port, &buffer[1], BUZZ_GPS_MAX_LINE-1, '\n');
-    if (rc < 0)
+    *out_count = count;
+    if (count > 0)
     {
-        buzz_logger(BUZZ_ERROR, "Did not find a CR in %d chars", BUZZ_GPS_MAX_LINE);
-        return rc;
+        /* a read error is reported again by the next call */
+        return BUZZ_GPS_SUCCESS;
     }
- 
-    return BUZZ_GPS_SUCCESS;
+    if (rc == BUZZ_GPS_SUCCESS)
+    {
+        return BUZZ_GPS_NOT_FOUND;
+    }
+    return rc;
 }
 
 
-/* We avoid the need for heap memory by spliting the sentence in place by overwriting ',' with '\0' */
-static int buzz_l_split_sentence(char * buffer, size_t buf_len, char ** out_words, size_t word_count)
+int buzz_gps_get_last_known_location(
+    buzz_gps_handle_t gps_handle, buzz_gps_location_t * out_location)
 {
-    int current_word = 0;
-    char * ptr;
+    int rc;
+    buzz_gps_fix_t fix;
 
-    ptr = buffer;
-    out_words[current_word] = ptr;
-    current_word++;
-    ptr = strchr(ptr, ',');
-    while(ptr != NULL && current_word < word_count)
+    rc = buzz_gps_get_last_known_fix(gps_handle, &fix);
+    if (rc != BUZZ_GPS_SUCCESS || (fix.flags & BUZZ_GPS_FIX_LOCATION) == 0)
     {
-        *ptr = '\0';
-        ptr++;
-        out_words[current_word] = ptr;
-        ptr = strchr(ptr, ',');
-        current_word++; 
+        return BUZZ_GPS_ERROR;
     }
+    out_location->lattitude = fix.latitude;
+    out_location->longitude = fix.longitude;
 
-    return current_word;
+    return BUZZ_GPS_SUCCESS;
 }
 
 
-static buzz_gps_location_t * buzz_l_parse_out_location(
-    char ** words,
-    const int word_count,
-    const int parsed_word_count,
-    const int lat_ndx,
-    const int lon_ndx,
-    const int lat_hem_ndx,
-    const int lon_hem_ndx)
+int buzz_gps_get_last_known_fix(
+    buzz_gps_handle_t gps_handle, buzz_gps_fix_t * out_fix)
 {
-    int rc;
-    buzz_gps_location_t * location;
-    float lat;
-    float lon;
-
-    if (parsed_word_count < word_count)
-    {
-        buzz_logger(BUZZ_ERROR, "bad word count %d %d", word_count, parsed_word_count);
-        return NULL;
-    }
-    rc = buzz_l_daysmins_to_float(words[lat_ndx], *words[lat_hem_ndx], &lat);
-    if (rc != BUZZ_GPS_SUCCESS)
-    {
-        buzz_logger(BUZZ_ERROR, "Failed to get lat: %s %c", words[lat_ndx], *words[lat_hem_ndx]);
-        return NULL;
-    }
-    rc = buzz_l_daysmins_to_float(words[lon_ndx], *words[lon_hem_ndx], &lon);
-    if (rc != BUZZ_GPS_SUCCESS)
+    BUZZ_SEQLOCK_READ(gps_handle->last_fix_snapshot, out_fix);
+    if (out_fix->flags == 0)
     {
-        buzz_logger(BUZZ_ERROR, "Failed to get lon: %s %c", words[lat_ndx], *words[lat_hem_ndx]);
-        return NULL;
+        return BUZZ_GPS_ERROR;
     }
-
-    location = (buzz_gps_location_t *) calloc(1, sizeof(buzz_gps_location_t));
-    location->lattitude = lat;
-    location->longitude = lon;
-
-    return location;
+    return BUZZ_GPS_SUCCESS;
 }
 
 
-static int buzz_l_parse_gprmc(buzz_gps_raw_event_t * raw_event, buzz_gps_event_t * out_event)
+int buzz_gps_set_filter(
+    buzz_gps_handle_t gps_handle,
+    buzz_gps_filter_model_t model,
+    double process_noise)
 {
-    buzz_gps_location_t * location;
-
-    buzz_logger(BUZZ_INFO, "In RMC parser");
-    location = buzz_l_parse_out_location(raw_event->words, 7, raw_event->word_count, 3, 5, 4, 6);
-    if (location == NULL)
+    if (atomic_load(&gps_handle->running) || gps_handle->reactor != NULL)
     {
+        BUZZ_LOG_WARN("Set the filter before starting the handle");
         return BUZZ_GPS_ERROR;
     }
-    out_event->location = location;
-    
+    buzz_filter_reset(&gps_handle->filter, model, process_noise);
+
     return BUZZ_GPS_SUCCESS;
 }
 
 
-static int buzz_l_parse_gpgll(buzz_gps_raw_event_t * raw_event, buzz_gps_event_t * out_event)
+int buzz_gps_predict(
+    buzz_gps_handle_t gps_handle,
+    uint64_t t_monotonic_ns,
+    buzz_gps_prediction_t * out_prediction)
 {
-    buzz_gps_location_t * location;
-    
-    buzz_logger(BUZZ_INFO, "In GLL parser");
-    location = buzz_l_parse_out_location(raw_event->words, 5, raw_event->word_count, 1, 3, 2, 4);
-    if (location == NULL)
+    return buzz_filter_predict(&gps_handle->filter, t_monotonic_ns, out_prediction);
+}
+
+
+int buzz_gps_set_fix_callback(
+    buzz_gps_handle_t gps_handle,
+    buzz_gps_fix_callback_t fix_cb,
+    void * user_arg)
+{
+    if (atomic_load(&gps_handle->running))
     {
+        BUZZ_LOG_WARN("Set the fix callback before starting the handle");
         return BUZZ_GPS_ERROR;
     }
-    out_event->location = location;
-    
+    gps_handle->fix_cb = fix_cb;
+    gps_handle->fix_user_arg = user_arg;
+
     return BUZZ_GPS_SUCCESS;
 }
 
 
 /*
- * read until we get a location or an error 
- *
- * must be called locked
+ * Hand a finished epoch to the recorders it is attached to and the epoch
+ * callback
  */
-static int buzz_l_get_events(
-    buzz_gps_handle_t gps_handle,
-    buzz_gps_raw_event_t * out_raw,
-    buzz_gps_event_t * out_event)
+static void buzz_l_epoch_done(const buzz_gps_fix_t * fix, void * user_arg)
 {
-    int rc;
-    
-    rc = buzz_l_get_raw_event(gps_handle, out_raw);
-    if (rc != BUZZ_GPS_SUCCESS)
+    buzz_gps_handle_t gps_handle = (buzz_gps_handle_t) user_arg;
+
+    if (gps_handle->store != NULL)
     {
-        buzz_logger(BUZZ_INFO, "Error getting raw sentence");
-        return BUZZ_GPS_RAW_SENTENCE;
+        buzz_store_add_fix(gps_handle->store, gps_handle->store_receiver, fix);
+    }
+    if (gps_handle->track != NULL)
+    {
+        buzz_gps_track_append(gps_handle->track, fix);
+    }
+    if (gps_handle->spatial != NULL)
+    {
+        buzz_gps_spatial_insert(gps_handle->spatial, gps_handle->spatial_receiver, fix);
+    }
+    if (gps_handle->geofence != NULL)
+    {
+        buzz_gps_geofence_update(gps_handle->geofence, fix);
+    }
+    if (gps_handle->epoch_cb != NULL)
+    {
+        gps_handle->epoch_cb(fix, gps_handle->epoch_user_arg);
     }
-    buzz_logger(BUZZ_DEBUG, "Found event type %d", out_raw->type);
-    memset(out_event, '\0', sizeof(buzz_gps_event_t));
-    rc = buzz_l_get_full_event(gps_handle, out_raw, out_event);
-
-    return rc;
 }
 
 
-static int buzz_l_get_raw_event(buzz_gps_handle_t gps_handle, buzz_gps_raw_event_t * raw_event)
+/*
+ * Turn fusion on while anything wants the epochs
+ */
+static void buzz_l_update_fusion(buzz_gps_handle_t gps_handle)
 {
-    int rc;
+    buzz_i_fusion_t * fusion = &gps_handle->fusion;
 
-    buzz_logger(BUZZ_DEBUG, "Reading a sentence from the GPS device...");
-    rc = buzz_l_read_sentence(gps_handle, raw_event->buffer, BUZZ_GPS_MAX_LINE);
-    if (rc != BUZZ_GPS_SUCCESS)
+    if (gps_handle->epoch_cb != NULL || gps_handle->store != NULL || gps_handle->track != NULL
+        || gps_handle->spatial != NULL || gps_handle->geofence != NULL)
     {
-        return BUZZ_GPS_ERROR;
+        fusion->cb = buzz_l_epoch_done;
+        fusion->user_arg = gps_handle;
     }
-
-    memcpy(raw_event->sentence, raw_event->buffer, BUZZ_GPS_MAX_LINE);
-    buzz_logger(BUZZ_INFO, "Read the sentence: %s", raw_event->buffer);
-
-    raw_event->word_count = buzz_l_split_sentence(raw_event->buffer, BUZZ_GPS_MAX_LINE, raw_event->words, BUZZ_GPS_MAX_PARSE_WORDS);
-    if(raw_event->word_count < 1)
+    else
     {
-        return BUZZ_GPS_ERROR;
+        fusion->cb = NULL;
     }
+    if (fusion->timeout_ns == 0)
+    {
+        fusion->timeout_ns = (uint64_t) BUZZ_GPS_DEFAULT_EPOCH_TIMEOUT_MS * 1000000u;
+    }
+    fusion->open = 0;
+}
 
-    buzz_logger(BUZZ_DEBUG, "Parsing sentence type %s of %d words", raw_event->words[0], raw_event->word_count);
-    raw_event->type = buzz_l_nmea_get_string_type(raw_event->words[0]);
 
-    int word_count = buzz_l_split_sentence(raw_event->buffer, BUZZ_GPS_MAX_LINE, raw_event->words, BUZZ_GPS_MAX_PARSE_WORDS);
-    if(word_count < 1)
+int buzz_gps_set_epoch_callback(
+    buzz_gps_handle_t gps_handle,
+    buzz_gps_fix_callback_t epoch_cb,
+    int timeout_ms,
+    void * user_arg)
+{
+    if (atomic_load(&gps_handle->running) || gps_handle->reactor != NULL)
     {
+        BUZZ_LOG_WARN("Set the epoch callback before starting the handle");
         return BUZZ_GPS_ERROR;
     }
+    if (timeout_ms <= 0)
+    {
+        timeout_ms = BUZZ_GPS_DEFAULT_EPOCH_TIMEOUT_MS;
+    }
+    gps_handle->epoch_cb = epoch_cb;
+    gps_handle->epoch_user_arg = user_arg;
+    gps_handle->fusion.timeout_ns = (uint64_t) timeout_ms * 1000000u;
+    buzz_l_update_fusion(gps_handle);
 
     return BUZZ_GPS_SUCCESS;
 }
 
 
-static int buzz_l_get_full_event(buzz_gps_handle_t gps_handle, buzz_gps_raw_event_t * raw_event, buzz_gps_event_t * out_event)
+int buzz_gps_store_attach(buzz_gps_store_t store, buzz_gps_handle_t gps_handle, int receiver_id)
 {
-    nmea_i_parser_t * parser_ent;
-    int rc;
-
-    parser_ent = &g_nmea_sentence_map[raw_event->type];
-    if (parser_ent->parser_func == NULL)
+    if (atomic_load(&gps_handle->running) || gps_handle->reactor != NULL)
     {
-        buzz_logger(BUZZ_INFO, "parser func is null");
-        return BUZZ_GPS_EVENT_NOT_FOUND; 
+        BUZZ_LOG_WARN("Attach the track store before starting the handle");
+        return BUZZ_GPS_ERROR;
     }
+    gps_handle->store = store;
+    gps_handle->store_receiver = receiver_id;
+    buzz_l_update_fusion(gps_handle);
 
-    rc = parser_ent->parser_func(raw_event, out_event);
-    buzz_logger(BUZZ_WARN, "parser func rc is %d", rc);
-
-    return rc;
+    return BUZZ_GPS_SUCCESS;
 }
 
 
-static void * buzz_l_gather_thread(void * arg)
+int buzz_gps_track_attach(buzz_gps_track_writer_t writer, buzz_gps_handle_t gps_handle)
 {
-    buzz_gps_handle_t gps_handle = (buzz_gps_handle_t) arg;
-    int rc;
-    struct timespec waittime;
-    buzz_gps_raw_event_t raw_event;
-    buzz_gps_event_t event;
-
-    pthread_mutex_lock(&gps_handle->mutex);
+    if (atomic_load(&gps_handle->running) || gps_handle->reactor != NULL)
     {
-        while(gps_handle->running)
-        {
-            rc = buzz_l_get_raw_event(gps_handle, &raw_event);
-            if (rc != BUZZ_GPS_SUCCESS)
-            {
-                buzz_logger(BUZZ_ERROR, "failed to get a sentence");
-
-                waittime.tv_sec = gps_handle->error_interval + time(NULL);;
-                waittime.tv_nsec = 0;
-            }
-            else
-            {
-                /* for now send out the callbacks under lock */
-                if (gps_handle->raw_cb != NULL)
-                {
-                    gps_handle->raw_cb(&raw_event, gps_handle->user_arg);
-                }
-                rc = buzz_l_get_full_event(gps_handle, &raw_event, &event);
-                if (rc == BUZZ_GPS_SUCCESS)
-                {
-                    /* freeing the data here is convenient but will allow users of callback 
-                    think they can use the structures beyond the life time of the callbackk. We
-                    must document this */
-                    if (event.location != NULL)
-                    {
-                        if (gps_handle->last_location != NULL)
-                        {
-                            free(gps_handle->last_location);     
-                        }
-                        gps_handle->last_location = event.location;
-                    }
-                    if (event.speed != NULL)
-                    {
-                        if (gps_handle->last_speed != NULL)
-                        {
-                            free(gps_handle->last_speed);
-                        }
-                        gps_handle->last_speed = event.speed;
-
-                    }
-                    if (event.altitude != NULL)
-                    {
-                        if (gps_handle->last_altitude != NULL)
-                        {
-                            free(gps_handle->last_altitude);
-                        }
-                        gps_handle->last_altitude = event.altitude;
-                    }
-                    if (gps_handle->event_cb != NULL)
-                    {
-                        gps_handle->event_cb(&event, gps_handle->user_arg);
-                    }
-                }
-                waittime.tv_sec = gps_handle->interval_time + time(NULL);
-                waittime.tv_nsec = 0;
-            }
-
-            pthread_cond_timedwait(&gps_handle->cond, &gps_handle->mutex, &waittime);
-        }
+        BUZZ_LOG_WARN("Attach the track file before starting the handle");
+        return BUZZ_GPS_ERROR;
     }
-    pthread_mutex_unlock(&gps_handle->mutex);
+    gps_handle->track = writer;
+    buzz_l_update_fusion(gps_handle);
 
-    return NULL;
+    return BUZZ_GPS_SUCCESS;
 }
 
 
-int buzz_gps_init(
-    buzz_gps_handle_t * out_handle,
-    const char * serial_path,
-    speed_t baud,
-    int options)
+int buzz_gps_spatial_attach(buzz_gps_spatial_t index, buzz_gps_handle_t gps_handle, int receiver_id)
 {
-
-    buzz_i_gps_handle_t * new_handle;
-    struct termios tty;
-
-    if (!g_nmea_sentence_map_initialized)
-    {
-        buzz_logger(BUZZ_DEBUG, "Setting up the sentence parse in global memory");
-        buzz_l_initialize_map();
-    }
-
-    buzz_logger(BUZZ_DEBUG, "Opening the serial port for bluetooth");
-    new_handle = (buzz_i_gps_handle_t *) calloc(1, sizeof(buzz_i_gps_handle_t));
-    new_handle->serial_port = open(serial_path, O_RDWR);
-    if (new_handle->serial_port < 0)
+    if (atomic_load(&gps_handle->running) || gps_handle->reactor != NULL)
     {
-        buzz_logger(BUZZ_ERROR, "Failed to open %s: %s", serial_path, strerror(errno));
-        goto error;
-    }
-
-    /* Only set options in not in debug mode */
-    if ((options | BUZZ_GPS_OPTIONS_DEBUG) == 0)
-    {
-        buzz_logger(BUZZ_DEBUG, "Setting tty options");
-        memset(&tty, 0, sizeof(tty));
-        if(tcgetattr(new_handle->serial_port, &tty) != 0) {
-            buzz_logger(BUZZ_ERROR, "Error %i from tcgetattr: %s\n", errno, strerror(errno));
-            goto error;
-        }
-        cfsetospeed (&tty, baud);
+        BUZZ_LOG_WARN("Attach the spatial index before starting the handle");
+        return BUZZ_GPS_ERROR;
     }
-    
-    pthread_cond_init(&new_handle->cond, NULL);
-    pthread_mutex_init(&new_handle->mutex, NULL);
-
-    *out_handle = new_handle;
+    gps_handle->spatial = index;
+    gps_handle->spatial_receiver = receiver_id;
+    buzz_l_update_fusion(gps_handle);
 
     return BUZZ_GPS_SUCCESS;
-error:
-    free(new_handle);
-    return BUZZ_GPS_ERROR;
 }
 
 
-int buzz_gps_destroy(buzz_gps_handle_t handle)
+int buzz_gps_geofence_attach(buzz_gps_geofence_t engine, buzz_gps_handle_t gps_handle)
 {
-    if (handle->running)
+    if (atomic_load(&gps_handle->running) || gps_handle->reactor != NULL)
     {
-        buzz_logger(BUZZ_WARN, "Trying to destroy a running handle. Call stop first");
+        BUZZ_LOG_WARN("Attach the geofence engine before starting the handle");
         return BUZZ_GPS_ERROR;
     }
-    close(handle->serial_port);
-    free(handle);
-    pthread_cond_destroy(&handle->cond);
-    pthread_mutex_destroy(&handle->mutex);
+    gps_handle->geofence = engine;
+    buzz_l_update_fusion(gps_handle);
+
     return BUZZ_GPS_SUCCESS;
 }
 
 
-int buzz_gps_get_event_blocking(
+int buzz_gps_set_dispatch(
     buzz_gps_handle_t gps_handle,
-    buzz_gps_raw_event_t * out_raw,
-    buzz_gps_event_t * out_event)
+    size_t queue_size,
+    buzz_gps_overflow_policy_t policy)
 {
-    int rc;
-
-    pthread_mutex_lock(&gps_handle->mutex);
+    if (atomic_load(&gps_handle->running))
     {
-        rc = buzz_l_get_events(gps_handle, out_raw, out_event);
+        BUZZ_LOG_WARN("Set the dispatch options before starting the handle");
+        return BUZZ_GPS_ERROR;
     }
-    pthread_mutex_unlock(&gps_handle->mutex);
+    if (queue_size == 0)
+    {
+        return BUZZ_GPS_ERROR;
+    }
+    gps_handle->dispatch_queue_size = queue_size;
+    gps_handle->dispatch_policy = policy;
 
-    return rc;
+    return BUZZ_GPS_SUCCESS;
 }
 
 
-
-int buzz_gps_get_last_known_location(
-    buzz_gps_handle_t gps_handle, buzz_gps_location_t * out_location)
+int buzz_gps_get_stats(buzz_gps_handle_t gps_handle, buzz_gps_stats_t * out_stats)
 {
-    int rc;
+    buzz_i_handle_stats_t * stats = &gps_handle->stats;
+    buzz_i_framer_t * framer = &gps_handle->framer;
+    int i;
 
-    pthread_mutex_lock(&gps_handle->mutex);
+    memset(out_stats, '\0', sizeof(buzz_gps_stats_t));
+    buzz_dispatch_get_stats(&gps_handle->dispatcher, out_stats);
+
+    out_stats->bytes_read = BUZZ_STAT_LOAD(framer->bytes_read);
+    out_stats->sentences_framed = BUZZ_STAT_LOAD(framer->sentences);
+    out_stats->overlong_lines = BUZZ_STAT_LOAD(framer->overlong_lines);
+    out_stats->resync_bytes = BUZZ_STAT_LOAD(framer->resync_bytes);
+
+    out_stats->checksum_errors = BUZZ_STAT_LOAD(stats->checksum_errors);
+    out_stats->unknown_sentences = BUZZ_STAT_LOAD(stats->unknown_sentences);
+    for (i = 0; i < BUZZ_GPS_TYPE_COUNT; i++)
     {
-        if (gps_handle->last_location == NULL)
-        {
-            rc = BUZZ_GPS_ERROR;
-        }
-        else
-        {
-            out_location->lattitude = gps_handle->last_location->lattitude;
-            out_location->longitude = gps_handle->last_location->longitude;
-            rc = BUZZ_GPS_SUCCESS;
-        }
+        out_stats->parse_ok[i] = BUZZ_STAT_LOAD(stats->parse_ok[i]);
+        out_stats->parse_failed[i] = BUZZ_STAT_LOAD(stats->parse_failed[i]);
+        out_stats->parse_ignored[i] = BUZZ_STAT_LOAD(stats->parse_ignored[i]);
     }
-    pthread_mutex_unlock(&gps_handle->mutex);
 
-    return rc;
+    out_stats->callbacks = BUZZ_STAT_LOAD(stats->callbacks);
+    out_stats->callback_ns = BUZZ_STAT_LOAD(stats->callback_ns);
+    out_stats->epochs = BUZZ_STAT_LOAD(gps_handle->fusion.epochs);
+    buzz_histogram_read(&stats->read_to_parse, &out_stats->read_to_parse);
+    buzz_histogram_read(&stats->parse_to_callback, &out_stats->parse_to_callback);
+    buzz_histogram_read(&stats->callback, &out_stats->callback);
+    buzz_histogram_read(&stats->total, &out_stats->total);
+
+    return BUZZ_GPS_SUCCESS;
 }
 
 
@@ -571,12 +1567,41 @@ int buzz_gps_start(buzz_gps_handle_t gps_handle,
                    buzz_gps_event_callback_t event_cb,
                    void * user_arg)
 {
-    if (gps_handle->running)
+    int rc;
+
+    if (atomic_load(&gps_handle->running))
+    {
+        BUZZ_LOG_WARN("Attempting to start a running handle");
+        return BUZZ_GPS_ERROR;
+    }
+    if (gps_handle->reactor != NULL)
     {
-        buzz_logger(BUZZ_WARN, "Attempting to start a running handle");
+        BUZZ_LOG_WARN("Attempting to start a handle owned by a reactor");
         return BUZZ_GPS_ERROR;
     }
 
+    if (pipe(gps_handle->wake_pipe) != 0)
+    {
+        BUZZ_LOG_ERROR("Failed to create the wake pipe: %s", strerror(errno));
+        return BUZZ_GPS_ERROR;
+    }
+    rc = buzz_dispatch_init(
+        &gps_handle->dispatcher,
+        gps_handle->dispatch_queue_size,
+        gps_handle->dispatch_policy,
+        buzz_handle_deliver,
+        buzz_handle_idle,
+        gps_handle);
+    if (rc != BUZZ_GPS_SUCCESS)
+    {
+        goto error_pipe;
+    }
+    rc = buzz_dispatch_start(&gps_handle->dispatcher);
+    if (rc != BUZZ_GPS_SUCCESS)
+    {
+        goto error_dispatch;
+    }
+
     pthread_mutex_lock(&gps_handle->mutex);
     {
         gps_handle->raw_cb = raw_cb;
@@ -584,28 +1609,83 @@ int buzz_gps_start(buzz_gps_handle_t gps_handle,
         gps_handle->user_arg = user_arg;
         gps_handle->interval_time = interval_time;
         gps_handle->error_interval = error_interval;
-        gps_handle->running = 1;
-        pthread_create(&gps_handle->thread_id, NULL, buzz_l_gather_thread, gps_handle);
+        gps_handle->replay.finished = 0;
+        atomic_store(&gps_handle->running, 1);
+        rc = pthread_create(&gps_handle->thread_id, NULL, buzz_l_gather_thread, gps_handle);
     }
     pthread_mutex_unlock(&gps_handle->mutex);
+    if (rc != 0)
+    {
+        BUZZ_LOG_ERROR("Failed to start the gather thread");
+        atomic_store(&gps_handle->running, 0);
+        buzz_dispatch_stop(&gps_handle->dispatcher);
+        goto error_dispatch;
+    }
 
     return BUZZ_GPS_SUCCESS;
+
+error_dispatch:
+    buzz_dispatch_destroy(&gps_handle->dispatcher);
+error_pipe:
+    close(gps_handle->wake_pipe[0]);
+    close(gps_handle->wake_pipe[1]);
+    return BUZZ_GPS_ERROR;
 }
 
 
 int buzz_gps_stop(buzz_gps_handle_t gps_handle)
 {
+    char c = 0;
+
+    if (!atomic_load(&gps_handle->running))
+    {
+        BUZZ_LOG_WARN("Attempting to stop a handle that is not running");
+        return BUZZ_GPS_ERROR;
+    }
+
+    BUZZ_LOG_INFO("Shutting down gps thread");
+    atomic_store(&gps_handle->running, 0);
+    if (write(gps_handle->wake_pipe[1], &c, 1) != 1)
+    {
+        BUZZ_LOG_ERROR("Failed to wake the gps thread: %s", strerror(errno));
+    }
 
+    BUZZ_LOG_INFO("waiting for the thread to end");
+    pthread_join(gps_handle->thread_id, NULL);
     pthread_mutex_lock(&gps_handle->mutex);
     {
-        buzz_logger(BUZZ_INFO, "Shutting down gps thread");
-        gps_handle->running = 0;
-        pthread_cond_broadcast(&gps_handle->cond);
+        pthread_cond_broadcast(&gps_handle->replay.finished_cond);
     }
     pthread_mutex_unlock(&gps_handle->mutex);
 
-    buzz_logger(BUZZ_INFO, "waiting for the thread to end");
-    pthread_join(gps_handle->thread_id, NULL);
+    /* events already queued are still delivered, and the epoch they were part of */
+    buzz_dispatch_stop(&gps_handle->dispatcher);
+    buzz_dispatch_destroy(&gps_handle->dispatcher);
+    buzz_handle_flush(gps_handle);
+    close(gps_handle->wake_pipe[0]);
+    close(gps_handle->wake_pipe[1]);
+
+    return BUZZ_GPS_SUCCESS;
+}
+
+
+int buzz_gps_replay_wait(buzz_gps_handle_t gps_handle)
+{
+    if (!gps_handle->replay.active || !atomic_load(&gps_handle->running))
+    {
+        BUZZ_LOG_WARN("Waiting on a handle that is not replaying");
+        return BUZZ_GPS_ERROR;
+    }
+
+    pthread_mutex_lock(&gps_handle->mutex);
+    {
+        /* buzz_gps_stop() also wakes this */
+        while (!gps_handle->replay.finished && atomic_load(&gps_handle->running))
+        {
+            pthread_cond_wait(&gps_handle->replay.finished_cond, &gps_handle->mutex);
+        }
+    }
+    pthread_mutex_unlock(&gps_handle->mutex);
 
     return BUZZ_GPS_SUCCESS;
 }
@@ -617,12 +1697,32 @@ int buzz_gps_location_transform(
     float * out_location)
 {
     int rc;
+    double v;
 
-    rc = buzz_l_daysmins_to_float(location_str, hemisphere, out_location);
+    rc = buzz_gps_location_transform_double(location_str, hemisphere, &v);
+    if (rc == BUZZ_GPS_SUCCESS)
+    {
+        *out_location = v;
+    }
     return rc;
 }
 
 
+int buzz_gps_location_transform_double(
+    const char * location_str,
+    const char hemisphere,
+    double * out_location)
+{
+    size_t len;
+
+    /* like the scanf this replaces, parse the number at the front of the string */
+    len = strspn(location_str, "0123456789.");
+    BUZZ_LOG_DEBUG("converting %.*s %c", (int) len, location_str, hemisphere);
+
+    return buzz_nmea_parse_coordinate(location_str, len, hemisphere, out_location);
+}
+
+
 int buzz_gps_free_blocking_event(buzz_gps_event_t * out_event)
 {
     if (out_event == NULL)
@@ -643,3 +1743,17 @@ int buzz_gps_free_blocking_event(buzz_gps_event_t * out_event)
     }
     return BUZZ_GPS_SUCCESS;
 }
+
+
+const char * buzz_gps_raw_field(
+    const buzz_gps_raw_event_t * raw_event,
+    int ndx,
+    size_t * out_len)
+{
+    if (ndx < 0 || ndx >= raw_event->field_count)
+    {
+        return NULL;
+    }
+    *out_len = raw_event->fields[ndx].length;
+    return &raw_event->sentence[raw_event->fields[ndx].offset];
+}
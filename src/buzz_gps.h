@@ -7,20 +7,28 @@
 #include <errno.h>
 #include <pthread.h>
 #include <time.h>
+#include <stdint.h>
 
 #define BUZZ_SENTENCE_MAX_LENGTH 80
 #define BUZZ_GPS_OPTIONS_NONE 0
 #define BUZZ_GPS_OPTIONS_DEBUG 0x01
+/* skip building the words[] compatibility view of raw events */
+#define BUZZ_GPS_OPTIONS_NO_WORDS 0x02
+/* accept sentences with a bad checksum, for trusted sources */
+#define BUZZ_GPS_OPTIONS_SKIP_CHECKSUM 0x04
 
 
 #define BUZZ_GPS_MAX_LINE 128
 #define BUZZ_GPS_MAX_PARSE_WORDS 32
 
 /*
- *  All supported RMEA sentence types
+ *  All supported RMEA sentence types. The names carry the GP prefix for
+ *  historical reasons but the type is the same whichever talker sent it,
+ *  see buzz_talker_t.
  */
 typedef enum buzz_sentence_type_e
 {
+    BUZZ_GPS_TYPE_UNKNOWN = -1,
     BUZZ_GPGGA = 0, // 	Global positioning system fix data (time, position, fix type data)
     BUZZ_GPGLL, // 	Geographic position, latitude, longitude
     BUZZ_GPVTG, // 	Course and speed information relative to the ground
@@ -36,26 +44,265 @@ typedef enum buzz_sentence_type_e
     BUZZ_GPS_TYPE_COUNT
 } buzz_sentence_type_t;
 
+/*
+ *  The talker ID, the two characters after the '$'
+ */
+typedef enum buzz_talker_e
+{
+    BUZZ_TALKER_UNKNOWN = 0,
+    BUZZ_TALKER_GP, // GPS
+    BUZZ_TALKER_GL, // GLONASS
+    BUZZ_TALKER_GA, // Galileo
+    BUZZ_TALKER_GB, // BeiDou
+    BUZZ_TALKER_BD, // BeiDou, older receivers
+    BUZZ_TALKER_GQ, // QZSS
+    BUZZ_TALKER_GN, // Combined solution from multiple constellations
+
+    BUZZ_TALKER_COUNT
+} buzz_talker_t;
+
 typedef enum buzz_gps_error_e
 {
     BUZZ_GPS_SUCCESS = 0,
     BUZZ_GPS_ERROR,
     BUZZ_GPS_RAW_SENTENCE,
     BUZZ_GPS_NOT_FOUND,
-    BUZZ_GPS_EVENT_NOT_FOUND
+    BUZZ_GPS_EVENT_NOT_FOUND,
+    BUZZ_GPS_END_OF_DATA
 } buzz_gps_error_t;
 
 
+/*
+ *  How fast a recorded log is fed to the parser
+ */
+typedef enum buzz_gps_replay_mode_e
+{
+    /* as fast as the sentences can be parsed */
+    BUZZ_GPS_REPLAY_FAST = 0,
+    /* paced by the UTC times in the sentences */
+    BUZZ_GPS_REPLAY_REALTIME,
+    /* paced by the UTC times, sped up by the given factor */
+    BUZZ_GPS_REPLAY_SCALED
+} buzz_gps_replay_mode_t;
+
+
+/*
+ *  What the reading thread does when the callbacks fall behind and the
+ *  event queue is full
+ */
+typedef enum buzz_gps_overflow_policy_e
+{
+    BUZZ_GPS_OVERFLOW_BLOCK = 0,    // wait for the callbacks to catch up
+    BUZZ_GPS_OVERFLOW_DROP_OLDEST,  // discard the oldest queued event
+    BUZZ_GPS_OVERFLOW_DROP_NEWEST   // discard the event that did not fit
+} buzz_gps_overflow_policy_t;
+
+#define BUZZ_GPS_DEFAULT_QUEUE_SIZE 64
+
+#define BUZZ_GPS_DEFAULT_EPOCH_TIMEOUT_MS 500
+
+#define BUZZ_GPS_LATENCY_BUCKETS 40
+
+/*
+ *  Latency distribution. buckets[0] counts 0 ns, buckets[i] counts
+ *  [2^(i-1), 2^i) ns and the last bucket also everything longer.
+ */
+typedef struct buzz_gps_histogram_s
+{
+    uint64_t buckets[BUZZ_GPS_LATENCY_BUCKETS];
+} buzz_gps_histogram_t;
+
+/*
+ *  Counters kept for a handle. They are always on and cheap to keep.
+ */
+typedef struct buzz_gps_stats_s
+{
+    uint64_t events_queued;
+    uint64_t events_dispatched;
+    uint64_t events_dropped_oldest;
+    uint64_t events_dropped_newest;
+    uint64_t producer_blocked;      // times the reader waited for queue space
+    uint64_t queue_high_water;
+
+    uint64_t bytes_read;
+    uint64_t sentences_framed;
+    uint64_t overlong_lines;        // dropped for exceeding BUZZ_GPS_MAX_LINE
+    uint64_t resync_bytes;          // skipped looking for the next '$'
+    uint64_t checksum_errors;       // sentences dropped for a bad checksum
+    uint64_t unknown_sentences;     // sentence type not recognised
+    uint64_t parse_ok[BUZZ_GPS_TYPE_COUNT];
+    uint64_t parse_failed[BUZZ_GPS_TYPE_COUNT];
+    uint64_t parse_ignored[BUZZ_GPS_TYPE_COUNT];    // no parser for the type
+
+    uint64_t callbacks;             // events handed to the callbacks
+    uint64_t callback_ns;           // total time spent in the callbacks
+    uint64_t epochs;                // fused fixes handed on by epoch fusion
+
+    /* where the time goes between reading a sentence and its callbacks */
+    buzz_gps_histogram_t read_to_parse;     // first byte read to parsed
+    buzz_gps_histogram_t parse_to_callback; // waiting in the event queue
+    buzz_gps_histogram_t callback;          // running the callbacks
+    buzz_gps_histogram_t total;             // first byte read to callbacks returned
+} buzz_gps_stats_t;
+
+
 typedef struct buzz_i_gps_handle_s * buzz_gps_handle_t;
 
+typedef struct buzz_i_gps_reactor_s * buzz_gps_reactor_t;
+
+typedef struct buzz_i_gps_store_s * buzz_gps_store_t;
+
+/* buzz_gps_store_open() options */
+#define BUZZ_GPS_STORE_FIXES     0x0
+/* also record every raw sentence read */
+#define BUZZ_GPS_STORE_SENTENCES 0x1
+
+#define BUZZ_GPS_STORE_DEFAULT_BATCH 1024
+#define BUZZ_GPS_STORE_DEFAULT_FLUSH_MS 250
+
+typedef struct buzz_i_track_writer_s * buzz_gps_track_writer_t;
+
+typedef struct buzz_i_track_reader_s * buzz_gps_track_reader_t;
+
+#define BUZZ_GPS_TRACK_DEFAULT_BLOCK_ROWS 4096
+
+typedef struct buzz_gps_track_stats_s
+{
+    uint64_t rows;                  // rows in the file, including earlier sessions
+    uint64_t skipped;               // fixes without a timestamp and position, or out of time order
+    uint64_t errors;                // blocks that failed to write
+} buzz_gps_track_stats_t;
+
+/*
+ *  Consecutive rows of a track file, pointing straight into the mapping.
+ *  altitude and speed_knots are NaN where the fix had none.
+ */
+typedef struct buzz_gps_track_span_s
+{
+    size_t count;
+    const int64_t * utc_ns;
+    const double * latitude;
+    const double * longitude;
+    const float * altitude;
+    const float * speed_knots;
+} buzz_gps_track_span_t;
+
+typedef struct buzz_gps_track_cursor_s
+{
+    buzz_gps_track_reader_t reader;
+    size_t block;
+    int64_t from_ns;
+    int64_t to_ns;
+} buzz_gps_track_cursor_t;
+
+typedef struct buzz_i_spatial_index_s * buzz_gps_spatial_t;
+
+/*
+ *  A point found by a spatial query. The position is the indexed one,
+ *  rounded to about a centimeter.
+ */
+typedef struct buzz_gps_spatial_hit_s
+{
+    int64_t utc_ns;
+    int receiver;
+    double latitude;
+    double longitude;
+} buzz_gps_spatial_hit_t;
+
+typedef struct buzz_i_simplifier_s * buzz_gps_simplifier_t;
+
+#define BUZZ_GPS_SIMPLIFY_DEFAULT_WINDOW 256
+#define BUZZ_GPS_SIMPLIFY_DEFAULT_GAP_MS 60000
+
+/*
+ *  Running state of a delta encoder or decoder, both ends start from
+ *  buzz_gps_delta_reset()
+ */
+typedef struct buzz_gps_delta_state_s
+{
+    int64_t time_ms;
+    int64_t latitude;
+    int64_t longitude;
+    int64_t altitude;
+    int64_t speed;
+} buzz_gps_delta_state_t;
+
+/* the most bytes buzz_gps_delta_encode() writes for one fix */
+#define BUZZ_GPS_DELTA_MAX_RECORD 51
+
+typedef struct buzz_i_geofence_engine_s * buzz_gps_geofence_t;
+
+/*
+ * Implementations of the batch geodesy functions, BUZZ_GPS_GEODESY_AUTO
+ * picks the fastest the CPU supports
+ */
+typedef enum buzz_gps_geodesy_kernel_e
+{
+    BUZZ_GPS_GEODESY_AUTO,
+    BUZZ_GPS_GEODESY_SCALAR,
+    BUZZ_GPS_GEODESY_SSE2,
+    BUZZ_GPS_GEODESY_AVX2
+} buzz_gps_geodesy_kernel_t;
+
+/* motion models of the position filter, see buzz_gps_set_filter() */
+typedef enum buzz_gps_filter_model_e
+{
+    BUZZ_GPS_FILTER_NONE,
+    BUZZ_GPS_FILTER_CONSTANT_VELOCITY,
+    BUZZ_GPS_FILTER_CONSTANT_ACCELERATION
+} buzz_gps_filter_model_t;
+
+typedef struct buzz_gps_prediction_s
+{
+    double latitude;
+    double longitude;
+    double east_mps;                // velocity in meters per second
+    double north_mps;
+    double speed_knots;
+    double course;                  // true course in degrees
+    double sigma_meters;            // one standard deviation of the position
+    int64_t age_ns;                 // time since the last reading, negative for the past
+} buzz_gps_prediction_t;
+
+typedef struct buzz_gps_store_stats_s
+{
+    uint64_t fixes;                 // rows written to the fixes table
+    uint64_t sentences;             // rows written to the sentences table
+    uint64_t transactions;
+    uint64_t dropped;               // records discarded because the queue was full
+    uint64_t errors;                // rows the database refused
+} buzz_gps_store_stats_t;
+
+/*
+ * Position of one comma separated field inside a raw sentence
+ */
+typedef struct buzz_gps_field_s
+{
+    unsigned char offset;
+    unsigned char length;
+} buzz_gps_field_t;
+
 /*
  * Parsed out raw string
+ *
+ * sentence holds the line exactly as it was read and is never modified.
+ * fields[] locates each field inside it. buffer/words[]/word_count are a
+ * compatibility view built from fields[]: buffer is a copy of sentence with
+ * the commas replaced by NULs and words[] point into it. The view is not
+ * built (word_count is 0) when the handle uses BUZZ_GPS_OPTIONS_NO_WORDS.
  */
 typedef struct buzz_gps_raw_event_s
 {
     buzz_sentence_type_t type;
+    buzz_talker_t talker;
 
     char sentence[BUZZ_GPS_MAX_LINE];
+    int length;
+    /* CLOCK_MONOTONIC time in ns at which the first byte of sentence was read */
+    uint64_t received_ns;
+    buzz_gps_field_t fields[BUZZ_GPS_MAX_PARSE_WORDS];
+    int field_count;
+
     char buffer[BUZZ_GPS_MAX_LINE];
     char * words[BUZZ_GPS_MAX_PARSE_WORDS];
     int word_count;
@@ -78,16 +325,127 @@ typedef struct buzz_gps_altitude_s
     float altitude_meters;
 } buzz_gps_altitude_t;
 
+/*
+ * Flags telling which parts of a buzz_gps_fix_t were filled in
+ */
+#define BUZZ_GPS_FIX_LOCATION   0x0001
+#define BUZZ_GPS_FIX_SPEED      0x0002
+#define BUZZ_GPS_FIX_ALTITUDE   0x0004
+#define BUZZ_GPS_FIX_TIME       0x0008
+#define BUZZ_GPS_FIX_DATE       0x0010
+#define BUZZ_GPS_FIX_COURSE     0x0020
+#define BUZZ_GPS_FIX_QUALITY    0x0040
+#define BUZZ_GPS_FIX_MODE       0x0080
+#define BUZZ_GPS_FIX_SATELLITES 0x0100
+#define BUZZ_GPS_FIX_IN_VIEW    0x0200
+#define BUZZ_GPS_FIX_HDOP       0x0400
+#define BUZZ_GPS_FIX_PDOP       0x0800
+#define BUZZ_GPS_FIX_VDOP       0x1000
+#define BUZZ_GPS_FIX_TIMESTAMP  0x2000
+
+/*
+ * Parsed information stored inline, so delivering it needs no heap memory.
+ * Only the parts named in flags are valid.
+ */
+typedef struct buzz_gps_fix_s
+{
+    buzz_sentence_type_t type;
+    buzz_talker_t talker;
+    unsigned int flags;
+    /* BUZZ_GPS_FIX_TIMESTAMP: receiver UTC time, whole seconds and in ns */
+    time_t time;
+    int64_t utc_ns;
+    /* CLOCK_MONOTONIC time in ns at which the sentence started arriving, 0 if unknown */
+    uint64_t received_ns;
+
+    /* BUZZ_GPS_FIX_LOCATION: signed decimal degrees */
+    double latitude;
+    double longitude;
+    /* BUZZ_GPS_FIX_SPEED: speed over ground */
+    double speed_knots;
+    /* BUZZ_GPS_FIX_COURSE: true course in degrees */
+    double course;
+    /* BUZZ_GPS_FIX_ALTITUDE: above mean sea level */
+    double altitude_meters;
+
+    /* BUZZ_GPS_FIX_TIME: UTC time of day in seconds since midnight */
+    double utc_seconds;
+    /* BUZZ_GPS_FIX_DATE: UTC date, month and day counted from 1 */
+    int year;
+    int month;
+    int day;
+
+    /* BUZZ_GPS_FIX_QUALITY: GGA fix quality, 0 no fix, 1 GPS, 2 DGPS, ... */
+    int quality;
+    /* BUZZ_GPS_FIX_MODE: GSA fix mode, 1 no fix, 2 2D, 3 3D */
+    int mode;
+    /* BUZZ_GPS_FIX_SATELLITES: satellites used in the solution */
+    int satellites_used;
+    /* BUZZ_GPS_FIX_IN_VIEW */
+    int satellites_in_view;
+    /* BUZZ_GPS_FIX_HDOP, BUZZ_GPS_FIX_PDOP, BUZZ_GPS_FIX_VDOP: dilution of precision */
+    double hdop;
+    double pdop;
+    double vdop;
+
+    /* epoch fixes only: a 1 << type bit for every sentence merged into it */
+    unsigned int sentences;
+} buzz_gps_fix_t;
+
+/*
+ * Pointer based view of a parsed sentence. It is kept for compatibility,
+ * buzz_gps_fix_t carries the same information without allocations.
+ */
 typedef struct buzz_gps_event_s
 {
     buzz_sentence_type_t type;
+    /* receiver UTC time, 0 until a date has been seen */
     time_t time;
+    /* CLOCK_MONOTONIC capture time, see buzz_gps_fix_t */
+    uint64_t received_ns;
 
     buzz_gps_location_t * location;
     buzz_gps_speed_t * speed;
     buzz_gps_altitude_t * altitude;
 } buzz_gps_event_t;
 
+typedef enum buzz_gps_geofence_transition_e
+{
+    BUZZ_GPS_GEOFENCE_ENTER,
+    BUZZ_GPS_GEOFENCE_EXIT,
+    BUZZ_GPS_GEOFENCE_DWELL     // still inside dwell_ms after entering
+} buzz_gps_geofence_transition_t;
+
+typedef struct buzz_gps_geofence_event_s
+{
+    int fence_id;
+    buzz_gps_geofence_transition_t transition;
+    /* the fix that caused it, only valid for the duration of the callback */
+    const buzz_gps_fix_t * fix;
+    /* time since the fence was entered, 0 for BUZZ_GPS_GEOFENCE_ENTER */
+    int64_t inside_ns;
+} buzz_gps_geofence_event_t;
+
+typedef struct buzz_gps_geofence_stats_s
+{
+    uint64_t fences;
+    uint64_t fixes;                 // fixes evaluated
+    uint64_t tests;                 // fences tested after the grid lookup
+    uint64_t events;                // transitions reported
+} buzz_gps_geofence_stats_t;
+
+/*
+ * One sentence returned by buzz_gps_get_events_batch(). rc is what
+ * buzz_gps_get_fix_blocking() would have returned for it, fix is only
+ * valid when rc is BUZZ_GPS_SUCCESS.
+ */
+typedef struct buzz_gps_batch_entry_s
+{
+    buzz_gps_raw_event_t raw;
+    buzz_gps_fix_t fix;
+    int rc;
+} buzz_gps_batch_entry_t;
+
 /*
  * Callback signature for raw sentences
  */
@@ -98,6 +456,17 @@ typedef void (*buzz_gps_raw_event_callback_t)(buzz_gps_raw_event_t * raw_event,
  */
 typedef void (*buzz_gps_event_callback_t)(buzz_gps_event_t * event, void * user_arg);
 
+/*
+ * Callback for parsed information stored inline. The fix is only valid for
+ * the duration of the call.
+ */
+typedef void (*buzz_gps_fix_callback_t)(const buzz_gps_fix_t * fix, void * user_arg);
+
+/*
+ * Callback for geofence transitions
+ */
+typedef void (*buzz_gps_geofence_callback_t)(const buzz_gps_geofence_event_t * event, void * user_arg);
+
 /*
  *  Initialize the GPS object
  *
@@ -107,6 +476,33 @@ typedef void (*buzz_gps_event_callback_t)(buzz_gps_event_t * event, void * user_
 int buzz_gps_init(
     buzz_gps_handle_t * out_handle, const char * serial_path, speed_t baud, int options);
 
+/*
+ *  Initialize a GPS object that replays a recorded NMEA log instead of
+ *  reading a device. The file is memory mapped, not read line by line.
+ *  Sentences go through the same parsers and callbacks as a live device
+ *  and the end of the log is reported as BUZZ_GPS_END_OF_DATA.
+ *
+ *  speed: the speed up factor for BUZZ_GPS_REPLAY_SCALED, ignored otherwise
+ */
+int buzz_gps_init_from_file(
+    buzz_gps_handle_t * out_handle,
+    const char * path,
+    buzz_gps_replay_mode_t mode,
+    double speed,
+    int options);
+
+/*
+ *  Same as buzz_gps_init_from_file() for a log already in memory. data is
+ *  not copied and must stay valid until the handle is destroyed.
+ */
+int buzz_gps_init_from_memory(
+    buzz_gps_handle_t * out_handle,
+    const char * data,
+    size_t len,
+    buzz_gps_replay_mode_t mode,
+    double speed,
+    int options);
+
 /*
  * Clean up all resources associated with a GPS object
  */
@@ -114,6 +510,10 @@ int buzz_gps_destroy(buzz_gps_handle_t handle);
 
 /*
  * Start a background thread to read GPS events as they come in. 
+ *
+ * Parsed events are queued and the callbacks are run from a second
+ * thread, so a slow callback does not stop the device from being read.
+ * See buzz_gps_set_dispatch() for what happens when the queue fills up.
  */
 int buzz_gps_start(buzz_gps_handle_t gps_handle,
                    int interval_time,
@@ -123,16 +523,101 @@ int buzz_gps_start(buzz_gps_handle_t gps_handle,
                    void * user_arg);
 
 /*
- * Stop reading GPS events 
+ * Also deliver every parsed sentence as a buzz_gps_fix_t from the
+ * background thread. Must be called before buzz_gps_start().
+ */
+int buzz_gps_set_fix_callback(
+    buzz_gps_handle_t gps_handle,
+    buzz_gps_fix_callback_t fix_cb,
+    void * user_arg);
+
+/*
+ * Merge the parsed sentences of each epoch, the ones sharing a UTC time,
+ * into one fix and deliver it to epoch_cb on the callback thread. Sentences
+ * without a time join the epoch in progress. An epoch ends when a sentence
+ * with another time arrives, or timeout_ms (0 for the default) after its
+ * first sentence if the rest never come; the timeout is checked about
+ * every 100ms. The other callbacks still see every sentence.
+ * Must be called before buzz_gps_start() or buzz_gps_reactor_add(), a NULL
+ * epoch_cb turns fusion off.
+ */
+int buzz_gps_set_epoch_callback(
+    buzz_gps_handle_t gps_handle,
+    buzz_gps_fix_callback_t epoch_cb,
+    int timeout_ms,
+    void * user_arg);
+
+/*
+ * Set the size of the event queue between the reading thread and the
+ * callbacks and what to do when it is full. The default is
+ * BUZZ_GPS_DEFAULT_QUEUE_SIZE events with BUZZ_GPS_OVERFLOW_BLOCK.
+ * Must be called before buzz_gps_start().
+ */
+int buzz_gps_set_dispatch(
+    buzz_gps_handle_t gps_handle,
+    size_t queue_size,
+    buzz_gps_overflow_policy_t policy);
+
+/*
+ * Copy the handle's counters into out_stats
+ */
+int buzz_gps_get_stats(buzz_gps_handle_t gps_handle, buzz_gps_stats_t * out_stats);
+
+/*
+ * Stop reading GPS events. Events already queued are delivered first.
  */
 int buzz_gps_stop(buzz_gps_handle_t gps_handle);
 
+/*
+ * Block until a started replay handle has read all of its log. Call
+ * buzz_gps_stop() afterwards, it still delivers the queued events.
+ */
+int buzz_gps_replay_wait(buzz_gps_handle_t gps_handle);
+
 /*
  * Get the last known GPS location
  */
 int buzz_gps_get_last_known_location(
     buzz_gps_handle_t gps_handle, buzz_gps_location_t * out_location);
 
+/*
+ * Get everything known from the sentences parsed so far. Only the parts
+ * named in out_fix->flags are valid.
+ *
+ * This and buzz_gps_get_last_known_location() never take the handle lock,
+ * so they do not wait for the reading thread and are cheap enough to poll
+ * at a high rate.
+ */
+int buzz_gps_get_last_known_fix(
+    buzz_gps_handle_t gps_handle, buzz_gps_fix_t * out_fix);
+
+/*
+ * Run a Kalman filter over the positions, speeds and courses the handle
+ * parses, so buzz_gps_predict() can dead reckon between fixes.
+ * process_noise is how much the motion may stray from the model, the
+ * acceleration (or jerk for BUZZ_GPS_FILTER_CONSTANT_ACCELERATION) power
+ * per second, 0 for the default. Must be called before buzz_gps_start()
+ * or buzz_gps_reactor_add(), BUZZ_GPS_FILTER_NONE turns the filter off.
+ */
+int buzz_gps_set_filter(
+    buzz_gps_handle_t gps_handle,
+    buzz_gps_filter_model_t model,
+    double process_noise);
+
+/*
+ * Estimate the position and velocity at t_monotonic_ns, a CLOCK_MONOTONIC
+ * time like buzz_gps_fix_t.received_ns. Like buzz_gps_get_last_known_fix()
+ * this never takes the handle lock.
+ *
+ *  Return code:
+ *   - BUZZ_GPS_SUCCESS
+ *   - BUZZ_GPS_NOT_FOUND: the filter is off or has no position yet
+ */
+int buzz_gps_predict(
+    buzz_gps_handle_t gps_handle,
+    uint64_t t_monotonic_ns,
+    buzz_gps_prediction_t * out_prediction);
+
 /*
  * Block until a parsed event is ready. If this returns BUZZ_GPS_SUCCESS you
  * must free the memory associated with buzz_gps_event_t by using the
@@ -142,12 +627,42 @@ int buzz_gps_get_last_known_location(
  *   - BUZZ_GPS_SUCCESS: raw and full event parsed
  *   - BUZZ_GPS_NOT_FOUND: raw event was processed but the full event was not parsed
  *   - BUZZ_GPS_ERROR: neither type was processed due to an error
+ *   - BUZZ_GPS_END_OF_DATA: a replayed log has no sentences left
  */
 int buzz_gps_get_event_blocking(
     buzz_gps_handle_t gps_handle,
     buzz_gps_raw_event_t * out_raw,
     buzz_gps_event_t * out_event);
 
+/*
+ * Same as buzz_gps_get_event_blocking() but the parsed information is
+ * stored in out_fix, so nothing is allocated and nothing needs to be freed.
+ */
+int buzz_gps_get_fix_blocking(
+    buzz_gps_handle_t gps_handle,
+    buzz_gps_raw_event_t * out_raw,
+    buzz_gps_fix_t * out_fix);
+
+/*
+ * Get up to max sentences with one lock and at most one read of the
+ * device. Sentences already buffered are returned without waiting;
+ * otherwise this waits up to timeout_ms (-1 waits forever) for data.
+ * A paced replay only returns the sentences that are already due, and
+ * waits for the next one with the handle unlocked.
+ *
+ *  Return code:
+ *   - BUZZ_GPS_SUCCESS: *out_count entries were filled in, check each rc
+ *   - BUZZ_GPS_NOT_FOUND: no complete sentence arrived before the timeout
+ *   - BUZZ_GPS_END_OF_DATA: a replayed log has no sentences left
+ *   - BUZZ_GPS_ERROR: the device could not be read
+ */
+int buzz_gps_get_events_batch(
+    buzz_gps_handle_t gps_handle,
+    buzz_gps_batch_entry_t * entries,
+    size_t max,
+    int timeout_ms,
+    size_t * out_count);
+
 /*
  *  Free the memory associated with the buzz_gps_event_t which was
  *  passed back from a call to buzz_gps_get_event_blocking(). This
@@ -155,6 +670,353 @@ int buzz_gps_get_event_blocking(
  */
 int buzz_gps_free_blocking_event(buzz_gps_event_t * out_event);
 
+/*
+ *  Get a field of a raw event without copying it.
+ *
+ *   ndx:     field index, 0 is the sentence type
+ *   out_len: set to the length of the field
+ *
+ *   Returns a pointer into raw_event->sentence (not NUL terminated) or
+ *   NULL if the sentence has no such field.
+ */
+const char * buzz_gps_raw_field(
+    const buzz_gps_raw_event_t * raw_event,
+    int ndx,
+    size_t * out_len);
+
+/*
+ *  Create a reactor that reads many GPS handles from one thread with
+ *  epoll, instead of the two threads per handle of buzz_gps_start().
+ */
+int buzz_gps_reactor_create(buzz_gps_reactor_t * out_reactor);
+
+/*
+ *  Clean up a reactor. It must be stopped and have no handles left.
+ */
+int buzz_gps_reactor_destroy(buzz_gps_reactor_t reactor);
+
+/*
+ *  Register a handle with the reactor. The handle's device is switched to
+ *  non-blocking mode and its sentences are parsed and handed to the
+ *  callbacks, and to the fix callback if one was set, on the reactor
+ *  thread. Callbacks run without the reactor's lock and may add or remove
+ *  other handles, but not their own.
+ *
+ *  A registered handle cannot also be started and its blocking calls
+ *  should not be used until it is removed.
+ */
+int buzz_gps_reactor_add(
+    buzz_gps_reactor_t reactor,
+    buzz_gps_handle_t gps_handle,
+    buzz_gps_raw_event_callback_t raw_cb,
+    buzz_gps_event_callback_t event_cb,
+    void * user_arg);
+
+/*
+ *  Unregister a handle and put its device back in blocking mode
+ */
+int buzz_gps_reactor_remove(buzz_gps_reactor_t reactor, buzz_gps_handle_t gps_handle);
+
+/*
+ *  Wait up to timeout_ms (-1 waits forever) for any handle to be readable
+ *  and process what arrived on the calling thread. For callers with their
+ *  own loop, it cannot be used while the reactor thread is started.
+ */
+int buzz_gps_reactor_run_once(buzz_gps_reactor_t reactor, int timeout_ms);
+
+/*
+ *  Run the reactor on a background thread until buzz_gps_reactor_stop()
+ */
+int buzz_gps_reactor_start(buzz_gps_reactor_t reactor);
+
+int buzz_gps_reactor_stop(buzz_gps_reactor_t reactor);
+
+/*
+ *  Open, or create, an SQLite track store at path and start its writer
+ *  thread. Rows are inserted in transactions of batch_rows (0 for the
+ *  default), or fewer once the oldest queued row has waited flush_ms
+ *  (0 for the default). The database uses a WAL journal so it can be
+ *  read while it is recorded.
+ *
+ *  Tables:
+ *    fixes (receiver, received_ns, utc_ns, flags, sentences, latitude,
+ *           longitude, altitude, speed_knots, course, quality, mode,
+ *           satellites_used, satellites_in_view, hdop, pdop, vdop)
+ *    sentences (receiver, received_ns, type, sentence)
+ *  Values a fix does not carry are NULL.
+ */
+int buzz_gps_store_open(
+    buzz_gps_store_t * out_store,
+    const char * path,
+    int options,
+    size_t batch_rows,
+    int flush_ms);
+
+/*
+ *  Record the fused fixes, see buzz_gps_set_epoch_callback(), of a handle
+ *  under receiver_id, and its raw sentences if the store was opened with
+ *  BUZZ_GPS_STORE_SENTENCES. Recording runs on the callback thread and
+ *  never waits for the database; when the writer falls behind rows are
+ *  dropped and counted. Must be called before buzz_gps_start() or
+ *  buzz_gps_reactor_add(), a NULL store detaches the handle.
+ */
+int buzz_gps_store_attach(buzz_gps_store_t store, buzz_gps_handle_t gps_handle, int receiver_id);
+
+/*
+ *  Write out everything queued and close the store. Handles attached to it
+ *  must be stopped, or removed from their reactor, first.
+ */
+int buzz_gps_store_close(buzz_gps_store_t store);
+
+int buzz_gps_store_get_stats(buzz_gps_store_t store, buzz_gps_store_stats_t * out_stats);
+
+/*
+ *  Open a columnar track file for appending, creating it if needed. Fixes
+ *  are buffered into blocks of block_rows (0 for the default) that are
+ *  written out whole, and the block time index is written on close. See
+ *  buzz_track.h for the layout.
+ */
+int buzz_gps_track_open(buzz_gps_track_writer_t * out_writer, const char * path, size_t block_rows);
+
+/*
+ *  Append a fix. Only fixes with BUZZ_GPS_FIX_TIMESTAMP and
+ *  BUZZ_GPS_FIX_LOCATION are kept, and a file is in time order so a fix
+ *  older than the last one appended is refused.
+ */
+int buzz_gps_track_append(buzz_gps_track_writer_t writer, const buzz_gps_fix_t * fix);
+
+/*
+ *  Append the fused fixes, see buzz_gps_set_epoch_callback(), of a handle
+ *  from its callback thread. Must be called before buzz_gps_start() or
+ *  buzz_gps_reactor_add(), a NULL writer detaches the handle.
+ */
+int buzz_gps_track_attach(buzz_gps_track_writer_t writer, buzz_gps_handle_t gps_handle);
+
+/*
+ *  Write out the last block and the index and close the file. Handles
+ *  attached to it must be stopped first.
+ */
+int buzz_gps_track_close(buzz_gps_track_writer_t writer);
+
+int buzz_gps_track_get_stats(buzz_gps_track_writer_t writer, buzz_gps_track_stats_t * out_stats);
+
+/*
+ *  Map a track file for reading. A file that was not closed is read up
+ *  to its last complete block.
+ */
+int buzz_gps_track_map(buzz_gps_track_reader_t * out_reader, const char * path);
+
+int buzz_gps_track_unmap(buzz_gps_track_reader_t reader);
+
+uint64_t buzz_gps_track_rows(buzz_gps_track_reader_t reader);
+
+/*
+ *  Start a scan of the rows with from_ns <= utc_ns < to_ns. The blocks are
+ *  found from the index, nothing is read until buzz_gps_track_next().
+ */
+void buzz_gps_track_range(
+    buzz_gps_track_reader_t reader,
+    int64_t from_ns,
+    int64_t to_ns,
+    buzz_gps_track_cursor_t * out_cursor);
+
+/*
+ *  Point out_span at the next run of rows in the range, at most one block
+ *  long. The span is valid until the reader is unmapped.
+ *
+ *   Returns BUZZ_GPS_END_OF_DATA once the range is exhausted.
+ */
+int buzz_gps_track_next(buzz_gps_track_cursor_t * cursor, buzz_gps_track_span_t * out_span);
+
+/*
+ *  Create an in-memory spatial index of fix positions, see buzz_spatial.h
+ */
+int buzz_gps_spatial_create(buzz_gps_spatial_t * out_index);
+
+/*
+ *  Free the index. Handles attached to it must be stopped first.
+ */
+int buzz_gps_spatial_destroy(buzz_gps_spatial_t index);
+
+/*
+ *  Add the position of a fix with BUZZ_GPS_FIX_TIMESTAMP and
+ *  BUZZ_GPS_FIX_LOCATION, other fixes are ignored. Safe to call from
+ *  several threads and while queries run.
+ */
+int buzz_gps_spatial_insert(buzz_gps_spatial_t index, int receiver, const buzz_gps_fix_t * fix);
+
+/*
+ *  Insert the fused fixes, see buzz_gps_set_epoch_callback(), of a handle
+ *  under receiver_id from its callback thread. Must be called before
+ *  buzz_gps_start() or buzz_gps_reactor_add(), a NULL index detaches the
+ *  handle.
+ */
+int buzz_gps_spatial_attach(buzz_gps_spatial_t index, buzz_gps_handle_t gps_handle, int receiver_id);
+
+uint64_t buzz_gps_spatial_count(buzz_gps_spatial_t index);
+
+/*
+ *  Find the points inside a box, in degrees, taken at from_ns <= utc_ns <
+ *  to_ns. A box with west greater than east crosses the antimeridian.
+ *  The first max_hits hits in time order are copied to out_hits and
+ *  out_count is set to the number found, which may be more.
+ */
+int buzz_gps_spatial_query_box(
+    buzz_gps_spatial_t index,
+    double south,
+    double west,
+    double north,
+    double east,
+    int64_t from_ns,
+    int64_t to_ns,
+    buzz_gps_spatial_hit_t * out_hits,
+    size_t max_hits,
+    size_t * out_count);
+
+/*
+ *  Same as buzz_gps_spatial_query_box() for the points within meters of a
+ *  position, by great circle distance
+ */
+int buzz_gps_spatial_query_radius(
+    buzz_gps_spatial_t index,
+    double latitude,
+    double longitude,
+    double meters,
+    int64_t from_ns,
+    int64_t to_ns,
+    buzz_gps_spatial_hit_t * out_hits,
+    size_t max_hits,
+    size_t * out_count);
+
+/*
+ *  Create a streaming simplifier, see buzz_simplify.h. The fixes it keeps
+ *  are handed to kept_cb as they are decided, every dropped fix is within
+ *  tolerance_m of the line between the kept fixes before and after it.
+ *  A fix is kept at least every max_gap_ms (0 for the default) and when
+ *  window (0 for the default) moving fixes are waiting for a decision.
+ *  A simplifier must only be fed from one thread.
+ */
+int buzz_gps_simplifier_create(
+    buzz_gps_simplifier_t * out_simplifier,
+    double tolerance_m,
+    int max_gap_ms,
+    size_t window,
+    buzz_gps_fix_callback_t kept_cb,
+    void * user_arg);
+
+int buzz_gps_simplifier_destroy(buzz_gps_simplifier_t simplifier);
+
+/*
+ *  Add the next fix of a track. Fixes without BUZZ_GPS_FIX_TIMESTAMP and
+ *  BUZZ_GPS_FIX_LOCATION are ignored.
+ */
+int buzz_gps_simplifier_add(buzz_gps_simplifier_t simplifier, const buzz_gps_fix_t * fix);
+
+/*
+ *  Keep the newest fix if it is still undecided, at the end of a track
+ */
+int buzz_gps_simplifier_flush(buzz_gps_simplifier_t simplifier);
+
+int buzz_gps_simplifier_get_stats(
+    buzz_gps_simplifier_t simplifier,
+    uint64_t * out_fixes_in,
+    uint64_t * out_fixes_kept);
+
+void buzz_gps_delta_reset(buzz_gps_delta_state_t * state);
+
+/*
+ *  Append the time, position and, when present, altitude and speed of a
+ *  fix to out as the change from the previous fix. Positions are rounded
+ *  to 1e-7 degrees, times to milliseconds, altitudes to decimeters and
+ *  speeds to hundredths of a knot.
+ *
+ *   Returns the bytes written, 0 if the fix has no timestamp or position
+ *   or out_size is below BUZZ_GPS_DELTA_MAX_RECORD.
+ */
+size_t buzz_gps_delta_encode(
+    buzz_gps_delta_state_t * state,
+    const buzz_gps_fix_t * fix,
+    unsigned char * out,
+    size_t out_size);
+
+/*
+ *  Read one record written by buzz_gps_delta_encode()
+ *
+ *   Returns the bytes used, 0 if in does not start with a whole record.
+ */
+size_t buzz_gps_delta_decode(
+    buzz_gps_delta_state_t * state,
+    const unsigned char * in,
+    size_t in_len,
+    buzz_gps_fix_t * out_fix);
+
+/*
+ *  Create a geofence engine, see buzz_geofence.h. It tracks one receiver
+ *  and reports its transitions to transition_cb, from the thread that
+ *  evaluates the fix. The callback must not call into the engine.
+ *  dwell_ms is how long after entering a fence BUZZ_GPS_GEOFENCE_DWELL
+ *  is reported, 0 for never.
+ */
+int buzz_gps_geofence_create(
+    buzz_gps_geofence_t * out_engine,
+    int dwell_ms,
+    buzz_gps_geofence_callback_t transition_cb,
+    void * user_arg);
+
+/*
+ *  Free the engine. Handles attached to it must be stopped first.
+ */
+int buzz_gps_geofence_destroy(buzz_gps_geofence_t engine);
+
+/*
+ *  Add a fence of every point within radius_m of a position, by great
+ *  circle distance. id is what transitions report, it does not need to be
+ *  unique.
+ */
+int buzz_gps_geofence_add_circle(
+    buzz_gps_geofence_t engine,
+    int id,
+    double latitude,
+    double longitude,
+    double radius_m);
+
+/*
+ *  Add a polygon fence of count vertices in degrees, with straight edges
+ *  in latitude and longitude. Edges may cross the antimeridian, but a
+ *  polygon around a pole is refused.
+ */
+int buzz_gps_geofence_add_polygon(
+    buzz_gps_geofence_t engine,
+    int id,
+    const double * latitudes,
+    const double * longitudes,
+    size_t count);
+
+/*
+ *  Remove every fence added with id, without reporting an exit
+ *
+ *   Returns BUZZ_GPS_NOT_FOUND if there was none.
+ */
+int buzz_gps_geofence_remove(buzz_gps_geofence_t engine, int id);
+
+/*
+ *  Evaluate the next position of the receiver and report the fences it
+ *  entered, left or has dwelled in. Dwell time is measured in receiver
+ *  time with BUZZ_GPS_FIX_TIMESTAMP, and capture time without.
+ *
+ *   Returns BUZZ_GPS_NOT_FOUND if the fix has no BUZZ_GPS_FIX_LOCATION.
+ */
+int buzz_gps_geofence_update(buzz_gps_geofence_t engine, const buzz_gps_fix_t * fix);
+
+/*
+ *  Evaluate the fused fixes, see buzz_gps_set_epoch_callback(), of a handle
+ *  from its callback thread. Must be called before buzz_gps_start() or
+ *  buzz_gps_reactor_add(), a NULL engine detaches the handle.
+ */
+int buzz_gps_geofence_attach(buzz_gps_geofence_t engine, buzz_gps_handle_t gps_handle);
+
+int buzz_gps_geofence_get_stats(buzz_gps_geofence_t engine, buzz_gps_geofence_stats_t * out_stats);
+
 /*
  *  Translate an NMEA location to a floating point location
  * 
@@ -162,7 +1024,8 @@ int buzz_gps_free_blocking_event(buzz_gps_event_t * out_event);
  *   hemisphere:   Compass direction <N,S,E,W>
  *   out_location: The floating point representation
  * 
- *   Returns 0 on success or non-zero on error.
+ *   Returns 0 on success or non-zero on error, including any other
+ *   hemisphere and more than 90 degrees N or S or 180 degrees E or W.
  * 
  */
 int buzz_gps_location_transform(
@@ -170,5 +1033,91 @@ int buzz_gps_location_transform(
     const char hemisphere,
     float * out_location);
 
+/*
+ *  Same as buzz_gps_location_transform() but without losing precision to a
+ *  float. The number is parsed without the C library so the result does
+ *  not depend on the locale.
+ */
+int buzz_gps_location_transform_double(
+    const char * location_str,
+    const char hemisphere,
+    double * out_location);
+
+/*
+ *  Batch geodesy over arrays of latitudes and longitudes in degrees, on
+ *  a sphere of the mean earth radius. Point i of each batch is
+ *  (lat1[i], lon1[i]) to (lat2[i], lon2[i]). The output may not overlap
+ *  the inputs.
+ */
+
+/* great circle distance in meters */
+int buzz_gps_haversine_batch(
+    const double * lat1,
+    const double * lon1,
+    const double * lat2,
+    const double * lon2,
+    double * out_meters,
+    size_t count);
+
+/*
+ *  Distance in meters on a flat projection around the midpoint. Faster
+ *  than the haversine and within 0.1% of it up to a few tens of km.
+ */
+int buzz_gps_equirectangular_batch(
+    const double * lat1,
+    const double * lon1,
+    const double * lat2,
+    const double * lon2,
+    double * out_meters,
+    size_t count);
+
+/* initial bearing from true north, in [0, 360) degrees */
+int buzz_gps_bearing_batch(
+    const double * lat1,
+    const double * lon1,
+    const double * lat2,
+    const double * lon2,
+    double * out_degrees,
+    size_t count);
+
+/* the point meters away from (lat[i], lon[i]) along bearing_degrees[i] */
+int buzz_gps_destination_batch(
+    const double * lat,
+    const double * lon,
+    const double * bearing_degrees,
+    const double * meters,
+    double * out_lat,
+    double * out_lon,
+    size_t count);
+
+/* distance along a track from its first point to each point */
+int buzz_gps_cumulative_distance(
+    const double * lat,
+    const double * lon,
+    double * out_meters,
+    size_t count);
+
+/*
+ *  Speed in meters per second over the leg from each point of a track to
+ *  the next, stored at the later point. The first point, and any leg not
+ *  forward in time, get NaN.
+ */
+int buzz_gps_segment_speed(
+    const double * lat,
+    const double * lon,
+    const int64_t * utc_ns,
+    double * out_mps,
+    size_t count);
+
+/*
+ *  Use one implementation of the batch functions for the whole process,
+ *  mostly for tests and benchmarks.
+ *
+ *   Returns BUZZ_GPS_NOT_FOUND if the CPU does not support it.
+ */
+int buzz_gps_geodesy_set_kernel(buzz_gps_geodesy_kernel_t kernel);
+
+buzz_gps_geodesy_kernel_t buzz_gps_geodesy_get_kernel(void);
+
 
 #endif
@@ -0,0 +1,190 @@
+/*
+ * GPS handle internals
+ *
+ * The handle is opaque to users of buzz_gps.h. This header shares its
+ * layout and the read/parse/deliver steps with the other modules that
+ * drive a handle, such as the reactor.
+ */
+#ifndef BUZZ_HANDLE_H
+#define BUZZ_HANDLE_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "buzz_gps.h"
+#include "buzz_dispatch.h"
+#include "buzz_filter.h"
+#include "buzz_framer.h"
+#include "buzz_fusion.h"
+#include "buzz_geofence.h"
+#include "buzz_seqlock.h"
+#include "buzz_spatial.h"
+#include "buzz_stats.h"
+#include "buzz_store.h"
+#include "buzz_track.h"
+
+/*
+ * Backing storage for the pointers of a buzz_gps_event_t handed to a
+ * callback, so the compatibility event needs no heap memory.
+ */
+typedef struct buzz_i_event_storage_s {
+    buzz_gps_location_t location;
+    buzz_gps_speed_t speed;
+    buzz_gps_altitude_t altitude;
+} buzz_i_event_storage_t;
+
+
+/*
+ * Counters behind buzz_gps_get_stats(), see buzz_stats.h for who writes them
+ */
+typedef struct buzz_i_handle_stats_s {
+    /* written with the handle mutex held */
+    _Atomic uint64_t checksum_errors;
+    _Atomic uint64_t unknown_sentences;
+    _Atomic uint64_t parse_ok[BUZZ_GPS_TYPE_COUNT];
+    _Atomic uint64_t parse_failed[BUZZ_GPS_TYPE_COUNT];
+    _Atomic uint64_t parse_ignored[BUZZ_GPS_TYPE_COUNT];
+    buzz_i_histogram_t read_to_parse;
+
+    /* written by the thread running the callbacks */
+    _Atomic uint64_t callbacks;
+    _Atomic uint64_t callback_ns;
+    buzz_i_histogram_t parse_to_callback;
+    buzz_i_histogram_t callback;
+    buzz_i_histogram_t total;
+} buzz_i_handle_stats_t;
+
+
+/*
+ * A recorded log read from memory in place of a device
+ */
+typedef struct buzz_i_replay_s {
+    int active;
+    const char * data;
+    size_t len;
+    size_t pos;
+    /* data was mapped by buzz_gps_init_from_file() and is unmapped on destroy */
+    int mapped;
+    buzz_gps_replay_mode_t mode;
+    double speed;
+
+    /* pacing is anchored on the first sentence with a UTC time */
+    int anchored;
+    double anchor_time;
+    struct timespec anchor_clock;
+    double last_time;
+    double day_offset;
+
+    /* a sentence framed before it was due, waiting for the next read */
+    int held;
+    char held_sentence[BUZZ_GPS_MAX_LINE];
+    int held_length;
+    struct timespec held_due;
+
+    /* set, under the handle mutex, once the gather thread has read everything */
+    int finished;
+    pthread_cond_t finished_cond;
+} buzz_i_replay_t;
+
+
+/*
+ * The last UTC date from an RMC or ZDA, so sentences carrying only a time
+ * of day can be given a full timestamp without calling mktime()
+ */
+typedef struct buzz_i_utc_date_s {
+    int valid;
+    /* seconds from the epoch to midnight of the cached date */
+    int64_t day_start;
+    /* time of day of the last stamped sentence, to notice midnight */
+    double last_seconds;
+} buzz_i_utc_date_t;
+
+
+typedef struct buzz_i_gps_handle_s {
+    int serial_port;
+    int options;
+    buzz_i_framer_t framer;
+    pthread_mutex_t mutex;
+    pthread_t thread_id;
+    /* written to by buzz_gps_stop() to wake the gather thread */
+    int wake_pipe[2];
+
+    /* every field seen so far, merged from all parsed sentences */
+    buzz_gps_fix_t last_fix;
+    /* written with the mutex held, by whoever parses */
+    buzz_i_utc_date_t utc_date;
+    /* copy of last_fix that readers take without the mutex */
+    BUZZ_SEQLOCK_DECLARE(buzz_gps_fix_t, last_fix_snapshot);
+
+    atomic_int running;
+
+    buzz_i_handle_stats_t stats;
+
+    int error_interval;
+    int interval_time;
+
+    buzz_gps_raw_event_callback_t raw_cb;
+    buzz_gps_event_callback_t event_cb;
+    void * user_arg;
+
+    buzz_gps_fix_callback_t fix_cb;
+    void * fix_user_arg;
+
+    /* fusion runs while any of these is set */
+    buzz_gps_fix_callback_t epoch_cb;
+    void * epoch_user_arg;
+    buzz_i_gps_store_t * store;
+    int store_receiver;
+    buzz_i_track_writer_t * track;
+    buzz_i_spatial_index_t * spatial;
+    int spatial_receiver;
+    buzz_i_geofence_engine_t * geofence;
+
+    /* fed with every parsed sentence, read by buzz_gps_predict() */
+    buzz_i_filter_t filter;
+
+    /* owned by the thread running the callbacks */
+    buzz_i_fusion_t fusion;
+
+    /* callbacks run on the dispatcher thread, not the gather thread */
+    buzz_i_dispatcher_t dispatcher;
+    size_t dispatch_queue_size;
+    buzz_gps_overflow_policy_t dispatch_policy;
+    buzz_i_event_storage_t event_storage;
+
+    /* serial_port is -1 when this is active */
+    buzz_i_replay_t replay;
+
+    /* set while the handle is registered with a reactor instead of started */
+    buzz_gps_reactor_t reactor;
+} buzz_i_gps_handle_t;
+
+/*
+ * Frame and parse the next sentence already in the handle's read buffer,
+ * without reading the serial port, and fold its fix into the last known fix.
+ *
+ *  Returns BUZZ_GPS_NOT_FOUND when no complete sentence is buffered.
+ *
+ * must be called locked
+ */
+int buzz_handle_next_buffered(buzz_gps_handle_t gps_handle, buzz_i_dispatch_item_t * out_item);
+
+/*
+ * Split and parse a raw event whose sentence and length are already set,
+ * without touching the read buffer or the last known fix. Used by the
+ * benchmarks to time the parsers on their own.
+ */
+int buzz_handle_parse(buzz_gps_handle_t gps_handle, buzz_gps_raw_event_t * raw_event, buzz_gps_fix_t * out_fix);
+
+/* run the handle's callbacks for one item, arg is the handle */
+void buzz_handle_deliver(buzz_i_dispatch_item_t * item, void * arg);
+
+/* time out a stalled epoch, call it on the thread that runs buzz_handle_deliver() */
+void buzz_handle_idle(void * arg);
+
+/* deliver the epoch in progress, when no more sentences will come */
+void buzz_handle_flush(buzz_gps_handle_t gps_handle);
+
+#endif
@@ -3,10 +3,17 @@
 #include <string.h>
 #include <time.h>
 #include <ctype.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include "buzz_gps.h"
 #include "buzz_logging.h"
 
-#define MAX_LOG_LINE 1024
 #define MAX_LEVEL_NAME_LEN 8
+/* the writer checks the rings at least this often */
+#define BUZZ_LOG_FLUSH_NS 10000000L
+/* stderr output is gathered into writes of up to this size */
+#define BUZZ_LOG_BATCH_SIZE 65536
 
 static char* _level_map[] = {
     "ERROR",
@@ -16,58 +23,501 @@ static char* _level_map[] = {
     NULL
 };
 
-static char * trim(char * s) {
-    size_t l = strlen(s);
+/*
+ * The formatted time only changes once a second, so it is cached rather
+ * than calling localtime_r() and strftime() for every line
+ */
+typedef struct buzz_i_log_clock_s {
+    time_t second;
+    char text[32];
+} buzz_i_log_clock_t;
 
-    if (s[l-1] == '\n') {
-        s[l-1] = '\0';
+typedef struct buzz_i_log_record_s {
+    LOG_LEVEL level;
+    time_t when;
+    size_t length;
+    char text[BUZZ_LOG_MAX_LINE];
+} buzz_i_log_record_t;
+
+/*
+ * A single producer, single consumer ring per logging thread. Only the
+ * thread that owns it pushes and only the writer pops, so neither side
+ * takes a lock. Rings live on _g_rings until their thread exits. New
+ * rings go on the front of the list and, while the writer runs, only the
+ * writer takes them off, so it can walk the list without the lock.
+ */
+typedef struct buzz_i_log_ring_s {
+    _Atomic size_t head;
+    _Atomic size_t tail;
+    size_t capacity;
+    /* set while the owner may push, see buzz_log_async_stop() */
+    atomic_int in_use;
+    /* the owning thread exited, free once drained */
+    atomic_int closed;
+    _Atomic uint64_t dropped;
+    /* only used by the writer */
+    uint64_t dropped_reported;
+    int drained;
+    struct buzz_i_log_ring_s * next;
+    buzz_i_log_record_t slots[];
+} buzz_i_log_ring_t;
+
+int g_buzz_log_level = BUZZ_INFO;
+
+static buzz_log_sink_t _g_sink = NULL;
+static void * _g_sink_arg = NULL;
+
+static atomic_int _g_async = 0;
+static size_t _g_ring_size = BUZZ_LOG_DEFAULT_RING_SIZE;
+static pthread_t _g_writer_id;
+static pthread_cond_t _g_writer_cond;
+
+/* guards the ring list and _g_writer_running, never taken to log or write a line */
+static pthread_mutex_t _g_rings_mutex = PTHREAD_MUTEX_INITIALIZER;
+static buzz_i_log_ring_t * _g_rings = NULL;
+static int _g_writer_running = 0;
+static uint64_t _g_dropped_freed = 0;
+
+static pthread_once_t _g_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t _g_ring_key;
+
+static __thread buzz_i_log_ring_t * _t_ring = NULL;
+static __thread buzz_i_log_clock_t _t_clock;
+/* the writer logs directly, it must not queue to itself */
+static __thread int _t_writer = 0;
+
+
+static const char * buzz_l_log_time(time_t now, buzz_i_log_clock_t * clock) {
+    struct tm tm;
+
+    if (clock->text[0] == '\0' || clock->second != now) {
+        localtime_r(&now, &tm);
+        strftime(clock->text, sizeof(clock->text), "%a %b %e %H:%M:%S %Y", &tm);
+        clock->second = now;
+    }
+    return clock->text;
+}
+
+
+static time_t buzz_l_log_now(void) {
+    struct timespec ts;
+
+    /* the coarse clock is a plain memory read, the second is all we keep */
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    return ts.tv_sec;
+}
+
+
+static size_t buzz_l_log_format(
+    char * out, size_t out_len, LOG_LEVEL level, const char * time_str, const char * text, size_t text_len) {
+    int n;
+
+    n = snprintf(out, out_len, "%s [%s]: %.*s", time_str, _level_map[level], (int) text_len, text);
+    if (n < 0) {
+        return 0;
     }
-    return s;
+    return (size_t) n < out_len ? (size_t) n : out_len - 1;
+}
+
+
+static void buzz_l_log_emit(LOG_LEVEL level, const char * line, size_t length) {
+    if (_g_sink != NULL) {
+        _g_sink(level, line, length, _g_sink_arg);
+    } else {
+        fprintf(stderr, "%.*s\n", (int) length, line);
+    }
+}
+
+
+static void buzz_l_ring_free(buzz_i_log_ring_t * ring) {
+    _g_dropped_freed += atomic_load(&ring->dropped);
+    free(ring);
+}
+
+
+/*
+ * Thread exit, the ring is freed here when no writer could be using it,
+ * otherwise by the writer once it has been drained
+ */
+static void buzz_l_ring_release(void * arg) {
+    buzz_i_log_ring_t * ring = (buzz_i_log_ring_t *) arg;
+    buzz_i_log_ring_t ** link;
+
+    pthread_mutex_lock(&_g_rings_mutex);
+    {
+        if (_g_writer_running) {
+            atomic_store(&ring->closed, 1);
+        } else {
+            for (link = &_g_rings; *link != NULL; link = &(*link)->next) {
+                if (*link == ring) {
+                    *link = ring->next;
+                    break;
+                }
+            }
+            buzz_l_ring_free(ring);
+        }
+    }
+    pthread_mutex_unlock(&_g_rings_mutex);
+}
+
+
+static void buzz_l_ring_key_init(void) {
+    pthread_key_create(&_g_ring_key, buzz_l_ring_release);
+}
+
+
+static buzz_i_log_ring_t * buzz_l_ring_get(void) {
+    buzz_i_log_ring_t * ring;
+    size_t capacity = 1;
+
+    if (_t_ring != NULL) {
+        return _t_ring;
+    }
+
+    while (capacity < _g_ring_size) {
+        capacity <<= 1;
+    }
+    ring = (buzz_i_log_ring_t *) calloc(1, sizeof(buzz_i_log_ring_t) + capacity * sizeof(buzz_i_log_record_t));
+    if (ring == NULL) {
+        return NULL;
+    }
+    ring->capacity = capacity;
+
+    pthread_once(&_g_key_once, buzz_l_ring_key_init);
+    pthread_setspecific(_g_ring_key, ring);
+    pthread_mutex_lock(&_g_rings_mutex);
+    {
+        ring->next = _g_rings;
+        _g_rings = ring;
+    }
+    pthread_mutex_unlock(&_g_rings_mutex);
+
+    _t_ring = ring;
+    return ring;
+}
+
+
+/*
+ * Format the message into the calling thread's ring. Returns 0 if the
+ * writer is not running and the caller should write the line itself.
+ */
+static int buzz_l_log_push(LOG_LEVEL level, const char * fmt, va_list a_list) {
+    buzz_i_log_ring_t * ring = buzz_l_ring_get();
+    buzz_i_log_record_t * record;
+    size_t head;
+    size_t tail;
+    int n;
+
+    if (ring == NULL) {
+        return 0;
+    }
+    /* pairs with buzz_log_async_stop() clearing _g_async then waiting for in_use */
+    atomic_store(&ring->in_use, 1);
+    if (!atomic_load(&_g_async)) {
+        atomic_store(&ring->in_use, 0);
+        return 0;
+    }
+
+    tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (tail - head >= ring->capacity) {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        atomic_store_explicit(&ring->in_use, 0, memory_order_release);
+        return 1;
+    }
+
+    record = &ring->slots[tail & (ring->capacity - 1)];
+    record->level = level;
+    record->when = buzz_l_log_now();
+    n = vsnprintf(record->text, sizeof(record->text), fmt, a_list);
+    record->length = n < 0 ? 0 : ((size_t) n < sizeof(record->text) ? (size_t) n : sizeof(record->text) - 1);
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+
+    if (tail + 1 - head == ring->capacity / 2) {
+        /* no mutex, a missed wakeup only costs one flush interval */
+        pthread_cond_signal(&_g_writer_cond);
+    }
+    atomic_store_explicit(&ring->in_use, 0, memory_order_release);
+    return 1;
+}
+
+
+typedef struct buzz_i_log_batch_s {
+    size_t length;
+    char data[BUZZ_LOG_BATCH_SIZE];
+} buzz_i_log_batch_t;
+
+
+static void buzz_l_batch_flush(buzz_i_log_batch_t * batch) {
+    if (batch->length > 0) {
+        fwrite(batch->data, 1, batch->length, stderr);
+        fflush(stderr);
+        batch->length = 0;
+    }
+}
+
+
+static void buzz_l_batch_line(buzz_i_log_batch_t * batch, LOG_LEVEL level, const char * line, size_t length) {
+    if (_g_sink != NULL) {
+        _g_sink(level, line, length, _g_sink_arg);
+        return;
+    }
+    if (batch->length + length + 1 > sizeof(batch->data)) {
+        buzz_l_batch_flush(batch);
+    }
+    memcpy(&batch->data[batch->length], line, length);
+    batch->length += length;
+    batch->data[batch->length++] = '\n';
+}
+
+
+/*
+ * Write out everything queued in the rings from first on, without
+ * _g_rings_mutex so threads can still start and exit while the sink runs.
+ * Returns 1 if the ring of an exited thread was emptied for
+ * buzz_l_writer_reap().
+ */
+static int buzz_l_writer_drain(buzz_i_log_ring_t * first, buzz_i_log_batch_t * batch, buzz_i_log_clock_t * clock) {
+    buzz_i_log_ring_t * ring;
+    buzz_i_log_record_t * record;
+    char line[BUZZ_LOG_MAX_LINE + 64];
+    size_t length;
+    size_t head;
+    uint64_t dropped;
+    int closed;
+    int reap = 0;
+
+    for (ring = first; ring != NULL; ring = ring->next) {
+        /* read before draining so nothing pushed before the thread exited is missed */
+        closed = atomic_load(&ring->closed);
+        head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        while (head != atomic_load_explicit(&ring->tail, memory_order_acquire)) {
+            record = &ring->slots[head & (ring->capacity - 1)];
+            length = buzz_l_log_format(line, sizeof(line), record->level,
+                buzz_l_log_time(record->when, clock), record->text, record->length);
+            buzz_l_batch_line(batch, record->level, line, length);
+            head++;
+            atomic_store_explicit(&ring->head, head, memory_order_release);
+        }
+
+        dropped = atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+        if (dropped != ring->dropped_reported) {
+            char text[64];
+
+            snprintf(text, sizeof(text), "%llu log lines dropped",
+                (unsigned long long) (dropped - ring->dropped_reported));
+            length = buzz_l_log_format(line, sizeof(line), BUZZ_WARN,
+                buzz_l_log_time(buzz_l_log_now(), clock), text, strlen(text));
+            buzz_l_batch_line(batch, BUZZ_WARN, line, length);
+            ring->dropped_reported = dropped;
+        }
+
+        if (closed) {
+            ring->drained = 1;
+            reap = 1;
+        }
+    }
+    buzz_l_batch_flush(batch);
+    return reap;
+}
+
+
+/*
+ * Free the rings of exited threads that buzz_l_writer_drain() emptied
+ *
+ * must be called with _g_rings_mutex held
+ */
+static void buzz_l_writer_reap(void) {
+    buzz_i_log_ring_t ** link = &_g_rings;
+    buzz_i_log_ring_t * ring;
+
+    while ((ring = *link) != NULL) {
+        if (ring->drained) {
+            *link = ring->next;
+            buzz_l_ring_free(ring);
+        } else {
+            link = &ring->next;
+        }
+    }
+}
+
+
+static void * buzz_l_writer_thread(void * arg) {
+    buzz_i_log_batch_t * batch = (buzz_i_log_batch_t *) arg;
+    buzz_i_log_clock_t clock;
+    buzz_i_log_ring_t * first;
+    struct timespec waittime;
+    int running = 1;
+    int reap;
+
+    _t_writer = 1;
+    memset(&clock, '\0', sizeof(clock));
+    pthread_mutex_lock(&_g_rings_mutex);
+    while (running) {
+        /* read first so the last pass sees every line pushed before stop */
+        running = atomic_load(&_g_async);
+        first = _g_rings;
+        pthread_mutex_unlock(&_g_rings_mutex);
+        reap = buzz_l_writer_drain(first, batch, &clock);
+        pthread_mutex_lock(&_g_rings_mutex);
+        if (reap) {
+            buzz_l_writer_reap();
+        }
+        /* stop clears _g_async with the lock held, so its signal cannot be missed */
+        if (running && atomic_load(&_g_async)) {
+            clock_gettime(CLOCK_MONOTONIC, &waittime);
+            waittime.tv_nsec += BUZZ_LOG_FLUSH_NS;
+            if (waittime.tv_nsec >= 1000000000L) {
+                waittime.tv_sec++;
+                waittime.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&_g_writer_cond, &_g_rings_mutex, &waittime);
+        }
+    }
+    pthread_mutex_unlock(&_g_rings_mutex);
+
+    free(batch);
+    return NULL;
 }
 
-static int _g_level = BUZZ_INFO;
 
 void buzz_set_log_level(const char * level) {
     int i;
     char upper_level[MAX_LEVEL_NAME_LEN];
 
-    for (i = 0; i < strnlen(level, MAX_LEVEL_NAME_LEN); i++) {
+    for (i = 0; i < strnlen(level, MAX_LEVEL_NAME_LEN - 1); i++) {
         upper_level[i] = toupper(level[i]);
     }
     upper_level[i] = '\0';
 
     for(i = 0; _level_map[i] != NULL; i++) {
         if (strcmp(upper_level, _level_map[i]) == 0) {
-            _g_level = i;
+            g_buzz_log_level = i;
+        }
+    }
+}
+
+
+void buzz_set_log_sink(buzz_log_sink_t sink, void * arg) {
+    _g_sink = sink;
+    _g_sink_arg = arg;
+}
+
+
+int buzz_log_async_start(size_t ring_size) {
+    buzz_i_log_batch_t * batch;
+    pthread_condattr_t attr;
+
+    pthread_mutex_lock(&_g_rings_mutex);
+    if (_g_writer_running) {
+        pthread_mutex_unlock(&_g_rings_mutex);
+        return BUZZ_GPS_ERROR;
+    }
+    batch = (buzz_i_log_batch_t *) calloc(1, sizeof(buzz_i_log_batch_t));
+    if (batch == NULL) {
+        pthread_mutex_unlock(&_g_rings_mutex);
+        return BUZZ_GPS_ERROR;
+    }
+    /* only rings created from now on get the new size */
+    _g_ring_size = ring_size == 0 ? BUZZ_LOG_DEFAULT_RING_SIZE : ring_size;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&_g_writer_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    atomic_store(&_g_async, 1);
+    if (pthread_create(&_g_writer_id, NULL, buzz_l_writer_thread, batch) != 0) {
+        atomic_store(&_g_async, 0);
+        pthread_cond_destroy(&_g_writer_cond);
+        pthread_mutex_unlock(&_g_rings_mutex);
+        free(batch);
+        return BUZZ_GPS_ERROR;
+    }
+    _g_writer_running = 1;
+    pthread_mutex_unlock(&_g_rings_mutex);
+
+    return BUZZ_GPS_SUCCESS;
+}
+
+
+int buzz_log_async_stop(void) {
+    buzz_i_log_ring_t * ring;
+
+    pthread_mutex_lock(&_g_rings_mutex);
+    if (!_g_writer_running) {
+        pthread_mutex_unlock(&_g_rings_mutex);
+        return BUZZ_GPS_ERROR;
+    }
+    /* new lines go straight to the sink, wait out any push already under way */
+    atomic_store(&_g_async, 0);
+    for (ring = _g_rings; ring != NULL; ring = ring->next) {
+        while (atomic_load(&ring->in_use)) {
+            sched_yield();
         }
     }
+    pthread_cond_signal(&_g_writer_cond);
+    pthread_mutex_unlock(&_g_rings_mutex);
+
+    pthread_join(_g_writer_id, NULL);
+
+    pthread_mutex_lock(&_g_rings_mutex);
+    {
+        _g_writer_running = 0;
+        pthread_cond_destroy(&_g_writer_cond);
+    }
+    pthread_mutex_unlock(&_g_rings_mutex);
+
+    return BUZZ_GPS_SUCCESS;
+}
+
+
+uint64_t buzz_log_dropped(void) {
+    buzz_i_log_ring_t * ring;
+    uint64_t dropped;
+
+    pthread_mutex_lock(&_g_rings_mutex);
+    {
+        dropped = _g_dropped_freed;
+        for (ring = _g_rings; ring != NULL; ring = ring->next) {
+            dropped += atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+        }
+    }
+    pthread_mutex_unlock(&_g_rings_mutex);
+
+    return dropped;
 }
 
+
 void buzz_logger(LOG_LEVEL level, const char* fmt, ...)
 {
-    time_t now;
-    char * tag;
-    char * time_str;
+    char text[BUZZ_LOG_MAX_LINE];
+    char line[BUZZ_LOG_MAX_LINE + 64];
+    size_t length;
+    int n;
+    int queued = 0;
 
     if (level > BUZZ_DEBUG) {
         level = BUZZ_DEBUG;
     }
-    if (level > _g_level) {
+    if (level > g_buzz_log_level) {
         return;
     }
 
-    tag = _level_map[level];
     va_list a_list;
     va_start(a_list, fmt);
-
-    time(&now);
-    time_str = ctime(&now);
-    trim(time_str);
-
-    fprintf(stderr, "%s [%s]: ", time_str, tag);
-    vfprintf(stderr, fmt, a_list);
-    fprintf(stderr, "\n");
-
+    if (atomic_load_explicit(&_g_async, memory_order_relaxed) && !_t_writer) {
+        queued = buzz_l_log_push(level, fmt, a_list);
+    }
+    if (!queued) {
+        /* one write per line so lines from different threads do not interleave */
+        n = vsnprintf(text, sizeof(text), fmt, a_list);
+        if (n >= 0) {
+            length = buzz_l_log_format(line, sizeof(line), level,
+                buzz_l_log_time(buzz_l_log_now(), &_t_clock), text,
+                (size_t) n < sizeof(text) ? (size_t) n : sizeof(text) - 1);
+            buzz_l_log_emit(level, line, length);
+        }
+    }
     va_end(a_list);
 }
-
@@ -2,23 +2,123 @@
  * Logging module
  *
  * This is a simple logger. It adds time and level information to log lines that are
- * then written to stderr
+ * then handed to a sink, stderr unless one is set with buzz_set_log_sink().
+ *
+ * By default each line is written by the thread logging it. After
+ * buzz_log_async_start() lines are formatted into a ring owned by the
+ * logging thread and a background thread writes them out in batches, so a
+ * slow terminal or sink never holds up the GPS threads.
  */
 #ifndef BUZZ_LOGGER_H
 #define BUZZ_LOGGER_H
 
 #include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* numeric levels for the preprocessor, the same values as LOG_LEVEL */
+#define BUZZ_LOG_LEVEL_ERROR 0
+#define BUZZ_LOG_LEVEL_WARN 1
+#define BUZZ_LOG_LEVEL_INFO 2
+#define BUZZ_LOG_LEVEL_DEBUG 3
 
 typedef enum LOG_LEVEL_E {
-   BUZZ_ERROR = 0,
-   BUZZ_WARN,
-   BUZZ_INFO,
-   BUZZ_DEBUG
+   BUZZ_ERROR = BUZZ_LOG_LEVEL_ERROR,
+   BUZZ_WARN = BUZZ_LOG_LEVEL_WARN,
+   BUZZ_INFO = BUZZ_LOG_LEVEL_INFO,
+   BUZZ_DEBUG = BUZZ_LOG_LEVEL_DEBUG
 } LOG_LEVEL;
 
+/*
+ * The most verbose level compiled in. The library sets it with
+ * ./configure --with-log-level, calls to the BUZZ_LOG_* macros above it
+ * compile to nothing.
+ */
+#ifndef BUZZ_LOG_MIN_LEVEL
+#define BUZZ_LOG_MIN_LEVEL BUZZ_LOG_LEVEL_DEBUG
+#endif
+
+/* the runtime level, set with buzz_set_log_level() */
+extern int g_buzz_log_level;
+
+/* lines longer than this are truncated */
+#define BUZZ_LOG_MAX_LINE 1024
+/* lines each thread can have waiting for the writer in async mode */
+#define BUZZ_LOG_DEFAULT_RING_SIZE 64
+
+/*
+ * Receives one formatted line, including the time and level but without a
+ * trailing newline. In async mode it is only called from the writer thread.
+ */
+typedef void (*buzz_log_sink_t)(LOG_LEVEL level, const char * line, size_t length, void * arg);
+
 void buzz_logger(LOG_LEVEL level, const char* message, ...);
 
-void buzz_set_log_level(const char * level);
+/*
+ * Log through these rather than buzz_logger() directly. The arguments are
+ * only evaluated when the level is enabled at runtime, and when it is
+ * compiled out they are type checked but generate no code.
+ */
+#define BUZZ_LOG(level, ...) \
+    do { \
+        if (__builtin_expect((level) <= g_buzz_log_level, 0)) { \
+            buzz_logger((level), __VA_ARGS__); \
+        } \
+    } while (0)
+
+#define BUZZ_LOG_ELIDED(level, ...) \
+    do { \
+        if (0) { \
+            buzz_logger((level), __VA_ARGS__); \
+        } \
+    } while (0)
+
+#if BUZZ_LOG_MIN_LEVEL >= BUZZ_LOG_LEVEL_ERROR
+#define BUZZ_LOG_ERROR(...) BUZZ_LOG(BUZZ_ERROR, __VA_ARGS__)
+#else
+#define BUZZ_LOG_ERROR(...) BUZZ_LOG_ELIDED(BUZZ_ERROR, __VA_ARGS__)
+#endif
 
+#if BUZZ_LOG_MIN_LEVEL >= BUZZ_LOG_LEVEL_WARN
+#define BUZZ_LOG_WARN(...) BUZZ_LOG(BUZZ_WARN, __VA_ARGS__)
+#else
+#define BUZZ_LOG_WARN(...) BUZZ_LOG_ELIDED(BUZZ_WARN, __VA_ARGS__)
 #endif
 
+#if BUZZ_LOG_MIN_LEVEL >= BUZZ_LOG_LEVEL_INFO
+#define BUZZ_LOG_INFO(...) BUZZ_LOG(BUZZ_INFO, __VA_ARGS__)
+#else
+#define BUZZ_LOG_INFO(...) BUZZ_LOG_ELIDED(BUZZ_INFO, __VA_ARGS__)
+#endif
+
+#if BUZZ_LOG_MIN_LEVEL >= BUZZ_LOG_LEVEL_DEBUG
+#define BUZZ_LOG_DEBUG(...) BUZZ_LOG(BUZZ_DEBUG, __VA_ARGS__)
+#else
+#define BUZZ_LOG_DEBUG(...) BUZZ_LOG_ELIDED(BUZZ_DEBUG, __VA_ARGS__)
+#endif
+
+void buzz_set_log_level(const char * level);
+
+/*
+ * Send log lines to sink instead of stderr. A NULL sink restores stderr.
+ * Set it before buzz_log_async_start() or while no thread is logging.
+ */
+void buzz_set_log_sink(buzz_log_sink_t sink, void * arg);
+
+/*
+ * Start the writer thread. Each logging thread gets a ring of ring_size
+ * lines (0 for the default); when its ring is full new lines are dropped
+ * and counted rather than waiting for the writer.
+ */
+int buzz_log_async_start(size_t ring_size);
+
+/*
+ * Write out everything still queued, stop the writer thread and go back to
+ * writing from the logging thread.
+ */
+int buzz_log_async_stop(void);
+
+/* lines dropped because a ring was full */
+uint64_t buzz_log_dropped(void);
+
+#endif
@@ -0,0 +1,434 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "buzz_nmea.h"
+
+#define BUZZ_NMEA_TALKER_KEY(a, b) (((unsigned) (a) << 8) | (unsigned) (b))
+
+#define BUZZ_NMEA_ID_KEY(a, b, c) \
+    (((uint32_t) (a) << 16) | ((uint32_t) (b) << 8) | (uint32_t) (c))
+
+/*
+ * Perfect hash of the packed three character sentence IDs. The multiplier
+ * was searched for offline so that every ID below lands in its own slot;
+ * the tests check every entry still round trips.
+ */
+#define BUZZ_NMEA_ID_HASH_BITS 4
+#define BUZZ_NMEA_ID_HASH(key) \
+    ((uint32_t) ((key) * UINT32_C(0x2b59c)) >> (32 - BUZZ_NMEA_ID_HASH_BITS))
+
+#define BUZZ_NMEA_ID_ENTRY(a, b, c, t) \
+    [BUZZ_NMEA_ID_HASH(BUZZ_NMEA_ID_KEY(a, b, c))] = { BUZZ_NMEA_ID_KEY(a, b, c), t }
+
+typedef struct buzz_i_nmea_id_s
+{
+    uint32_t key;
+    buzz_sentence_type_t type;
+} buzz_i_nmea_id_t;
+
+static const buzz_i_nmea_id_t g_nmea_ids[1 << BUZZ_NMEA_ID_HASH_BITS] =
+{
+    BUZZ_NMEA_ID_ENTRY('G', 'G', 'A', BUZZ_GPGGA),
+    BUZZ_NMEA_ID_ENTRY('G', 'L', 'L', BUZZ_GPGLL),
+    BUZZ_NMEA_ID_ENTRY('V', 'T', 'G', BUZZ_GPVTG),
+    BUZZ_NMEA_ID_ENTRY('R', 'M', 'C', BUZZ_GPRMC),
+    BUZZ_NMEA_ID_ENTRY('G', 'S', 'A', BUZZ_GPGSA),
+    BUZZ_NMEA_ID_ENTRY('G', 'S', 'V', BUZZ_GPGSV),
+    BUZZ_NMEA_ID_ENTRY('M', 'S', 'S', BUZZ_GPMSS),
+    BUZZ_NMEA_ID_ENTRY('T', 'R', 'F', BUZZ_GPTRF),
+    BUZZ_NMEA_ID_ENTRY('S', 'T', 'N', BUZZ_GPSTN),
+    BUZZ_NMEA_ID_ENTRY('X', 'T', 'E', BUZZ_GPXTE),
+    BUZZ_NMEA_ID_ENTRY('Z', 'D', 'A', BUZZ_GPZDA),
+};
+
+_Static_assert(BUZZ_GPS_TYPE_COUNT == 11, "add new sentence types to g_nmea_ids");
+
+#define BUZZ_NMEA_MAX_DIGITS 18
+
+static const int64_t g_pow10[BUZZ_NMEA_MAX_DIGITS + 1] =
+{
+    INT64_C(1), INT64_C(10), INT64_C(100), INT64_C(1000), INT64_C(10000),
+    INT64_C(100000), INT64_C(1000000), INT64_C(10000000), INT64_C(100000000),
+    INT64_C(1000000000), INT64_C(10000000000), INT64_C(100000000000),
+    INT64_C(1000000000000), INT64_C(10000000000000), INT64_C(100000000000000),
+    INT64_C(1000000000000000), INT64_C(10000000000000000),
+    INT64_C(100000000000000000), INT64_C(1000000000000000000)
+};
+
+
+int buzz_nmea_tokenize(
+    const char * sentence,
+    buzz_gps_field_t * fields,
+    int max_fields)
+{
+    int field_count = 0;
+    size_t start = 0;
+    size_t ndx;
+    char c;
+
+    for (ndx = 0; ; ndx++)
+    {
+        c = sentence[ndx];
+        if (c == ',' && field_count < max_fields - 1)
+        {
+            fields[field_count].offset = start;
+            fields[field_count].length = ndx - start;
+            field_count++;
+            start = ndx + 1;
+        }
+        else if (c == '\0' || c == '*' || c == '\r' || c == '\n')
+        {
+            break;
+        }
+    }
+    fields[field_count].offset = start;
+    fields[field_count].length = ndx - start;
+
+    return field_count + 1;
+}
+
+
+unsigned char buzz_nmea_xor(const char * data, size_t len)
+{
+    uint64_t acc64 = 0;
+    uint64_t word;
+    size_t ndx = 0;
+#ifdef __SSE2__
+    __m128i acc = _mm_setzero_si128();
+
+    for (; ndx + 16 <= len; ndx += 16)
+    {
+        acc = _mm_xor_si128(acc, _mm_loadu_si128((const __m128i *) &data[ndx]));
+    }
+    /* fold the 16 lanes down to the low 8 bytes */
+    acc = _mm_xor_si128(acc, _mm_srli_si128(acc, 8));
+    _mm_storel_epi64((__m128i *) &acc64, acc);
+#endif
+
+    for (; ndx + 8 <= len; ndx += 8)
+    {
+        memcpy(&word, &data[ndx], sizeof(word));
+        acc64 ^= word;
+    }
+    acc64 ^= acc64 >> 32;
+    acc64 ^= acc64 >> 16;
+    acc64 ^= acc64 >> 8;
+    for (; ndx < len; ndx++)
+    {
+        acc64 ^= (unsigned char) data[ndx];
+    }
+
+    return (unsigned char) acc64;
+}
+
+
+static int buzz_l_nmea_hex(char c)
+{
+    if (c >= '0' && c <= '9')
+    {
+        return c - '0';
+    }
+    c |= 0x20;
+    if (c >= 'a' && c <= 'f')
+    {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+
+int buzz_nmea_verify_checksum(const char * sentence, size_t len)
+{
+    int hi;
+    int lo;
+
+    while (len > 0 && (sentence[len - 1] == '\n' || sentence[len - 1] == '\r'))
+    {
+        len--;
+    }
+    /* the checksum is always the last three characters */
+    if (len < 4 || sentence[len - 3] != '*')
+    {
+        return memchr(sentence, '*', len) == NULL ? BUZZ_GPS_NOT_FOUND : BUZZ_GPS_ERROR;
+    }
+    hi = buzz_l_nmea_hex(sentence[len - 2]);
+    lo = buzz_l_nmea_hex(sentence[len - 1]);
+    if (hi < 0 || lo < 0)
+    {
+        return BUZZ_GPS_ERROR;
+    }
+    /* skip the '$' */
+    if (buzz_nmea_xor(&sentence[1], len - 4) != ((hi << 4) | lo))
+    {
+        return BUZZ_GPS_ERROR;
+    }
+    return BUZZ_GPS_SUCCESS;
+}
+
+
+static buzz_talker_t buzz_l_nmea_talker(char a, char b)
+{
+    switch (BUZZ_NMEA_TALKER_KEY(a, b))
+    {
+        case BUZZ_NMEA_TALKER_KEY('G', 'P'):
+            return BUZZ_TALKER_GP;
+        case BUZZ_NMEA_TALKER_KEY('G', 'L'):
+            return BUZZ_TALKER_GL;
+        case BUZZ_NMEA_TALKER_KEY('G', 'A'):
+            return BUZZ_TALKER_GA;
+        case BUZZ_NMEA_TALKER_KEY('G', 'B'):
+            return BUZZ_TALKER_GB;
+        case BUZZ_NMEA_TALKER_KEY('B', 'D'):
+            return BUZZ_TALKER_BD;
+        case BUZZ_NMEA_TALKER_KEY('G', 'Q'):
+            return BUZZ_TALKER_GQ;
+        case BUZZ_NMEA_TALKER_KEY('G', 'N'):
+            return BUZZ_TALKER_GN;
+        default:
+            return BUZZ_TALKER_UNKNOWN;
+    }
+}
+
+
+buzz_sentence_type_t buzz_nmea_classify(
+    const char * type_field,
+    size_t len,
+    buzz_talker_t * out_talker)
+{
+    uint32_t key;
+    const buzz_i_nmea_id_t * ent;
+
+    *out_talker = BUZZ_TALKER_UNKNOWN;
+    if (len != 6 || type_field[0] != '$')
+    {
+        return BUZZ_GPS_TYPE_UNKNOWN;
+    }
+    *out_talker = buzz_l_nmea_talker(type_field[1], type_field[2]);
+    if (*out_talker == BUZZ_TALKER_UNKNOWN)
+    {
+        return BUZZ_GPS_TYPE_UNKNOWN;
+    }
+
+    key = BUZZ_NMEA_ID_KEY(type_field[3], type_field[4], type_field[5]);
+    ent = &g_nmea_ids[BUZZ_NMEA_ID_HASH(key)];
+    if (ent->key != key)
+    {
+        return BUZZ_GPS_TYPE_UNKNOWN;
+    }
+    return ent->type;
+}
+
+
+int buzz_nmea_parse_decimal(
+    const char * str,
+    size_t len,
+    int64_t * out_mantissa,
+    int * out_scale)
+{
+    int64_t mantissa = 0;
+    int scale = 0;
+    int digits = 0;
+    int seen_point = 0;
+    int negative = 0;
+    size_t ndx = 0;
+    unsigned d;
+
+    if (len > 0 && (str[0] == '-' || str[0] == '+'))
+    {
+        negative = str[0] == '-';
+        ndx++;
+    }
+    for (; ndx < len; ndx++)
+    {
+        d = (unsigned char) str[ndx] - '0';
+        if (d <= 9)
+        {
+            if (++digits > BUZZ_NMEA_MAX_DIGITS)
+            {
+                return BUZZ_GPS_ERROR;
+            }
+            mantissa = mantissa * 10 + d;
+            scale += seen_point;
+        }
+        else if (str[ndx] == '.' && !seen_point)
+        {
+            seen_point = 1;
+        }
+        else
+        {
+            return BUZZ_GPS_ERROR;
+        }
+    }
+    if (digits == 0)
+    {
+        return BUZZ_GPS_ERROR;
+    }
+
+    *out_mantissa = negative ? -mantissa : mantissa;
+    *out_scale = scale;
+    return BUZZ_GPS_SUCCESS;
+}
+
+
+int buzz_nmea_parse_double(const char * str, size_t len, double * out_value)
+{
+    int64_t mantissa;
+    int scale;
+
+    if (buzz_nmea_parse_decimal(str, len, &mantissa, &scale) != BUZZ_GPS_SUCCESS)
+    {
+        return BUZZ_GPS_ERROR;
+    }
+    *out_value = (double) mantissa / (double) g_pow10[scale];
+    return BUZZ_GPS_SUCCESS;
+}
+
+
+int buzz_nmea_parse_int(const char * str, size_t len, int * out_value)
+{
+    int64_t mantissa;
+    int scale;
+
+    if (buzz_nmea_parse_decimal(str, len, &mantissa, &scale) != BUZZ_GPS_SUCCESS
+        || scale != 0 || mantissa > INT32_MAX || mantissa < INT32_MIN)
+    {
+        return BUZZ_GPS_ERROR;
+    }
+    *out_value = (int) mantissa;
+    return BUZZ_GPS_SUCCESS;
+}
+
+
+int buzz_nmea_parse_coordinate(
+    const char * str,
+    size_t len,
+    char hemisphere,
+    double * out_degrees)
+{
+    int64_t mantissa;
+    int64_t unit;
+    int64_t degrees;
+    int64_t minutes;
+    int scale;
+    double v;
+    double limit;
+
+    if (buzz_nmea_parse_decimal(str, len, &mantissa, &scale) != BUZZ_GPS_SUCCESS
+        || mantissa < 0)
+    {
+        return BUZZ_GPS_ERROR;
+    }
+
+    /* keep 100 * 60 * 10^scale in range, NMEA never sends this many digits */
+    if (scale > 12)
+    {
+        mantissa /= g_pow10[scale - 12];
+        scale = 12;
+    }
+
+    /* mantissa is DDDMM.MMMM * 10^scale */
+    unit = g_pow10[scale];
+    degrees = mantissa / (100 * unit);
+    minutes = mantissa - degrees * 100 * unit;
+    if (minutes >= 60 * unit)
+    {
+        return BUZZ_GPS_ERROR;
+    }
+    v = (double) degrees + (double) minutes / (double) (60 * unit);
+
+    /* a missing or unknown hemisphere would put the fix in the wrong place */
+    switch (hemisphere)
+    {
+        case 'n':
+        case 'N':
+            limit = 90.0;
+            break;
+        case 's':
+        case 'S':
+            limit = 90.0;
+            v = -v;
+            break;
+        case 'e':
+        case 'E':
+            limit = 180.0;
+            break;
+        case 'w':
+        case 'W':
+            limit = 180.0;
+            v = -v;
+            break;
+        default:
+            return BUZZ_GPS_ERROR;
+    }
+    if (v > limit || v < -limit)
+    {
+        return BUZZ_GPS_ERROR;
+    }
+    *out_degrees = v;
+    return BUZZ_GPS_SUCCESS;
+}
+
+
+int buzz_nmea_parse_time(const char * str, size_t len, double * out_seconds)
+{
+    int hours;
+    int minutes;
+    double seconds;
+
+    if (len < 6
+        || buzz_nmea_parse_int(str, 2, &hours) != BUZZ_GPS_SUCCESS
+        || buzz_nmea_parse_int(&str[2], 2, &minutes) != BUZZ_GPS_SUCCESS
+        || buzz_nmea_parse_double(&str[4], len - 4, &seconds) != BUZZ_GPS_SUCCESS)
+    {
+        return BUZZ_GPS_ERROR;
+    }
+    /* 60 is allowed for a leap second */
+    if (hours < 0 || hours > 23 || minutes < 0 || minutes > 59 || seconds < 0.0 || seconds >= 61.0)
+    {
+        return BUZZ_GPS_ERROR;
+    }
+    *out_seconds = hours * 3600.0 + minutes * 60.0 + seconds;
+    return BUZZ_GPS_SUCCESS;
+}
+
+
+int buzz_nmea_parse_date(const char * str, size_t len, int * out_year, int * out_month, int * out_day)
+{
+    int day;
+    int month;
+    int year;
+
+    if (len != 6
+        || buzz_nmea_parse_int(str, 2, &day) != BUZZ_GPS_SUCCESS
+        || buzz_nmea_parse_int(&str[2], 2, &month) != BUZZ_GPS_SUCCESS
+        || buzz_nmea_parse_int(&str[4], 2, &year) != BUZZ_GPS_SUCCESS)
+    {
+        return BUZZ_GPS_ERROR;
+    }
+    if (day < 1 || day > 31 || month < 1 || month > 12 || year < 0)
+    {
+        return BUZZ_GPS_ERROR;
+    }
+    /* two digit years, GPS receivers predate 2000 but not 1980 */
+    *out_year = year < 80 ? 2000 + year : 1900 + year;
+    *out_month = month;
+    *out_day = day;
+    return BUZZ_GPS_SUCCESS;
+}
+
+
+int64_t buzz_nmea_days_from_civil(int year, int month, int day)
+{
+    int64_t y = year - (month <= 2);
+    int64_t era = (y >= 0 ? y : y - 399) / 400;
+    int64_t yoe = y - era * 400;
+    int64_t doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+    /* March based years put the leap day last, 719468 days from 0000-03-01 to 1970-01-01 */
+    return era * 146097 + doe - 719468;
+}
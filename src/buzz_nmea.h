@@ -0,0 +1,100 @@
+/*
+ * NMEA sentence helpers
+ *
+ * Low level routines shared by the parsers that work directly on the
+ * immutable sentence text held in a buzz_gps_raw_event_t.
+ */
+#ifndef BUZZ_NMEA_H
+#define BUZZ_NMEA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "buzz_gps.h"
+
+/*
+ * Record the offset and length of every comma separated field in one pass.
+ * The last field stops at the '*' checksum marker or the line ending.
+ *
+ *  Returns the number of fields found, at most max_fields.
+ */
+int buzz_nmea_tokenize(
+    const char * sentence,
+    buzz_gps_field_t * fields,
+    int max_fields);
+
+/*
+ * XOR of len bytes, 16 at a time with SSE2 when the compiler targets it
+ * and 8 at a time otherwise
+ */
+unsigned char buzz_nmea_xor(const char * data, size_t len);
+
+/*
+ * Check the "*hh" trailer of a framed "$...*hh\r\n" sentence against the
+ * XOR of the characters between the '$' and the '*'.
+ *
+ *  Returns BUZZ_GPS_SUCCESS, BUZZ_GPS_NOT_FOUND if the sentence has no
+ *  checksum, or BUZZ_GPS_ERROR if it is malformed or does not match.
+ */
+int buzz_nmea_verify_checksum(const char * sentence, size_t len);
+
+/*
+ * Classify a sentence from its first field, e.g. "$GNRMC". The talker and
+ * the sentence ID are decoded separately in constant time so every
+ * constellation maps onto the same sentence type.
+ *
+ *  Returns the sentence type or BUZZ_GPS_TYPE_UNKNOWN.
+ */
+buzz_sentence_type_t buzz_nmea_classify(
+    const char * type_field,
+    size_t len,
+    buzz_talker_t * out_talker);
+
+/*
+ * Parse an unsigned or signed decimal number such as "070.25" without
+ * going through the C library so the result does not depend on the locale.
+ * The value is mantissa / 10^scale, e.g. 7025 and 2.
+ *
+ *  Returns BUZZ_GPS_SUCCESS or BUZZ_GPS_ERROR if the text is empty, has
+ *  characters other than digits and one '.', or more than 18 digits.
+ */
+int buzz_nmea_parse_decimal(
+    const char * str,
+    size_t len,
+    int64_t * out_mantissa,
+    int * out_scale);
+
+int buzz_nmea_parse_double(const char * str, size_t len, double * out_value);
+
+int buzz_nmea_parse_int(const char * str, size_t len, int * out_value);
+
+/*
+ * Convert a DDMM.MMMM or DDDMM.MMMM coordinate and its hemisphere to signed
+ * decimal degrees. The degrees and minutes are separated in scaled integer
+ * arithmetic so only the final division rounds. The hemisphere must be one
+ * of N, S, E or W, and the result within 90 degrees for N and S and 180
+ * for E and W.
+ */
+int buzz_nmea_parse_coordinate(
+    const char * str,
+    size_t len,
+    char hemisphere,
+    double * out_degrees);
+
+/*
+ * Convert a hhmmss or hhmmss.ss UTC time to seconds since midnight
+ */
+int buzz_nmea_parse_time(const char * str, size_t len, double * out_seconds);
+
+/*
+ * Split a ddmmyy date, two digit years below 80 are taken to be 20yy
+ */
+int buzz_nmea_parse_date(const char * str, size_t len, int * out_year, int * out_month, int * out_day);
+
+/*
+ * Days from 1970-01-01 to a proleptic Gregorian date, in integer arithmetic
+ * so it needs neither mktime() nor the time zone
+ */
+int64_t buzz_nmea_days_from_civil(int year, int month, int day);
+
+#endif
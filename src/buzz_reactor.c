@@ -0,0 +1,457 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "buzz_gps.h"
+#include "buzz_dispatch.h"
+#include "buzz_framer.h"
+#include "buzz_handle.h"
+#include "buzz_logging.h"
+
+#define BUZZ_REACTOR_MAX_EVENTS 16
+/* the reactor thread wakes at least this often to time out epochs */
+#define BUZZ_REACTOR_IDLE_MS 100
+
+
+typedef struct buzz_i_reactor_entry_s
+{
+    /* NULL when the entry is free to be reused */
+    buzz_gps_handle_t gps_handle;
+    /* the fcntl flags to restore when the handle is removed */
+    int fd_flags;
+    struct buzz_i_reactor_entry_s * next;
+} buzz_i_reactor_entry_t;
+
+
+typedef struct buzz_i_gps_reactor_s
+{
+    int epoll_fd;
+    /* an eventfd registered with a NULL entry, written to by stop */
+    int wake_fd;
+
+    /*
+     * Held while ready handles are looked up and while handles are added
+     * or removed. Entries are only freed by destroy, so an event that was
+     * returned for a handle removed meanwhile finds a free entry rather
+     * than freed memory.
+     */
+    pthread_mutex_t mutex;
+    buzz_i_reactor_entry_t * entries;
+    int handle_count;
+
+    /*
+     * the handle being read or timed out with the mutex released, so its
+     * callbacks can add and remove other handles. Removing it waits on
+     * busy_cond until it is done.
+     */
+    buzz_gps_handle_t busy;
+    pthread_cond_t busy_cond;
+
+    atomic_int running;
+    pthread_t thread_id;
+} buzz_i_gps_reactor_t;
+
+
+static buzz_i_reactor_entry_t * buzz_l_reactor_find(buzz_gps_reactor_t reactor, buzz_gps_handle_t gps_handle)
+{
+    buzz_i_reactor_entry_t * entry;
+
+    for (entry = reactor->entries; entry != NULL; entry = entry->next)
+    {
+        if (entry->gps_handle == gps_handle)
+        {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+
+/*
+ * Release the lock to work on gps_handle, which stays registered until
+ * buzz_l_reactor_relock()
+ *
+ * must be called locked
+ */
+static void buzz_l_reactor_unlock_for(buzz_gps_reactor_t reactor, buzz_gps_handle_t gps_handle)
+{
+    reactor->busy = gps_handle;
+    pthread_mutex_unlock(&reactor->mutex);
+}
+
+
+static void buzz_l_reactor_relock(buzz_gps_reactor_t reactor)
+{
+    pthread_mutex_lock(&reactor->mutex);
+    reactor->busy = NULL;
+    pthread_cond_broadcast(&reactor->busy_cond);
+}
+
+
+/*
+ * Read once from a ready handle and deliver every complete sentence.
+ * Only one read is done per wakeup so that a chatty device cannot starve
+ * the others; epoll is level triggered and reports it again if more is
+ * waiting.
+ */
+static void buzz_l_reactor_read(buzz_gps_reactor_t reactor, buzz_gps_handle_t gps_handle)
+{
+    buzz_i_dispatch_item_t item;
+    ssize_t n;
+    int err;
+    int rc;
+
+    pthread_mutex_lock(&gps_handle->mutex);
+    {
+        n = buzz_framer_fill(&gps_handle->framer, gps_handle->serial_port);
+        err = errno;
+    }
+    pthread_mutex_unlock(&gps_handle->mutex);
+
+    if (n == 0 || (n < 0 && err != EAGAIN && err != EWOULDBLOCK))
+    {
+        if (n == 0)
+        {
+            BUZZ_LOG_ERROR("End of file on the serial port");
+        }
+        else
+        {
+            BUZZ_LOG_ERROR("GPS error returned when reading the serial port: %s", strerror(err));
+        }
+        /* stop polling it, the entry stays until the handle is removed */
+        epoll_ctl(reactor->epoll_fd, EPOLL_CTL_DEL, gps_handle->serial_port, NULL);
+    }
+
+    for (;;)
+    {
+        pthread_mutex_lock(&gps_handle->mutex);
+        {
+            rc = buzz_handle_next_buffered(gps_handle, &item);
+        }
+        pthread_mutex_unlock(&gps_handle->mutex);
+        if (rc != BUZZ_GPS_SUCCESS)
+        {
+            break;
+        }
+        buzz_handle_deliver(&item, gps_handle);
+    }
+}
+
+
+static int buzz_l_reactor_poll(buzz_gps_reactor_t reactor, int timeout_ms)
+{
+    struct epoll_event events[BUZZ_REACTOR_MAX_EVENTS];
+    buzz_i_reactor_entry_t * entry;
+    buzz_gps_handle_t gps_handle;
+    uint64_t count;
+    int n;
+    int i;
+
+    n = epoll_wait(reactor->epoll_fd, events, BUZZ_REACTOR_MAX_EVENTS, timeout_ms);
+    if (n < 0)
+    {
+        if (errno == EINTR)
+        {
+            return BUZZ_GPS_SUCCESS;
+        }
+        BUZZ_LOG_ERROR("Failed to wait for the GPS devices: %s", strerror(errno));
+        return BUZZ_GPS_ERROR;
+    }
+
+    pthread_mutex_lock(&reactor->mutex);
+    {
+        for (i = 0; i < n; i++)
+        {
+            entry = (buzz_i_reactor_entry_t *) events[i].data.ptr;
+            if (entry == NULL)
+            {
+                if (read(reactor->wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+                {
+                    BUZZ_LOG_ERROR("Failed to clear the reactor wakeup: %s", strerror(errno));
+                }
+                continue;
+            }
+            gps_handle = entry->gps_handle;
+            if (gps_handle != NULL)
+            {
+                /* the callbacks run without the lock */
+                buzz_l_reactor_unlock_for(reactor, gps_handle);
+                buzz_l_reactor_read(reactor, gps_handle);
+                buzz_l_reactor_relock(reactor);
+            }
+        }
+        /* entries are only ever pushed on the front, so next stays valid while unlocked */
+        for (entry = reactor->entries; entry != NULL; entry = entry->next)
+        {
+            gps_handle = entry->gps_handle;
+            if (gps_handle != NULL)
+            {
+                buzz_l_reactor_unlock_for(reactor, gps_handle);
+                buzz_handle_idle(gps_handle);
+                buzz_l_reactor_relock(reactor);
+            }
+        }
+    }
+    pthread_mutex_unlock(&reactor->mutex);
+
+    return BUZZ_GPS_SUCCESS;
+}
+
+
+static void * buzz_l_reactor_thread(void * arg)
+{
+    buzz_gps_reactor_t reactor = (buzz_gps_reactor_t) arg;
+
+    while (atomic_load(&reactor->running))
+    {
+        if (buzz_l_reactor_poll(reactor, BUZZ_REACTOR_IDLE_MS) != BUZZ_GPS_SUCCESS)
+        {
+            break;
+        }
+    }
+    return NULL;
+}
+
+
+int buzz_gps_reactor_create(buzz_gps_reactor_t * out_reactor)
+{
+    buzz_i_gps_reactor_t * new_reactor;
+    struct epoll_event ev;
+
+    new_reactor = (buzz_i_gps_reactor_t *) calloc(1, sizeof(buzz_i_gps_reactor_t));
+    if (new_reactor == NULL)
+    {
+        return BUZZ_GPS_ERROR;
+    }
+    new_reactor->wake_fd = -1;
+    new_reactor->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (new_reactor->epoll_fd < 0)
+    {
+        BUZZ_LOG_ERROR("Failed to create the epoll instance: %s", strerror(errno));
+        goto error;
+    }
+    new_reactor->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (new_reactor->wake_fd < 0)
+    {
+        BUZZ_LOG_ERROR("Failed to create the reactor wakeup: %s", strerror(errno));
+        goto error;
+    }
+    memset(&ev, '\0', sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(new_reactor->epoll_fd, EPOLL_CTL_ADD, new_reactor->wake_fd, &ev) != 0)
+    {
+        BUZZ_LOG_ERROR("Failed to register the reactor wakeup: %s", strerror(errno));
+        goto error;
+    }
+    pthread_mutex_init(&new_reactor->mutex, NULL);
+    pthread_cond_init(&new_reactor->busy_cond, NULL);
+
+    *out_reactor = new_reactor;
+
+    return BUZZ_GPS_SUCCESS;
+error:
+    if (new_reactor->wake_fd >= 0)
+    {
+        close(new_reactor->wake_fd);
+    }
+    if (new_reactor->epoll_fd >= 0)
+    {
+        close(new_reactor->epoll_fd);
+    }
+    free(new_reactor);
+    return BUZZ_GPS_ERROR;
+}
+
+
+int buzz_gps_reactor_destroy(buzz_gps_reactor_t reactor)
+{
+    buzz_i_reactor_entry_t * entry;
+
+    if (atomic_load(&reactor->running))
+    {
+        BUZZ_LOG_WARN("Trying to destroy a running reactor. Call stop first");
+        return BUZZ_GPS_ERROR;
+    }
+    if (reactor->handle_count > 0)
+    {
+        BUZZ_LOG_WARN("Trying to destroy a reactor with %d handles. Remove them first", reactor->handle_count);
+        return BUZZ_GPS_ERROR;
+    }
+
+    while (reactor->entries != NULL)
+    {
+        entry = reactor->entries;
+        reactor->entries = entry->next;
+        free(entry);
+    }
+    close(reactor->wake_fd);
+    close(reactor->epoll_fd);
+    pthread_cond_destroy(&reactor->busy_cond);
+    pthread_mutex_destroy(&reactor->mutex);
+    free(reactor);
+
+    return BUZZ_GPS_SUCCESS;
+}
+
+
+int buzz_gps_reactor_add(
+    buzz_gps_reactor_t reactor,
+    buzz_gps_handle_t gps_handle,
+    buzz_gps_raw_event_callback_t raw_cb,
+    buzz_gps_event_callback_t event_cb,
+    void * user_arg)
+{
+    buzz_i_reactor_entry_t * entry;
+    struct epoll_event ev;
+    int flags;
+    int rc = BUZZ_GPS_ERROR;
+
+    if (atomic_load(&gps_handle->running) || gps_handle->reactor != NULL)
+    {
+        BUZZ_LOG_WARN("Attempting to add a handle that is already running");
+        return BUZZ_GPS_ERROR;
+    }
+    if (gps_handle->replay.active)
+    {
+        BUZZ_LOG_WARN("A replay handle has no device to poll");
+        return BUZZ_GPS_ERROR;
+    }
+
+    pthread_mutex_lock(&reactor->mutex);
+    {
+        flags = fcntl(gps_handle->serial_port, F_GETFL);
+        if (flags < 0 || fcntl(gps_handle->serial_port, F_SETFL, flags | O_NONBLOCK) != 0)
+        {
+            BUZZ_LOG_ERROR("Failed to make the serial port non-blocking: %s", strerror(errno));
+            goto out;
+        }
+
+        entry = buzz_l_reactor_find(reactor, NULL);
+        if (entry == NULL)
+        {
+            entry = (buzz_i_reactor_entry_t *) calloc(1, sizeof(buzz_i_reactor_entry_t));
+            if (entry == NULL)
+            {
+                fcntl(gps_handle->serial_port, F_SETFL, flags);
+                goto out;
+            }
+            entry->next = reactor->entries;
+            reactor->entries = entry;
+        }
+
+        gps_handle->raw_cb = raw_cb;
+        gps_handle->event_cb = event_cb;
+        gps_handle->user_arg = user_arg;
+
+        memset(&ev, '\0', sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.ptr = entry;
+        if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, gps_handle->serial_port, &ev) != 0)
+        {
+            BUZZ_LOG_ERROR("Failed to register the serial port: %s", strerror(errno));
+            fcntl(gps_handle->serial_port, F_SETFL, flags);
+            goto out;
+        }
+        entry->fd_flags = flags;
+        entry->gps_handle = gps_handle;
+        gps_handle->reactor = reactor;
+        reactor->handle_count++;
+        rc = BUZZ_GPS_SUCCESS;
+    }
+out:
+    pthread_mutex_unlock(&reactor->mutex);
+
+    return rc;
+}
+
+
+int buzz_gps_reactor_remove(buzz_gps_reactor_t reactor, buzz_gps_handle_t gps_handle)
+{
+    buzz_i_reactor_entry_t * entry;
+
+    if (gps_handle->reactor != reactor)
+    {
+        BUZZ_LOG_WARN("Attempting to remove a handle that is not in this reactor");
+        return BUZZ_GPS_ERROR;
+    }
+
+    pthread_mutex_lock(&reactor->mutex);
+    {
+        /* the caller may destroy the handle next, let the reactor finish with it */
+        while (reactor->busy == gps_handle)
+        {
+            pthread_cond_wait(&reactor->busy_cond, &reactor->mutex);
+        }
+        entry = buzz_l_reactor_find(reactor, gps_handle);
+        /* fails harmlessly if a read error already took it out */
+        epoll_ctl(reactor->epoll_fd, EPOLL_CTL_DEL, gps_handle->serial_port, NULL);
+        fcntl(gps_handle->serial_port, F_SETFL, entry->fd_flags);
+        buzz_handle_flush(gps_handle);
+        entry->gps_handle = NULL;
+        gps_handle->reactor = NULL;
+        reactor->handle_count--;
+    }
+    pthread_mutex_unlock(&reactor->mutex);
+
+    return BUZZ_GPS_SUCCESS;
+}
+
+
+int buzz_gps_reactor_run_once(buzz_gps_reactor_t reactor, int timeout_ms)
+{
+    if (atomic_load(&reactor->running))
+    {
+        BUZZ_LOG_WARN("The reactor thread is already running");
+        return BUZZ_GPS_ERROR;
+    }
+    return buzz_l_reactor_poll(reactor, timeout_ms);
+}
+
+
+int buzz_gps_reactor_start(buzz_gps_reactor_t reactor)
+{
+    if (atomic_load(&reactor->running))
+    {
+        BUZZ_LOG_WARN("Attempting to start a running reactor");
+        return BUZZ_GPS_ERROR;
+    }
+
+    atomic_store(&reactor->running, 1);
+    if (pthread_create(&reactor->thread_id, NULL, buzz_l_reactor_thread, reactor) != 0)
+    {
+        BUZZ_LOG_ERROR("Failed to start the reactor thread");
+        atomic_store(&reactor->running, 0);
+        return BUZZ_GPS_ERROR;
+    }
+
+    return BUZZ_GPS_SUCCESS;
+}
+
+
+int buzz_gps_reactor_stop(buzz_gps_reactor_t reactor)
+{
+    uint64_t one = 1;
+
+    if (!atomic_load(&reactor->running))
+    {
+        BUZZ_LOG_WARN("Attempting to stop a reactor that is not running");
+        return BUZZ_GPS_ERROR;
+    }
+
+    BUZZ_LOG_INFO("Shutting down the reactor thread");
+    atomic_store(&reactor->running, 0);
+    if (write(reactor->wake_fd, &one, sizeof(one)) != sizeof(one))
+    {
+        BUZZ_LOG_ERROR("Failed to wake the reactor thread: %s", strerror(errno));
+    }
+    pthread_join(reactor->thread_id, NULL);
+
+    return BUZZ_GPS_SUCCESS;
+}
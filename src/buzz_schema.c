@@ -0,0 +1,342 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "buzz_schema.h"
+#include "buzz_nmea.h"
+#include "buzz_logging.h"
+
+/*
+ * How the text of a value is converted
+ */
+typedef enum buzz_i_value_type_e {
+    BUZZ_I_VALUE_DOUBLE,
+    BUZZ_I_VALUE_INT,
+    /* hhmmss.ss */
+    BUZZ_I_VALUE_TIME,
+    /* ddmmyy */
+    BUZZ_I_VALUE_DATE,
+    /* dd,mm,yyyy */
+    BUZZ_I_VALUE_DMY,
+    /* DDMM.MMMM,N,DDDMM.MMMM,W */
+    BUZZ_I_VALUE_POSITION,
+    /* the number of fields that are not empty */
+    BUZZ_I_VALUE_TALLY
+} buzz_i_value_type_t;
+
+/* size of the buzz_gps_fix_t member each conversion writes */
+#define BUZZ_I_VALUE_SIZE_DOUBLE sizeof(double)
+#define BUZZ_I_VALUE_SIZE_INT sizeof(int)
+#define BUZZ_I_VALUE_SIZE_TIME sizeof(double)
+#define BUZZ_I_VALUE_SIZE_DATE sizeof(int)
+#define BUZZ_I_VALUE_SIZE_DMY sizeof(int)
+#define BUZZ_I_VALUE_SIZE_POSITION sizeof(double)
+#define BUZZ_I_VALUE_SIZE_TALLY sizeof(int)
+
+/*
+ * Every value a schema can name: its conversion, the buzz_gps_fix_t member
+ * it is written to, the flag set once it is, and how many fields it spans.
+ * DATE and DMY fill year, month and day, POSITION latitude and longitude.
+ */
+#define BUZZ_FIELD_KINDS(K) \
+    K(TIME,            TIME,     utc_seconds,        BUZZ_GPS_FIX_TIME,       1) \
+    K(DATE,            DATE,     year,               BUZZ_GPS_FIX_DATE,       1) \
+    K(DAY_MONTH_YEAR,  DMY,      year,               BUZZ_GPS_FIX_DATE,       3) \
+    K(POSITION,        POSITION, latitude,           BUZZ_GPS_FIX_LOCATION,   4) \
+    K(SPEED_KNOTS,     DOUBLE,   speed_knots,        BUZZ_GPS_FIX_SPEED,      1) \
+    K(COURSE,          DOUBLE,   course,             BUZZ_GPS_FIX_COURSE,     1) \
+    K(ALTITUDE,        DOUBLE,   altitude_meters,    BUZZ_GPS_FIX_ALTITUDE,   1) \
+    K(QUALITY,         INT,      quality,            BUZZ_GPS_FIX_QUALITY,    1) \
+    K(MODE,            INT,      mode,               BUZZ_GPS_FIX_MODE,       1) \
+    K(SATELLITES_USED, INT,      satellites_used,    BUZZ_GPS_FIX_SATELLITES, 1) \
+    K(SATELLITE_IDS,   TALLY,    satellites_used,    BUZZ_GPS_FIX_SATELLITES, 12) \
+    K(IN_VIEW,         INT,      satellites_in_view, BUZZ_GPS_FIX_IN_VIEW,    1) \
+    K(HDOP,            DOUBLE,   hdop,               BUZZ_GPS_FIX_HDOP,       1) \
+    K(PDOP,            DOUBLE,   pdop,               BUZZ_GPS_FIX_PDOP,       1) \
+    K(VDOP,            DOUBLE,   vdop,               BUZZ_GPS_FIX_VDOP,       1)
+
+/*
+ * The sentence schemas, one F(field index, kind, REQUIRED or OPTIONAL) per
+ * value. A sentence fails to parse when a required value is missing or
+ * malformed, optional ones are skipped.
+ */
+#define BUZZ_SCHEMA_GGA(F) \
+    F(1,  TIME,            OPTIONAL) \
+    F(2,  POSITION,        OPTIONAL) \
+    F(6,  QUALITY,         REQUIRED) \
+    F(7,  SATELLITES_USED, OPTIONAL) \
+    F(8,  HDOP,            OPTIONAL) \
+    F(9,  ALTITUDE,        OPTIONAL)
+
+#define BUZZ_SCHEMA_GLL(F) \
+    F(1,  POSITION,        REQUIRED) \
+    F(5,  TIME,            OPTIONAL)
+
+#define BUZZ_SCHEMA_VTG(F) \
+    F(1,  COURSE,          OPTIONAL) \
+    F(5,  SPEED_KNOTS,     REQUIRED)
+
+#define BUZZ_SCHEMA_RMC(F) \
+    F(1,  TIME,            OPTIONAL) \
+    F(3,  POSITION,        REQUIRED) \
+    F(7,  SPEED_KNOTS,     OPTIONAL) \
+    F(8,  COURSE,          OPTIONAL) \
+    F(9,  DATE,            OPTIONAL)
+
+#define BUZZ_SCHEMA_GSA(F) \
+    F(2,  MODE,            REQUIRED) \
+    F(3,  SATELLITE_IDS,   OPTIONAL) \
+    F(15, PDOP,            OPTIONAL) \
+    F(16, HDOP,            OPTIONAL) \
+    F(17, VDOP,            OPTIONAL)
+
+#define BUZZ_SCHEMA_GSV(F) \
+    F(3,  IN_VIEW,         REQUIRED)
+
+#define BUZZ_SCHEMA_ZDA(F) \
+    F(1,  TIME,            OPTIONAL) \
+    F(2,  DAY_MONTH_YEAR,  REQUIRED)
+
+/* sentence type and the suffix of its BUZZ_SCHEMA_ list */
+#define BUZZ_SENTENCE_SCHEMAS(S) \
+    S(BUZZ_GPGGA, GGA) \
+    S(BUZZ_GPGLL, GLL) \
+    S(BUZZ_GPVTG, VTG) \
+    S(BUZZ_GPRMC, RMC) \
+    S(BUZZ_GPGSA, GSA) \
+    S(BUZZ_GPGSV, GSV) \
+    S(BUZZ_GPZDA, ZDA)
+
+
+#define BUZZ_I_REQUIRED 1
+#define BUZZ_I_OPTIONAL 0
+
+typedef enum buzz_i_field_kind_e {
+#define BUZZ_L_KIND_ENUM(name, type, member, flag, span) BUZZ_I_FIELD_##name,
+    BUZZ_FIELD_KINDS(BUZZ_L_KIND_ENUM)
+#undef BUZZ_L_KIND_ENUM
+    BUZZ_I_FIELD_COUNT
+} buzz_i_field_kind_t;
+
+enum {
+#define BUZZ_L_KIND_SPAN(name, type, member, flag, span) BUZZ_I_SPAN_##name = (span),
+    BUZZ_FIELD_KINDS(BUZZ_L_KIND_SPAN)
+#undef BUZZ_L_KIND_SPAN
+};
+
+typedef struct buzz_i_field_kind_desc_s {
+    const char * name;
+    buzz_i_value_type_t type;
+    size_t offset;
+    unsigned int flag;
+    int span;
+} buzz_i_field_kind_desc_t;
+
+static const buzz_i_field_kind_desc_t g_field_kinds[BUZZ_I_FIELD_COUNT] = {
+#define BUZZ_L_KIND_DESC(name, type, member, flag, span) \
+    [BUZZ_I_FIELD_##name] = { #name, BUZZ_I_VALUE_##type, offsetof(buzz_gps_fix_t, member), (flag), (span) },
+    BUZZ_FIELD_KINDS(BUZZ_L_KIND_DESC)
+#undef BUZZ_L_KIND_DESC
+};
+
+typedef struct buzz_i_schema_field_s {
+    unsigned char index;
+    unsigned char kind;
+    unsigned char required;
+} buzz_i_schema_field_t;
+
+struct buzz_i_sentence_schema_s {
+    const buzz_i_schema_field_t * fields;
+    int count;
+};
+
+
+/*
+ * Compile time checks: each kind writes a member of the size its
+ * conversion produces, and each schema has a required value and fields
+ * that lie inside a sentence without overlapping
+ */
+#define BUZZ_L_KIND_CHECK(name, type, member, flag, span) \
+    _Static_assert(sizeof(((buzz_gps_fix_t *) 0)->member) == BUZZ_I_VALUE_SIZE_##type, \
+        "the " #name " value does not match buzz_gps_fix_t." #member);
+BUZZ_FIELD_KINDS(BUZZ_L_KIND_CHECK)
+#undef BUZZ_L_KIND_CHECK
+
+#define BUZZ_L_FIELD_CHECK(ndx, kind, req) \
+    _Static_assert((ndx) > 0 && (ndx) + BUZZ_I_SPAN_##kind <= BUZZ_GPS_MAX_PARSE_WORDS, \
+        "the " #kind " value at field " #ndx " is out of range");
+#define BUZZ_L_FIELD_MASK(ndx, kind, req) ((((uint64_t) 1 << BUZZ_I_SPAN_##kind) - 1) << (ndx))
+#define BUZZ_L_FIELD_MASK_OR(ndx, kind, req) | BUZZ_L_FIELD_MASK(ndx, kind, req)
+#define BUZZ_L_FIELD_MASK_SUM(ndx, kind, req) + BUZZ_L_FIELD_MASK(ndx, kind, req)
+#define BUZZ_L_FIELD_REQUIRED(ndx, kind, req) + BUZZ_I_##req
+
+#define BUZZ_L_SCHEMA_CHECK(type, name) \
+    BUZZ_SCHEMA_##name(BUZZ_L_FIELD_CHECK) \
+    _Static_assert((0 BUZZ_SCHEMA_##name(BUZZ_L_FIELD_MASK_OR)) == (0 BUZZ_SCHEMA_##name(BUZZ_L_FIELD_MASK_SUM)), \
+        "the " #name " schema has overlapping fields"); \
+    _Static_assert((0 BUZZ_SCHEMA_##name(BUZZ_L_FIELD_REQUIRED)) > 0, \
+        "the " #name " schema has no required field");
+BUZZ_SENTENCE_SCHEMAS(BUZZ_L_SCHEMA_CHECK)
+#undef BUZZ_L_SCHEMA_CHECK
+
+
+#define BUZZ_L_SCHEMA_FIELD(ndx, kind, req) { (ndx), BUZZ_I_FIELD_##kind, BUZZ_I_##req },
+#define BUZZ_L_SCHEMA_FIELDS(type, name) \
+    static const buzz_i_schema_field_t g_schema_##name[] = { BUZZ_SCHEMA_##name(BUZZ_L_SCHEMA_FIELD) };
+BUZZ_SENTENCE_SCHEMAS(BUZZ_L_SCHEMA_FIELDS)
+#undef BUZZ_L_SCHEMA_FIELDS
+
+static const buzz_i_sentence_schema_t g_schemas[BUZZ_GPS_TYPE_COUNT] = {
+#define BUZZ_L_SCHEMA_ENTRY(type, name) \
+    [type] = { g_schema_##name, sizeof(g_schema_##name) / sizeof(buzz_i_schema_field_t) },
+    BUZZ_SENTENCE_SCHEMAS(BUZZ_L_SCHEMA_ENTRY)
+#undef BUZZ_L_SCHEMA_ENTRY
+};
+
+
+const buzz_i_sentence_schema_t * buzz_schema_for(buzz_sentence_type_t type)
+{
+    if ((unsigned) type >= BUZZ_GPS_TYPE_COUNT || g_schemas[type].fields == NULL)
+    {
+        return NULL;
+    }
+    return &g_schemas[type];
+}
+
+
+static char buzz_l_schema_char(const buzz_gps_raw_event_t * raw_event, int ndx)
+{
+    if (raw_event->fields[ndx].length == 0)
+    {
+        return '\0';
+    }
+    return raw_event->sentence[raw_event->fields[ndx].offset];
+}
+
+
+static int buzz_l_schema_dmy(const buzz_gps_raw_event_t * raw_event, int ndx, buzz_gps_fix_t * out_fix)
+{
+    const buzz_gps_field_t * fields = &raw_event->fields[ndx];
+    const char * sentence = raw_event->sentence;
+    int day;
+    int month;
+    int year;
+
+    if (buzz_nmea_parse_int(&sentence[fields[0].offset], fields[0].length, &day) != BUZZ_GPS_SUCCESS
+        || buzz_nmea_parse_int(&sentence[fields[1].offset], fields[1].length, &month) != BUZZ_GPS_SUCCESS
+        || buzz_nmea_parse_int(&sentence[fields[2].offset], fields[2].length, &year) != BUZZ_GPS_SUCCESS
+        || day < 1 || day > 31 || month < 1 || month > 12 || year < 1980)
+    {
+        return BUZZ_GPS_ERROR;
+    }
+    out_fix->year = year;
+    out_fix->month = month;
+    out_fix->day = day;
+    return BUZZ_GPS_SUCCESS;
+}
+
+
+static int buzz_l_schema_position(const buzz_gps_raw_event_t * raw_event, int ndx, buzz_gps_fix_t * out_fix)
+{
+    const buzz_gps_field_t * fields = &raw_event->fields[ndx];
+    const char * sentence = raw_event->sentence;
+    double lat;
+    double lon;
+
+    if (buzz_nmea_parse_coordinate(&sentence[fields[0].offset], fields[0].length,
+            buzz_l_schema_char(raw_event, ndx + 1), &lat) != BUZZ_GPS_SUCCESS
+        || buzz_nmea_parse_coordinate(&sentence[fields[2].offset], fields[2].length,
+            buzz_l_schema_char(raw_event, ndx + 3), &lon) != BUZZ_GPS_SUCCESS)
+    {
+        return BUZZ_GPS_ERROR;
+    }
+    out_fix->latitude = lat;
+    out_fix->longitude = lon;
+    return BUZZ_GPS_SUCCESS;
+}
+
+
+static int buzz_l_schema_value(
+    const buzz_i_field_kind_desc_t * desc,
+    const buzz_gps_raw_event_t * raw_event,
+    int ndx,
+    buzz_gps_fix_t * out_fix)
+{
+    const char * str = &raw_event->sentence[raw_event->fields[ndx].offset];
+    size_t len = raw_event->fields[ndx].length;
+    char * member = (char *) out_fix + desc->offset;
+    int count = 0;
+    int i;
+
+    switch (desc->type)
+    {
+        case BUZZ_I_VALUE_DOUBLE:
+            return buzz_nmea_parse_double(str, len, (double *) member);
+
+        case BUZZ_I_VALUE_INT:
+            return buzz_nmea_parse_int(str, len, (int *) member);
+
+        case BUZZ_I_VALUE_TIME:
+            return buzz_nmea_parse_time(str, len, (double *) member);
+
+        case BUZZ_I_VALUE_DATE:
+            return buzz_nmea_parse_date(str, len, &out_fix->year, &out_fix->month, &out_fix->day);
+
+        case BUZZ_I_VALUE_DMY:
+            return buzz_l_schema_dmy(raw_event, ndx, out_fix);
+
+        case BUZZ_I_VALUE_POSITION:
+            return buzz_l_schema_position(raw_event, ndx, out_fix);
+
+        case BUZZ_I_VALUE_TALLY:
+            for (i = 0; i < desc->span; i++)
+            {
+                count += raw_event->fields[ndx + i].length > 0;
+            }
+            *(int *) member = count;
+            return BUZZ_GPS_SUCCESS;
+    }
+    return BUZZ_GPS_ERROR;
+}
+
+
+int buzz_schema_parse(
+    const buzz_i_sentence_schema_t * schema,
+    const buzz_gps_raw_event_t * raw_event,
+    buzz_gps_fix_t * out_fix)
+{
+    const buzz_i_schema_field_t * field;
+    const buzz_i_field_kind_desc_t * desc;
+    int i;
+
+    for (i = 0; i < schema->count; i++)
+    {
+        field = &schema->fields[i];
+        desc = &g_field_kinds[field->kind];
+
+        if (field->index + desc->span > raw_event->field_count
+            || (desc->type != BUZZ_I_VALUE_TALLY && raw_event->fields[field->index].length == 0))
+        {
+            if (field->required)
+            {
+                BUZZ_LOG_ERROR("Missing the %s field %d of %d", desc->name, field->index, raw_event->field_count);
+                return BUZZ_GPS_ERROR;
+            }
+            continue;
+        }
+        if (buzz_l_schema_value(desc, raw_event, field->index, out_fix) != BUZZ_GPS_SUCCESS)
+        {
+            if (field->required)
+            {
+                BUZZ_LOG_ERROR("Failed to get %s: %.*s", desc->name,
+                    raw_event->fields[field->index].length, &raw_event->sentence[raw_event->fields[field->index].offset]);
+                return BUZZ_GPS_ERROR;
+            }
+            BUZZ_LOG_DEBUG("Skipping a bad %s field %d", desc->name, field->index);
+            continue;
+        }
+        out_fix->flags |= desc->flag;
+    }
+
+    return BUZZ_GPS_SUCCESS;
+}
@@ -0,0 +1,32 @@
+/*
+ * Table driven sentence parsing
+ *
+ * Every supported sentence is described by a schema listing which field
+ * holds which value, instead of a parser written by hand for each one.
+ * The schemas live in buzz_schema.c.
+ */
+#ifndef BUZZ_SCHEMA_H
+#define BUZZ_SCHEMA_H
+
+#include "buzz_gps.h"
+
+typedef struct buzz_i_sentence_schema_s buzz_i_sentence_schema_t;
+
+/*
+ *  Returns the schema for a sentence type, NULL if it has none
+ */
+const buzz_i_sentence_schema_t * buzz_schema_for(buzz_sentence_type_t type);
+
+/*
+ * Fill in out_fix from the fields of a split sentence. Empty optional
+ * fields are skipped and leave their flag clear.
+ *
+ *  Returns BUZZ_GPS_SUCCESS, or BUZZ_GPS_ERROR if a required field is
+ *  missing or malformed.
+ */
+int buzz_schema_parse(
+    const buzz_i_sentence_schema_t * schema,
+    const buzz_gps_raw_event_t * raw_event,
+    buzz_gps_fix_t * out_fix);
+
+#endif
@@ -0,0 +1,93 @@
+/*
+ * Sequence lock
+ *
+ * Publishes a small struct from one writer to any number of readers without
+ * a mutex. Readers never block the writer; they retry the copy if the
+ * writer changed the data underneath them. The payload is copied as relaxed
+ * atomic words so concurrent readers are not data races.
+ */
+#ifndef BUZZ_SEQLOCK_H
+#define BUZZ_SEQLOCK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+
+/* number of 64 bit words needed to hold a value of type t */
+#define BUZZ_SEQLOCK_WORDS(t) ((sizeof(t) + sizeof(uint64_t) - 1) / sizeof(uint64_t))
+
+/* declare a seqlock named name able to hold a value of type t */
+#define BUZZ_SEQLOCK_DECLARE(t, name) \
+    struct { \
+        atomic_uint seq; \
+        _Atomic uint64_t words[BUZZ_SEQLOCK_WORDS(t)]; \
+    } name
+
+#define BUZZ_SEQLOCK_WRITE(lock, src) \
+    buzz_seqlock_write(&(lock).seq, (lock).words, (src), sizeof(*(src)))
+
+#define BUZZ_SEQLOCK_READ(lock, dst) \
+    buzz_seqlock_read(&(lock).seq, (lock).words, (dst), sizeof(*(dst)))
+
+
+/* only one writer at a time, callers serialize writers themselves */
+static inline void buzz_seqlock_write(
+    atomic_uint * seq, _Atomic uint64_t * words, const void * src, size_t len)
+{
+    uint64_t tmp[8];
+    unsigned s;
+    size_t n;
+    size_t i;
+    size_t chunk;
+
+    s = atomic_load_explicit(seq, memory_order_relaxed);
+    atomic_store_explicit(seq, s + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    for (n = 0; n < len; n += sizeof(tmp))
+    {
+        chunk = len - n < sizeof(tmp) ? len - n : sizeof(tmp);
+        memset(tmp, 0, sizeof(tmp));
+        memcpy(tmp, (const char *) src + n, chunk);
+        for (i = 0; i * sizeof(uint64_t) < chunk; i++)
+        {
+            atomic_store_explicit(&words[n / sizeof(uint64_t) + i], tmp[i], memory_order_relaxed);
+        }
+    }
+
+    atomic_store_explicit(seq, s + 2, memory_order_release);
+}
+
+
+static inline void buzz_seqlock_read(
+    atomic_uint * seq, _Atomic uint64_t * words, void * dst, size_t len)
+{
+    uint64_t tmp[8];
+    unsigned s1;
+    unsigned s2;
+    size_t n;
+    size_t i;
+    size_t chunk;
+
+    do
+    {
+        while ((s1 = atomic_load_explicit(seq, memory_order_acquire)) & 1)
+        {
+            /* writer in progress */
+        }
+        for (n = 0; n < len; n += sizeof(tmp))
+        {
+            chunk = len - n < sizeof(tmp) ? len - n : sizeof(tmp);
+            for (i = 0; i * sizeof(uint64_t) < chunk; i++)
+            {
+                tmp[i] = atomic_load_explicit(&words[n / sizeof(uint64_t) + i], memory_order_relaxed);
+            }
+            memcpy((char *) dst + n, tmp, chunk);
+        }
+        atomic_thread_fence(memory_order_acquire);
+        s2 = atomic_load_explicit(seq, memory_order_relaxed);
+    } while (s1 != s2);
+}
+
+#endif
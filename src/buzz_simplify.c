@@ -0,0 +1,190 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "buzz_simplify.h"
+#include "buzz_geodesy.h"
+#include "buzz_logging.h"
+#include "buzz_stats.h"
+
+
+int buzz_gps_simplifier_create(
+    buzz_gps_simplifier_t * out_simplifier,
+    double tolerance_m,
+    int max_gap_ms,
+    size_t window,
+    buzz_gps_fix_callback_t kept_cb,
+    void * user_arg)
+{
+    buzz_i_simplifier_t * simplifier;
+
+    if (tolerance_m < 0.0 || kept_cb == NULL)
+    {
+        return BUZZ_GPS_ERROR;
+    }
+    simplifier = (buzz_i_simplifier_t *) calloc(1, sizeof(buzz_i_simplifier_t));
+    if (simplifier == NULL)
+    {
+        return BUZZ_GPS_ERROR;
+    }
+    simplifier->tolerance = tolerance_m;
+    simplifier->max_gap_ns = (int64_t) (max_gap_ms <= 0 ? BUZZ_GPS_SIMPLIFY_DEFAULT_GAP_MS : max_gap_ms) * 1000000;
+    simplifier->cb = kept_cb;
+    simplifier->user_arg = user_arg;
+    simplifier->window_size = window == 0 ? BUZZ_GPS_SIMPLIFY_DEFAULT_WINDOW : window;
+    simplifier->window = (buzz_i_simplify_point_t *) malloc(simplifier->window_size * sizeof(buzz_i_simplify_point_t));
+    if (simplifier->window == NULL)
+    {
+        free(simplifier);
+        return BUZZ_GPS_ERROR;
+    }
+
+    *out_simplifier = simplifier;
+    return BUZZ_GPS_SUCCESS;
+}
+
+
+int buzz_gps_simplifier_destroy(buzz_gps_simplifier_t simplifier)
+{
+    free(simplifier->window);
+    free(simplifier);
+
+    return BUZZ_GPS_SUCCESS;
+}
+
+
+/* an equirectangular projection is plenty over the few km of a window */
+static buzz_i_simplify_point_t buzz_l_simplify_project(buzz_i_simplifier_t * simplifier, const buzz_gps_fix_t * fix)
+{
+    buzz_i_simplify_point_t point;
+    double dlon = fix->longitude - simplifier->anchor.longitude;
+
+    if (dlon > 180.0)
+    {
+        dlon -= 360.0;
+    }
+    else if (dlon < -180.0)
+    {
+        dlon += 360.0;
+    }
+    point.x = dlon * simplifier->x_scale;
+    point.y = (fix->latitude - simplifier->anchor.latitude) * simplifier->y_scale;
+    return point;
+}
+
+
+/* distance from p to the segment from the anchor, at the origin, to end */
+static double buzz_l_simplify_distance(buzz_i_simplify_point_t p, buzz_i_simplify_point_t end)
+{
+    double length2 = end.x * end.x + end.y * end.y;
+    double t = 0.0;
+
+    if (length2 > 0.0)
+    {
+        t = (p.x * end.x + p.y * end.y) / length2;
+        t = t < 0.0 ? 0.0 : (t > 1.0 ? 1.0 : t);
+    }
+    return hypot(p.x - t * end.x, p.y - t * end.y);
+}
+
+
+static void buzz_l_simplify_keep(buzz_i_simplifier_t * simplifier, const buzz_gps_fix_t * fix)
+{
+    simplifier->anchor = *fix;
+    simplifier->anchored = 1;
+    simplifier->x_scale = BUZZ_GEODESY_EARTH_RADIUS * BUZZ_GEODESY_DEG_TO_RAD
+        * cos(fix->latitude * BUZZ_GEODESY_DEG_TO_RAD);
+    simplifier->y_scale = BUZZ_GEODESY_EARTH_RADIUS * BUZZ_GEODESY_DEG_TO_RAD;
+    simplifier->window_count = 0;
+    simplifier->pending = 0;
+
+    BUZZ_STAT_ADD(simplifier->fixes_kept, 1);
+    simplifier->cb(fix, simplifier->user_arg);
+}
+
+
+/*
+ * Start the window over from the anchor with fix as the newest point,
+ * keeping it straight away when it has no room
+ */
+static void buzz_l_simplify_open(buzz_i_simplifier_t * simplifier, const buzz_gps_fix_t * fix)
+{
+    buzz_i_simplify_point_t point = buzz_l_simplify_project(simplifier, fix);
+
+    if (hypot(point.x, point.y) > simplifier->tolerance)
+    {
+        if (simplifier->window_count == simplifier->window_size)
+        {
+            buzz_l_simplify_keep(simplifier, fix);
+            return;
+        }
+        simplifier->window[simplifier->window_count++] = point;
+    }
+    simplifier->last = *fix;
+    simplifier->pending = 1;
+}
+
+
+int buzz_gps_simplifier_add(buzz_gps_simplifier_t simplifier, const buzz_gps_fix_t * fix)
+{
+    buzz_i_simplify_point_t end;
+    size_t i;
+
+    if ((fix->flags & (BUZZ_GPS_FIX_TIMESTAMP | BUZZ_GPS_FIX_LOCATION))
+        != (BUZZ_GPS_FIX_TIMESTAMP | BUZZ_GPS_FIX_LOCATION))
+    {
+        return BUZZ_GPS_NOT_FOUND;
+    }
+    BUZZ_STAT_ADD(simplifier->fixes_in, 1);
+    if (!simplifier->anchored)
+    {
+        buzz_l_simplify_keep(simplifier, fix);
+        return BUZZ_GPS_SUCCESS;
+    }
+
+    /* does the segment to the new fix still pass close to everything since the anchor */
+    end = buzz_l_simplify_project(simplifier, fix);
+    for (i = 0; i < simplifier->window_count; i++)
+    {
+        if (buzz_l_simplify_distance(simplifier->window[i], end) > simplifier->tolerance)
+        {
+            break;
+        }
+    }
+    if (i < simplifier->window_count)
+    {
+        /* the previous fix ended the last segment that did */
+        buzz_l_simplify_keep(simplifier, &simplifier->last);
+    }
+    buzz_l_simplify_open(simplifier, fix);
+
+    /* even a parked receiver reports now and then */
+    if (simplifier->pending && fix->utc_ns - simplifier->anchor.utc_ns >= simplifier->max_gap_ns)
+    {
+        buzz_l_simplify_keep(simplifier, fix);
+    }
+    return BUZZ_GPS_SUCCESS;
+}
+
+
+int buzz_gps_simplifier_flush(buzz_gps_simplifier_t simplifier)
+{
+    if (simplifier->pending)
+    {
+        buzz_l_simplify_keep(simplifier, &simplifier->last);
+    }
+    return BUZZ_GPS_SUCCESS;
+}
+
+
+int buzz_gps_simplifier_get_stats(
+    buzz_gps_simplifier_t simplifier,
+    uint64_t * out_fixes_in,
+    uint64_t * out_fixes_kept)
+{
+    *out_fixes_in = BUZZ_STAT_LOAD(simplifier->fixes_in);
+    *out_fixes_kept = BUZZ_STAT_LOAD(simplifier->fixes_kept);
+
+    return BUZZ_GPS_SUCCESS;
+}
@@ -0,0 +1,56 @@
+/*
+ * Streaming track simplification
+ *
+ * An opening window simplifier: the last kept fix anchors a segment to the
+ * newest fix, and a fix is only kept once some fix in between would be
+ * further than the tolerance from that segment. Every dropped fix is then
+ * within the tolerance of the line between the kept fixes around it.
+ *
+ * Fixes within the tolerance of the anchor are within it of any segment
+ * from the anchor too, so they are not buffered at all. A parked receiver
+ * costs nothing but a fix every max_gap, and the window only holds fixes
+ * of a track that is actually moving.
+ */
+#ifndef BUZZ_SIMPLIFY_H
+#define BUZZ_SIMPLIFY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "buzz_gps.h"
+
+/* a fix in meters east and north of the anchor */
+typedef struct buzz_i_simplify_point_s
+{
+    double x;
+    double y;
+} buzz_i_simplify_point_t;
+
+typedef struct buzz_i_simplifier_s
+{
+    double tolerance;
+    int64_t max_gap_ns;
+    buzz_gps_fix_callback_t cb;
+    void * user_arg;
+
+    int anchored;
+    buzz_gps_fix_t anchor;
+    /* meters per degree at the anchor */
+    double x_scale;
+    double y_scale;
+
+    /* the newest fix, not kept yet */
+    int pending;
+    buzz_gps_fix_t last;
+
+    /* fixes since the anchor further than the tolerance from it */
+    buzz_i_simplify_point_t * window;
+    size_t window_count;
+    size_t window_size;
+
+    _Atomic uint64_t fixes_in;
+    _Atomic uint64_t fixes_kept;
+} buzz_i_simplifier_t;
+
+#endif
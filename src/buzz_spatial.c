@@ -0,0 +1,758 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "buzz_spatial.h"
+#include "buzz_geodesy.h"
+#include "buzz_logging.h"
+#include "buzz_stats.h"
+
+/* key ranges a query box is covered with, more just scan a little extra */
+#define BUZZ_SPATIAL_MAX_RANGES 128
+
+typedef struct buzz_i_spatial_range_s
+{
+    uint64_t lo;
+    uint64_t hi;
+} buzz_i_spatial_range_t;
+
+/* an inclusive box of quantized coordinates */
+typedef struct buzz_i_spatial_box_s
+{
+    uint32_t x0;
+    uint32_t x1;
+    uint32_t y0;
+    uint32_t y1;
+} buzz_i_spatial_box_t;
+
+typedef struct buzz_i_spatial_query_s
+{
+    buzz_i_spatial_box_t boxes[2];
+    int box_count;
+    int64_t from_ns;
+    int64_t to_ns;
+
+    /* radius queries also check the distance */
+    int circle;
+    double latitude;
+    double longitude;
+    double meters;
+
+    buzz_i_spatial_range_t ranges[BUZZ_SPATIAL_MAX_RANGES];
+    size_t range_count;
+    int stop_level;
+
+    buzz_gps_spatial_hit_t * hits;
+    size_t hit_count;
+    size_t hit_size;
+} buzz_i_spatial_query_t;
+
+
+static uint32_t buzz_l_quantize(double value, double min, double span)
+{
+    double q = (value - min) / span * 4294967296.0;
+
+    if (!(q > 0.0))
+    {
+        return 0;
+    }
+    if (q >= 4294967295.0)
+    {
+        return UINT32_MAX;
+    }
+    return (uint32_t) q;
+}
+
+
+/* spread the bits of v out to the even bits of the result */
+static uint64_t buzz_l_spread(uint32_t v)
+{
+    uint64_t x = v;
+
+    x = (x | (x << 16)) & 0x0000FFFF0000FFFFull;
+    x = (x | (x << 8)) & 0x00FF00FF00FF00FFull;
+    x = (x | (x << 4)) & 0x0F0F0F0F0F0F0F0Full;
+    x = (x | (x << 2)) & 0x3333333333333333ull;
+    x = (x | (x << 1)) & 0x5555555555555555ull;
+    return x;
+}
+
+
+static uint32_t buzz_l_compact(uint64_t x)
+{
+    x &= 0x5555555555555555ull;
+    x = (x | (x >> 1)) & 0x3333333333333333ull;
+    x = (x | (x >> 2)) & 0x0F0F0F0F0F0F0F0Full;
+    x = (x | (x >> 4)) & 0x00FF00FF00FF00FFull;
+    x = (x | (x >> 8)) & 0x0000FFFF0000FFFFull;
+    x = (x | (x >> 16)) & 0x00000000FFFFFFFFull;
+    return (uint32_t) x;
+}
+
+
+/* longitude in the even bits, latitude in the odd ones */
+static uint64_t buzz_l_morton(uint32_t x, uint32_t y)
+{
+    return buzz_l_spread(x) | (buzz_l_spread(y) << 1);
+}
+
+
+static int buzz_l_entry_cmp(const void * a, const void * b)
+{
+    const buzz_i_spatial_entry_t * ea = (const buzz_i_spatial_entry_t *) a;
+    const buzz_i_spatial_entry_t * eb = (const buzz_i_spatial_entry_t *) b;
+
+    if (ea->key != eb->key)
+    {
+        return ea->key < eb->key ? -1 : 1;
+    }
+    return ea->utc_ns < eb->utc_ns ? -1 : ea->utc_ns > eb->utc_ns;
+}
+
+
+static int buzz_l_hit_cmp(const void * a, const void * b)
+{
+    const buzz_gps_spatial_hit_t * ha = (const buzz_gps_spatial_hit_t *) a;
+    const buzz_gps_spatial_hit_t * hb = (const buzz_gps_spatial_hit_t *) b;
+
+    if (ha->utc_ns != hb->utc_ns)
+    {
+        return ha->utc_ns < hb->utc_ns ? -1 : 1;
+    }
+    return (ha->receiver > hb->receiver) - (ha->receiver < hb->receiver);
+}
+
+
+static int buzz_l_range_cmp(const void * a, const void * b)
+{
+    const buzz_i_spatial_range_t * ra = (const buzz_i_spatial_range_t *) a;
+    const buzz_i_spatial_range_t * rb = (const buzz_i_spatial_range_t *) b;
+
+    return ra->lo < rb->lo ? -1 : ra->lo > rb->lo;
+}
+
+
+/*
+ * The last adjacent pair of runs where the older is no bigger than the
+ * newer, which keeps the run sizes roughly doubling like a binary counter
+ *
+ * must be called locked
+ */
+static int buzz_l_spatial_merge_pair(buzz_i_spatial_index_t * index, size_t * out_first)
+{
+    size_t i;
+
+    for (i = index->run_count; i >= 2; i--)
+    {
+        if (index->runs[i - 2].count <= index->runs[i - 1].count)
+        {
+            *out_first = i - 2;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+/*
+ * Merge runs until their sizes decrease again. The merge itself runs with
+ * the lock released; runs are never modified, only replaced.
+ *
+ * only called from the merge thread
+ */
+static void buzz_l_spatial_compact(buzz_i_spatial_index_t * index)
+{
+    buzz_i_spatial_run_t a;
+    buzz_i_spatial_run_t b;
+    buzz_i_spatial_entry_t * merged;
+    size_t first;
+    size_t i;
+    size_t j;
+    size_t k;
+
+    for (;;)
+    {
+        pthread_rwlock_rdlock(&index->lock);
+        if (!buzz_l_spatial_merge_pair(index, &first))
+        {
+            pthread_rwlock_unlock(&index->lock);
+            break;
+        }
+        a = index->runs[first];
+        b = index->runs[first + 1];
+        pthread_rwlock_unlock(&index->lock);
+
+        merged = (buzz_i_spatial_entry_t *) malloc((a.count + b.count) * sizeof(buzz_i_spatial_entry_t));
+        if (merged == NULL)
+        {
+            BUZZ_LOG_ERROR("Out of memory merging the spatial index");
+            break;
+        }
+        for (i = 0, j = 0, k = 0; i < a.count && j < b.count; k++)
+        {
+            merged[k] = buzz_l_entry_cmp(&a.entries[i], &b.entries[j]) <= 0 ? a.entries[i++] : b.entries[j++];
+        }
+        memcpy(&merged[k], &a.entries[i], (a.count - i) * sizeof(buzz_i_spatial_entry_t));
+        k += a.count - i;
+        memcpy(&merged[k], &b.entries[j], (b.count - j) * sizeof(buzz_i_spatial_entry_t));
+
+        /* only inserts ran meanwhile, and they only append runs */
+        pthread_rwlock_wrlock(&index->lock);
+        index->runs[first].entries = merged;
+        index->runs[first].count = a.count + b.count;
+        memmove(&index->runs[first + 1], &index->runs[first + 2],
+            (index->run_count - first - 2) * sizeof(buzz_i_spatial_run_t));
+        index->run_count--;
+        pthread_rwlock_unlock(&index->lock);
+
+        /* no query can still be reading them once the write lock was held */
+        free(a.entries);
+        free(b.entries);
+
+        pthread_mutex_lock(&index->merge_mutex);
+        index->merges++;
+        pthread_cond_broadcast(&index->merged_cond);
+        pthread_mutex_unlock(&index->merge_mutex);
+    }
+}
+
+
+static void * buzz_l_spatial_merge_thread(void * arg)
+{
+    buzz_i_spatial_index_t * index = (buzz_i_spatial_index_t *) arg;
+
+    pthread_mutex_lock(&index->merge_mutex);
+    while (!index->stopping)
+    {
+        if (!index->merge_pending)
+        {
+            pthread_cond_wait(&index->merge_cond, &index->merge_mutex);
+            continue;
+        }
+        index->merge_pending = 0;
+        index->merging = 1;
+        pthread_mutex_unlock(&index->merge_mutex);
+
+        buzz_l_spatial_compact(index);
+
+        pthread_mutex_lock(&index->merge_mutex);
+        index->merging = 0;
+        /* wake inserts waiting for a run even when nothing could be merged */
+        pthread_cond_broadcast(&index->merged_cond);
+    }
+    pthread_mutex_unlock(&index->merge_mutex);
+
+    return NULL;
+}
+
+
+/* hand the runs to the merge thread */
+static void buzz_l_spatial_wake_merger(buzz_i_spatial_index_t * index)
+{
+    pthread_mutex_lock(&index->merge_mutex);
+    index->merge_pending = 1;
+    pthread_cond_signal(&index->merge_cond);
+    pthread_mutex_unlock(&index->merge_mutex);
+}
+
+
+/* wait for the merge thread to free a run, or to find it cannot */
+static void buzz_l_spatial_wait_merge(buzz_i_spatial_index_t * index)
+{
+    uint64_t merges;
+
+    pthread_mutex_lock(&index->merge_mutex);
+    merges = index->merges;
+    index->merge_pending = 1;
+    pthread_cond_signal(&index->merge_cond);
+    while (index->merges == merges && (index->merge_pending || index->merging))
+    {
+        pthread_cond_wait(&index->merged_cond, &index->merge_mutex);
+    }
+    pthread_mutex_unlock(&index->merge_mutex);
+}
+
+
+int buzz_gps_spatial_create(buzz_gps_spatial_t * out_index)
+{
+    buzz_i_spatial_index_t * index;
+
+    index = (buzz_i_spatial_index_t *) calloc(1, sizeof(buzz_i_spatial_index_t));
+    if (index == NULL)
+    {
+        return BUZZ_GPS_ERROR;
+    }
+    index->buffer = (buzz_i_spatial_entry_t *) malloc(BUZZ_SPATIAL_BUFFER_SIZE * sizeof(buzz_i_spatial_entry_t));
+    if (index->buffer == NULL)
+    {
+        free(index);
+        return BUZZ_GPS_ERROR;
+    }
+    pthread_rwlock_init(&index->lock, NULL);
+    pthread_mutex_init(&index->merge_mutex, NULL);
+    pthread_cond_init(&index->merge_cond, NULL);
+    pthread_cond_init(&index->merged_cond, NULL);
+
+    if (pthread_create(&index->merge_thread, NULL, buzz_l_spatial_merge_thread, index) != 0)
+    {
+        BUZZ_LOG_ERROR("Failed to start the spatial index merge thread");
+        pthread_cond_destroy(&index->merged_cond);
+        pthread_cond_destroy(&index->merge_cond);
+        pthread_mutex_destroy(&index->merge_mutex);
+        pthread_rwlock_destroy(&index->lock);
+        free(index->buffer);
+        free(index);
+        return BUZZ_GPS_ERROR;
+    }
+
+    *out_index = index;
+    return BUZZ_GPS_SUCCESS;
+}
+
+
+int buzz_gps_spatial_destroy(buzz_gps_spatial_t index)
+{
+    size_t i;
+
+    pthread_mutex_lock(&index->merge_mutex);
+    index->stopping = 1;
+    pthread_cond_signal(&index->merge_cond);
+    pthread_mutex_unlock(&index->merge_mutex);
+    pthread_join(index->merge_thread, NULL);
+
+    for (i = 0; i < index->run_count; i++)
+    {
+        free(index->runs[i].entries);
+    }
+    free(index->buffer);
+    pthread_cond_destroy(&index->merged_cond);
+    pthread_cond_destroy(&index->merge_cond);
+    pthread_mutex_destroy(&index->merge_mutex);
+    pthread_rwlock_destroy(&index->lock);
+    free(index);
+
+    return BUZZ_GPS_SUCCESS;
+}
+
+
+/*
+ * Sort the full buffer into the newest run. Returns 0 when there is no room
+ * for another run, the buffer then stays full until a merge makes some.
+ *
+ * must be called locked
+ */
+static int buzz_l_spatial_seal(buzz_i_spatial_index_t * index)
+{
+    buzz_i_spatial_entry_t * buffer;
+
+    if (index->run_count == BUZZ_SPATIAL_MAX_RUNS)
+    {
+        return 0;
+    }
+    buffer = (buzz_i_spatial_entry_t *) malloc(BUZZ_SPATIAL_BUFFER_SIZE * sizeof(buzz_i_spatial_entry_t));
+    if (buffer == NULL)
+    {
+        return 0;
+    }
+    qsort(index->buffer, index->buffered, sizeof(buzz_i_spatial_entry_t), buzz_l_entry_cmp);
+    index->runs[index->run_count].entries = index->buffer;
+    index->runs[index->run_count].count = index->buffered;
+    index->run_count++;
+    index->buffer = buffer;
+    index->buffered = 0;
+    return 1;
+}
+
+
+int buzz_gps_spatial_insert(buzz_gps_spatial_t index, int receiver, const buzz_gps_fix_t * fix)
+{
+    buzz_i_spatial_entry_t * entry;
+    int merge = 0;
+
+    if ((fix->flags & (BUZZ_GPS_FIX_TIMESTAMP | BUZZ_GPS_FIX_LOCATION))
+        != (BUZZ_GPS_FIX_TIMESTAMP | BUZZ_GPS_FIX_LOCATION))
+    {
+        return BUZZ_GPS_NOT_FOUND;
+    }
+
+    pthread_rwlock_wrlock(&index->lock);
+    if (index->buffered == BUZZ_SPATIAL_BUFFER_SIZE && !buzz_l_spatial_seal(index))
+    {
+        /* every run is taken, which only happens when merges fall far behind */
+        pthread_rwlock_unlock(&index->lock);
+        buzz_l_spatial_wait_merge(index);
+        pthread_rwlock_wrlock(&index->lock);
+        if (index->buffered == BUZZ_SPATIAL_BUFFER_SIZE && !buzz_l_spatial_seal(index))
+        {
+            pthread_rwlock_unlock(&index->lock);
+            BUZZ_LOG_ERROR("No room left in the spatial index");
+            return BUZZ_GPS_ERROR;
+        }
+    }
+    entry = &index->buffer[index->buffered++];
+    entry->key = buzz_l_morton(
+        buzz_l_quantize(fix->longitude, -180.0, 360.0),
+        buzz_l_quantize(fix->latitude, -90.0, 180.0));
+    entry->utc_ns = fix->utc_ns;
+    entry->receiver = receiver;
+    entry->reserved = 0;
+    BUZZ_STAT_ADD(index->points, 1);
+
+    if (index->buffered == BUZZ_SPATIAL_BUFFER_SIZE && buzz_l_spatial_seal(index))
+    {
+        merge = index->run_count >= 2;
+    }
+    pthread_rwlock_unlock(&index->lock);
+
+    if (merge)
+    {
+        buzz_l_spatial_wake_merger(index);
+    }
+    return BUZZ_GPS_SUCCESS;
+}
+
+
+uint64_t buzz_gps_spatial_count(buzz_gps_spatial_t index)
+{
+    return BUZZ_STAT_LOAD(index->points);
+}
+
+
+static void buzz_l_spatial_add_range(buzz_i_spatial_query_t * query, uint64_t lo, uint64_t hi)
+{
+    buzz_i_spatial_range_t * last = query->range_count > 0 ? &query->ranges[query->range_count - 1] : NULL;
+
+    /* the cells of a box come out in key order, so neighbours join up */
+    if (last != NULL && lo >= last->lo && (last->hi == UINT64_MAX || last->hi + 1 >= lo))
+    {
+        last->hi = hi > last->hi ? hi : last->hi;
+    }
+    else if (query->range_count == BUZZ_SPATIAL_MAX_RANGES)
+    {
+        /* out of ranges, scan the gap as well */
+        last->lo = lo < last->lo ? lo : last->lo;
+        last->hi = hi > last->hi ? hi : last->hi;
+    }
+    else
+    {
+        query->ranges[query->range_count].lo = lo;
+        query->ranges[query->range_count].hi = hi;
+        query->range_count++;
+    }
+}
+
+
+/*
+ * Cover box with the key ranges of quadtree cells, visited in key order.
+ * Cells inside the box are taken whole, cells on its edge are split down
+ * to stop_level and then taken whole too, leaving the exact test to the
+ * scan.
+ */
+static void buzz_l_spatial_cover(
+    buzz_i_spatial_query_t * query,
+    const buzz_i_spatial_box_t * box,
+    uint32_t cx,
+    uint32_t cy,
+    int level)
+{
+    uint64_t extent = level == 32 ? UINT32_MAX : ((uint64_t) 1 << level) - 1;
+    uint64_t cx1 = cx + extent;
+    uint64_t cy1 = cy + extent;
+    uint64_t lo;
+    uint32_t half;
+
+    if (cx1 < box->x0 || cx > box->x1 || cy1 < box->y0 || cy > box->y1)
+    {
+        return;
+    }
+    if ((cx >= box->x0 && cx1 <= box->x1 && cy >= box->y0 && cy1 <= box->y1) || level <= query->stop_level)
+    {
+        lo = buzz_l_morton(cx, cy);
+        buzz_l_spatial_add_range(query, lo, level == 32 ? UINT64_MAX : lo | (((uint64_t) 1 << (2 * level)) - 1));
+        return;
+    }
+    half = (uint32_t) 1 << (level - 1);
+    buzz_l_spatial_cover(query, box, cx, cy, level - 1);
+    buzz_l_spatial_cover(query, box, cx + half, cy, level - 1);
+    buzz_l_spatial_cover(query, box, cx, cy + half, level - 1);
+    buzz_l_spatial_cover(query, box, cx + half, cy + half, level - 1);
+}
+
+
+static int buzz_l_spatial_match(buzz_i_spatial_query_t * query, const buzz_i_spatial_entry_t * entry)
+{
+    uint32_t x = buzz_l_compact(entry->key);
+    uint32_t y = buzz_l_compact(entry->key >> 1);
+    buzz_gps_spatial_hit_t * hit;
+    double latitude;
+    double longitude;
+    int i;
+
+    if (entry->utc_ns < query->from_ns || entry->utc_ns >= query->to_ns)
+    {
+        return BUZZ_GPS_SUCCESS;
+    }
+    for (i = 0; i < query->box_count; i++)
+    {
+        if (x >= query->boxes[i].x0 && x <= query->boxes[i].x1 && y >= query->boxes[i].y0 && y <= query->boxes[i].y1)
+        {
+            break;
+        }
+    }
+    if (i == query->box_count)
+    {
+        return BUZZ_GPS_SUCCESS;
+    }
+    latitude = y * (180.0 / 4294967296.0) - 90.0;
+    longitude = x * (360.0 / 4294967296.0) - 180.0;
+    if (query->circle && buzz_geodesy_haversine(query->latitude, query->longitude, latitude, longitude) > query->meters)
+    {
+        return BUZZ_GPS_SUCCESS;
+    }
+
+    if (query->hit_count == query->hit_size)
+    {
+        size_t hit_size = query->hit_size == 0 ? 256 : query->hit_size * 2;
+        buzz_gps_spatial_hit_t * grown;
+
+        grown = (buzz_gps_spatial_hit_t *) realloc(query->hits, hit_size * sizeof(buzz_gps_spatial_hit_t));
+        if (grown == NULL)
+        {
+            return BUZZ_GPS_ERROR;
+        }
+        query->hits = grown;
+        query->hit_size = hit_size;
+    }
+    hit = &query->hits[query->hit_count++];
+    hit->utc_ns = entry->utc_ns;
+    hit->receiver = entry->receiver;
+    hit->latitude = latitude;
+    hit->longitude = longitude;
+    return BUZZ_GPS_SUCCESS;
+}
+
+
+/* first entry whose key is not below key */
+static size_t buzz_l_spatial_lower_bound(const buzz_i_spatial_run_t * run, uint64_t key)
+{
+    size_t low = 0;
+    size_t high = run->count;
+    size_t mid;
+
+    while (low < high)
+    {
+        mid = low + (high - low) / 2;
+        if (run->entries[mid].key < key)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+
+static int buzz_l_spatial_run_query(
+    buzz_i_spatial_index_t * index,
+    buzz_i_spatial_query_t * query,
+    buzz_gps_spatial_hit_t * out_hits,
+    size_t max_hits,
+    size_t * out_count)
+{
+    const buzz_i_spatial_run_t * run;
+    const buzz_i_spatial_range_t * range;
+    uint32_t extent;
+    size_t i;
+    size_t r;
+    size_t e;
+    int level;
+    int rc = BUZZ_GPS_SUCCESS;
+
+    /* split edge cells down to about an eighth of the box */
+    extent = 0;
+    for (i = 0; i < (size_t) query->box_count; i++)
+    {
+        extent = query->boxes[i].x1 - query->boxes[i].x0 > extent ? query->boxes[i].x1 - query->boxes[i].x0 : extent;
+        extent = query->boxes[i].y1 - query->boxes[i].y0 > extent ? query->boxes[i].y1 - query->boxes[i].y0 : extent;
+    }
+    level = extent == 0 ? 0 : 32 - __builtin_clz(extent);
+    query->stop_level = level > 3 ? level - 3 : 0;
+    query->range_count = 0;
+    for (i = 0; i < (size_t) query->box_count; i++)
+    {
+        buzz_l_spatial_cover(query, &query->boxes[i], 0, 0, 32);
+    }
+    if (query->box_count > 1)
+    {
+        /* the two halves of a split box must not scan any key twice */
+        qsort(query->ranges, query->range_count, sizeof(buzz_i_spatial_range_t), buzz_l_range_cmp);
+        for (i = 1, r = 0; i < query->range_count; i++)
+        {
+            if (query->ranges[r].hi != UINT64_MAX && query->ranges[i].lo > query->ranges[r].hi)
+            {
+                query->ranges[++r] = query->ranges[i];
+            }
+            else if (query->ranges[i].hi > query->ranges[r].hi)
+            {
+                query->ranges[r].hi = query->ranges[i].hi;
+            }
+        }
+        query->range_count = query->range_count > 0 ? r + 1 : 0;
+    }
+
+    pthread_rwlock_rdlock(&index->lock);
+    for (i = 0; i < index->run_count && rc == BUZZ_GPS_SUCCESS; i++)
+    {
+        run = &index->runs[i];
+        for (r = 0; r < query->range_count && rc == BUZZ_GPS_SUCCESS; r++)
+        {
+            range = &query->ranges[r];
+            for (e = buzz_l_spatial_lower_bound(run, range->lo);
+                 e < run->count && run->entries[e].key <= range->hi && rc == BUZZ_GPS_SUCCESS; e++)
+            {
+                rc = buzz_l_spatial_match(query, &run->entries[e]);
+            }
+        }
+    }
+    for (e = 0; e < index->buffered && rc == BUZZ_GPS_SUCCESS; e++)
+    {
+        rc = buzz_l_spatial_match(query, &index->buffer[e]);
+    }
+    pthread_rwlock_unlock(&index->lock);
+
+    if (rc == BUZZ_GPS_SUCCESS)
+    {
+        qsort(query->hits, query->hit_count, sizeof(buzz_gps_spatial_hit_t), buzz_l_hit_cmp);
+        if (query->hit_count > 0)
+        {
+            memcpy(out_hits, query->hits,
+                (query->hit_count < max_hits ? query->hit_count : max_hits) * sizeof(buzz_gps_spatial_hit_t));
+        }
+        *out_count = query->hit_count;
+    }
+    free(query->hits);
+    return rc;
+}
+
+
+/*
+ * Add the box from south west to north east. A box whose west edge is
+ * east of its east edge crosses the antimeridian and is split in two.
+ */
+static void buzz_l_spatial_set_box(
+    buzz_i_spatial_query_t * query,
+    double south,
+    double west,
+    double north,
+    double east)
+{
+    uint32_t y0 = buzz_l_quantize(south, -90.0, 180.0);
+    uint32_t y1 = buzz_l_quantize(north, -90.0, 180.0);
+
+    query->box_count = 0;
+    if (west > east)
+    {
+        query->boxes[0] = (buzz_i_spatial_box_t) {buzz_l_quantize(west, -180.0, 360.0), UINT32_MAX, y0, y1};
+        query->boxes[1] = (buzz_i_spatial_box_t) {0, buzz_l_quantize(east, -180.0, 360.0), y0, y1};
+        query->box_count = 2;
+    }
+    else
+    {
+        query->boxes[0] = (buzz_i_spatial_box_t) {
+            buzz_l_quantize(west, -180.0, 360.0), buzz_l_quantize(east, -180.0, 360.0), y0, y1};
+        query->box_count = 1;
+    }
+}
+
+
+int buzz_gps_spatial_query_box(
+    buzz_gps_spatial_t index,
+    double south,
+    double west,
+    double north,
+    double east,
+    int64_t from_ns,
+    int64_t to_ns,
+    buzz_gps_spatial_hit_t * out_hits,
+    size_t max_hits,
+    size_t * out_count)
+{
+    buzz_i_spatial_query_t query;
+
+    if (south > north)
+    {
+        return BUZZ_GPS_ERROR;
+    }
+    memset(&query, '\0', sizeof(query));
+    buzz_l_spatial_set_box(&query, south, west, north, east);
+    query.from_ns = from_ns;
+    query.to_ns = to_ns;
+
+    return buzz_l_spatial_run_query(index, &query, out_hits, max_hits, out_count);
+}
+
+
+int buzz_gps_spatial_query_radius(
+    buzz_gps_spatial_t index,
+    double latitude,
+    double longitude,
+    double meters,
+    int64_t from_ns,
+    int64_t to_ns,
+    buzz_gps_spatial_hit_t * out_hits,
+    size_t max_hits,
+    size_t * out_count)
+{
+    buzz_i_spatial_query_t query;
+    double dlat;
+    double dlon;
+    double south;
+    double north;
+    double west;
+    double east;
+
+    if (meters < 0.0)
+    {
+        return BUZZ_GPS_ERROR;
+    }
+    memset(&query, '\0', sizeof(query));
+    dlat = meters / BUZZ_GEODESY_EARTH_RADIUS / BUZZ_GEODESY_DEG_TO_RAD;
+    south = latitude - dlat;
+    north = latitude + dlat;
+    if (south <= -90.0 || north >= 90.0)
+    {
+        /* the circle takes in a pole, every longitude is in reach */
+        west = -180.0;
+        east = 180.0;
+    }
+    else
+    {
+        /* widest where the circle is closest to a pole */
+        dlon = dlat / cos((fabs(south) > fabs(north) ? fabs(south) : fabs(north)) * BUZZ_GEODESY_DEG_TO_RAD);
+        if (dlon >= 180.0)
+        {
+            west = -180.0;
+            east = 180.0;
+        }
+        else
+        {
+            west = longitude - dlon;
+            east = longitude + dlon;
+            west = west < -180.0 ? west + 360.0 : west;
+            east = east > 180.0 ? east - 360.0 : east;
+        }
+    }
+    buzz_l_spatial_set_box(&query, south, west, north, east);
+    query.from_ns = from_ns;
+    query.to_ns = to_ns;
+    query.circle = 1;
+    query.latitude = latitude;
+    query.longitude = longitude;
+    query.meters = meters;
+
+    return buzz_l_spatial_run_query(index, &query, out_hits, max_hits, out_count);
+}
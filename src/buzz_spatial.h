@@ -0,0 +1,70 @@
+/*
+ * Spatial index over recorded fixes
+ *
+ * Every point is keyed by the Morton (Z order) code of its position,
+ * quantized to 32 bits a coordinate, which keeps nearby points close
+ * together in key order. New points go into a small buffer that is sorted
+ * into a run when full, and runs of similar size are merged the way a
+ * log structured merge tree does, so an insert costs a few memory moves
+ * on average and there are only ever about log2(points) runs to search.
+ *
+ * A query covers its box with a few dozen key ranges and binary searches
+ * each run for them. Runs never change once built. Merges are done by a
+ * thread owned by the index, which writes a new run with the lock released
+ * and only takes the write lock to swap it in, so an insert never costs
+ * more than sorting the buffer however large the runs grow.
+ */
+#ifndef BUZZ_SPATIAL_H
+#define BUZZ_SPATIAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "buzz_gps.h"
+
+/* points buffered before they are sorted into a run */
+#define BUZZ_SPATIAL_BUFFER_SIZE 4096
+#define BUZZ_SPATIAL_MAX_RUNS 64
+
+typedef struct buzz_i_spatial_entry_s
+{
+    uint64_t key;
+    int64_t utc_ns;
+    int32_t receiver;
+    uint32_t reserved;
+} buzz_i_spatial_entry_t;
+
+/* entries sorted by key */
+typedef struct buzz_i_spatial_run_s
+{
+    buzz_i_spatial_entry_t * entries;
+    size_t count;
+} buzz_i_spatial_run_t;
+
+typedef struct buzz_i_spatial_index_s
+{
+    /* queries read, inserts and merges write */
+    pthread_rwlock_t lock;
+
+    /* the merge thread, woken when a run is added */
+    pthread_mutex_t merge_mutex;
+    pthread_cond_t merge_cond;
+    /* signalled after every merge, for inserts waiting on a free run */
+    pthread_cond_t merged_cond;
+    pthread_t merge_thread;
+    int merge_pending;
+    int merging;
+    int stopping;
+    uint64_t merges;
+
+    buzz_i_spatial_entry_t * buffer;
+    size_t buffered;
+    buzz_i_spatial_run_t runs[BUZZ_SPATIAL_MAX_RUNS];
+    size_t run_count;
+
+    _Atomic uint64_t points;
+} buzz_i_spatial_index_t;
+
+#endif
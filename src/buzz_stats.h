@@ -0,0 +1,63 @@
+/*
+ * Handle statistics
+ *
+ * Every counter has a single writer: the thread holding the handle mutex
+ * for the reading and parsing counters, and the thread running the
+ * callbacks for the delivery ones. A relaxed load and store is enough to
+ * bump them, which costs the same as a plain increment, and
+ * buzz_gps_get_stats() can read them from any thread without a lock.
+ */
+#ifndef BUZZ_STATS_H
+#define BUZZ_STATS_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#include "buzz_gps.h"
+
+#define BUZZ_STAT_ADD(counter, n) \
+    atomic_store_explicit(&(counter), \
+        atomic_load_explicit(&(counter), memory_order_relaxed) + (n), memory_order_relaxed)
+
+#define BUZZ_STAT_LOAD(counter) atomic_load_explicit(&(counter), memory_order_relaxed)
+
+typedef struct buzz_i_histogram_s
+{
+    _Atomic uint64_t buckets[BUZZ_GPS_LATENCY_BUCKETS];
+} buzz_i_histogram_t;
+
+
+static inline uint64_t buzz_stats_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+
+/* bucket i holds [2^(i-1), 2^i) ns, the last one everything above */
+static inline void buzz_histogram_record(buzz_i_histogram_t * histogram, uint64_t ns)
+{
+    int bucket = ns == 0 ? 0 : 64 - __builtin_clzll(ns);
+
+    if (bucket >= BUZZ_GPS_LATENCY_BUCKETS)
+    {
+        bucket = BUZZ_GPS_LATENCY_BUCKETS - 1;
+    }
+    BUZZ_STAT_ADD(histogram->buckets[bucket], 1);
+}
+
+
+static inline void buzz_histogram_read(buzz_i_histogram_t * histogram, buzz_gps_histogram_t * out)
+{
+    int i;
+
+    for (i = 0; i < BUZZ_GPS_LATENCY_BUCKETS; i++)
+    {
+        out->buckets[i] = BUZZ_STAT_LOAD(histogram->buckets[i]);
+    }
+}
+
+#endif
@@ -0,0 +1,423 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "buzz_store.h"
+#include "buzz_logging.h"
+#include "buzz_stats.h"
+
+/* the queue holds this many batches before records are dropped */
+#define BUZZ_STORE_QUEUE_BATCHES 4
+/* how long a write waits for a reader holding the database */
+#define BUZZ_STORE_BUSY_TIMEOUT_MS 1000
+
+static const char * _g_store_schema =
+    "CREATE TABLE IF NOT EXISTS fixes ("
+    " id INTEGER PRIMARY KEY,"
+    " receiver INTEGER NOT NULL,"
+    " received_ns INTEGER,"
+    " utc_ns INTEGER,"
+    " flags INTEGER NOT NULL,"
+    " sentences INTEGER NOT NULL,"
+    " latitude REAL,"
+    " longitude REAL,"
+    " altitude REAL,"
+    " speed_knots REAL,"
+    " course REAL,"
+    " quality INTEGER,"
+    " mode INTEGER,"
+    " satellites_used INTEGER,"
+    " satellites_in_view INTEGER,"
+    " hdop REAL,"
+    " pdop REAL,"
+    " vdop REAL);"
+    "CREATE TABLE IF NOT EXISTS sentences ("
+    " id INTEGER PRIMARY KEY,"
+    " receiver INTEGER NOT NULL,"
+    " received_ns INTEGER,"
+    " type INTEGER NOT NULL,"
+    " sentence TEXT NOT NULL);";
+
+static const char * _g_insert_fix =
+    "INSERT INTO fixes (receiver, received_ns, utc_ns, flags, sentences, latitude, longitude,"
+    " altitude, speed_knots, course, quality, mode, satellites_used, satellites_in_view,"
+    " hdop, pdop, vdop) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)";
+
+static const char * _g_insert_sentence =
+    "INSERT INTO sentences (receiver, received_ns, type, sentence) VALUES (?, ?, ?, ?)";
+
+
+/*
+ * Reserve the next queue slot, with the mutex held. Wakes the writer when
+ * the first record arrives, to start its flush timer, and when a batch is
+ * full.
+ */
+static buzz_i_store_record_t * buzz_l_store_slot(buzz_i_gps_store_t * store)
+{
+    buzz_i_store_record_t * record;
+
+    if (store->stopping || store->pending_count == store->capacity)
+    {
+        BUZZ_STAT_ADD(store->dropped, 1);
+        return NULL;
+    }
+    if (store->pending_count == 0)
+    {
+        store->first_pending_ns = buzz_stats_now_ns();
+    }
+    record = &store->pending[store->pending_count++];
+    if (store->pending_count == 1 || store->pending_count == store->batch_rows)
+    {
+        pthread_cond_signal(&store->cond);
+    }
+    return record;
+}
+
+
+void buzz_store_add_fix(buzz_i_gps_store_t * store, int receiver, const buzz_gps_fix_t * fix)
+{
+    buzz_i_store_record_t * record;
+
+    pthread_mutex_lock(&store->mutex);
+    record = buzz_l_store_slot(store);
+    if (record != NULL)
+    {
+        record->receiver = receiver;
+        record->is_sentence = 0;
+        record->u.fix = *fix;
+    }
+    pthread_mutex_unlock(&store->mutex);
+}
+
+
+void buzz_store_add_sentence(buzz_i_gps_store_t * store, int receiver, const buzz_gps_raw_event_t * raw_event)
+{
+    buzz_i_store_record_t * record;
+
+    pthread_mutex_lock(&store->mutex);
+    record = buzz_l_store_slot(store);
+    if (record != NULL)
+    {
+        record->receiver = receiver;
+        record->is_sentence = 1;
+        record->u.sentence.type = raw_event->type;
+        record->u.sentence.received_ns = raw_event->received_ns;
+        record->u.sentence.length = raw_event->length;
+        memcpy(record->u.sentence.text, raw_event->sentence, raw_event->length);
+    }
+    pthread_mutex_unlock(&store->mutex);
+}
+
+
+static void buzz_l_bind_double(sqlite3_stmt * stmt, int column, int present, double value)
+{
+    if (present)
+    {
+        sqlite3_bind_double(stmt, column, value);
+    }
+    else
+    {
+        sqlite3_bind_null(stmt, column);
+    }
+}
+
+
+static void buzz_l_bind_int(sqlite3_stmt * stmt, int column, int present, int64_t value)
+{
+    if (present)
+    {
+        sqlite3_bind_int64(stmt, column, value);
+    }
+    else
+    {
+        sqlite3_bind_null(stmt, column);
+    }
+}
+
+
+static void buzz_l_bind_fix(sqlite3_stmt * stmt, int receiver, const buzz_gps_fix_t * fix)
+{
+    unsigned int flags = fix->flags;
+
+    sqlite3_bind_int(stmt, 1, receiver);
+    buzz_l_bind_int(stmt, 2, fix->received_ns != 0, (int64_t) fix->received_ns);
+    buzz_l_bind_int(stmt, 3, flags & BUZZ_GPS_FIX_TIMESTAMP, fix->utc_ns);
+    sqlite3_bind_int64(stmt, 4, flags);
+    sqlite3_bind_int64(stmt, 5, fix->sentences);
+    buzz_l_bind_double(stmt, 6, flags & BUZZ_GPS_FIX_LOCATION, fix->latitude);
+    buzz_l_bind_double(stmt, 7, flags & BUZZ_GPS_FIX_LOCATION, fix->longitude);
+    buzz_l_bind_double(stmt, 8, flags & BUZZ_GPS_FIX_ALTITUDE, fix->altitude_meters);
+    buzz_l_bind_double(stmt, 9, flags & BUZZ_GPS_FIX_SPEED, fix->speed_knots);
+    buzz_l_bind_double(stmt, 10, flags & BUZZ_GPS_FIX_COURSE, fix->course);
+    buzz_l_bind_int(stmt, 11, flags & BUZZ_GPS_FIX_QUALITY, fix->quality);
+    buzz_l_bind_int(stmt, 12, flags & BUZZ_GPS_FIX_MODE, fix->mode);
+    buzz_l_bind_int(stmt, 13, flags & BUZZ_GPS_FIX_SATELLITES, fix->satellites_used);
+    buzz_l_bind_int(stmt, 14, flags & BUZZ_GPS_FIX_IN_VIEW, fix->satellites_in_view);
+    buzz_l_bind_double(stmt, 15, flags & BUZZ_GPS_FIX_HDOP, fix->hdop);
+    buzz_l_bind_double(stmt, 16, flags & BUZZ_GPS_FIX_PDOP, fix->pdop);
+    buzz_l_bind_double(stmt, 17, flags & BUZZ_GPS_FIX_VDOP, fix->vdop);
+}
+
+
+static int buzz_l_store_step(buzz_i_gps_store_t * store, sqlite3_stmt * stmt)
+{
+    int rc;
+
+    rc = sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+    if (rc != SQLITE_DONE)
+    {
+        BUZZ_STAT_ADD(store->errors, 1);
+        BUZZ_LOG_ERROR("Failed to write to the track store: %s", sqlite3_errmsg(store->db));
+        return BUZZ_GPS_ERROR;
+    }
+    return BUZZ_GPS_SUCCESS;
+}
+
+
+/*
+ * Insert a batch in one transaction, so the journal is synced once per
+ * batch rather than once per row
+ */
+static void buzz_l_store_write(buzz_i_gps_store_t * store, buzz_i_store_record_t * records, size_t count)
+{
+    sqlite3_stmt * stmt;
+    size_t i;
+    int in_transaction;
+    uint64_t fixes = 0;
+    uint64_t sentences = 0;
+
+    if (count == 0)
+    {
+        return;
+    }
+    /* if BEGIN fails the rows are still written, one transaction each */
+    in_transaction = buzz_l_store_step(store, store->begin) == BUZZ_GPS_SUCCESS;
+    for (i = 0; i < count; i++)
+    {
+        if (records[i].is_sentence)
+        {
+            stmt = store->insert_sentence;
+            sqlite3_bind_int(stmt, 1, records[i].receiver);
+            buzz_l_bind_int(stmt, 2, records[i].u.sentence.received_ns != 0,
+                (int64_t) records[i].u.sentence.received_ns);
+            sqlite3_bind_int(stmt, 3, records[i].u.sentence.type);
+            sqlite3_bind_text(stmt, 4, records[i].u.sentence.text, records[i].u.sentence.length, SQLITE_STATIC);
+        }
+        else
+        {
+            stmt = store->insert_fix;
+            buzz_l_bind_fix(stmt, records[i].receiver, &records[i].u.fix);
+        }
+        if (buzz_l_store_step(store, stmt) == BUZZ_GPS_SUCCESS)
+        {
+            if (records[i].is_sentence)
+            {
+                sentences++;
+            }
+            else
+            {
+                fixes++;
+            }
+        }
+    }
+    if (in_transaction && buzz_l_store_step(store, store->commit) != BUZZ_GPS_SUCCESS)
+    {
+        /* nothing in the batch was kept */
+        sqlite3_exec(store->db, "ROLLBACK", NULL, NULL, NULL);
+        BUZZ_STAT_ADD(store->errors, fixes + sentences);
+        return;
+    }
+    BUZZ_STAT_ADD(store->fixes, fixes);
+    BUZZ_STAT_ADD(store->sentences, sentences);
+    BUZZ_STAT_ADD(store->transactions, in_transaction ? 1 : fixes + sentences);
+}
+
+
+static void * buzz_l_store_thread(void * arg)
+{
+    buzz_i_gps_store_t * store = (buzz_i_gps_store_t *) arg;
+    buzz_i_store_record_t * records;
+    struct timespec deadline;
+    uint64_t deadline_ns;
+    size_t count;
+    int stopping;
+
+    pthread_mutex_lock(&store->mutex);
+    for (;;)
+    {
+        /* write when a batch is full, or the oldest record has waited flush_ns */
+        while (!store->stopping && store->pending_count < store->batch_rows)
+        {
+            if (store->pending_count == 0)
+            {
+                pthread_cond_wait(&store->cond, &store->mutex);
+                continue;
+            }
+            deadline_ns = store->first_pending_ns + store->flush_ns;
+            deadline.tv_sec = deadline_ns / 1000000000u;
+            deadline.tv_nsec = deadline_ns % 1000000000u;
+            if (pthread_cond_timedwait(&store->cond, &store->mutex, &deadline) == ETIMEDOUT)
+            {
+                break;
+            }
+        }
+        stopping = store->stopping;
+
+        /* swap the queue for the empty batch buffer and write it unlocked */
+        records = store->pending;
+        count = store->pending_count;
+        store->pending = store->batch;
+        store->pending_count = 0;
+        store->batch = records;
+        pthread_mutex_unlock(&store->mutex);
+
+        buzz_l_store_write(store, records, count);
+
+        pthread_mutex_lock(&store->mutex);
+        if (stopping && store->pending_count == 0)
+        {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&store->mutex);
+
+    return NULL;
+}
+
+
+static void buzz_l_store_free(buzz_i_gps_store_t * store)
+{
+    sqlite3_finalize(store->begin);
+    sqlite3_finalize(store->commit);
+    sqlite3_finalize(store->insert_fix);
+    sqlite3_finalize(store->insert_sentence);
+    if (store->db != NULL)
+    {
+        sqlite3_close(store->db);
+    }
+    pthread_cond_destroy(&store->cond);
+    pthread_mutex_destroy(&store->mutex);
+    free(store->pending);
+    free(store->batch);
+    free(store);
+}
+
+
+static int buzz_l_store_prepare(buzz_i_gps_store_t * store, const char * sql, sqlite3_stmt ** out_stmt)
+{
+    if (sqlite3_prepare_v2(store->db, sql, -1, out_stmt, NULL) != SQLITE_OK)
+    {
+        BUZZ_LOG_ERROR("Failed to prepare %s: %s", sql, sqlite3_errmsg(store->db));
+        return BUZZ_GPS_ERROR;
+    }
+    return BUZZ_GPS_SUCCESS;
+}
+
+
+int buzz_gps_store_open(
+    buzz_gps_store_t * out_store,
+    const char * path,
+    int options,
+    size_t batch_rows,
+    int flush_ms)
+{
+    buzz_i_gps_store_t * store;
+    pthread_condattr_t attr;
+    char * errmsg = NULL;
+
+    store = (buzz_i_gps_store_t *) calloc(1, sizeof(buzz_i_gps_store_t));
+    if (store == NULL)
+    {
+        return BUZZ_GPS_ERROR;
+    }
+    store->options = options;
+    store->batch_rows = batch_rows == 0 ? BUZZ_GPS_STORE_DEFAULT_BATCH : batch_rows;
+    store->flush_ns = (uint64_t) (flush_ms <= 0 ? BUZZ_GPS_STORE_DEFAULT_FLUSH_MS : flush_ms) * 1000000u;
+    store->capacity = store->batch_rows * BUZZ_STORE_QUEUE_BATCHES;
+
+    pthread_mutex_init(&store->mutex, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&store->cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    store->pending = (buzz_i_store_record_t *) malloc(store->capacity * sizeof(buzz_i_store_record_t));
+    store->batch = (buzz_i_store_record_t *) malloc(store->capacity * sizeof(buzz_i_store_record_t));
+    if (store->pending == NULL || store->batch == NULL)
+    {
+        buzz_l_store_free(store);
+        return BUZZ_GPS_ERROR;
+    }
+
+    /* the connection is only used by one thread at a time */
+    if (sqlite3_open_v2(path, &store->db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_NOMUTEX, NULL)
+        != SQLITE_OK)
+    {
+        BUZZ_LOG_ERROR("Failed to open the track store %s: %s", path,
+            store->db != NULL ? sqlite3_errmsg(store->db) : "out of memory");
+        buzz_l_store_free(store);
+        return BUZZ_GPS_ERROR;
+    }
+    sqlite3_busy_timeout(store->db, BUZZ_STORE_BUSY_TIMEOUT_MS);
+
+    /* with WAL a commit only has to reach the log, NORMAL skips the fsync per transaction */
+    if (sqlite3_exec(store->db, "PRAGMA journal_mode=WAL; PRAGMA synchronous=NORMAL;", NULL, NULL, &errmsg)
+            != SQLITE_OK
+        || sqlite3_exec(store->db, _g_store_schema, NULL, NULL, &errmsg) != SQLITE_OK)
+    {
+        BUZZ_LOG_ERROR("Failed to set up the track store %s: %s", path, errmsg);
+        sqlite3_free(errmsg);
+        buzz_l_store_free(store);
+        return BUZZ_GPS_ERROR;
+    }
+    if (buzz_l_store_prepare(store, "BEGIN", &store->begin) != BUZZ_GPS_SUCCESS
+        || buzz_l_store_prepare(store, "COMMIT", &store->commit) != BUZZ_GPS_SUCCESS
+        || buzz_l_store_prepare(store, _g_insert_fix, &store->insert_fix) != BUZZ_GPS_SUCCESS
+        || buzz_l_store_prepare(store, _g_insert_sentence, &store->insert_sentence) != BUZZ_GPS_SUCCESS)
+    {
+        buzz_l_store_free(store);
+        return BUZZ_GPS_ERROR;
+    }
+
+    if (pthread_create(&store->thread_id, NULL, buzz_l_store_thread, store) != 0)
+    {
+        BUZZ_LOG_ERROR("Failed to start the track store writer");
+        buzz_l_store_free(store);
+        return BUZZ_GPS_ERROR;
+    }
+
+    *out_store = store;
+    return BUZZ_GPS_SUCCESS;
+}
+
+
+int buzz_gps_store_close(buzz_gps_store_t store)
+{
+    pthread_mutex_lock(&store->mutex);
+    {
+        store->stopping = 1;
+        pthread_cond_signal(&store->cond);
+    }
+    pthread_mutex_unlock(&store->mutex);
+
+    /* the writer commits what is queued before it returns */
+    pthread_join(store->thread_id, NULL);
+    buzz_l_store_free(store);
+
+    return BUZZ_GPS_SUCCESS;
+}
+
+
+int buzz_gps_store_get_stats(buzz_gps_store_t store, buzz_gps_store_stats_t * out_stats)
+{
+    out_stats->fixes = BUZZ_STAT_LOAD(store->fixes);
+    out_stats->sentences = BUZZ_STAT_LOAD(store->sentences);
+    out_stats->transactions = BUZZ_STAT_LOAD(store->transactions);
+    out_stats->dropped = BUZZ_STAT_LOAD(store->dropped);
+    out_stats->errors = BUZZ_STAT_LOAD(store->errors);
+
+    return BUZZ_GPS_SUCCESS;
+}
@@ -0,0 +1,78 @@
+/*
+ * Track store
+ *
+ * Records fused fixes, and optionally the raw sentences, of any number of
+ * handles into an SQLite database. The callback threads only copy records
+ * into a queue; a writer thread owned by the store inserts them with
+ * prepared statements, many rows per transaction, on a WAL journal so
+ * readers of the database never block it.
+ */
+#ifndef BUZZ_STORE_H
+#define BUZZ_STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sqlite3.h>
+
+#include "buzz_gps.h"
+
+typedef struct buzz_i_store_record_s
+{
+    int receiver;
+    /* 0 for a fix, 1 for a raw sentence */
+    int is_sentence;
+    union
+    {
+        buzz_gps_fix_t fix;
+        struct
+        {
+            buzz_sentence_type_t type;
+            uint64_t received_ns;
+            int length;
+            char text[BUZZ_GPS_MAX_LINE];
+        } sentence;
+    } u;
+} buzz_i_store_record_t;
+
+typedef struct buzz_i_gps_store_s
+{
+    int options;
+    size_t batch_rows;
+    uint64_t flush_ns;
+
+    /* records waiting for the writer, guarded by mutex */
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    buzz_i_store_record_t * pending;
+    size_t pending_count;
+    size_t capacity;
+    uint64_t first_pending_ns;
+    int stopping;
+
+    /* only used by the writer thread once it is started */
+    buzz_i_store_record_t * batch;
+    sqlite3 * db;
+    sqlite3_stmt * begin;
+    sqlite3_stmt * commit;
+    sqlite3_stmt * insert_fix;
+    sqlite3_stmt * insert_sentence;
+    pthread_t thread_id;
+
+    _Atomic uint64_t fixes;
+    _Atomic uint64_t sentences;
+    _Atomic uint64_t transactions;
+    _Atomic uint64_t dropped;
+    _Atomic uint64_t errors;
+} buzz_i_gps_store_t;
+
+/*
+ * Queue a record for the writer. These never wait on the database, when
+ * the queue is full the record is dropped and counted.
+ */
+void buzz_store_add_fix(buzz_i_gps_store_t * store, int receiver, const buzz_gps_fix_t * fix);
+
+void buzz_store_add_sentence(buzz_i_gps_store_t * store, int receiver, const buzz_gps_raw_event_t * raw_event);
+
+#endif
@@ -0,0 +1,622 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "buzz_track.h"
+#include "buzz_logging.h"
+#include "buzz_stats.h"
+
+static const char _g_track_padding[8];
+
+
+static size_t buzz_l_track_block_size(uint32_t rows)
+{
+    return (sizeof(buzz_i_track_block_t) + (size_t) rows * BUZZ_TRACK_ROW_BYTES + 7) & ~(size_t) 7;
+}
+
+
+/*
+ * Check that the index of a trailer lies between the header and the
+ * trailer and that each of its blocks is aligned, in order and ends before
+ * the index, so the reader can trust it without touching the blocks
+ */
+static int buzz_l_track_trailer_valid(
+    const unsigned char * map,
+    size_t map_size,
+    const buzz_i_track_trailer_t * trailer)
+{
+    const buzz_i_track_index_t * index;
+    uint64_t index_end = map_size - sizeof(buzz_i_track_trailer_t);
+    uint64_t end = sizeof(buzz_i_track_header_t);
+    uint64_t rows = 0;
+    uint64_t i;
+
+    if (memcmp(trailer->magic, BUZZ_TRACK_TRAILER_MAGIC, 8) != 0
+        || trailer->index_offset < sizeof(buzz_i_track_header_t)
+        || trailer->index_offset > index_end
+        || trailer->index_offset % 8 != 0
+        || trailer->blocks > (index_end - trailer->index_offset) / sizeof(buzz_i_track_index_t)
+        || trailer->blocks * sizeof(buzz_i_track_index_t) != index_end - trailer->index_offset)
+    {
+        return 0;
+    }
+
+    index = (const buzz_i_track_index_t *) (map + trailer->index_offset);
+    for (i = 0; i < trailer->blocks; i++)
+    {
+        if (index[i].rows == 0 || index[i].offset < end || index[i].offset % 8 != 0
+            || index[i].offset > trailer->index_offset
+            || buzz_l_track_block_size(index[i].rows) > trailer->index_offset - index[i].offset)
+        {
+            return 0;
+        }
+        end = index[i].offset + buzz_l_track_block_size(index[i].rows);
+        rows += index[i].rows;
+    }
+    return rows == trailer->rows;
+}
+
+
+/*
+ * Find the blocks of a mapped track file. The index is taken from the
+ * trailer when there is a valid one, otherwise it is rebuilt into a
+ * malloc()ed copy by walking the blocks up to the first one that is
+ * incomplete. out_data_end is set to the end of the last block.
+ */
+static int buzz_l_track_load(
+    const unsigned char * map,
+    size_t map_size,
+    const buzz_i_track_index_t ** out_index,
+    buzz_i_track_index_t ** out_rebuilt,
+    size_t * out_blocks,
+    uint64_t * out_rows,
+    uint64_t * out_data_end)
+{
+    const buzz_i_track_header_t * header = (const buzz_i_track_header_t *) map;
+    const buzz_i_track_trailer_t * trailer;
+    const buzz_i_track_block_t * block;
+    buzz_i_track_index_t * rebuilt = NULL;
+    size_t blocks = 0;
+    size_t size = 0;
+    uint64_t rows = 0;
+    uint64_t offset;
+
+    *out_rebuilt = NULL;
+    if (map_size < sizeof(buzz_i_track_header_t) || memcmp(header->magic, BUZZ_TRACK_MAGIC, 8) != 0
+        || header->version != BUZZ_TRACK_VERSION)
+    {
+        return BUZZ_GPS_ERROR;
+    }
+
+    if (map_size >= sizeof(buzz_i_track_header_t) + sizeof(buzz_i_track_trailer_t) && map_size % 8 == 0)
+    {
+        trailer = (const buzz_i_track_trailer_t *) (map + map_size - sizeof(buzz_i_track_trailer_t));
+        if (buzz_l_track_trailer_valid(map, map_size, trailer))
+        {
+            *out_index = (const buzz_i_track_index_t *) (map + trailer->index_offset);
+            *out_blocks = trailer->blocks;
+            *out_rows = trailer->rows;
+            *out_data_end = trailer->index_offset;
+            return BUZZ_GPS_SUCCESS;
+        }
+        if (memcmp(trailer->magic, BUZZ_TRACK_TRAILER_MAGIC, 8) == 0)
+        {
+            BUZZ_LOG_WARN("The track file index is damaged, walking the blocks instead");
+        }
+    }
+
+    /* no usable trailer, the writer did not close the file */
+    offset = sizeof(buzz_i_track_header_t);
+    while (offset + sizeof(buzz_i_track_block_t) <= map_size)
+    {
+        block = (const buzz_i_track_block_t *) (map + offset);
+        if (memcmp(block->magic, BUZZ_TRACK_BLOCK_MAGIC, 4) != 0 || block->rows == 0
+            || offset + buzz_l_track_block_size(block->rows) > map_size)
+        {
+            break;
+        }
+        if (blocks == size)
+        {
+            buzz_i_track_index_t * grown;
+
+            size = size == 0 ? 64 : size * 2;
+            grown = (buzz_i_track_index_t *) realloc(rebuilt, size * sizeof(buzz_i_track_index_t));
+            if (grown == NULL)
+            {
+                free(rebuilt);
+                return BUZZ_GPS_ERROR;
+            }
+            rebuilt = grown;
+        }
+        rebuilt[blocks].offset = offset;
+        rebuilt[blocks].rows = block->rows;
+        rebuilt[blocks].reserved = 0;
+        rebuilt[blocks].first_ns = block->first_ns;
+        rebuilt[blocks].last_ns = block->last_ns;
+        blocks++;
+        rows += block->rows;
+        offset += buzz_l_track_block_size(block->rows);
+    }
+
+    *out_index = rebuilt;
+    *out_rebuilt = rebuilt;
+    *out_blocks = blocks;
+    *out_rows = rows;
+    *out_data_end = offset;
+    return BUZZ_GPS_SUCCESS;
+}
+
+
+static int buzz_l_track_write_all(int fd, struct iovec * iov, int iovcnt, uint64_t offset, size_t total)
+{
+    ssize_t written;
+
+    written = pwritev(fd, iov, iovcnt, offset);
+    if (written < 0 || (size_t) written != total)
+    {
+        BUZZ_LOG_ERROR("Failed to write the track file: %s", written < 0 ? strerror(errno) : "short write");
+        return BUZZ_GPS_ERROR;
+    }
+    return BUZZ_GPS_SUCCESS;
+}
+
+
+/*
+ * Write the rows gathered so far as one block, straight from the column
+ * buffers
+ *
+ * must be called locked
+ */
+static int buzz_l_track_flush_block(buzz_i_track_writer_t * writer)
+{
+    buzz_i_track_block_t block;
+    buzz_i_track_index_t * entry;
+    struct iovec iov[7];
+    size_t n = writer->count;
+    size_t size;
+
+    if (n == 0)
+    {
+        return BUZZ_GPS_SUCCESS;
+    }
+    if (writer->blocks == writer->index_size)
+    {
+        size_t index_size = writer->index_size == 0 ? 64 : writer->index_size * 2;
+        buzz_i_track_index_t * grown;
+
+        grown = (buzz_i_track_index_t *) realloc(writer->index, index_size * sizeof(buzz_i_track_index_t));
+        if (grown == NULL)
+        {
+            return BUZZ_GPS_ERROR;
+        }
+        writer->index = grown;
+        writer->index_size = index_size;
+    }
+
+    memcpy(block.magic, BUZZ_TRACK_BLOCK_MAGIC, 4);
+    block.rows = (uint32_t) n;
+    block.first_ns = writer->utc_ns[0];
+    block.last_ns = writer->utc_ns[n - 1];
+    size = buzz_l_track_block_size(block.rows);
+
+    iov[0].iov_base = &block;
+    iov[0].iov_len = sizeof(block);
+    iov[1].iov_base = writer->utc_ns;
+    iov[1].iov_len = n * sizeof(int64_t);
+    iov[2].iov_base = writer->latitude;
+    iov[2].iov_len = n * sizeof(double);
+    iov[3].iov_base = writer->longitude;
+    iov[3].iov_len = n * sizeof(double);
+    iov[4].iov_base = writer->altitude;
+    iov[4].iov_len = n * sizeof(float);
+    iov[5].iov_base = writer->speed_knots;
+    iov[5].iov_len = n * sizeof(float);
+    iov[6].iov_base = (void *) _g_track_padding;
+    iov[6].iov_len = size - sizeof(block) - n * BUZZ_TRACK_ROW_BYTES;
+
+    /* the rows are kept to try again with the next one */
+    if (buzz_l_track_write_all(writer->fd, iov, 7, writer->offset, size) != BUZZ_GPS_SUCCESS)
+    {
+        BUZZ_STAT_ADD(writer->errors, 1);
+        return BUZZ_GPS_ERROR;
+    }
+
+    entry = &writer->index[writer->blocks++];
+    entry->offset = writer->offset;
+    entry->rows = block.rows;
+    entry->reserved = 0;
+    entry->first_ns = block.first_ns;
+    entry->last_ns = block.last_ns;
+    writer->offset += size;
+    writer->count = 0;
+
+    return BUZZ_GPS_SUCCESS;
+}
+
+
+static void buzz_l_track_writer_free(buzz_i_track_writer_t * writer)
+{
+    if (writer->fd >= 0)
+    {
+        close(writer->fd);
+    }
+    pthread_mutex_destroy(&writer->mutex);
+    free(writer->utc_ns);
+    free(writer->latitude);
+    free(writer->longitude);
+    free(writer->altitude);
+    free(writer->speed_knots);
+    free(writer->index);
+    free(writer);
+}
+
+
+/*
+ * Pick up the blocks of an existing file and cut off its index, so new
+ * blocks go after the last one
+ */
+static int buzz_l_track_reopen(buzz_i_track_writer_t * writer, size_t file_size)
+{
+    const buzz_i_track_index_t * index;
+    buzz_i_track_index_t * rebuilt;
+    unsigned char * map;
+    size_t blocks;
+    uint64_t rows;
+    uint64_t data_end;
+    int rc;
+
+    map = (unsigned char *) mmap(NULL, file_size, PROT_READ, MAP_SHARED, writer->fd, 0);
+    if (map == MAP_FAILED)
+    {
+        return BUZZ_GPS_ERROR;
+    }
+    rc = buzz_l_track_load(map, file_size, &index, &rebuilt, &blocks, &rows, &data_end);
+    if (rc == BUZZ_GPS_SUCCESS && blocks > 0)
+    {
+        writer->index = (buzz_i_track_index_t *) malloc(blocks * sizeof(buzz_i_track_index_t));
+        if (writer->index == NULL)
+        {
+            rc = BUZZ_GPS_ERROR;
+        }
+        else
+        {
+            memcpy(writer->index, index, blocks * sizeof(buzz_i_track_index_t));
+            writer->blocks = blocks;
+            writer->index_size = blocks;
+            writer->last_ns = index[blocks - 1].last_ns;
+        }
+    }
+    free(rebuilt);
+    munmap(map, file_size);
+    if (rc != BUZZ_GPS_SUCCESS)
+    {
+        return rc;
+    }
+
+    writer->offset = data_end;
+    BUZZ_STAT_ADD(writer->rows, rows);
+    if (ftruncate(writer->fd, data_end) != 0)
+    {
+        return BUZZ_GPS_ERROR;
+    }
+    return BUZZ_GPS_SUCCESS;
+}
+
+
+int buzz_gps_track_open(buzz_gps_track_writer_t * out_writer, const char * path, size_t block_rows)
+{
+    buzz_i_track_writer_t * writer;
+    buzz_i_track_header_t header;
+    struct iovec iov;
+    struct stat st;
+
+    if (block_rows == 0)
+    {
+        block_rows = BUZZ_GPS_TRACK_DEFAULT_BLOCK_ROWS;
+    }
+    if (block_rows > UINT32_MAX)
+    {
+        return BUZZ_GPS_ERROR;
+    }
+    writer = (buzz_i_track_writer_t *) calloc(1, sizeof(buzz_i_track_writer_t));
+    if (writer == NULL)
+    {
+        return BUZZ_GPS_ERROR;
+    }
+    pthread_mutex_init(&writer->mutex, NULL);
+    writer->block_rows = (uint32_t) block_rows;
+    writer->last_ns = INT64_MIN;
+    writer->utc_ns = (int64_t *) malloc(block_rows * sizeof(int64_t));
+    writer->latitude = (double *) malloc(block_rows * sizeof(double));
+    writer->longitude = (double *) malloc(block_rows * sizeof(double));
+    writer->altitude = (float *) malloc(block_rows * sizeof(float));
+    writer->speed_knots = (float *) malloc(block_rows * sizeof(float));
+    writer->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (writer->fd < 0)
+    {
+        BUZZ_LOG_ERROR("Failed to open %s: %s", path, strerror(errno));
+        buzz_l_track_writer_free(writer);
+        return BUZZ_GPS_ERROR;
+    }
+    if (writer->utc_ns == NULL || writer->latitude == NULL || writer->longitude == NULL
+        || writer->altitude == NULL || writer->speed_knots == NULL || fstat(writer->fd, &st) != 0)
+    {
+        buzz_l_track_writer_free(writer);
+        return BUZZ_GPS_ERROR;
+    }
+
+    if (st.st_size == 0)
+    {
+        memset(&header, '\0', sizeof(header));
+        memcpy(header.magic, BUZZ_TRACK_MAGIC, 8);
+        header.version = BUZZ_TRACK_VERSION;
+        header.block_rows = writer->block_rows;
+        iov.iov_base = &header;
+        iov.iov_len = sizeof(header);
+        if (buzz_l_track_write_all(writer->fd, &iov, 1, 0, sizeof(header)) != BUZZ_GPS_SUCCESS)
+        {
+            buzz_l_track_writer_free(writer);
+            return BUZZ_GPS_ERROR;
+        }
+        writer->offset = sizeof(header);
+    }
+    else if (buzz_l_track_reopen(writer, st.st_size) != BUZZ_GPS_SUCCESS)
+    {
+        BUZZ_LOG_ERROR("%s is not a track file", path);
+        buzz_l_track_writer_free(writer);
+        return BUZZ_GPS_ERROR;
+    }
+
+    *out_writer = writer;
+    return BUZZ_GPS_SUCCESS;
+}
+
+
+int buzz_gps_track_append(buzz_gps_track_writer_t writer, const buzz_gps_fix_t * fix)
+{
+    size_t n;
+    int rc = BUZZ_GPS_SUCCESS;
+
+    if ((fix->flags & (BUZZ_GPS_FIX_TIMESTAMP | BUZZ_GPS_FIX_LOCATION))
+        != (BUZZ_GPS_FIX_TIMESTAMP | BUZZ_GPS_FIX_LOCATION))
+    {
+        BUZZ_STAT_ADD(writer->skipped, 1);
+        return BUZZ_GPS_NOT_FOUND;
+    }
+
+    pthread_mutex_lock(&writer->mutex);
+    /* a full block is only left behind when writing it failed */
+    if (fix->utc_ns < writer->last_ns
+        || (writer->count == writer->block_rows && buzz_l_track_flush_block(writer) != BUZZ_GPS_SUCCESS))
+    {
+        pthread_mutex_unlock(&writer->mutex);
+        BUZZ_STAT_ADD(writer->skipped, 1);
+        return BUZZ_GPS_ERROR;
+    }
+    n = writer->count;
+    writer->utc_ns[n] = fix->utc_ns;
+    writer->latitude[n] = fix->latitude;
+    writer->longitude[n] = fix->longitude;
+    writer->altitude[n] = fix->flags & BUZZ_GPS_FIX_ALTITUDE ? (float) fix->altitude_meters : NAN;
+    writer->speed_knots[n] = fix->flags & BUZZ_GPS_FIX_SPEED ? (float) fix->speed_knots : NAN;
+    writer->last_ns = fix->utc_ns;
+    writer->count++;
+    BUZZ_STAT_ADD(writer->rows, 1);
+    if (writer->count == writer->block_rows)
+    {
+        rc = buzz_l_track_flush_block(writer);
+    }
+    pthread_mutex_unlock(&writer->mutex);
+
+    return rc;
+}
+
+
+int buzz_gps_track_close(buzz_gps_track_writer_t writer)
+{
+    buzz_i_track_trailer_t trailer;
+    struct iovec iov[2];
+    size_t index_bytes;
+    int rc;
+
+    pthread_mutex_lock(&writer->mutex);
+    rc = buzz_l_track_flush_block(writer);
+    if (rc == BUZZ_GPS_SUCCESS)
+    {
+        index_bytes = writer->blocks * sizeof(buzz_i_track_index_t);
+        memset(&trailer, '\0', sizeof(trailer));
+        trailer.index_offset = writer->offset;
+        trailer.blocks = writer->blocks;
+        trailer.rows = BUZZ_STAT_LOAD(writer->rows);
+        memcpy(trailer.magic, BUZZ_TRACK_TRAILER_MAGIC, 8);
+
+        iov[0].iov_base = writer->index;
+        iov[0].iov_len = index_bytes;
+        iov[1].iov_base = &trailer;
+        iov[1].iov_len = sizeof(trailer);
+        rc = buzz_l_track_write_all(writer->fd, iov, 2, writer->offset, index_bytes + sizeof(trailer));
+    }
+    if (rc == BUZZ_GPS_SUCCESS && fdatasync(writer->fd) != 0)
+    {
+        rc = BUZZ_GPS_ERROR;
+    }
+    pthread_mutex_unlock(&writer->mutex);
+
+    buzz_l_track_writer_free(writer);
+    return rc;
+}
+
+
+int buzz_gps_track_get_stats(buzz_gps_track_writer_t writer, buzz_gps_track_stats_t * out_stats)
+{
+    out_stats->rows = BUZZ_STAT_LOAD(writer->rows);
+    out_stats->skipped = BUZZ_STAT_LOAD(writer->skipped);
+    out_stats->errors = BUZZ_STAT_LOAD(writer->errors);
+
+    return BUZZ_GPS_SUCCESS;
+}
+
+
+int buzz_gps_track_map(buzz_gps_track_reader_t * out_reader, const char * path)
+{
+    buzz_i_track_reader_t * reader;
+    struct stat st;
+    uint64_t data_end;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        BUZZ_LOG_ERROR("Failed to open %s: %s", path, strerror(errno));
+        return BUZZ_GPS_ERROR;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        close(fd);
+        return BUZZ_GPS_ERROR;
+    }
+    reader = (buzz_i_track_reader_t *) calloc(1, sizeof(buzz_i_track_reader_t));
+    if (reader == NULL)
+    {
+        close(fd);
+        return BUZZ_GPS_ERROR;
+    }
+    reader->map_size = st.st_size;
+    reader->map = (const unsigned char *) mmap(NULL, reader->map_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (reader->map == MAP_FAILED)
+    {
+        free(reader);
+        return BUZZ_GPS_ERROR;
+    }
+    if (buzz_l_track_load(reader->map, reader->map_size, &reader->index, &reader->rebuilt,
+            &reader->blocks, &reader->rows, &data_end) != BUZZ_GPS_SUCCESS)
+    {
+        BUZZ_LOG_ERROR("%s is not a track file", path);
+        munmap((void *) reader->map, reader->map_size);
+        free(reader);
+        return BUZZ_GPS_ERROR;
+    }
+
+    *out_reader = reader;
+    return BUZZ_GPS_SUCCESS;
+}
+
+
+int buzz_gps_track_unmap(buzz_gps_track_reader_t reader)
+{
+    munmap((void *) reader->map, reader->map_size);
+    free(reader->rebuilt);
+    free(reader);
+
+    return BUZZ_GPS_SUCCESS;
+}
+
+
+uint64_t buzz_gps_track_rows(buzz_gps_track_reader_t reader)
+{
+    return reader->rows;
+}
+
+
+/* first of count times that is not before ns */
+static size_t buzz_l_track_lower_bound(const int64_t * times, size_t count, int64_t ns)
+{
+    size_t low = 0;
+    size_t high = count;
+    size_t mid;
+
+    while (low < high)
+    {
+        mid = low + (high - low) / 2;
+        if (times[mid] < ns)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+
+void buzz_gps_track_range(
+    buzz_gps_track_reader_t reader,
+    int64_t from_ns,
+    int64_t to_ns,
+    buzz_gps_track_cursor_t * out_cursor)
+{
+    size_t low = 0;
+    size_t high = reader->blocks;
+    size_t mid;
+
+    /* the first block that ends at or after from_ns */
+    while (low < high)
+    {
+        mid = low + (high - low) / 2;
+        if (reader->index[mid].last_ns < from_ns)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    out_cursor->reader = reader;
+    out_cursor->block = low;
+    out_cursor->from_ns = from_ns;
+    out_cursor->to_ns = to_ns;
+}
+
+
+int buzz_gps_track_next(buzz_gps_track_cursor_t * cursor, buzz_gps_track_span_t * out_span)
+{
+    buzz_gps_track_reader_t reader = cursor->reader;
+    const buzz_i_track_index_t * entry;
+    const unsigned char * columns;
+    const int64_t * utc_ns;
+    size_t rows;
+    size_t first;
+    size_t last;
+
+    while (cursor->block < reader->blocks)
+    {
+        entry = &reader->index[cursor->block++];
+        if (entry->first_ns >= cursor->to_ns)
+        {
+            break;
+        }
+        rows = entry->rows;
+        columns = reader->map + entry->offset + sizeof(buzz_i_track_block_t);
+        utc_ns = (const int64_t *) columns;
+
+        /* whole blocks inside the range need no search */
+        first = entry->first_ns >= cursor->from_ns ? 0 : buzz_l_track_lower_bound(utc_ns, rows, cursor->from_ns);
+        last = entry->last_ns < cursor->to_ns ? rows : buzz_l_track_lower_bound(utc_ns, rows, cursor->to_ns);
+        if (first == last)
+        {
+            continue;
+        }
+
+        out_span->count = last - first;
+        out_span->utc_ns = utc_ns + first;
+        out_span->latitude = (const double *) (columns + rows * sizeof(int64_t)) + first;
+        out_span->longitude = (const double *) (columns + rows * (sizeof(int64_t) + sizeof(double))) + first;
+        out_span->altitude = (const float *) (columns + rows * (sizeof(int64_t) + 2 * sizeof(double))) + first;
+        out_span->speed_knots = (const float *) (columns + rows * (sizeof(int64_t) + 2 * sizeof(double) + sizeof(float)))
+            + first;
+        return BUZZ_GPS_SUCCESS;
+    }
+    cursor->block = reader->blocks;
+    return BUZZ_GPS_END_OF_DATA;
+}
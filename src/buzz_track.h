@@ -0,0 +1,111 @@
+/*
+ * Columnar track files
+ *
+ * A compact on-disk form for the fused fixes of one receiver, to be read
+ * back with mmap instead of re-parsing NMEA text. All values are in host
+ * byte order.
+ *
+ *   header    buzz_i_track_header_t
+ *   block...  buzz_i_track_block_t, then the columns of its rows:
+ *             int64_t utc_ns[rows], double latitude[rows],
+ *             double longitude[rows], float altitude[rows],
+ *             float speed_knots[rows], padded to 8 bytes
+ *   index     buzz_i_track_index_t for every block
+ *   trailer   buzz_i_track_trailer_t
+ *
+ * Rows are in time order. The index and trailer are written on close, and
+ * dropped again when the file is reopened to append, so a file whose
+ * writer died without closing it is read by walking the blocks instead.
+ */
+#ifndef BUZZ_TRACK_H
+#define BUZZ_TRACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "buzz_gps.h"
+
+#define BUZZ_TRACK_MAGIC "BUZZTRK1"
+#define BUZZ_TRACK_BLOCK_MAGIC "BZBK"
+#define BUZZ_TRACK_TRAILER_MAGIC "BUZZTEND"
+#define BUZZ_TRACK_VERSION 1
+
+/* bytes of column data per row */
+#define BUZZ_TRACK_ROW_BYTES (2 * sizeof(double) + sizeof(int64_t) + 2 * sizeof(float))
+
+typedef struct buzz_i_track_header_s
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t block_rows;
+} buzz_i_track_header_t;
+
+typedef struct buzz_i_track_block_s
+{
+    char magic[4];
+    uint32_t rows;
+    int64_t first_ns;
+    int64_t last_ns;
+} buzz_i_track_block_t;
+
+typedef struct buzz_i_track_index_s
+{
+    uint64_t offset;
+    uint32_t rows;
+    uint32_t reserved;
+    int64_t first_ns;
+    int64_t last_ns;
+} buzz_i_track_index_t;
+
+typedef struct buzz_i_track_trailer_s
+{
+    uint64_t index_offset;
+    uint64_t blocks;
+    uint64_t rows;
+    char magic[8];
+} buzz_i_track_trailer_t;
+
+_Static_assert(sizeof(buzz_i_track_header_t) % 8 == 0, "blocks must start 8 byte aligned");
+_Static_assert(sizeof(buzz_i_track_block_t) % 8 == 0, "columns must start 8 byte aligned");
+_Static_assert(sizeof(buzz_i_track_index_t) % 8 == 0, "the trailer must be 8 byte aligned");
+
+typedef struct buzz_i_track_writer_s
+{
+    pthread_mutex_t mutex;
+    int fd;
+    uint32_t block_rows;
+    /* where the next block goes */
+    uint64_t offset;
+    int64_t last_ns;
+
+    /* the block being filled */
+    size_t count;
+    int64_t * utc_ns;
+    double * latitude;
+    double * longitude;
+    float * altitude;
+    float * speed_knots;
+
+    buzz_i_track_index_t * index;
+    size_t blocks;
+    size_t index_size;
+
+    _Atomic uint64_t rows;
+    _Atomic uint64_t skipped;
+    _Atomic uint64_t errors;
+} buzz_i_track_writer_t;
+
+typedef struct buzz_i_track_reader_s
+{
+    const unsigned char * map;
+    size_t map_size;
+    /* points into the mapping, or to a copy rebuilt by walking the blocks */
+    const buzz_i_track_index_t * index;
+    buzz_i_track_index_t * rebuilt;
+    size_t blocks;
+    uint64_t rows;
+} buzz_i_track_reader_t;
+
+#endif
@@ -6,11 +6,15 @@
 #include <stddef.h>
 #include <setjmp.h>
 #include <limits.h>
+#include <math.h>
+#include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <cmocka.h>
+#include <sqlite3.h>
 
 #include <buzz_gps.h>
+#include <buzz_logging.h>
 
 
 typedef struct test_fifo_obj_s
@@ -21,8 +25,11 @@ typedef struct test_fifo_obj_s
 
    int raw_received;
    int event_received;
+   int fix_received;
+   int gate_closed;
    buzz_gps_raw_event_t raw;
    buzz_gps_event_t event;
+   buzz_gps_fix_t fix;
 } test_fifo_obj_t;
 
 
@@ -63,6 +70,20 @@ static int test_teardown (void** state)
 }
 
 
+/* write body as a complete sentence with a valid checksum */
+static void write_sentence(FILE * source_pipe, const char * body)
+{
+   unsigned char checksum = 0;
+   const char * p;
+
+   for (p = body; *p != '\0'; p++)
+   {
+      checksum ^= (unsigned char) *p;
+   }
+   fprintf(source_pipe, "$%s*%02X\r\n", body, checksum);
+}
+
+
 static void test_bad_path(void **state)
 {
    int rc;
@@ -145,58 +166,2354 @@ static void test_simple_rmc_gll(void **state)
 }
 
 
-/*
- * asyn tests
- */
-static void raw_cb(buzz_gps_raw_event_t * raw, void * user_arg)
+static void test_framing_partial_sentences(void **state)
 {
-   test_fifo_obj_t * test_state = (test_fifo_obj_t *) user_arg;
+   int rc;
+   int i;
+   buzz_gps_handle_t gps_h;
+   test_fifo_obj_t * test_state = (test_fifo_obj_t *) *state;
+   FILE * source_pipe;
+   buzz_gps_raw_event_t raw;
+   buzz_gps_event_t event;
 
-   pthread_mutex_lock(&test_state->mutex);
+   rc = buzz_gps_init(&gps_h, test_state->fifo_path, 0, BUZZ_GPS_OPTIONS_DEBUG);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+
+   source_pipe = fopen(test_state->fifo_path, "w");
+   /* junk before the first sentence, then an overlong line that must be dropped */
+   fprintf(source_pipe, "noise\r\n$GPXXX,");
+   for (i = 0; i < 20; i++)
    {
-      test_state->raw = *raw;
-      test_state->raw_received = 1;
-      pthread_cond_signal(&test_state->cond);
+      fprintf(source_pipe, "0123456789");
    }
-   pthread_mutex_unlock(&test_state->mutex);
+   fprintf(source_pipe, "\r\n$GPRMC,171552.935,V,3854.825,N,07702.466,W,70.5,2.50,021116,,E*4A\r\n");
+   /* only half of the next sentence is available on the first read */
+   fprintf(source_pipe, "$GPGLL,3854.777,N,0770");
+   fflush(source_pipe);
 
-   printf("Got raw event: %s\n", raw->sentence);
+   rc = buzz_gps_get_event_blocking(gps_h, &raw, &event);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   assert_int_equal(BUZZ_GPRMC, raw.type);
+   assert_string_equal("$GPRMC,171552.935,V,3854.825,N,07702.466,W,70.5,2.50,021116,,E*4A\r\n", raw.sentence);
+   buzz_gps_free_blocking_event(&event);
+
+   fprintf(source_pipe, "2.464,W,171848.935,V*34\r\n");
+   fclose(source_pipe);
+
+   rc = buzz_gps_get_event_blocking(gps_h, &raw, &event);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   assert_int_equal(BUZZ_GPGLL, raw.type);
+   assert_string_equal("$GPGLL,3854.777,N,07702.464,W,171848.935,V*34\r\n", raw.sentence);
+   assert_int_equal(7, raw.word_count);
+   buzz_gps_free_blocking_event(&event);
+
+   rc = buzz_gps_destroy(gps_h);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
 }
 
 
-static void event_cb(buzz_gps_event_t * event, void * user_arg)
+static void test_raw_fields(void **state)
 {
-   test_fifo_obj_t * test_state = (test_fifo_obj_t *) user_arg;
+   int rc;
+   buzz_gps_handle_t gps_h;
+   test_fifo_obj_t * test_state = (test_fifo_obj_t *) *state;
+   FILE * source_pipe;
+   buzz_gps_raw_event_t raw;
+   buzz_gps_event_t event;
+   const char * field;
+   size_t len;
+   static const char * rmc = "$GPRMC,171552.935,V,3854.825,N,07702.466,W,70.5,2.50,021116,,E*4A\r\n";
 
-   printf("got event\n");
-   if (event->location != NULL)
+   rc = buzz_gps_init(&gps_h, test_state->fifo_path, 0, BUZZ_GPS_OPTIONS_DEBUG | BUZZ_GPS_OPTIONS_NO_WORDS);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+
+   source_pipe = fopen(test_state->fifo_path, "w");
+   fprintf(source_pipe, "%s", rmc);
+   fclose(source_pipe);
+
+   rc = buzz_gps_get_event_blocking(gps_h, &raw, &event);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   assert_string_equal(rmc, raw.sentence);
+   assert_int_equal(strlen(rmc), raw.length);
+   assert_int_equal(12, raw.field_count);
+   assert_int_equal(0, raw.word_count);
+   assert_ptr_not_equal(NULL, event.location);
+
+   field = buzz_gps_raw_field(&raw, 0, &len);
+   assert_int_equal(6, len);
+   assert_memory_equal("$GPRMC", field, len);
+   field = buzz_gps_raw_field(&raw, 3, &len);
+   assert_int_equal(8, len);
+   assert_memory_equal("3854.825", field, len);
+   field = buzz_gps_raw_field(&raw, 10, &len);
+   assert_int_equal(0, len);
+   /* the last field stops before the checksum */
+   field = buzz_gps_raw_field(&raw, 11, &len);
+   assert_int_equal(1, len);
+   assert_memory_equal("E", field, len);
+   assert_ptr_equal(NULL, buzz_gps_raw_field(&raw, 12, &len));
+   buzz_gps_free_blocking_event(&event);
+
+   rc = buzz_gps_destroy(gps_h);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+}
+
+
+static void test_classify_talkers(void **state)
+{
+   int rc;
+   int i;
+   buzz_gps_handle_t gps_h;
+   test_fifo_obj_t * test_state = (test_fifo_obj_t *) *state;
+   FILE * source_pipe;
+   buzz_gps_raw_event_t raw;
+   buzz_gps_event_t event;
+   char body[32];
+   static const char * ids[] =
    {
-      pthread_mutex_lock(&test_state->mutex);
+      "GGA", "GLL", "VTG", "RMC", "GSA", "GSV", "MSS", "TRF", "STN", "XTE", "ZDA"
+   };
+
+   rc = buzz_gps_init(&gps_h, test_state->fifo_path, 0, BUZZ_GPS_OPTIONS_DEBUG);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+
+   source_pipe = fopen(test_state->fifo_path, "w");
+   write_sentence(source_pipe, "GNRMC,171552.935,V,3854.825,N,07702.466,W,70.5,2.50,021116,,E");
+   write_sentence(source_pipe, "GLGLL,3854.777,N,07702.464,W,171848.935,V");
+   write_sentence(source_pipe, "BDRMC,171552.935,V,3854.825,N,07702.466,W,70.5,2.50,021116,,E");
+   write_sentence(source_pipe, "PUBX,00,171552.935");
+   write_sentence(source_pipe, "GPRMQ,1");
+   for (i = 0; i < BUZZ_GPS_TYPE_COUNT; i++)
+   {
+      snprintf(body, sizeof(body), "GA%s,1", ids[i]);
+      write_sentence(source_pipe, body);
+   }
+   fclose(source_pipe);
+
+   rc = buzz_gps_get_event_blocking(gps_h, &raw, &event);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   assert_int_equal(BUZZ_GPRMC, raw.type);
+   assert_int_equal(BUZZ_TALKER_GN, raw.talker);
+   assert_ptr_not_equal(NULL, event.location);
+   buzz_gps_free_blocking_event(&event);
+
+   rc = buzz_gps_get_event_blocking(gps_h, &raw, &event);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   assert_int_equal(BUZZ_GPGLL, raw.type);
+   assert_int_equal(BUZZ_TALKER_GL, raw.talker);
+   assert_ptr_not_equal(NULL, event.location);
+   buzz_gps_free_blocking_event(&event);
+
+   rc = buzz_gps_get_event_blocking(gps_h, &raw, &event);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   assert_int_equal(BUZZ_GPRMC, raw.type);
+   assert_int_equal(BUZZ_TALKER_BD, raw.talker);
+   buzz_gps_free_blocking_event(&event);
+
+   /* proprietary and unknown sentences are raw only */
+   rc = buzz_gps_get_event_blocking(gps_h, &raw, &event);
+   assert_int_equal(BUZZ_GPS_EVENT_NOT_FOUND, rc);
+   assert_int_equal(BUZZ_GPS_TYPE_UNKNOWN, raw.type);
+   assert_int_equal(BUZZ_TALKER_UNKNOWN, raw.talker);
+   rc = buzz_gps_get_event_blocking(gps_h, &raw, &event);
+   assert_int_equal(BUZZ_GPS_EVENT_NOT_FOUND, rc);
+   assert_int_equal(BUZZ_GPS_TYPE_UNKNOWN, raw.type);
+   assert_int_equal(BUZZ_TALKER_GP, raw.talker);
+
+   for (i = 0; i < BUZZ_GPS_TYPE_COUNT; i++)
+   {
+      rc = buzz_gps_get_event_blocking(gps_h, &raw, &event);
+      assert_int_equal(i, raw.type);
+      assert_int_equal(BUZZ_TALKER_GA, raw.talker);
+      if (rc == BUZZ_GPS_SUCCESS)
       {
-         test_state->event = *event;
-         test_state->event_received = 1;
-         pthread_cond_signal(&test_state->cond);
+         buzz_gps_free_blocking_event(&event);
       }
-      pthread_mutex_unlock(&test_state->mutex);
-   
-      printf("Got location %f %f\n", event->location->lattitude, event->location->longitude);
    }
+
+   rc = buzz_gps_destroy(gps_h);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
 }
 
 
-static void test_simple_async(void **state)
+static void test_location_transform(void **state)
+{
+   int rc;
+   double v;
+   float f;
+
+   rc = buzz_gps_location_transform_double("3854.825", 'N', &v);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   assert_float_equal(38.0 + 54.825 / 60.0, v, 1e-12);
+
+   rc = buzz_gps_location_transform_double("07702.4661234", 'W', &v);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   assert_float_equal(-(77.0 + 2.4661234 / 60.0), v, 1e-12);
+
+   rc = buzz_gps_location_transform_double("4916.45", 's', &v);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   assert_float_equal(-(49.0 + 16.45 / 60.0), v, 1e-12);
+
+   /* trailing text after the number is ignored */
+   rc = buzz_gps_location_transform("3854.825,N", 'N', &f);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   assert_float_equal(38.0 + 54.825 / 60.0, f, 1e-5);
+
+   rc = buzz_gps_location_transform_double("", 'N', &v);
+   assert_int_not_equal(BUZZ_GPS_SUCCESS, rc);
+   rc = buzz_gps_location_transform_double("abc", 'N', &v);
+   assert_int_not_equal(BUZZ_GPS_SUCCESS, rc);
+   rc = buzz_gps_location_transform_double("3875.000", 'N', &v);
+   assert_int_not_equal(BUZZ_GPS_SUCCESS, rc);
+   rc = buzz_gps_location_transform_double("38.54.825", 'N', &v);
+   assert_int_not_equal(BUZZ_GPS_SUCCESS, rc);
+
+   /* a hemisphere that is missing or not a compass direction */
+   rc = buzz_gps_location_transform_double("3854.825", '\0', &v);
+   assert_int_not_equal(BUZZ_GPS_SUCCESS, rc);
+   rc = buzz_gps_location_transform_double("3854.825", 'X', &v);
+   assert_int_not_equal(BUZZ_GPS_SUCCESS, rc);
+
+   /* out of range for the hemisphere */
+   rc = buzz_gps_location_transform_double("9000.000", 'S', &v);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   assert_float_equal(-90.0, v, 0.0);
+   rc = buzz_gps_location_transform_double("9000.001", 'N', &v);
+   assert_int_not_equal(BUZZ_GPS_SUCCESS, rc);
+   rc = buzz_gps_location_transform_double("12000.000", 'S', &v);
+   assert_int_not_equal(BUZZ_GPS_SUCCESS, rc);
+   rc = buzz_gps_location_transform_double("17959.999", 'E', &v);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   rc = buzz_gps_location_transform_double("18000.001", 'W', &v);
+   assert_int_not_equal(BUZZ_GPS_SUCCESS, rc);
+}
+
+
+#define GEODESY_TEST_POINTS 1003
+
+static double test_random(unsigned int * seed)
+{
+   *seed = *seed * 1103515245u + 12345u;
+   return (*seed >> 8) / 16777216.0;
+}
+
+
+static double geodesy_angle_diff(double a, double b)
+{
+   double d = fmod(fabs(a - b), 360.0);
+
+   return d > 180.0 ? 360.0 - d : d;
+}
+
+
+static void test_geodesy_batch(void **state)
+{
+   static double lat1[GEODESY_TEST_POINTS];
+   static double lon1[GEODESY_TEST_POINTS];
+   static double lat2[GEODESY_TEST_POINTS];
+   static double lon2[GEODESY_TEST_POINTS];
+   static double meters[GEODESY_TEST_POINTS];
+   static double bearing[GEODESY_TEST_POINTS];
+   static double expect[5][GEODESY_TEST_POINTS];
+   static double out[5][GEODESY_TEST_POINTS];
+   const buzz_gps_geodesy_kernel_t kernels[3] =
+      { BUZZ_GPS_GEODESY_SCALAR, BUZZ_GPS_GEODESY_SSE2, BUZZ_GPS_GEODESY_AVX2 };
+   unsigned int seed = 11;
+   int64_t utc_ns[4] = { 0, 1000000000LL, 3000000000LL, 3000000000LL };
+   int rc;
+   int k;
+   int i;
+
+   /* anywhere on earth, short hops, and across the antimeridian */
+   for (i = 0; i < GEODESY_TEST_POINTS; i++)
+   {
+      lat1[i] = -89.0 + 178.0 * test_random(&seed);
+      lon1[i] = -180.0 + 360.0 * test_random(&seed);
+      if (i % 3 == 0)
+      {
+         lat2[i] = -89.0 + 178.0 * test_random(&seed);
+         lon2[i] = -180.0 + 360.0 * test_random(&seed);
+      }
+      else
+      {
+         lat2[i] = fmax(fmin(lat1[i] + 0.02 * (test_random(&seed) - 0.5), 89.9), -89.9);
+         lon2[i] = lon1[i] + 0.02 * (test_random(&seed) - 0.5);
+         lon2[i] += lon2[i] > 180.0 ? -360.0 : (lon2[i] < -180.0 ? 360.0 : 0.0);
+      }
+      meters[i] = 20000000.0 * test_random(&seed) * (i % 2 ? 1.0 : 0.0001);
+      bearing[i] = 360.0 * test_random(&seed);
+   }
+
+   /* every kernel the CPU has agrees with the scalar one */
+   for (k = 0; k < 3; k++)
+   {
+      rc = buzz_gps_geodesy_set_kernel(kernels[k]);
+      if (rc == BUZZ_GPS_NOT_FOUND)
+      {
+         continue;
+      }
+      assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+      assert_int_equal(kernels[k], buzz_gps_geodesy_get_kernel());
+      buzz_gps_haversine_batch(lat1, lon1, lat2, lon2, out[0], GEODESY_TEST_POINTS);
+      buzz_gps_equirectangular_batch(lat1, lon1, lat2, lon2, out[1], GEODESY_TEST_POINTS);
+      buzz_gps_bearing_batch(lat1, lon1, lat2, lon2, out[2], GEODESY_TEST_POINTS);
+      buzz_gps_destination_batch(lat1, lon1, bearing, meters, out[3], out[4], GEODESY_TEST_POINTS);
+      if (k == 0)
+      {
+         memcpy(expect, out, sizeof(expect));
+         continue;
+      }
+      for (i = 0; i < GEODESY_TEST_POINTS; i++)
+      {
+         assert_float_equal(expect[0][i], out[0][i], 1e-6);
+         assert_float_equal(expect[1][i], out[1][i], 1e-6 + 1e-13 * expect[1][i]);
+         assert_true(geodesy_angle_diff(expect[2][i], out[2][i]) < 1e-9);
+         assert_true(out[2][i] >= 0.0 && out[2][i] < 360.0);
+         assert_float_equal(expect[3][i], out[3][i], 1e-9);
+         assert_true(geodesy_angle_diff(expect[4][i], out[4][i]) < 1e-9);
+      }
+   }
+   buzz_gps_geodesy_set_kernel(BUZZ_GPS_GEODESY_AUTO);
+   assert_int_not_equal(BUZZ_GPS_GEODESY_AUTO, buzz_gps_geodesy_get_kernel());
+
+   /* a degree of the equator, and due east along it */
+   lat1[0] = 0.0;
+   lon1[0] = 179.5;
+   lat2[0] = 0.0;
+   lon2[0] = -179.5;
+   buzz_gps_haversine_batch(lat1, lon1, lat2, lon2, out[0], 1);
+   assert_float_equal(6371008.8 * M_PI / 180.0, out[0][0], 1e-6);
+   buzz_gps_equirectangular_batch(lat1, lon1, lat2, lon2, out[0], 1);
+   assert_float_equal(6371008.8 * M_PI / 180.0, out[0][0], 1e-6);
+   buzz_gps_bearing_batch(lat1, lon1, lat2, lon2, out[0], 1);
+   assert_float_equal(90.0, out[0][0], 1e-9);
+
+   /* going somewhere and back again */
+   for (k = 0; k < 3; k++)
+   {
+      if (buzz_gps_geodesy_set_kernel(kernels[k]) != BUZZ_GPS_SUCCESS)
+      {
+         continue;
+      }
+      buzz_gps_destination_batch(lat1, lon1, bearing, meters, lat2, lon2, GEODESY_TEST_POINTS);
+      buzz_gps_haversine_batch(lat1, lon1, lat2, lon2, out[0], GEODESY_TEST_POINTS);
+      for (i = 0; i < GEODESY_TEST_POINTS; i++)
+      {
+         if (meters[i] < 19000000.0)
+         {
+            assert_float_equal(meters[i], out[0][i], 1e-4);
+         }
+         assert_true(lat2[i] >= -90.0 && lat2[i] <= 90.0 && lon2[i] >= -180.0 && lon2[i] <= 180.0);
+      }
+   }
+   buzz_gps_geodesy_set_kernel(BUZZ_GPS_GEODESY_AUTO);
+
+   /* along a track: east a degree, then a degree north in two seconds */
+   lat1[0] = 0.0;
+   lon1[0] = 0.0;
+   lat1[1] = 0.0;
+   lon1[1] = 1.0;
+   lat1[2] = 1.0;
+   lon1[2] = 1.0;
+   lat1[3] = 1.0;
+   lon1[3] = 1.0;
+   buzz_gps_cumulative_distance(lat1, lon1, out[0], 4);
+   assert_float_equal(0.0, out[0][0], 0.0);
+   assert_float_equal(6371008.8 * M_PI / 180.0, out[0][1], 1e-6);
+   assert_float_equal(2.0 * 6371008.8 * M_PI / 180.0, out[0][2], 1e-6);
+   assert_float_equal(out[0][2], out[0][3], 0.0);
+   buzz_gps_segment_speed(lat1, lon1, utc_ns, out[1], 4);
+   assert_true(isnan(out[1][0]));
+   assert_float_equal(out[0][1], out[1][1], 1e-6);
+   assert_float_equal(out[0][1] / 2.0, out[1][2], 1e-6);
+   assert_true(isnan(out[1][3]));
+}
+
+
+static void test_fix_blocking(void **state)
 {
    int rc;
    buzz_gps_handle_t gps_h;
    test_fifo_obj_t * test_state = (test_fifo_obj_t *) *state;
    FILE * source_pipe;
-   buzz_gps_location_t test_location;
+   buzz_gps_raw_event_t raw;
+   buzz_gps_fix_t fix;
+   buzz_gps_location_t location;
 
    rc = buzz_gps_init(&gps_h, test_state->fifo_path, 0, BUZZ_GPS_OPTIONS_DEBUG);
    assert_int_equal(BUZZ_GPS_SUCCESS, rc);
 
-   rc = buzz_gps_get_last_known_location(gps_h, &test_location);
+   source_pipe = fopen(test_state->fifo_path, "w");
+   write_sentence(source_pipe, "GPRMC,171552.935,V,3854.8251234,N,07702.466,W,70.5,2.50,021116,,E");
+   write_sentence(source_pipe, "GPXTE,A,A,0.67,L,N");
+   fclose(source_pipe);
+
+   rc = buzz_gps_get_fix_blocking(gps_h, &raw, &fix);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   assert_int_equal(BUZZ_GPRMC, fix.type);
+   assert_int_equal(BUZZ_TALKER_GP, fix.talker);
+   assert_true(fix.flags & BUZZ_GPS_FIX_LOCATION);
+   assert_float_equal(38.0 + 54.8251234 / 60.0, fix.latitude, 1e-12);
+   assert_float_equal(-(77.0 + 2.466 / 60.0), fix.longitude, 1e-12);
+
+   /* the blocking API also keeps the last known location */
+   rc = buzz_gps_get_last_known_location(gps_h, &location);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   assert_float_equal(fix.latitude, location.lattitude, 1e-5);
+
+   rc = buzz_gps_get_fix_blocking(gps_h, &raw, &fix);
+   assert_int_not_equal(BUZZ_GPS_SUCCESS, rc);
+   assert_int_equal(BUZZ_GPXTE, raw.type);
+
+   rc = buzz_gps_destroy(gps_h);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+}
+
+
+static void test_sentence_schemas(void **state)
+{
+   int rc;
+   buzz_gps_handle_t gps_h;
+   test_fifo_obj_t * test_state = (test_fifo_obj_t *) *state;
+   FILE * source_pipe;
+   buzz_gps_raw_event_t raw;
+   buzz_gps_fix_t fix;
+
+   rc = buzz_gps_init(&gps_h, test_state->fifo_path, 0, BUZZ_GPS_OPTIONS_DEBUG);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+
+   source_pipe = fopen(test_state->fifo_path, "w");
+   write_sentence(source_pipe, "GPGGA,123519,4807.038,N,01131.000,E,1,08,0.9,545.4,M,46.9,M,,");
+   /* no fix yet, the position is empty */
+   write_sentence(source_pipe, "GPGGA,123520.50,,,,,0,00,,,M,,M,,");
+   write_sentence(source_pipe, "GPVTG,054.7,T,034.4,M,005.5,N,010.2,K,A");
+   write_sentence(source_pipe, "GPVTG,,T,,M,,N,,K,N");
+   write_sentence(source_pipe, "GPGSA,A,3,04,05,,09,12,,,24,,,,,2.5,1.3,2.1");
+   write_sentence(source_pipe, "GPGSV,2,1,06,14,14,200,30,12,43,040,43,04,79,266,23,16,15,261,82");
+   write_sentence(source_pipe, "GPZDA,201530.00,04,07,2002,00,00");
+   write_sentence(source_pipe, "GPRMC,225446,A,4916.45,N,12311.12,W,000.5,054.7,191194,020.3,E");
+   fclose(source_pipe);
+
+   rc = buzz_gps_get_fix_blocking(gps_h, &raw, &fix);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   assert_int_equal(BUZZ_GPGGA, fix.type);
+   assert_int_equal(BUZZ_GPS_FIX_TIME | BUZZ_GPS_FIX_LOCATION | BUZZ_GPS_FIX_QUALITY | BUZZ_GPS_FIX_SATELLITES
+      | BUZZ_GPS_FIX_HDOP | BUZZ_GPS_FIX_ALTITUDE, fix.flags);
+   assert_float_equal(12 * 3600 + 35 * 60 + 19, fix.utc_seconds, 1e-9);
+   assert_float_equal(48.0 + 7.038 / 60.0, fix.latitude, 1e-12);
+   assert_float_equal(11.0 + 31.0 / 60.0, fix.longitude, 1e-12);
+   assert_int_equal(1, fix.quality);
+   assert_int_equal(8, fix.satellites_used);
+   assert_float_equal(0.9, fix.hdop, 1e-12);
+   assert_float_equal(545.4, fix.altitude_meters, 1e-12);
+
+   rc = buzz_gps_get_fix_blocking(gps_h, &raw, &fix);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   assert_int_equal(BUZZ_GPS_FIX_TIME | BUZZ_GPS_FIX_QUALITY | BUZZ_GPS_FIX_SATELLITES, fix.flags);
+   assert_float_equal(12 * 3600 + 35 * 60 + 20.5, fix.utc_seconds, 1e-9);
+   assert_int_equal(0, fix.quality);
+
+   rc = buzz_gps_get_fix_blocking(gps_h, &raw, &fix);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   assert_int_equal(BUZZ_GPVTG, fix.type);
+   assert_int_equal(BUZZ_GPS_FIX_COURSE | BUZZ_GPS_FIX_SPEED, fix.flags);
+   assert_float_equal(54.7, fix.course, 1e-12);
+   assert_float_equal(5.5, fix.speed_knots, 1e-12);
+
+   /* the speed is required */
+   rc = buzz_gps_get_fix_blocking(gps_h, &raw, &fix);
    assert_int_not_equal(BUZZ_GPS_SUCCESS, rc);
+   assert_int_equal(BUZZ_GPVTG, raw.type);
+
+   rc = buzz_gps_get_fix_blocking(gps_h, &raw, &fix);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   assert_int_equal(BUZZ_GPGSA, fix.type);
+   assert_int_equal(3, fix.mode);
+   assert_int_equal(5, fix.satellites_used);
+   assert_float_equal(2.5, fix.pdop, 1e-12);
+   assert_float_equal(1.3, fix.hdop, 1e-12);
+   assert_float_equal(2.1, fix.vdop, 1e-12);
+
+   rc = buzz_gps_get_fix_blocking(gps_h, &raw, &fix);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   assert_int_equal(BUZZ_GPS_FIX_IN_VIEW, fix.flags);
+   assert_int_equal(6, fix.satellites_in_view);
+
+   rc = buzz_gps_get_fix_blocking(gps_h, &raw, &fix);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   assert_int_equal(BUZZ_GPS_FIX_TIME | BUZZ_GPS_FIX_DATE | BUZZ_GPS_FIX_TIMESTAMP, fix.flags);
+   assert_int_equal(2002, fix.year);
+   assert_int_equal(7, fix.month);
+   assert_int_equal(4, fix.day);
+
+   rc = buzz_gps_get_fix_blocking(gps_h, &raw, &fix);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   assert_int_equal(BUZZ_GPRMC, fix.type);
+   assert_true(fix.flags & BUZZ_GPS_FIX_DATE);
+   assert_int_equal(1994, fix.year);
+   assert_int_equal(11, fix.month);
+   assert_int_equal(19, fix.day);
+   assert_float_equal(0.5, fix.speed_knots, 1e-12);
+   assert_float_equal(54.7, fix.course, 1e-12);
+
+   rc = buzz_gps_destroy(gps_h);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+}
+
+
+static void test_events_batch(void **state)
+{
+   int rc;
+   int i;
+   size_t count;
+   buzz_gps_handle_t gps_h;
+   test_fifo_obj_t * test_state = (test_fifo_obj_t *) *state;
+   FILE * source_pipe;
+   buzz_gps_batch_entry_t entries[4];
+
+   rc = buzz_gps_init(&gps_h, test_state->fifo_path, 0, BUZZ_GPS_OPTIONS_DEBUG);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+
+   /* nothing written yet */
+   rc = buzz_gps_get_events_batch(gps_h, entries, 4, 10, &count);
+   assert_int_equal(BUZZ_GPS_NOT_FOUND, rc);
+   assert_int_equal(0, count);
+
+   source_pipe = fopen(test_state->fifo_path, "w");
+   for (i = 0; i < 4; i++)
+   {
+      write_sentence(source_pipe, "GPRMC,171552.935,V,3854.825,N,07702.466,W,70.5,2.50,021116,,E");
+   }
+   write_sentence(source_pipe, "GPXTE,A,A,0.67,L,N");
+   write_sentence(source_pipe, "GPGLL,3854.826,N,07702.467,W,171553.000,A");
+   fprintf(source_pipe, "$GPGLL,3854.826,N,");
+   fflush(source_pipe);
+
+   rc = buzz_gps_get_events_batch(gps_h, entries, 4, 1000, &count);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   assert_int_equal(4, count);
+   for (i = 0; i < 4; i++)
+   {
+      assert_int_equal(BUZZ_GPS_SUCCESS, entries[i].rc);
+      assert_int_equal(BUZZ_GPRMC, entries[i].raw.type);
+      assert_true(entries[i].fix.flags & BUZZ_GPS_FIX_LOCATION);
+   }
+
+   /* the rest was already buffered, an unparsed sentence has its own rc */
+   rc = buzz_gps_get_events_batch(gps_h, entries, 4, 0, &count);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   assert_int_equal(2, count);
+   assert_int_equal(BUZZ_GPXTE, entries[0].raw.type);
+   assert_int_not_equal(BUZZ_GPS_SUCCESS, entries[0].rc);
+   assert_int_equal(BUZZ_GPGLL, entries[1].raw.type);
+   assert_int_equal(BUZZ_GPS_SUCCESS, entries[1].rc);
+
+   /* only half a sentence is left */
+   rc = buzz_gps_get_events_batch(gps_h, entries, 4, 10, &count);
+   assert_int_equal(BUZZ_GPS_NOT_FOUND, rc);
+   assert_int_equal(0, count);
+
+   fclose(source_pipe);
+   rc = buzz_gps_destroy(gps_h);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+}
+
+
+static void test_checksum(void **state)
+{
+   int rc;
+   size_t count;
+   buzz_gps_handle_t gps_h;
+   test_fifo_obj_t * test_state = (test_fifo_obj_t *) *state;
+   FILE * source_pipe;
+   buzz_gps_batch_entry_t entries[4];
+   buzz_gps_stats_t stats;
+   static const char * bad_rmc = "$GPRMC,171552.935,V,3854.825,N,07702.466,W,70.5,2.50,021116,,E*4B\r\n";
+
+   rc = buzz_gps_init(&gps_h, test_state->fifo_path, 0, BUZZ_GPS_OPTIONS_DEBUG);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+
+   source_pipe = fopen(test_state->fifo_path, "w");
+   fprintf(source_pipe, "%s", bad_rmc);
+   /* lower case hex and a missing checksum are both accepted */
+   fprintf(source_pipe, "$GPGLL,3854.826,N,07702.467,W,171554.000,A*24\r\n");
+   fprintf(source_pipe, "$GPRMC,171552.935,V,3854.825,N,07702.466,W,70.5,2.50,021116,,E*4a\r\n");
+   fprintf(source_pipe, "$GPGLL,3854.826,N,07702.467,W,171554.000,A\r\n");
+   /* a corrupted checksum field */
+   fprintf(source_pipe, "$GPGLL,3854.826,N,07702.467,W,171554.000,A*2G\r\n");
+   fflush(source_pipe);
+
+   rc = buzz_gps_get_events_batch(gps_h, entries, 4, 1000, &count);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   assert_int_equal(3, count);
+   assert_int_equal(BUZZ_GPGLL, entries[0].raw.type);
+   assert_int_equal(BUZZ_GPRMC, entries[1].raw.type);
+   assert_int_equal(BUZZ_GPGLL, entries[2].raw.type);
+
+   rc = buzz_gps_get_stats(gps_h, &stats);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   assert_int_equal(2, stats.checksum_errors);
+
+   fclose(source_pipe);
+   rc = buzz_gps_destroy(gps_h);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+
+   /* trusted sources can skip the check */
+   rc = buzz_gps_init(&gps_h, test_state->fifo_path, 0, BUZZ_GPS_OPTIONS_DEBUG | BUZZ_GPS_OPTIONS_SKIP_CHECKSUM);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+
+   source_pipe = fopen(test_state->fifo_path, "w");
+   fprintf(source_pipe, "%s", bad_rmc);
+   fflush(source_pipe);
+
+   rc = buzz_gps_get_events_batch(gps_h, entries, 4, 1000, &count);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   assert_int_equal(1, count);
+   assert_string_equal(bad_rmc, entries[0].raw.sentence);
+   rc = buzz_gps_get_stats(gps_h, &stats);
+   assert_int_equal(0, stats.checksum_errors);
+
+   fclose(source_pipe);
+   rc = buzz_gps_destroy(gps_h);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+}
+
+
+static uint64_t test_now_ns(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+
+/* how long ago the latest raw sentence was stamped as received */
+static void staleness_raw_cb(buzz_gps_raw_event_t * raw, void * user_arg)
+{
+   uint64_t * worst = (uint64_t *) user_arg;
+   uint64_t age = test_now_ns() - raw->received_ns;
+
+   if (age > *worst)
+   {
+      *worst = age;
+   }
+}
+
+
+static void test_replay_from_memory(void **state)
+{
+   int rc;
+   size_t count;
+   buzz_gps_handle_t gps_h;
+   buzz_gps_raw_event_t raw;
+   buzz_gps_fix_t fix;
+   buzz_gps_batch_entry_t entries[4];
+   struct timespec start;
+   struct timespec end;
+   double elapsed;
+   uint64_t worst_ns;
+   /* the last line has no line ending */
+   static const char log[] =
+      "$GPGLL,3854.826,N,07702.467,W,171553.000,A*23\r\n"
+      "$GPGSA,A,2,14,12,04,16,17,11,,,,,,,0.1,0.0,0.9*38\r\n"
+      "$GPGLL,3854.826,N,07702.467,W,171554.000,A*24";
+
+   rc = buzz_gps_init_from_memory(&gps_h, log, strlen(log), BUZZ_GPS_REPLAY_FAST, 0.0, BUZZ_GPS_OPTIONS_NONE);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+
+   rc = buzz_gps_get_fix_blocking(gps_h, &raw, &fix);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   assert_int_equal(BUZZ_GPGLL, fix.type);
+   rc = buzz_gps_get_events_batch(gps_h, entries, 4, -1, &count);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   assert_int_equal(2, count);
+   assert_int_equal(BUZZ_GPGSA, entries[0].raw.type);
+   assert_int_equal(BUZZ_GPGLL, entries[1].raw.type);
+   assert_int_equal(BUZZ_GPS_SUCCESS, entries[1].rc);
+
+   rc = buzz_gps_get_events_batch(gps_h, entries, 4, -1, &count);
+   assert_int_equal(BUZZ_GPS_END_OF_DATA, rc);
+   rc = buzz_gps_get_fix_blocking(gps_h, &raw, &fix);
+   assert_int_equal(BUZZ_GPS_END_OF_DATA, rc);
+
+   rc = buzz_gps_destroy(gps_h);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+
+   /* the two timed sentences are a second apart, at 10x that is 0.1s */
+   rc = buzz_gps_init_from_memory(&gps_h, log, strlen(log), BUZZ_GPS_REPLAY_SCALED, 0.0, BUZZ_GPS_OPTIONS_NONE);
+   assert_int_not_equal(BUZZ_GPS_SUCCESS, rc);
+   rc = buzz_gps_init_from_memory(&gps_h, log, strlen(log), BUZZ_GPS_REPLAY_SCALED, 10.0, BUZZ_GPS_OPTIONS_NONE);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+
+   clock_gettime(CLOCK_MONOTONIC, &start);
+   do
+   {
+      rc = buzz_gps_get_events_batch(gps_h, entries, 4, -1, &count);
+   } while (rc == BUZZ_GPS_SUCCESS);
+   clock_gettime(CLOCK_MONOTONIC, &end);
+   assert_int_equal(BUZZ_GPS_END_OF_DATA, rc);
+   elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+   assert_true(elapsed >= 0.09);
+   assert_true(elapsed < 0.5);
+
+   rc = buzz_gps_destroy(gps_h);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+
+   /* a batch only holds what is due, and gives up on the rest at the timeout */
+   rc = buzz_gps_init_from_memory(&gps_h, log, strlen(log), BUZZ_GPS_REPLAY_SCALED, 10.0, BUZZ_GPS_OPTIONS_NONE);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   rc = buzz_gps_get_events_batch(gps_h, entries, 4, 0, &count);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   assert_int_equal(2, count);
+   clock_gettime(CLOCK_MONOTONIC, &start);
+   rc = buzz_gps_get_events_batch(gps_h, entries, 4, 20, &count);
+   clock_gettime(CLOCK_MONOTONIC, &end);
+   assert_int_equal(BUZZ_GPS_NOT_FOUND, rc);
+   elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+   assert_true(elapsed >= 0.015);
+   assert_true(elapsed < 0.07);
+   rc = buzz_gps_get_events_batch(gps_h, entries, 4, -1, &count);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   assert_int_equal(1, count);
+   assert_int_equal(BUZZ_GPGLL, entries[0].raw.type);
+   assert_int_equal(BUZZ_GPS_SUCCESS, entries[0].rc);
+   rc = buzz_gps_get_events_batch(gps_h, entries, 4, -1, &count);
+   assert_int_equal(BUZZ_GPS_END_OF_DATA, rc);
+
+   rc = buzz_gps_destroy(gps_h);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+
+   /* the whole log is framed at once, paced sentences are stamped when handed out */
+   rc = buzz_gps_init_from_memory(&gps_h, log, strlen(log), BUZZ_GPS_REPLAY_SCALED, 10.0, BUZZ_GPS_OPTIONS_NONE);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   for (count = 0; count < 3; count++)
+   {
+      rc = buzz_gps_get_fix_blocking(gps_h, &raw, &fix);
+      assert_int_not_equal(BUZZ_GPS_END_OF_DATA, rc);
+      assert_true(test_now_ns() - raw.received_ns < 20000000u);
+   }
+   rc = buzz_gps_destroy(gps_h);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+
+   rc = buzz_gps_init_from_memory(&gps_h, log, strlen(log), BUZZ_GPS_REPLAY_SCALED, 10.0, BUZZ_GPS_OPTIONS_NONE);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   worst_ns = 0;
+   rc = buzz_gps_start(gps_h, 0, 0, staleness_raw_cb, NULL, &worst_ns);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   rc = buzz_gps_replay_wait(gps_h);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   rc = buzz_gps_stop(gps_h);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   assert_true(worst_ns < 20000000u);
+   rc = buzz_gps_destroy(gps_h);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+}
+
+
+/* a receiver heading east at 20 knots, one fix a second */
+static void test_kalman_predict(void **state)
+{
+   int rc;
+   int model;
+   int with_vtg;
+   int i;
+   buzz_gps_handle_t gps_h;
+   buzz_gps_raw_event_t raw;
+   buzz_gps_fix_t fix;
+   buzz_gps_fix_t last = { 0 };
+   buzz_gps_prediction_t prediction;
+   char * log;
+   size_t log_size;
+   FILE * out;
+   char body[128];
+   double speed = 20.0 * 0.514444;
+   double meters_per_degree = 6371008.8 * M_PI / 180.0;
+   double x_scale = meters_per_degree * cos(48.0 * M_PI / 180.0);
+   double sigma[2];
+   double minutes;
+   double east;
+   double north;
+
+   /* then again with a VTG repeating the speed of every epoch */
+   for (with_vtg = 0; with_vtg < 2; with_vtg++)
+   {
+      out = open_memstream(&log, &log_size);
+      for (i = 0; i < 20; i++)
+      {
+         minutes = 30.0 + i * speed / x_scale * 60.0;
+         snprintf(body, sizeof(body), "GPRMC,1200%02d.00,A,4800.00000,N,011%08.5f,E,20.0,90.0,171026,,", i, minutes);
+         write_sentence(out, body);
+         if (with_vtg)
+         {
+            write_sentence(out, "GPVTG,90.0,T,,M,20.0,N,37.0,K,A");
+         }
+      }
+      fclose(out);
+
+      for (model = BUZZ_GPS_FILTER_CONSTANT_VELOCITY; model <= BUZZ_GPS_FILTER_CONSTANT_ACCELERATION; model++)
+      {
+         rc = buzz_gps_init_from_memory(&gps_h, log, log_size, BUZZ_GPS_REPLAY_FAST, 0.0, BUZZ_GPS_OPTIONS_NONE);
+         assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+         rc = buzz_gps_predict(gps_h, 0, &prediction);
+         assert_int_equal(BUZZ_GPS_NOT_FOUND, rc);
+         rc = buzz_gps_set_filter(gps_h, (buzz_gps_filter_model_t) model, 0.0);
+         assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+         rc = buzz_gps_predict(gps_h, 0, &prediction);
+         assert_int_equal(BUZZ_GPS_NOT_FOUND, rc);
+
+         while ((rc = buzz_gps_get_fix_blocking(gps_h, &raw, &fix)) == BUZZ_GPS_SUCCESS)
+         {
+            if (fix.flags & BUZZ_GPS_FIX_LOCATION)
+            {
+               last = fix;
+            }
+         }
+         assert_int_equal(BUZZ_GPS_END_OF_DATA, rc);
+
+         /* half a second after the last fix it has moved on by half the speed */
+         rc = buzz_gps_predict(gps_h, last.received_ns + 500000000u, &prediction);
+         assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+         east = (prediction.longitude - last.longitude) * x_scale;
+         north = (prediction.latitude - last.latitude) * meters_per_degree;
+         assert_true(fabs(east - 0.5 * speed) < 1.0);
+         assert_true(fabs(north) < 1.0);
+         assert_true(fabs(prediction.east_mps - speed) < 0.2);
+         assert_true(fabs(prediction.north_mps) < 0.2);
+         assert_true(fabs(prediction.speed_knots - 20.0) < 0.4);
+         assert_true(fabs(prediction.course - 90.0) < 1.0);
+         assert_true(prediction.sigma_meters > 0.0 && prediction.sigma_meters < 5.0);
+         assert_true(prediction.age_ns == 500000000);
+
+         /* the VTG of an epoch adds nothing the RMC had not already said */
+         if (with_vtg)
+         {
+            assert_float_equal(sigma[model - BUZZ_GPS_FILTER_CONSTANT_VELOCITY], prediction.sigma_meters, 1e-9);
+         }
+         sigma[model - BUZZ_GPS_FILTER_CONSTANT_VELOCITY] = prediction.sigma_meters;
+
+         rc = buzz_gps_destroy(gps_h);
+         assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+      }
+      free(log);
+   }
+}
+
+
+static void count_raw_cb(buzz_gps_raw_event_t * raw, void * user_arg)
+{
+   int * count = (int *) user_arg;
+
+   (*count)++;
+}
+
+
+static void count_fix_cb(const buzz_gps_fix_t * fix, void * user_arg)
+{
+   int * count = (int *) user_arg;
+
+   (*count)++;
+}
+
+
+static void test_replay_from_file(void **state)
+{
+   int rc;
+   int raw_count = 0;
+   int fix_count = 0;
+   buzz_gps_handle_t gps_h;
+   buzz_gps_stats_t stats;
+   char path[PATH_MAX];
+
+   /* examples/sample.txt relative to the tests build directory */
+   snprintf(path, sizeof(path), "%s/../examples/sample.txt", getenv("srcdir") ? getenv("srcdir") : ".");
+
+   rc = buzz_gps_init_from_file(&gps_h, "/nonexistent/sample.txt", BUZZ_GPS_REPLAY_FAST, 0.0, BUZZ_GPS_OPTIONS_NONE);
+   assert_int_not_equal(BUZZ_GPS_SUCCESS, rc);
+
+   rc = buzz_gps_init_from_file(&gps_h, path, BUZZ_GPS_REPLAY_FAST, 0.0, BUZZ_GPS_OPTIONS_NONE);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+
+   /* nothing to wait for until it is started */
+   rc = buzz_gps_replay_wait(gps_h);
+   assert_int_not_equal(BUZZ_GPS_SUCCESS, rc);
+
+   rc = buzz_gps_set_fix_callback(gps_h, count_fix_cb, &fix_count);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   rc = buzz_gps_start(gps_h, 0, 0, count_raw_cb, NULL, &raw_count);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   rc = buzz_gps_replay_wait(gps_h);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   rc = buzz_gps_stop(gps_h);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+
+   /* every line of the sample is a sentence with a good checksum */
+   assert_int_equal(600, raw_count);
+   assert_true(fix_count > 0);
+   rc = buzz_gps_get_stats(gps_h, &stats);
+   assert_int_equal(0, stats.checksum_errors);
+   assert_int_equal(600, stats.events_dispatched);
+
+   rc = buzz_gps_destroy(gps_h);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+}
+
+
+static uint64_t histogram_sum(const buzz_gps_histogram_t * histogram)
+{
+   uint64_t sum = 0;
+   int i;
+
+   for (i = 0; i < BUZZ_GPS_LATENCY_BUCKETS; i++)
+   {
+      sum += histogram->buckets[i];
+   }
+   return sum;
+}
+
+
+static void test_stats(void **state)
+{
+   int rc;
+   int raw_count = 0;
+   int fix_count = 0;
+   buzz_gps_handle_t gps_h;
+   buzz_gps_stats_t stats;
+   char data[1024];
+   char overlong[200];
+
+   memset(overlong, 'x', sizeof(overlong) - 1);
+   overlong[sizeof(overlong) - 1] = '\0';
+   snprintf(data, sizeof(data),
+      "noise"
+      "$GP%s\r\n"
+      "$GPRMC,171552.935,A,3854.825,N,07702.466,W,70.5,2.50,021116,,E*00\r\n"
+      "$GPXXX,1,2*4C\r\n"
+      "$GPXTE,A,A,0.67,L,N*6F\r\n"
+      "$GPRMC,171552.935,A,38x4.825,N,07702.466,W,70.5,2.50,021116,,E*10\r\n"
+      "$GPRMC,171552.935,A,3854.825,N,07702.466,W,70.5,2.50,021116,,E*5D\r\n"
+      "$GPRMC,171553.935,A,3854.826,N,07702.467,W,70.5,2.50,021116,,E*5E\r\n",
+      overlong);
+
+   rc = buzz_gps_init_from_memory(&gps_h, data, strlen(data), BUZZ_GPS_REPLAY_FAST, 0.0, BUZZ_GPS_OPTIONS_NONE);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   rc = buzz_gps_set_fix_callback(gps_h, count_fix_cb, &fix_count);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   rc = buzz_gps_start(gps_h, 0, 0, count_raw_cb, NULL, &raw_count);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   rc = buzz_gps_replay_wait(gps_h);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   rc = buzz_gps_stop(gps_h);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+
+   assert_int_equal(5, raw_count);
+   assert_int_equal(2, fix_count);
+
+   rc = buzz_gps_get_stats(gps_h, &stats);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   assert_int_equal(strlen(data), stats.bytes_read);
+   assert_int_equal(6, stats.sentences_framed);
+   assert_int_equal(1, stats.overlong_lines);
+   assert_true(stats.resync_bytes >= strlen("noise") + strlen(overlong));
+   assert_int_equal(1, stats.checksum_errors);
+   assert_int_equal(1, stats.unknown_sentences);
+   assert_int_equal(1, stats.parse_ignored[BUZZ_GPXTE]);
+   assert_int_equal(1, stats.parse_failed[BUZZ_GPRMC]);
+   assert_int_equal(2, stats.parse_ok[BUZZ_GPRMC]);
+   assert_int_equal(0, stats.parse_ok[BUZZ_GPGLL]);
+
+   /* every delivered event went through each stage once */
+   assert_int_equal(5, stats.callbacks);
+   assert_int_equal(3, histogram_sum(&stats.read_to_parse));
+   assert_int_equal(3, histogram_sum(&stats.parse_to_callback));
+   assert_int_equal(5, histogram_sum(&stats.callback));
+   assert_int_equal(5, histogram_sum(&stats.total));
+
+   rc = buzz_gps_destroy(gps_h);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+}
+
+
+static void epoch_cb(const buzz_gps_fix_t * fix, void * user_arg)
+{
+   test_fifo_obj_t * test_state = (test_fifo_obj_t *) user_arg;
+
+   pthread_mutex_lock(&test_state->mutex);
+   if (test_state->fix_received == 0)
+   {
+      memcpy(&test_state->fix, fix, sizeof(buzz_gps_fix_t));
+   }
+   test_state->fix_received++;
+   pthread_cond_broadcast(&test_state->cond);
+   pthread_mutex_unlock(&test_state->mutex);
+}
+
+
+static void test_utc_timestamps(void **state)
+{
+   int rc;
+   buzz_gps_handle_t gps_h;
+   buzz_gps_raw_event_t raw;
+   buzz_gps_fix_t fix;
+   buzz_gps_event_t event;
+   static const char log[] =
+      "$GPGGA,235959.50,4807.038,N,01131.000,E,1,08,0.9,545.4,M,46.9,M,,*60\r\n"
+      "$GPRMC,235959.75,A,4807.038,N,01131.000,E,022.4,084.4,311299,003.1,W*44\r\n"
+      "$GPGGA,000000.25,4807.038,N,01131.000,E,1,08,0.9,545.4,M,46.9,M,,*63\r\n";
+
+   rc = buzz_gps_init_from_memory(&gps_h, log, strlen(log), BUZZ_GPS_REPLAY_FAST, 0.0, BUZZ_GPS_OPTIONS_NONE);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+
+   /* no date seen yet */
+   rc = buzz_gps_get_fix_blocking(gps_h, &raw, &fix);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   assert_false(fix.flags & BUZZ_GPS_FIX_TIMESTAMP);
+   assert_int_equal(0, fix.time);
+   assert_true(fix.received_ns != 0);
+   assert_int_equal(raw.received_ns, fix.received_ns);
+
+   /* 1999-12-31T23:59:59.75Z */
+   rc = buzz_gps_get_event_blocking(gps_h, &raw, &event);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   assert_int_equal(946684799, event.time);
+   assert_int_equal(raw.received_ns, event.received_ns);
+   buzz_gps_free_blocking_event(&event);
+
+   /* the GGA after midnight is stamped on the next day */
+   rc = buzz_gps_get_fix_blocking(gps_h, &raw, &fix);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   assert_true(fix.flags & BUZZ_GPS_FIX_TIMESTAMP);
+   assert_int_equal(946684800, fix.time);
+   assert_true(fix.utc_ns == 946684800250000000LL);
+
+   rc = buzz_gps_destroy(gps_h);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+}
+
+
+static void test_epoch_fusion(void **state)
+{
+   int rc;
+   int i;
+   int raw_count = 0;
+   buzz_gps_handle_t gps_h;
+   buzz_gps_stats_t stats;
+   test_fifo_obj_t * test_state = (test_fifo_obj_t *) *state;
+   FILE * source_pipe;
+   static const char log[] =
+      "$GPRMC,123519,A,4807.038,N,01131.000,E,022.4,084.4,230394,003.1,W*6A\r\n"
+      "$GPGGA,123519,4807.038,N,01131.000,E,1,08,0.9,545.4,M,46.9,M,,*47\r\n"
+      "$GPGSA,A,3,04,05,,09,12,,,24,,,,,2.5,1.3,2.1*39\r\n"
+      "$GPGSV,2,1,08,01,40,083,46,02,17,308,41,12,07,344,39,14,22,228,45*75\r\n"
+      "$GPRMC,123520,A,4807.040,N,01131.002,E,022.4,084.4,230394,003.1,W*6D\r\n"
+      "$GPGGA,123520,4807.040,N,01131.002,E,1,08,0.9,545.6,M,46.9,M,,*42\r\n";
+
+   /* six sentences in two epochs, the last closed by stop */
+   rc = buzz_gps_init_from_memory(&gps_h, log, strlen(log), BUZZ_GPS_REPLAY_FAST, 0.0, BUZZ_GPS_OPTIONS_NONE);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   rc = buzz_gps_set_epoch_callback(gps_h, epoch_cb, 0, test_state);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   rc = buzz_gps_start(gps_h, 0, 0, count_raw_cb, NULL, &raw_count);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   rc = buzz_gps_set_epoch_callback(gps_h, epoch_cb, 0, test_state);
+   assert_int_not_equal(BUZZ_GPS_SUCCESS, rc);
+   rc = buzz_gps_replay_wait(gps_h);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   rc = buzz_gps_stop(gps_h);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+
+   assert_int_equal(6, raw_count);
+   assert_int_equal(2, test_state->fix_received);
+   assert_int_equal((1 << BUZZ_GPRMC) | (1 << BUZZ_GPGGA) | (1 << BUZZ_GPGSA) | (1 << BUZZ_GPGSV),
+      test_state->fix.sentences);
+   assert_int_equal(BUZZ_GPS_FIX_LOCATION | BUZZ_GPS_FIX_SPEED | BUZZ_GPS_FIX_COURSE | BUZZ_GPS_FIX_ALTITUDE
+      | BUZZ_GPS_FIX_TIME | BUZZ_GPS_FIX_DATE | BUZZ_GPS_FIX_QUALITY | BUZZ_GPS_FIX_MODE
+      | BUZZ_GPS_FIX_SATELLITES | BUZZ_GPS_FIX_IN_VIEW | BUZZ_GPS_FIX_HDOP | BUZZ_GPS_FIX_PDOP
+      | BUZZ_GPS_FIX_VDOP | BUZZ_GPS_FIX_TIMESTAMP, test_state->fix.flags);
+   assert_float_equal(22.4, test_state->fix.speed_knots, 1e-12);
+   assert_float_equal(545.4, test_state->fix.altitude_meters, 1e-12);
+   /* GSA comes after GGA and has the last word on the DOP */
+   assert_float_equal(1.3, test_state->fix.hdop, 1e-12);
+   assert_int_equal(5, test_state->fix.satellites_used);
+   assert_int_equal(8, test_state->fix.satellites_in_view);
+   rc = buzz_gps_get_stats(gps_h, &stats);
+   assert_int_equal(2, stats.epochs);
+
+   rc = buzz_gps_destroy(gps_h);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+
+   /* an epoch whose other sentences never come is closed by the timeout */
+   test_state->fix_received = 0;
+   rc = buzz_gps_init(&gps_h, test_state->fifo_path, 0, BUZZ_GPS_OPTIONS_DEBUG);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   rc = buzz_gps_set_epoch_callback(gps_h, epoch_cb, 50, test_state);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   rc = buzz_gps_start(gps_h, 0, 0, NULL, NULL, NULL);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+
+   source_pipe = fopen(test_state->fifo_path, "w");
+   write_sentence(source_pipe, "GPGGA,123519,4807.038,N,01131.000,E,1,08,0.9,545.4,M,46.9,M,,");
+   fflush(source_pipe);
+   for (i = 0; i < 2000 && test_state->fix_received == 0; i++)
+   {
+      usleep(1000);
+   }
+   pthread_mutex_lock(&test_state->mutex);
+   assert_int_equal(1, test_state->fix_received);
+   assert_int_equal(1 << BUZZ_GPGGA, test_state->fix.sentences);
+   pthread_mutex_unlock(&test_state->mutex);
+
+   fclose(source_pipe);
+   rc = buzz_gps_stop(gps_h);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   rc = buzz_gps_destroy(gps_h);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+}
+
+
+static int64_t query_int(sqlite3 * db, const char * sql)
+{
+   sqlite3_stmt * stmt;
+   int64_t value;
+
+   assert_int_equal(SQLITE_OK, sqlite3_prepare_v2(db, sql, -1, &stmt, NULL));
+   assert_int_equal(SQLITE_ROW, sqlite3_step(stmt));
+   value = sqlite3_column_int64(stmt, 0);
+   sqlite3_finalize(stmt);
+   return value;
+}
+
+
+static void test_track_store(void **state)
+{
+   int rc;
+   int i;
+   buzz_gps_handle_t gps_h;
+   buzz_gps_store_t store;
+   buzz_gps_store_stats_t stats;
+   sqlite3 * db;
+   char path[PATH_MAX];
+   static const char log[] =
+      "$GPRMC,123519,A,4807.038,N,01131.000,E,022.4,084.4,230394,003.1,W*6A\r\n"
+      "$GPGGA,123519,4807.038,N,01131.000,E,1,08,0.9,545.4,M,46.9,M,,*47\r\n"
+      "$GPGSA,A,3,04,05,,09,12,,,24,,,,,2.5,1.3,2.1*39\r\n"
+      "$GPGSV,2,1,08,01,40,083,46,02,17,308,41,12,07,344,39,14,22,228,45*75\r\n"
+      "$GPRMC,123520,A,4807.040,N,01131.002,E,022.4,084.4,230394,003.1,W*6D\r\n"
+      "$GPGGA,123520,4807.040,N,01131.002,E,1,08,0.9,545.6,M,46.9,M,,*42\r\n";
+
+   getcwd(path, sizeof(path));
+   strcat(path, "/track_store.db");
+   unlink(path);
+
+   rc = buzz_gps_store_open(&store, "/nonexistent/track_store.db", BUZZ_GPS_STORE_FIXES, 0, 0);
+   assert_int_not_equal(BUZZ_GPS_SUCCESS, rc);
+
+   /* small batches so the rows span several transactions */
+   rc = buzz_gps_store_open(&store, path, BUZZ_GPS_STORE_SENTENCES, 4, 0);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   rc = buzz_gps_init_from_memory(&gps_h, log, strlen(log), BUZZ_GPS_REPLAY_FAST, 0.0, BUZZ_GPS_OPTIONS_NONE);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   rc = buzz_gps_store_attach(store, gps_h, 7);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   rc = buzz_gps_start(gps_h, 0, 0, NULL, NULL, NULL);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   rc = buzz_gps_store_attach(store, gps_h, 7);
+   assert_int_not_equal(BUZZ_GPS_SUCCESS, rc);
+   rc = buzz_gps_replay_wait(gps_h);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   rc = buzz_gps_stop(gps_h);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   rc = buzz_gps_destroy(gps_h);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+
+   /* the last rows go out once they have waited the flush time */
+   for (i = 0; i < 2000; i++)
+   {
+      buzz_gps_store_get_stats(store, &stats);
+      if (stats.fixes + stats.sentences == 8)
+      {
+         break;
+      }
+      usleep(1000);
+   }
+   assert_int_equal(2, stats.fixes);
+   assert_int_equal(6, stats.sentences);
+   assert_true(stats.transactions >= 2);
+   assert_int_equal(0, stats.dropped);
+   assert_int_equal(0, stats.errors);
+   rc = buzz_gps_store_close(store);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+
+   assert_int_equal(SQLITE_OK, sqlite3_open(path, &db));
+   assert_int_equal(2, query_int(db, "SELECT count(*) FROM fixes WHERE receiver = 7"));
+   assert_int_equal(6, query_int(db, "SELECT count(*) FROM sentences WHERE receiver = 7"));
+   assert_true(query_int(db, "SELECT utc_ns FROM fixes ORDER BY id LIMIT 1") == 764426119000000000LL);
+   assert_int_equal(5, query_int(db, "SELECT satellites_used FROM fixes ORDER BY id LIMIT 1"));
+   assert_int_equal(1, query_int(db, "SELECT pdop IS NULL FROM fixes ORDER BY id DESC LIMIT 1"));
+   assert_int_equal(BUZZ_GPGSV, query_int(db, "SELECT type FROM sentences ORDER BY id LIMIT 1 OFFSET 3"));
+   sqlite3_close(db);
+   unlink(path);
+}
+
+
+static void track_fix(buzz_gps_fix_t * fix, int i)
+{
+   memset(fix, '\0', sizeof(buzz_gps_fix_t));
+   fix->flags = BUZZ_GPS_FIX_TIMESTAMP | BUZZ_GPS_FIX_LOCATION | BUZZ_GPS_FIX_SPEED;
+   /* 10 Hz */
+   fix->utc_ns = 764426119000000000LL + (int64_t) i * 100000000LL;
+   fix->latitude = 48.0 + i * 1e-6;
+   fix->longitude = 11.0 - i * 1e-6;
+   fix->speed_knots = i % 50;
+}
+
+
+static void test_track_file(void **state)
+{
+   int rc;
+   int i;
+   int64_t expect;
+   buzz_gps_track_writer_t writer;
+   buzz_gps_track_reader_t reader;
+   buzz_gps_track_cursor_t cursor;
+   buzz_gps_track_span_t span;
+   buzz_gps_track_stats_t stats;
+   buzz_gps_fix_t fix;
+   char path[PATH_MAX];
+   struct stat st;
+   FILE * out;
+   uint64_t index_offset;
+   size_t rows;
+   size_t j;
+
+   getcwd(path, sizeof(path));
+   strcat(path, "/track_file.trk");
+   unlink(path);
+
+   rc = buzz_gps_track_open(&writer, path, 1000);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   for (i = 0; i < 2500; i++)
+   {
+      track_fix(&fix, i);
+      rc = buzz_gps_track_append(writer, &fix);
+      assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   }
+   /* going back in time, or no position */
+   track_fix(&fix, 10);
+   assert_int_not_equal(BUZZ_GPS_SUCCESS, buzz_gps_track_append(writer, &fix));
+   track_fix(&fix, 2500);
+   fix.flags &= ~BUZZ_GPS_FIX_LOCATION;
+   assert_int_not_equal(BUZZ_GPS_SUCCESS, buzz_gps_track_append(writer, &fix));
+   buzz_gps_track_get_stats(writer, &stats);
+   assert_int_equal(2500, stats.rows);
+   assert_int_equal(2, stats.skipped);
+   rc = buzz_gps_track_close(writer);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+
+   /* appending to it carries on after the last block */
+   rc = buzz_gps_track_open(&writer, path, 1000);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   for (i = 2500; i < 3000; i++)
+   {
+      track_fix(&fix, i);
+      rc = buzz_gps_track_append(writer, &fix);
+      assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   }
+   rc = buzz_gps_track_close(writer);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+
+   rc = buzz_gps_track_map(&reader, path);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   assert_int_equal(3000, buzz_gps_track_rows(reader));
+
+   /* rows 950 to 2049, across three blocks */
+   track_fix(&fix, 950);
+   expect = fix.utc_ns;
+   track_fix(&fix, 2050);
+   buzz_gps_track_range(reader, expect, fix.utc_ns, &cursor);
+   rows = 0;
+   i = 950;
+   while (buzz_gps_track_next(&cursor, &span) == BUZZ_GPS_SUCCESS)
+   {
+      for (j = 0; j < span.count; j++, i++)
+      {
+         track_fix(&fix, i);
+         assert_true(span.utc_ns[j] == fix.utc_ns);
+         assert_float_equal(fix.latitude, span.latitude[j], 0.0);
+         assert_float_equal(fix.longitude, span.longitude[j], 0.0);
+         assert_float_equal(fix.speed_knots, span.speed_knots[j], 0.0);
+         assert_true(isnan(span.altitude[j]));
+      }
+      rows += span.count;
+   }
+   assert_int_equal(1100, rows);
+   rc = buzz_gps_track_unmap(reader);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+
+   /* a block pointing past the end of the file is not trusted */
+   out = fopen(path, "r+b");
+   assert_non_null(out);
+   fseek(out, -32, SEEK_END);
+   assert_int_equal(1, fread(&index_offset, sizeof(index_offset), 1, out));
+   fseek(out, (long) index_offset, SEEK_SET);
+   index_offset = UINT64_MAX - 4096;
+   assert_int_equal(1, fwrite(&index_offset, sizeof(index_offset), 1, out));
+   fclose(out);
+   rc = buzz_gps_track_map(&reader, path);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   assert_int_equal(3000, buzz_gps_track_rows(reader));
+   buzz_gps_track_unmap(reader);
+
+   /* without its index the blocks are found by walking the file */
+   rc = stat(path, &st);
+   assert_int_equal(0, rc);
+   rc = truncate(path, st.st_size - 8);
+   assert_int_equal(0, rc);
+   rc = buzz_gps_track_map(&reader, path);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   assert_int_equal(3000, buzz_gps_track_rows(reader));
+   buzz_gps_track_range(reader, INT64_MIN, INT64_MAX, &cursor);
+   rows = 0;
+   while (buzz_gps_track_next(&cursor, &span) == BUZZ_GPS_SUCCESS)
+   {
+      rows += span.count;
+   }
+   assert_int_equal(3000, rows);
+   buzz_gps_track_unmap(reader);
+   unlink(path);
+}
+
+
+#define SPATIAL_TEST_POINTS 20000
+
+static void spatial_fix(buzz_gps_fix_t * fix, int i)
+{
+   unsigned int seed = (unsigned int) i * 2654435761u;
+   double u = (seed & 0xFFFF) / 65536.0;
+   double v = (seed >> 16) / 65536.0;
+
+   memset(fix, '\0', sizeof(buzz_gps_fix_t));
+   fix->flags = BUZZ_GPS_FIX_TIMESTAMP | BUZZ_GPS_FIX_LOCATION;
+   /* from the end, so the hits have to be put back in time order */
+   fix->utc_ns = (int64_t) (SPATIAL_TEST_POINTS - i) * 100000000LL;
+   fix->latitude = 47.0 + 2.0 * u;
+   /* every fourth point around the antimeridian */
+   fix->longitude = i % 4 == 0 ? 179.0 + 2.0 * v : 10.0 + 2.0 * v;
+   if (fix->longitude >= 180.0)
+   {
+      fix->longitude -= 360.0;
+   }
+}
+
+
+static double spatial_distance(double lat1, double lon1, double lat2, double lon2)
+{
+   double rad = M_PI / 180.0;
+   double a = sin((lat2 - lat1) * rad / 2) * sin((lat2 - lat1) * rad / 2)
+      + cos(lat1 * rad) * cos(lat2 * rad) * sin((lon2 - lon1) * rad / 2) * sin((lon2 - lon1) * rad / 2);
+
+   return 2.0 * 6371008.8 * asin(sqrt(a));
+}
+
+
+static void test_spatial_index(void **state)
+{
+   int rc;
+   int i;
+   size_t j;
+   size_t count;
+   size_t expect;
+   buzz_gps_spatial_t index;
+   buzz_gps_fix_t fix;
+   static buzz_gps_spatial_hit_t hits[SPATIAL_TEST_POINTS];
+
+   rc = buzz_gps_spatial_create(&index);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   for (i = 0; i < SPATIAL_TEST_POINTS; i++)
+   {
+      spatial_fix(&fix, i);
+      rc = buzz_gps_spatial_insert(index, i % 3, &fix);
+      assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   }
+   fix.flags = BUZZ_GPS_FIX_LOCATION;
+   assert_int_not_equal(BUZZ_GPS_SUCCESS, buzz_gps_spatial_insert(index, 0, &fix));
+   assert_int_equal(SPATIAL_TEST_POINTS, buzz_gps_spatial_count(index));
+
+   /* a box, limited to the second half of the points by time */
+   expect = 0;
+   for (i = 0; i < SPATIAL_TEST_POINTS; i++)
+   {
+      spatial_fix(&fix, i);
+      if (fix.latitude >= 47.3 && fix.latitude <= 47.6 && fix.longitude >= 10.5 && fix.longitude <= 11.1
+          && fix.utc_ns < (int64_t) (SPATIAL_TEST_POINTS / 2) * 100000000LL)
+      {
+         expect++;
+      }
+   }
+   rc = buzz_gps_spatial_query_box(index, 47.3, 10.5, 47.6, 11.1,
+      INT64_MIN, (int64_t) (SPATIAL_TEST_POINTS / 2) * 100000000LL, hits, SPATIAL_TEST_POINTS, &count);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   assert_true(expect > 100);
+   assert_int_equal(expect, count);
+   for (j = 1; j < count; j++)
+   {
+      assert_true(hits[j - 1].utc_ns <= hits[j].utc_ns);
+   }
+   assert_true(hits[0].latitude >= 47.3 && hits[0].latitude <= 47.6);
+
+   /* only the first hits are copied, the count is of all of them */
+   rc = buzz_gps_spatial_query_box(index, 47.3, 10.5, 47.6, 11.1,
+      INT64_MIN, (int64_t) (SPATIAL_TEST_POINTS / 2) * 100000000LL, hits, 5, &count);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   assert_int_equal(expect, count);
+
+   /* across the antimeridian */
+   expect = 0;
+   for (i = 0; i < SPATIAL_TEST_POINTS; i++)
+   {
+      spatial_fix(&fix, i);
+      if (fix.latitude >= 48.0 && fix.latitude <= 48.5 && (fix.longitude >= 179.7 || fix.longitude <= -179.6))
+      {
+         expect++;
+      }
+   }
+   rc = buzz_gps_spatial_query_box(index, 48.0, 179.7, 48.5, -179.6, INT64_MIN, INT64_MAX,
+      hits, SPATIAL_TEST_POINTS, &count);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   assert_true(expect > 100);
+   assert_int_equal(expect, count);
+
+   /* 5km around a point */
+   expect = 0;
+   for (i = 0; i < SPATIAL_TEST_POINTS; i++)
+   {
+      spatial_fix(&fix, i);
+      if (spatial_distance(48.0, 11.0, fix.latitude, fix.longitude) <= 5000.0)
+      {
+         expect++;
+      }
+   }
+   rc = buzz_gps_spatial_query_radius(index, 48.0, 11.0, 5000.0, INT64_MIN, INT64_MAX,
+      hits, SPATIAL_TEST_POINTS, &count);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   assert_true(expect > 10);
+   assert_int_equal(expect, count);
+   for (j = 0; j < count; j++)
+   {
+      assert_true(spatial_distance(48.0, 11.0, hits[j].latitude, hits[j].longitude) <= 5000.0);
+   }
+
+   rc = buzz_gps_spatial_destroy(index);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+}
+
+
+#define SIMPLIFY_TEST_FIXES 4800
+
+typedef struct simplify_capture_s
+{
+   buzz_gps_fix_t kept[SIMPLIFY_TEST_FIXES];
+   size_t count;
+} simplify_capture_t;
+
+
+static void kept_cb(const buzz_gps_fix_t * fix, void * user_arg)
+{
+   simplify_capture_t * capture = (simplify_capture_t *) user_arg;
+
+   capture->kept[capture->count++] = *fix;
+}
+
+
+/* five minutes parked with a meter of jitter, two minutes east at 10m/s, then a turn */
+static void simplify_fix(buzz_gps_fix_t * fix, int i)
+{
+   double meters = 111195.0;
+   double east = 0.0;
+   double north = 0.0;
+   double angle;
+
+   memset(fix, '\0', sizeof(buzz_gps_fix_t));
+   fix->flags = BUZZ_GPS_FIX_TIMESTAMP | BUZZ_GPS_FIX_LOCATION | BUZZ_GPS_FIX_SPEED;
+   fix->utc_ns = 764426119000000000LL + (int64_t) i * 100000000LL;
+   if (i < 3000)
+   {
+      east = (i * 7 % 11 - 5) * 0.1;
+      north = (i * 5 % 13 - 6) * 0.1;
+   }
+   else if (i < 4200)
+   {
+      east = (i - 3000) * 1.0;
+      fix->speed_knots = 19.4;
+   }
+   else
+   {
+      angle = (i - 4200) * 0.005;
+      east = 1200.0 + 200.0 * sin(angle);
+      north = 200.0 - 200.0 * cos(angle);
+      fix->speed_knots = 19.4;
+   }
+   fix->latitude = 48.0 + north / meters;
+   fix->longitude = 11.0 + east / (meters * cos(48.0 * M_PI / 180.0));
+}
+
+
+static double simplify_error(const buzz_gps_fix_t * a, const buzz_gps_fix_t * b, const buzz_gps_fix_t * p)
+{
+   double x_scale = 6371008.8 * M_PI / 180.0 * cos(a->latitude * M_PI / 180.0);
+   double y_scale = 6371008.8 * M_PI / 180.0;
+   double bx = (b->longitude - a->longitude) * x_scale;
+   double by = (b->latitude - a->latitude) * y_scale;
+   double px = (p->longitude - a->longitude) * x_scale;
+   double py = (p->latitude - a->latitude) * y_scale;
+   double t = bx * bx + by * by > 0.0 ? (px * bx + py * by) / (bx * bx + by * by) : 0.0;
+
+   t = t < 0.0 ? 0.0 : (t > 1.0 ? 1.0 : t);
+   return hypot(px - t * bx, py - t * by);
+}
+
+
+static void test_simplify_and_delta(void **state)
+{
+   int rc;
+   int i;
+   size_t k = 0;
+   size_t n;
+   size_t used;
+   size_t encoded = 0;
+   uint64_t fixes_in;
+   uint64_t fixes_kept;
+   buzz_gps_simplifier_t simplifier;
+   buzz_gps_fix_t fix;
+   buzz_gps_fix_t decoded;
+   buzz_gps_delta_state_t encoder;
+   buzz_gps_delta_state_t decoder;
+   static simplify_capture_t capture;
+   static unsigned char buffer[SIMPLIFY_TEST_FIXES * BUZZ_GPS_DELTA_MAX_RECORD];
+
+   capture.count = 0;
+   rc = buzz_gps_simplifier_create(&simplifier, 5.0, 0, 0, kept_cb, &capture);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   for (i = 0; i < SIMPLIFY_TEST_FIXES; i++)
+   {
+      simplify_fix(&fix, i);
+      rc = buzz_gps_simplifier_add(simplifier, &fix);
+      assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   }
+   buzz_gps_simplifier_flush(simplifier);
+   buzz_gps_simplifier_get_stats(simplifier, &fixes_in, &fixes_kept);
+   buzz_gps_simplifier_destroy(simplifier);
+   assert_int_equal(SIMPLIFY_TEST_FIXES, fixes_in);
+   assert_int_equal(capture.count, fixes_kept);
+
+   /* at least 10 times fewer, and none of the dropped ones more than 5m off */
+   assert_true(capture.count * 10 <= SIMPLIFY_TEST_FIXES);
+   assert_true(capture.kept[0].utc_ns == 764426119000000000LL);
+   simplify_fix(&fix, SIMPLIFY_TEST_FIXES - 1);
+   assert_true(capture.kept[capture.count - 1].utc_ns == fix.utc_ns);
+   for (i = 0; i < SIMPLIFY_TEST_FIXES; i++)
+   {
+      simplify_fix(&fix, i);
+      while (capture.kept[k + 1].utc_ns < fix.utc_ns)
+      {
+         k++;
+      }
+      assert_true(simplify_error(&capture.kept[k], &capture.kept[k + 1], &fix) <= 5.0 + 1e-6);
+   }
+
+   /* what is kept round trips through the delta encoding */
+   buzz_gps_delta_reset(&encoder);
+   for (k = 0; k < capture.count; k++)
+   {
+      n = buzz_gps_delta_encode(&encoder, &capture.kept[k], &buffer[encoded], sizeof(buffer) - encoded);
+      assert_true(n > 0);
+      encoded += n;
+   }
+   buzz_gps_delta_reset(&decoder);
+   used = 0;
+   for (k = 0; k < capture.count; k++)
+   {
+      n = buzz_gps_delta_decode(&decoder, &buffer[used], encoded - used, &decoded);
+      assert_true(n > 0);
+      used += n;
+      assert_true(decoded.utc_ns == capture.kept[k].utc_ns);
+      assert_float_equal(capture.kept[k].latitude, decoded.latitude, 0.6e-7);
+      assert_float_equal(capture.kept[k].longitude, decoded.longitude, 0.6e-7);
+      assert_float_equal(capture.kept[k].speed_knots, decoded.speed_knots, 0.006);
+      assert_true(decoded.flags & BUZZ_GPS_FIX_SPEED);
+      assert_false(decoded.flags & BUZZ_GPS_FIX_ALTITUDE);
+   }
+   assert_int_equal(encoded, used);
+   assert_int_equal(0, buzz_gps_delta_decode(&decoder, buffer, 1, &decoded));
+
+   /* the whole track at 10Hz, consecutive fixes cost a few bytes each */
+   buzz_gps_delta_reset(&encoder);
+   encoded = 0;
+   for (i = 0; i < SIMPLIFY_TEST_FIXES; i++)
+   {
+      simplify_fix(&fix, i);
+      encoded += buzz_gps_delta_encode(&encoder, &fix, &buffer[encoded], sizeof(buffer) - encoded);
+   }
+   assert_true(encoded < SIMPLIFY_TEST_FIXES * 8);
+}
+
+
+#define GEOFENCE_TEST_CIRCLES 3000
+#define GEOFENCE_TEST_POLYGONS 1000
+#define GEOFENCE_TEST_FENCES (GEOFENCE_TEST_CIRCLES + GEOFENCE_TEST_POLYGONS + 1)
+#define GEOFENCE_TEST_FIXES 2000
+
+typedef struct geofence_capture_s
+{
+   char inside[GEOFENCE_TEST_FENCES];
+   buzz_gps_geofence_event_t events[16];
+   size_t count;
+   int bad;
+} geofence_capture_t;
+
+typedef struct geofence_shape_s
+{
+   double latitude;
+   double longitude;
+   double radius;
+   double latitudes[4];
+   double longitudes[4];
+} geofence_shape_t;
+
+
+static void geofence_cb(const buzz_gps_geofence_event_t * event, void * user_arg)
+{
+   geofence_capture_t * capture = (geofence_capture_t *) user_arg;
+
+   if (event->fence_id >= 0 && event->fence_id < GEOFENCE_TEST_FENCES)
+   {
+      if (event->transition == BUZZ_GPS_GEOFENCE_ENTER)
+      {
+         capture->bad += capture->inside[event->fence_id];
+         capture->inside[event->fence_id] = 1;
+      }
+      else if (event->transition == BUZZ_GPS_GEOFENCE_EXIT)
+      {
+         capture->bad += !capture->inside[event->fence_id];
+         capture->inside[event->fence_id] = 0;
+      }
+   }
+   if (capture->count < 16)
+   {
+      capture->events[capture->count++] = *event;
+   }
+}
+
+
+static int geofence_in_polygon(const geofence_shape_t * shape, double lat, double lon)
+{
+   int i;
+   int j;
+   int inside = 0;
+
+   for (i = 0, j = 3; i < 4; j = i++)
+   {
+      if ((shape->latitudes[i] > lat) != (shape->latitudes[j] > lat)
+          && lon < (shape->longitudes[j] - shape->longitudes[i]) * (lat - shape->latitudes[i])
+             / (shape->latitudes[j] - shape->latitudes[i]) + shape->longitudes[i])
+      {
+         inside = !inside;
+      }
+   }
+   return inside;
+}
+
+
+static void test_geofence(void **state)
+{
+   int rc;
+   int i;
+   int f;
+   int expect;
+   unsigned int seed = 7;
+   double angle;
+   buzz_gps_geofence_t engine;
+   buzz_gps_geofence_stats_t stats;
+   buzz_gps_fix_t fix;
+   static geofence_shape_t shapes[GEOFENCE_TEST_FENCES];
+   static geofence_capture_t capture;
+   const double square_lat[4] = { 10.0, 10.0, 10.1, 10.1 };
+   const double square_lon[4] = { 179.9, -179.9, -179.9, 179.9 };
+
+   memset(&capture, '\0', sizeof(capture));
+   rc = buzz_gps_geofence_create(&engine, 30000, geofence_cb, &capture);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+
+   /* circles of 20 to 400m and quadrilaterals scattered over a city, and one region */
+   for (f = 0; f < GEOFENCE_TEST_FENCES; f++)
+   {
+      shapes[f].latitude = 48.0 + 0.2 * test_random(&seed);
+      shapes[f].longitude = 11.0 + 0.3 * test_random(&seed);
+      if (f < GEOFENCE_TEST_CIRCLES || f == GEOFENCE_TEST_FENCES - 1)
+      {
+         shapes[f].radius = f < GEOFENCE_TEST_CIRCLES ? 20.0 + 380.0 * test_random(&seed) : 10000.0;
+         rc = buzz_gps_geofence_add_circle(engine, f, shapes[f].latitude, shapes[f].longitude, shapes[f].radius);
+         assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+         continue;
+      }
+      for (i = 0; i < 4; i++)
+      {
+         angle = (i + test_random(&seed) * 0.8) * M_PI / 2.0;
+         shapes[f].latitudes[i] = shapes[f].latitude + 0.004 * test_random(&seed) * sin(angle);
+         shapes[f].longitudes[i] = shapes[f].longitude + 0.006 * test_random(&seed) * cos(angle);
+      }
+      rc = buzz_gps_geofence_add_polygon(engine, f, shapes[f].latitudes, shapes[f].longitudes, 4);
+      assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   }
+   assert_int_not_equal(BUZZ_GPS_SUCCESS, buzz_gps_geofence_add_polygon(engine, 0, square_lat, square_lon, 2));
+   assert_int_not_equal(BUZZ_GPS_SUCCESS, buzz_gps_geofence_add_circle(engine, 0, 91.0, 0.0, 10.0));
+
+   /* every fix agrees with testing every fence */
+   memset(&fix, '\0', sizeof(buzz_gps_fix_t));
+   fix.flags = BUZZ_GPS_FIX_TIMESTAMP | BUZZ_GPS_FIX_LOCATION;
+   for (i = 0; i < GEOFENCE_TEST_FIXES; i++)
+   {
+      fix.utc_ns = (int64_t) i * 1000000000LL;
+      fix.latitude = 47.99 + 0.22 * test_random(&seed);
+      fix.longitude = 10.99 + 0.32 * test_random(&seed);
+      rc = buzz_gps_geofence_update(engine, &fix);
+      assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+      for (f = 0; f < GEOFENCE_TEST_FENCES; f++)
+      {
+         if (f < GEOFENCE_TEST_CIRCLES || f == GEOFENCE_TEST_FENCES - 1)
+         {
+            expect = spatial_distance(fix.latitude, fix.longitude, shapes[f].latitude, shapes[f].longitude)
+               <= shapes[f].radius;
+         }
+         else
+         {
+            expect = geofence_in_polygon(&shapes[f], fix.latitude, fix.longitude);
+         }
+         assert_int_equal(expect, capture.inside[f]);
+      }
+   }
+   assert_int_equal(0, capture.bad);
+   buzz_gps_geofence_get_stats(engine, &stats);
+   assert_int_equal(GEOFENCE_TEST_FENCES, stats.fences);
+   assert_int_equal(GEOFENCE_TEST_FIXES, stats.fixes);
+   /* the grid leaves a few fences to test a fix against, not thousands */
+   assert_true(stats.tests < (uint64_t) GEOFENCE_TEST_FIXES * 50);
+   fix.flags = BUZZ_GPS_FIX_TIMESTAMP;
+   assert_int_equal(BUZZ_GPS_NOT_FOUND, buzz_gps_geofence_update(engine, &fix));
+   buzz_gps_geofence_destroy(engine);
+
+   /* enter, dwell after 30s, exit */
+   memset(&capture, '\0', sizeof(capture));
+   rc = buzz_gps_geofence_create(&engine, 30000, geofence_cb, &capture);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   rc = buzz_gps_geofence_add_circle(engine, 1, 48.0, 11.0, 100.0);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   rc = buzz_gps_geofence_add_polygon(engine, 2, square_lat, square_lon, 4);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   fix.flags = BUZZ_GPS_FIX_TIMESTAMP | BUZZ_GPS_FIX_LOCATION;
+   fix.latitude = 48.0005;
+   fix.longitude = 11.0;
+   for (i = 0; i <= 40; i += 10)
+   {
+      fix.utc_ns = (int64_t) i * 1000000000LL + (i == 30 ? 1 : 0);
+      buzz_gps_geofence_update(engine, &fix);
+   }
+   fix.utc_ns = 50000000000LL;
+   fix.latitude = 48.002;
+   buzz_gps_geofence_update(engine, &fix);
+   assert_int_equal(3, capture.count);
+   assert_int_equal(BUZZ_GPS_GEOFENCE_ENTER, capture.events[0].transition);
+   assert_int_equal(1, capture.events[0].fence_id);
+   assert_true(capture.events[0].inside_ns == 0);
+   assert_int_equal(BUZZ_GPS_GEOFENCE_DWELL, capture.events[1].transition);
+   assert_true(capture.events[1].inside_ns == 30000000001LL);
+   assert_int_equal(BUZZ_GPS_GEOFENCE_EXIT, capture.events[2].transition);
+   assert_true(capture.events[2].inside_ns == 50000000000LL);
+
+   /* a polygon across the antimeridian */
+   capture.count = 0;
+   fix.latitude = 10.05;
+   fix.longitude = -179.95;
+   buzz_gps_geofence_update(engine, &fix);
+   fix.longitude = 179.95;
+   buzz_gps_geofence_update(engine, &fix);
+   fix.longitude = 179.8;
+   buzz_gps_geofence_update(engine, &fix);
+   assert_int_equal(2, capture.count);
+   assert_int_equal(2, capture.events[0].fence_id);
+   assert_int_equal(BUZZ_GPS_GEOFENCE_ENTER, capture.events[0].transition);
+   assert_int_equal(BUZZ_GPS_GEOFENCE_EXIT, capture.events[1].transition);
+
+   /* a removed fence is gone without an exit */
+   capture.count = 0;
+   fix.longitude = 179.95;
+   buzz_gps_geofence_update(engine, &fix);
+   assert_int_equal(BUZZ_GPS_SUCCESS, buzz_gps_geofence_remove(engine, 2));
+   assert_int_equal(BUZZ_GPS_NOT_FOUND, buzz_gps_geofence_remove(engine, 2));
+   buzz_gps_geofence_update(engine, &fix);
+   assert_int_equal(1, capture.count);
+   buzz_gps_geofence_get_stats(engine, &stats);
+   assert_int_equal(1, stats.fences);
+   buzz_gps_geofence_destroy(engine);
+
+   /* removed fences are dropped, and the fence the receiver is in moves down */
+   memset(&capture, '\0', sizeof(capture));
+   rc = buzz_gps_geofence_create(&engine, 0, geofence_cb, &capture);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   buzz_gps_geofence_add_circle(engine, 10, 10.0, 10.0, 100.0);
+   buzz_gps_geofence_add_circle(engine, 1, 48.0, 11.0, 100.0);
+   fix.latitude = 48.0005;
+   fix.longitude = 11.0;
+   buzz_gps_geofence_update(engine, &fix);
+   assert_int_equal(BUZZ_GPS_SUCCESS, buzz_gps_geofence_remove(engine, 10));
+   for (i = 0; i < 1000; i++)
+   {
+      buzz_gps_geofence_add_circle(engine, 100 + i, 10.0, 10.0, 100.0);
+      buzz_gps_geofence_update(engine, &fix);
+      assert_int_equal(BUZZ_GPS_SUCCESS, buzz_gps_geofence_remove(engine, 100 + i));
+   }
+   fix.latitude = 48.002;
+   buzz_gps_geofence_update(engine, &fix);
+   assert_int_equal(2, capture.count);
+   assert_int_equal(BUZZ_GPS_GEOFENCE_ENTER, capture.events[0].transition);
+   assert_int_equal(BUZZ_GPS_GEOFENCE_EXIT, capture.events[1].transition);
+   assert_int_equal(1, capture.events[1].fence_id);
+   assert_int_equal(BUZZ_GPS_SUCCESS, buzz_gps_geofence_remove(engine, 1));
+   assert_int_equal(BUZZ_GPS_NOT_FOUND, buzz_gps_geofence_remove(engine, 10));
+   buzz_gps_geofence_destroy(engine);
+}
+
+
+#define LOG_TEST_THREADS 2
+#define LOG_TEST_LINES 2000
+
+typedef struct log_capture_s
+{
+   int lines[LOG_TEST_THREADS];
+   int next[LOG_TEST_THREADS];
+   int out_of_order;
+   int bad_format;
+   int warnings;
+} log_capture_t;
+
+
+static void capture_sink(LOG_LEVEL level, const char * line, size_t length, void * arg)
+{
+   log_capture_t * capture = (log_capture_t *) arg;
+   const char * text;
+   int thread;
+   int seq;
+
+   if (level == BUZZ_WARN)
+   {
+      capture->warnings++;
+      return;
+   }
+   text = strstr(line, " [INFO]: ");
+   if (text == NULL || line[length] != '\0' || sscanf(text, " [INFO]: thread %d line %d", &thread, &seq) != 2
+       || thread < 0 || thread >= LOG_TEST_THREADS)
+   {
+      capture->bad_format++;
+      return;
+   }
+   /* each thread's lines come out in the order it logged them */
+   if (seq < capture->next[thread])
+   {
+      capture->out_of_order++;
+   }
+   capture->next[thread] = seq + 1;
+   capture->lines[thread]++;
+}
+
+
+static void * log_thread(void * arg)
+{
+   int thread = (int) (intptr_t) arg;
+   int i;
+
+   for (i = 0; i < LOG_TEST_LINES; i++)
+   {
+      buzz_logger(BUZZ_INFO, "thread %d line %d", thread, i);
+   }
+   return NULL;
+}
+
+
+typedef struct log_spawn_s
+{
+   int lines;
+   int spawned;
+} log_spawn_t;
+
+
+static void * log_line_thread(void * arg)
+{
+   buzz_logger(BUZZ_INFO, "from a short lived thread");
+   return NULL;
+}
+
+
+/* a thread starts, logs and exits while the writer is in the sink */
+static void spawn_sink(LOG_LEVEL level, const char * line, size_t length, void * arg)
+{
+   log_spawn_t * spawn = (log_spawn_t *) arg;
+   pthread_t thread;
+
+   spawn->lines++;
+   if (!spawn->spawned)
+   {
+      spawn->spawned = 1;
+      pthread_create(&thread, NULL, log_line_thread, NULL);
+      pthread_join(thread, NULL);
+   }
+}
+
+
+static void test_async_logging(void **state)
+{
+   int rc;
+   int i;
+   pthread_t threads[LOG_TEST_THREADS];
+   log_capture_t capture;
+   log_spawn_t spawn;
+   uint64_t dropped;
+
+   memset(&capture, '\0', sizeof(capture));
+   buzz_set_log_level("INFO");
+   buzz_set_log_sink(capture_sink, &capture);
+
+   buzz_logger(BUZZ_INFO, "thread 0 line 0");
+   assert_int_equal(1, capture.lines[0]);
+   assert_int_equal(0, capture.bad_format);
+   memset(&capture, '\0', sizeof(capture));
+
+   dropped = buzz_log_dropped();
+   rc = buzz_log_async_start(0);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   rc = buzz_log_async_start(0);
+   assert_int_not_equal(BUZZ_GPS_SUCCESS, rc);
+
+   for (i = 0; i < LOG_TEST_THREADS; i++)
+   {
+      pthread_create(&threads[i], NULL, log_thread, (void *) (intptr_t) i);
+   }
+   for (i = 0; i < LOG_TEST_THREADS; i++)
+   {
+      pthread_join(threads[i], NULL);
+   }
+   rc = buzz_log_async_stop();
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   rc = buzz_log_async_stop();
+   assert_int_not_equal(BUZZ_GPS_SUCCESS, rc);
+
+   /* a full ring drops lines rather than blocking, and says so */
+   dropped = buzz_log_dropped() - dropped;
+   assert_int_equal(0, capture.bad_format);
+   assert_int_equal(0, capture.out_of_order);
+   assert_int_equal(LOG_TEST_THREADS * LOG_TEST_LINES, capture.lines[0] + capture.lines[1] + dropped);
+   assert_true(dropped == 0 || capture.warnings > 0);
+
+   /* the writer does not hold the ring list lock while it writes */
+   memset(&spawn, '\0', sizeof(spawn));
+   buzz_set_log_sink(spawn_sink, &spawn);
+   rc = buzz_log_async_start(0);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   buzz_logger(BUZZ_INFO, "from the test thread");
+   /* both lines are written before stop, which would log directly */
+   for (i = 0; i < 100 && spawn.lines < 2; i++)
+   {
+      usleep(10000);
+   }
+   rc = buzz_log_async_stop();
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   assert_int_equal(2, spawn.lines);
+
+   buzz_set_log_sink(NULL, NULL);
+}
+
+
+/*
+ * asyn tests
+ */
+static void raw_cb(buzz_gps_raw_event_t * raw, void * user_arg)
+{
+   test_fifo_obj_t * test_state = (test_fifo_obj_t *) user_arg;
+
+   pthread_mutex_lock(&test_state->mutex);
+   {
+      test_state->raw = *raw;
+      test_state->raw_received = 1;
+      pthread_cond_signal(&test_state->cond);
+   }
+   pthread_mutex_unlock(&test_state->mutex);
+
+   printf("Got raw event: %s\n", raw->sentence);
+}
+
+
+static void event_cb(buzz_gps_event_t * event, void * user_arg)
+{
+   test_fifo_obj_t * test_state = (test_fifo_obj_t *) user_arg;
+
+   printf("got event\n");
+   if (event->location != NULL)
+   {
+      pthread_mutex_lock(&test_state->mutex);
+      {
+         test_state->event = *event;
+         test_state->event_received = 1;
+         pthread_cond_signal(&test_state->cond);
+      }
+      pthread_mutex_unlock(&test_state->mutex);
+   
+      printf("Got location %f %f\n", event->location->lattitude, event->location->longitude);
+   }
+}
+
+
+static void fix_cb(const buzz_gps_fix_t * fix, void * user_arg)
+{
+   test_fifo_obj_t * test_state = (test_fifo_obj_t *) user_arg;
+
+   pthread_mutex_lock(&test_state->mutex);
+   {
+      test_state->fix = *fix;
+      test_state->fix_received = 1;
+      pthread_cond_signal(&test_state->cond);
+   }
+   pthread_mutex_unlock(&test_state->mutex);
+}
+
+
+/*
+ * The reader thread sits in read() holding the handle lock while no data
+ * arrives. Polling the last fix must not wait for it.
+ */
+static void test_last_fix_does_not_block(void **state)
+{
+   int rc;
+   int i;
+   buzz_gps_handle_t gps_h;
+   test_fifo_obj_t * test_state = (test_fifo_obj_t *) *state;
+   FILE * source_pipe;
+   buzz_gps_fix_t fix;
+   buzz_gps_location_t location;
+
+   rc = buzz_gps_init(&gps_h, test_state->fifo_path, 0, BUZZ_GPS_OPTIONS_DEBUG);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   rc = buzz_gps_start(gps_h, 0, 1, NULL, NULL, NULL);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   usleep(100000);
+
+   for (i = 0; i < 1000; i++)
+   {
+      rc = buzz_gps_get_last_known_fix(gps_h, &fix);
+      assert_int_not_equal(BUZZ_GPS_SUCCESS, rc);
+   }
+
+   source_pipe = fopen(test_state->fifo_path, "w");
+   write_sentence(source_pipe, "GPRMC,171552.935,V,3854.825,N,07702.466,W,70.5,2.50,021116,,E");
+   fclose(source_pipe);
+
+   do
+   {
+      usleep(1000);
+      rc = buzz_gps_get_last_known_fix(gps_h, &fix);
+   } while (rc != BUZZ_GPS_SUCCESS);
+   assert_true(fix.flags & BUZZ_GPS_FIX_LOCATION);
+   assert_float_equal(38.0 + 54.825 / 60.0, fix.latitude, 1e-12);
+   rc = buzz_gps_get_last_known_location(gps_h, &location);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   assert_float_equal(fix.longitude, location.longitude, 1e-5);
+
+   rc = buzz_gps_stop(gps_h);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   rc = buzz_gps_destroy(gps_h);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+}
+
+
+/* holds up the dispatcher thread until the test opens the gate */
+static void gated_fix_cb(const buzz_gps_fix_t * fix, void * user_arg)
+{
+   test_fifo_obj_t * test_state = (test_fifo_obj_t *) user_arg;
+
+   pthread_mutex_lock(&test_state->mutex);
+   {
+      test_state->fix = *fix;
+      test_state->fix_received++;
+      pthread_cond_broadcast(&test_state->cond);
+      while (test_state->gate_closed)
+      {
+         pthread_cond_wait(&test_state->cond, &test_state->mutex);
+      }
+   }
+   pthread_mutex_unlock(&test_state->mutex);
+}
+
+
+static void run_overflow_policy(test_fifo_obj_t * test_state, buzz_gps_overflow_policy_t policy)
+{
+   int rc;
+   int i;
+   buzz_gps_handle_t gps_h;
+   FILE * source_pipe;
+   buzz_gps_fix_t fix;
+   buzz_gps_stats_t stats;
+   char body[96];
+   const int sentence_count = 20;
+
+   rc = buzz_gps_init(&gps_h, test_state->fifo_path, 0, BUZZ_GPS_OPTIONS_DEBUG);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   rc = buzz_gps_set_dispatch(gps_h, 4, policy);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   rc = buzz_gps_set_fix_callback(gps_h, gated_fix_cb, test_state);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   test_state->gate_closed = 1;
+   rc = buzz_gps_start(gps_h, 0, 1, NULL, NULL, NULL);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+
+   source_pipe = fopen(test_state->fifo_path, "w");
+   for (i = 0; i < sentence_count; i++)
+   {
+      snprintf(body, sizeof(body), "GPRMC,171552.935,V,38%02d.000,N,07702.466,W,70.5,2.50,021116,,E", i);
+      write_sentence(source_pipe, body);
+   }
+   fclose(source_pipe);
+
+   /* the reader keeps going while the callback is stuck */
+   do
+   {
+      usleep(1000);
+      rc = buzz_gps_get_last_known_fix(gps_h, &fix);
+   } while (rc != BUZZ_GPS_SUCCESS || fix.latitude < 38.0 + (sentence_count - 1) / 60.0 - 1e-9);
+
+   pthread_mutex_lock(&test_state->mutex);
+   {
+      test_state->gate_closed = 0;
+      pthread_cond_broadcast(&test_state->cond);
+   }
+   pthread_mutex_unlock(&test_state->mutex);
+
+   rc = buzz_gps_stop(gps_h);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+
+   rc = buzz_gps_get_stats(gps_h, &stats);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   assert_int_equal(stats.events_dispatched, test_state->fix_received);
+   assert_int_equal(4, stats.queue_high_water);
+   if (policy == BUZZ_GPS_OVERFLOW_DROP_NEWEST)
+   {
+      assert_true(stats.events_dropped_newest > 0);
+      assert_int_equal(0, stats.events_dropped_oldest);
+      assert_int_equal(sentence_count, stats.events_queued + stats.events_dropped_newest);
+      assert_int_equal(stats.events_queued, stats.events_dispatched);
+   }
+   else
+   {
+      assert_true(stats.events_dropped_oldest > 0);
+      assert_int_equal(0, stats.events_dropped_newest);
+      assert_int_equal(sentence_count, stats.events_queued);
+      assert_int_equal(sentence_count, stats.events_dispatched + stats.events_dropped_oldest);
+      /* the newest fix always survives */
+      assert_float_equal(fix.latitude, test_state->fix.latitude, 1e-12);
+   }
+
+   rc = buzz_gps_destroy(gps_h);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+}
+
+
+static void test_overflow_drop_newest(void **state)
+{
+   run_overflow_policy((test_fifo_obj_t *) *state, BUZZ_GPS_OVERFLOW_DROP_NEWEST);
+}
+
+
+static void test_overflow_drop_oldest(void **state)
+{
+   run_overflow_policy((test_fifo_obj_t *) *state, BUZZ_GPS_OVERFLOW_DROP_OLDEST);
+}
+
+
+typedef struct test_reactor_remove_s
+{
+   buzz_gps_reactor_t reactor;
+   buzz_gps_handle_t gps_handle;
+   int calls;
+   int rc;
+} test_reactor_remove_t;
+
+
+/* takes another handle out of the reactor from within a callback */
+static void reactor_remove_cb(buzz_gps_raw_event_t * raw, void * user_arg)
+{
+   test_reactor_remove_t * remove_state = (test_reactor_remove_t *) user_arg;
+
+   if (remove_state->calls++ == 0)
+   {
+      remove_state->rc = buzz_gps_reactor_remove(remove_state->reactor, remove_state->gps_handle);
+   }
+}
+
+
+/*
+ * Two devices read by one reactor, first driven from the test thread and
+ * then from the reactor's own thread
+ */
+static void test_reactor_two_handles(void **state)
+{
+   int rc;
+   int i;
+   int count_a = 0;
+   int count_b = 0;
+   char second_path[PATH_MAX];
+   buzz_gps_handle_t gps_a;
+   buzz_gps_handle_t gps_b;
+   buzz_gps_reactor_t reactor;
+   buzz_gps_fix_t fix;
+   test_fifo_obj_t * test_state = (test_fifo_obj_t *) *state;
+   test_reactor_remove_t remove_state;
+   FILE * pipe_a;
+   FILE * pipe_b;
+
+   snprintf(second_path, sizeof(second_path), "%s2", test_state->fifo_path);
+   mkfifo(second_path, 0666);
+
+   rc = buzz_gps_init(&gps_a, test_state->fifo_path, 0, BUZZ_GPS_OPTIONS_DEBUG);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   rc = buzz_gps_init(&gps_b, second_path, 0, BUZZ_GPS_OPTIONS_DEBUG);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+
+   rc = buzz_gps_reactor_create(&reactor);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   rc = buzz_gps_reactor_add(reactor, gps_a, count_raw_cb, NULL, &count_a);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   rc = buzz_gps_reactor_add(reactor, gps_b, count_raw_cb, NULL, &count_b);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+
+   /* a handle in a reactor cannot be added twice, started or destroyed */
+   rc = buzz_gps_reactor_add(reactor, gps_a, count_raw_cb, NULL, &count_a);
+   assert_int_not_equal(BUZZ_GPS_SUCCESS, rc);
+   rc = buzz_gps_start(gps_a, 0, 1, raw_cb, NULL, test_state);
+   assert_int_not_equal(BUZZ_GPS_SUCCESS, rc);
+   rc = buzz_gps_destroy(gps_a);
+   assert_int_not_equal(BUZZ_GPS_SUCCESS, rc);
+
+   pipe_a = fopen(test_state->fifo_path, "w");
+   pipe_b = fopen(second_path, "w");
+   for (i = 0; i < 3; i++)
+   {
+      write_sentence(pipe_a, "GPRMC,171552.935,V,3854.825,N,07702.466,W,70.5,2.50,021116,,E");
+   }
+   write_sentence(pipe_b, "GPGLL,3854.826,N,07702.467,W,171553.000,A");
+   /* half a sentence stays buffered until the rest arrives */
+   fprintf(pipe_b, "$GPGLL,3854.826,N,");
+   fflush(pipe_a);
+   fflush(pipe_b);
+
+   for (i = 0; i < 50 && (count_a < 3 || count_b < 1); i++)
+   {
+      rc = buzz_gps_reactor_run_once(reactor, 100);
+      assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   }
+   assert_int_equal(3, count_a);
+   assert_int_equal(1, count_b);
+
+   fprintf(pipe_b, "07702.467,W,171554.000,A*24\r\n");
+   fflush(pipe_b);
+   for (i = 0; i < 50 && count_b < 2; i++)
+   {
+      rc = buzz_gps_reactor_run_once(reactor, 100);
+      assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   }
+   assert_int_equal(2, count_b);
+
+   rc = buzz_gps_get_last_known_fix(gps_b, &fix);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   assert_int_equal(BUZZ_GPGLL, fix.type);
+   assert_float_equal(38.91376, fix.latitude, 0.00001);
+
+   /* a destroy should fail while handles are registered */
+   rc = buzz_gps_reactor_destroy(reactor);
+   assert_int_not_equal(BUZZ_GPS_SUCCESS, rc);
+   rc = buzz_gps_reactor_remove(reactor, gps_b);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+
+   /* callbacks run without the reactor lock, so one can remove another handle */
+   remove_state.reactor = reactor;
+   remove_state.gps_handle = gps_a;
+   remove_state.calls = 0;
+   remove_state.rc = BUZZ_GPS_ERROR;
+   rc = buzz_gps_reactor_add(reactor, gps_b, reactor_remove_cb, NULL, &remove_state);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   write_sentence(pipe_b, "GPGLL,3854.826,N,07702.467,W,171555.000,A");
+   fflush(pipe_b);
+   for (i = 0; i < 50 && remove_state.calls < 1; i++)
+   {
+      rc = buzz_gps_reactor_run_once(reactor, 100);
+      assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   }
+   assert_int_equal(1, remove_state.calls);
+   assert_int_equal(BUZZ_GPS_SUCCESS, remove_state.rc);
+   rc = buzz_gps_reactor_remove(reactor, gps_a);
+   assert_int_not_equal(BUZZ_GPS_SUCCESS, rc);
+   rc = buzz_gps_reactor_remove(reactor, gps_b);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+
+   /* now let the reactor thread deliver to the usual callbacks */
+   rc = buzz_gps_reactor_add(reactor, gps_a, raw_cb, NULL, test_state);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   rc = buzz_gps_reactor_start(reactor);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   rc = buzz_gps_reactor_run_once(reactor, 0);
+   assert_int_not_equal(BUZZ_GPS_SUCCESS, rc);
+
+   write_sentence(pipe_a, "GPGLL,3854.826,N,07702.467,W,171553.000,A");
+   fflush(pipe_a);
+   pthread_mutex_lock(&test_state->mutex);
+   {
+      while(!test_state->raw_received)
+      {
+         pthread_cond_wait(&test_state->cond, &test_state->mutex);
+      }
+   }
+   pthread_mutex_unlock(&test_state->mutex);
+   assert_int_equal(BUZZ_GPGLL, test_state->raw.type);
+
+   rc = buzz_gps_reactor_stop(reactor);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   rc = buzz_gps_reactor_remove(reactor, gps_a);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   rc = buzz_gps_reactor_destroy(reactor);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+
+   fclose(pipe_a);
+   fclose(pipe_b);
+   rc = buzz_gps_destroy(gps_a);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   rc = buzz_gps_destroy(gps_b);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+   remove(second_path);
+}
+
+
+static void test_simple_async(void **state)
+{
+   int rc;
+   buzz_gps_handle_t gps_h;
+   test_fifo_obj_t * test_state = (test_fifo_obj_t *) *state;
+   FILE * source_pipe;
+   buzz_gps_location_t test_location;
+
+   rc = buzz_gps_init(&gps_h, test_state->fifo_path, 0, BUZZ_GPS_OPTIONS_DEBUG);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
+
+   rc = buzz_gps_get_last_known_location(gps_h, &test_location);
+   assert_int_not_equal(BUZZ_GPS_SUCCESS, rc);
+
+   rc = buzz_gps_set_fix_callback(gps_h, fix_cb, test_state);
+   assert_int_equal(BUZZ_GPS_SUCCESS, rc);
 
    rc = buzz_gps_start(
       gps_h, 1, 1, raw_cb, event_cb, test_state);
@@ -213,7 +2530,7 @@ static void test_simple_async(void **state)
 
    pthread_mutex_lock(&test_state->mutex);
    {
-      while(!test_state->event_received || !test_state->raw_received)
+      while(!test_state->event_received || !test_state->raw_received || !test_state->fix_received)
       {
          pthread_cond_wait(&test_state->cond, &test_state->mutex);
       }
@@ -223,6 +2540,8 @@ static void test_simple_async(void **state)
    assert_int_equal(BUZZ_GPRMC, test_state->raw.type);
    assert_int_equal(12, test_state->raw.word_count);
    assert_ptr_not_equal(NULL, test_state->event.location);
+   assert_int_equal(BUZZ_GPRMC, test_state->fix.type);
+   assert_true(test_state->fix.flags & BUZZ_GPS_FIX_LOCATION);
 
    rc = buzz_gps_get_last_known_location(gps_h, &test_location);
    assert_int_equal(BUZZ_GPS_SUCCESS, rc);
@@ -248,6 +2567,31 @@ int main(int argc, char ** argv)
         cmocka_unit_test_setup_teardown(test_simple_async, test_setup, test_teardown),
         cmocka_unit_test_setup_teardown(test_simple_rmc_gll, test_setup, test_teardown),
         cmocka_unit_test_setup_teardown(test_bad_path, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_framing_partial_sentences, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_raw_fields, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_classify_talkers, test_setup, test_teardown),
+        cmocka_unit_test(test_location_transform),
+        cmocka_unit_test(test_geodesy_batch),
+        cmocka_unit_test_setup_teardown(test_fix_blocking, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_sentence_schemas, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_events_batch, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_checksum, test_setup, test_teardown),
+        cmocka_unit_test(test_replay_from_memory),
+        cmocka_unit_test(test_replay_from_file),
+        cmocka_unit_test(test_kalman_predict),
+        cmocka_unit_test(test_stats),
+        cmocka_unit_test(test_utc_timestamps),
+        cmocka_unit_test_setup_teardown(test_epoch_fusion, test_setup, test_teardown),
+        cmocka_unit_test(test_track_store),
+        cmocka_unit_test(test_track_file),
+        cmocka_unit_test(test_spatial_index),
+        cmocka_unit_test(test_simplify_and_delta),
+        cmocka_unit_test(test_geofence),
+        cmocka_unit_test(test_async_logging),
+        cmocka_unit_test_setup_teardown(test_last_fix_does_not_block, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_overflow_drop_newest, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_overflow_drop_oldest, test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_reactor_two_handles, test_setup, test_teardown),
     };
  
     return cmocka_run_group_tests(tests, NULL, NULL);